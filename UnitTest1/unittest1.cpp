@@ -48,6 +48,34 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(picohash_oa)
+        {
+            int ret = picohash_oa_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(picohash_oa_embedded)
+        {
+            int ret = picohash_oa_embedded_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(picohash_oa_resize)
+        {
+            int ret = picohash_oa_resize_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(cid_table_bench)
+        {
+            int ret = cid_table_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(bytestream)
         {
             int ret = bytestream_test();
@@ -209,6 +237,20 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(binlog_index)
+        {
+            int ret = binlog_index_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(binlog_async)
+        {
+            int ret = binlog_async_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(app_message_overflow)
         {
             int ret = app_message_overflow_test();
@@ -243,6 +285,14 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(stream_output_sched)
+        {
+            int ret = stream_output_sched_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(stream_retransmit_copy)
         {
             int ret = test_copy_for_retransmit();
@@ -544,6 +594,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(datagram_ring)
+        {
+            int ret = datagram_ring_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(ddos_amplification)
         {
             int ret = ddos_amplification_test();
@@ -638,6 +695,13 @@ namespace UnitTest1
         {
             int ret = stream_rank_test();
 
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(stream_table)
+        {
+            int ret = stream_table_test();
+
             Assert::AreEqual(ret, 0);
         }
 
@@ -739,6 +803,34 @@ namespace UnitTest1
 			Assert::AreEqual(ret, 0);
 		}
 
+        TEST_METHOD(zero_copy_send)
+        {
+            int ret = zero_copy_send_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(protect_batch)
+        {
+            int ret = protect_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(receive_batch)
+        {
+            int ret = receive_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(stream_data_borrow)
+        {
+            int ret = stream_data_borrow_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
 		TEST_METHOD(test_very_long_max)
 		{
 			int ret = tls_api_very_long_max_test();
@@ -865,6 +957,55 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(test_sockets_batch)
+        {
+            int ret = socket_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(test_sockets_send_batch)
+        {
+            int ret = socket_send_batch_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(test_sockets_event)
+        {
+            int ret = socket_event_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(test_sockets_sharded_loop)
+        {
+            int ret = socket_sharded_loop_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(slab)
+        {
+            int ret = slab_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(stateless_pool)
+        {
+            int ret = stateless_pool_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(wheel)
+        {
+            int ret = wheel_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(ticket_store)
         {
@@ -894,6 +1035,20 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(ticket_index)
+        {
+            int ret = ticket_index_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(token_index)
+        {
+            int ret = token_index_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(token_reuse_api)
         {
             int ret = token_reuse_api_test();
@@ -901,6 +1056,27 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(anti_replay)
+        {
+            int ret = anti_replay_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(memory_budget)
+        {
+            int ret = memory_budget_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(flow_control_autotune)
+        {
+            int ret = flow_control_autotune_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_session_resume)
         {
             int ret = session_resume_test();
@@ -1243,6 +1419,20 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(protect_batch_vector)
+        {
+            int ret = protect_batch_vector_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(protect_batch_bench)
+        {
+            int ret = protect_batch_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(zero_rtt_spurious)
         {
@@ -1885,12 +2075,24 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(stream_ref) {
+            int ret = stream_ref_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(queue_network_input) {
             int ret = queue_network_input_test();
 
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(stream_reassembly) {
+            int ret = stream_reassembly_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(pacing_update) {
             int ret = pacing_update_test();
 
@@ -2597,6 +2799,12 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(h3zero_priority) {
+            int ret = h3zero_priority_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(http_drop) {
             int ret = http_drop_test();
 
@@ -2669,6 +2877,18 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(admission) {
+            int ret = admission_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(initial_flood) {
+            int ret = initial_flood_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(cplusplus) {
             int ret = cplusplustest();
 
@@ -31,53 +31,53 @@
 #include "picoquic_binlog.h"
 #include "picoquic.h"
 
-int autoqlog(picoquic_cnx_t* cnx)
+int autoqlog(picoquic_autoqlog_request_t const* request)
 {
     int ret = 0;
-    uint64_t log_time = cnx->start_time;
+    uint64_t log_time = 0;
     uint16_t flags = 0;
-    FILE* f_binlog = picoquic_open_cc_log_file_for_read(cnx->binlog_file_name, &flags, &log_time);
+    FILE* f_binlog = picoquic_open_cc_log_file_for_read(request->binlog_file_name, &flags, &log_time);
     if (f_binlog == NULL) {
-        DBG_PRINTF("Cannot open file %s for reading.\n", cnx->binlog_file_name);
+        DBG_PRINTF("Cannot open file %s for reading.\n", request->binlog_file_name);
         ret = -1;
     }
     else {
         char filename[512];
         char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
 
-        if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
-            DBG_PRINTF("Cannot convert connection id for %s", cnx->binlog_file_name);
+        if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &request->cid) != 0) {
+            DBG_PRINTF("Cannot convert connection id for %s", request->binlog_file_name);
             ret = -1;
         }
         else
         {
             int sprintf_ret = -1;
-            if (cnx->quic->use_unique_log_names) {
+            if (request->use_unique_log_names) {
                 sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%x.%s.%s",
-                    cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name, cnx->log_unique,
-                    (cnx->client_mode) ? "client" : "server", "qlog");
+                    request->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name, request->log_unique,
+                    (request->client_mode) ? "client" : "server", "qlog");
             }
             else {
                 sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%s.%s",
-                    cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name,
-                    (cnx->client_mode) ? "client" : "server", "qlog");
+                    request->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name,
+                    (request->client_mode) ? "client" : "server", "qlog");
             }
 
             if (sprintf_ret != 0) {
-                DBG_PRINTF("Cannot format file name for connection %s in file %s", cid_name, cnx->binlog_file_name);
+                DBG_PRINTF("Cannot format file name for connection %s in file %s", cid_name, request->binlog_file_name);
                 ret = -1;
             }
             else {
-                ret = qlog_convert(&cnx->initial_cnxid, f_binlog, cnx->binlog_file_name, filename, cnx->quic->qlog_dir, flags);
+                ret = qlog_convert(&request->cid, f_binlog, request->binlog_file_name, filename, request->qlog_dir, flags);
                 picoquic_file_close(f_binlog);
                 if (ret != 0) {
-                    DBG_PRINTF("Cannot convert file %s to qlog, err = %d.\n", cnx->binlog_file_name, ret);
+                    DBG_PRINTF("Cannot convert file %s to qlog, err = %d.\n", request->binlog_file_name, ret);
                 }
                 else {
-                    if (cnx->quic->binlog_dir == NULL) {
+                    if (request->delete_binlog) {
                         int last_err = 0;
-                        if ((ret = picoquic_file_delete(cnx->binlog_file_name, &last_err)) != 0) {
-                            DBG_PRINTF("Cannot delete file %s to qlog, err = %d.\n", cnx->binlog_file_name, last_err);
+                        if ((ret = picoquic_file_delete(request->binlog_file_name, &last_err)) != 0) {
+                            DBG_PRINTF("Cannot delete file %s to qlog, err = %d.\n", request->binlog_file_name, last_err);
                         }
                     }
                 }
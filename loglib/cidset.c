@@ -40,7 +40,13 @@ static int picoquic_cid_compare(const void* key0, const void* key1)
 
 picohash_table * cidset_create()
 {
-    return picohash_create(32, picoquic_cid_hash, picoquic_cid_compare);
+    return cidset_create_ex(32);
+}
+
+/* The keys must start with a connection id, but can hold other data */
+picohash_table * cidset_create_ex(size_t nb_bin)
+{
+    return picohash_create(nb_bin, picoquic_cid_hash, picoquic_cid_compare);
 }
 
 picohash_table * cidset_delete(picohash_table * cids)
@@ -23,6 +23,7 @@
 #include "picohash.h"
 
 picohash_table * cidset_create();
+picohash_table * cidset_create_ex(size_t nb_bin);
 picohash_table * cidset_delete(picohash_table * cids);
 
 /*! \brief Insert connection id \a cid into a set of connection ids \a cids if
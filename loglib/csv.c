@@ -56,8 +56,7 @@ int picoquic_cc_log_file_to_csv(char const* bin_cc_log_name, char const* csv_cc_
     return ret;
 }
 
-/* Extract all picoquic_log_event_cc_update events from the binary log file and write them into an csv file. */
-int picoquic_cc_bin_to_csv(FILE * f_binlog, FILE * f_csvlog)
+static int csv_write_header(FILE * f_csvlog)
 {
     int ret = 0;
 
@@ -87,6 +86,14 @@ int picoquic_cc_bin_to_csv(FILE * f_binlog, FILE * f_csvlog)
     ret |= fprintf(f_csvlog, "transit, ") <= 0;
     ret |= fprintf(f_csvlog, "\n") <= 0;
 
+    return ret;
+}
+
+/* Extract all picoquic_log_event_cc_update events from the binary log file and write them into an csv file. */
+int picoquic_cc_bin_to_csv(FILE * f_binlog, FILE * f_csvlog)
+{
+    int ret = csv_write_header(f_csvlog);
+
     if (ret == 0) {
 
         csv_cb_data data;
@@ -100,6 +107,24 @@ int picoquic_cc_bin_to_csv(FILE * f_binlog, FILE * f_csvlog)
     return ret;
 }
 
+/* Same, but only for the events of the specified connection */
+int picoquic_cc_bin_to_csv_indexed(const binlog_index_t * index, const picoquic_connection_id_t * cid, FILE * f_csvlog)
+{
+    int ret = csv_write_header(f_csvlog);
+
+    if (ret == 0) {
+
+        csv_cb_data data;
+        data.f = f_csvlog;
+        data.starttime = 0;
+        data.idx = 0;
+
+        ret = binlog_index_iterate(index, cid, csv_cb, &data);
+    }
+
+    return ret;
+}
+
 int csv_cb(bytestream * s, void * ptr)
 {
     csv_cb_data * data = (csv_cb_data*)ptr;
@@ -20,9 +20,15 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#ifdef _WINDOWS
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
 
 #include "picoquic_internal.h"
 #include "bytestream.h"
@@ -209,6 +215,254 @@ int binlog_convert(FILE * f_binlog, const picoquic_connection_id_t * cid, binlog
     return fileread_binlog(f_binlog, binlog_convert_event, &ctx);
 }
 
+/* Memory mapped access to the binary log */
+int binlog_map_open(binlog_map_t * map, FILE * f_binlog)
+{
+    int ret = 0;
+    int64_t file_length;
+
+    memset(map, 0, sizeof(binlog_map_t));
+#ifdef _WINDOWS
+    if (_fseeki64(f_binlog, 0, SEEK_END) != 0 || (file_length = _ftelli64(f_binlog)) < 0) {
+#else
+    if (fseeko(f_binlog, 0, SEEK_END) != 0 || (file_length = (int64_t)ftello(f_binlog)) < 0) {
+#endif
+        ret = -1;
+    }
+    else if ((uint64_t)file_length > (uint64_t)SIZE_MAX) {
+        ret = -1;
+    }
+    else if (file_length > 0) {
+        map->length = (size_t)file_length;
+#ifdef _WINDOWS
+        map->h_map = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(f_binlog)), NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map->h_map != NULL) {
+            map->bytes = (const uint8_t*)MapViewOfFile(map->h_map, FILE_MAP_READ, 0, 0, 0);
+            if (map->bytes == NULL) {
+                CloseHandle(map->h_map);
+                map->h_map = NULL;
+            }
+        }
+#else
+        void* x = mmap(NULL, map->length, PROT_READ, MAP_PRIVATE, fileno(f_binlog), 0);
+        if (x != MAP_FAILED) {
+            map->bytes = (const uint8_t*)x;
+        }
+#endif
+        if (map->bytes != NULL) {
+            map->is_mapped = 1;
+        }
+        else {
+            /* Mapping not available, read the whole file instead */
+            uint8_t* buffer = (uint8_t*)malloc(map->length);
+
+            if (buffer == NULL || fseek(f_binlog, 0, SEEK_SET) != 0 ||
+                fread(buffer, map->length, 1, f_binlog) != 1) {
+                free(buffer);
+                map->length = 0;
+                ret = -1;
+            }
+            else {
+                map->bytes = buffer;
+            }
+        }
+    }
+
+    return ret;
+}
+
+void binlog_map_close(binlog_map_t * map)
+{
+    if (map->bytes != NULL) {
+        if (map->is_mapped) {
+#ifdef _WINDOWS
+            UnmapViewOfFile(map->bytes);
+            CloseHandle(map->h_map);
+#else
+            munmap((void*)map->bytes, map->length);
+#endif
+        }
+        else {
+            free((void*)map->bytes);
+        }
+    }
+    memset(map, 0, sizeof(binlog_map_t));
+}
+
+/* Index of the events by connection ID.
+ * The first pass over the file records the offset and the connection of each
+ * event, and counts the events per connection. The offsets are then sorted by
+ * connection, keeping the file order within each connection.
+ */
+int binlog_index_open(binlog_index_t * index, FILE * f_binlog)
+{
+    int ret = 0;
+    size_t pos = 16;
+    size_t nb_alloc = 0;
+    size_t nb_cids_alloc = 0;
+    uint64_t* offsets = NULL;
+    binlog_index_cid_t** event_cid = NULL;
+
+    memset(index, 0, sizeof(binlog_index_t));
+
+    if ((index->cid_table = cidset_create_ex(4096)) == NULL ||
+        binlog_map_open(&index->map, f_binlog) != 0) {
+        ret = -1;
+    }
+
+    while (ret == 0 && pos + 4 <= index->map.length) {
+        const uint8_t* head = index->map.bytes + pos;
+        uint32_t len = (head[0] << 24) | (head[1] << 16) | (head[2] << 8) | head[3];
+        picoquic_connection_id_t cid;
+        bytestream stream;
+        bytestream* s;
+        binlog_index_cid_t* cid_entry = NULL;
+        picohash_item* item;
+
+        if (len > index->map.length - pos - 4) {
+            /* The file was not closed properly, keep the complete events */
+            DBG_PRINTF("Truncated event at offset %zu", pos);
+            index->is_truncated = 1;
+            break;
+        }
+        s = bytestream_ref_init(&stream, head + 4, len);
+        if (byteread_cid(s, &cid) != 0) {
+            ret = -1;
+            break;
+        }
+
+        if ((item = picohash_retrieve(index->cid_table, &cid)) != NULL) {
+            cid_entry = (binlog_index_cid_t*)item->key;
+        }
+        else if ((cid_entry = (binlog_index_cid_t*)malloc(sizeof(binlog_index_cid_t))) == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(cid_entry, 0, sizeof(binlog_index_cid_t));
+            cid_entry->cid = cid;
+            if (picohash_insert(index->cid_table, cid_entry) != 0) {
+                free(cid_entry);
+                ret = -1;
+            }
+            else {
+                if (index->nb_cids >= nb_cids_alloc) {
+                    size_t new_alloc = (nb_cids_alloc == 0) ? 64 : 2 * nb_cids_alloc;
+                    binlog_index_cid_t** new_cids = (binlog_index_cid_t**)realloc(index->cids,
+                        new_alloc * sizeof(binlog_index_cid_t*));
+                    if (new_cids == NULL) {
+                        ret = -1;
+                    }
+                    else {
+                        index->cids = new_cids;
+                        nb_cids_alloc = new_alloc;
+                    }
+                }
+                if (ret == 0) {
+                    index->cids[index->nb_cids++] = cid_entry;
+                }
+            }
+        }
+
+        if (ret == 0 && index->nb_events >= nb_alloc) {
+            size_t new_alloc = (nb_alloc == 0) ? 1024 : 2 * nb_alloc;
+            uint64_t* new_offsets = (uint64_t*)realloc(offsets, new_alloc * sizeof(uint64_t));
+            binlog_index_cid_t** new_event_cid = NULL;
+
+            if (new_offsets != NULL) {
+                offsets = new_offsets;
+                new_event_cid = (binlog_index_cid_t**)realloc(event_cid, new_alloc * sizeof(binlog_index_cid_t*));
+            }
+            if (new_event_cid == NULL) {
+                ret = -1;
+            }
+            else {
+                event_cid = new_event_cid;
+                nb_alloc = new_alloc;
+            }
+        }
+
+        if (ret == 0) {
+            offsets[index->nb_events] = pos;
+            event_cid[index->nb_events] = cid_entry;
+            index->nb_events++;
+            cid_entry->nb_events++;
+            pos += 4 + (size_t)len;
+        }
+    }
+
+    if (ret == 0 && pos < index->map.length) {
+        /* The last event is incomplete, maybe even its length */
+        index->is_truncated = 1;
+    }
+
+    if (ret == 0 && index->nb_events > 0) {
+        if ((index->event_offsets = (uint64_t*)malloc(index->nb_events * sizeof(uint64_t))) == NULL) {
+            ret = -1;
+        }
+        else {
+            size_t first_event = 0;
+
+            for (size_t i = 0; i < index->nb_cids; i++) {
+                index->cids[i]->first_event = first_event;
+                first_event += index->cids[i]->nb_events;
+                index->cids[i]->nb_events = 0;
+            }
+            for (size_t i = 0; i < index->nb_events; i++) {
+                binlog_index_cid_t* cid_entry = event_cid[i];
+                index->event_offsets[cid_entry->first_event + cid_entry->nb_events] = offsets[i];
+                cid_entry->nb_events++;
+            }
+        }
+    }
+
+    free(offsets);
+    free(event_cid);
+
+    return ret;
+}
+
+void binlog_index_close(binlog_index_t * index)
+{
+    if (index->cid_table != NULL) {
+        (void)cidset_delete(index->cid_table);
+    }
+    free(index->cids);
+    free(index->event_offsets);
+    binlog_map_close(&index->map);
+    memset(index, 0, sizeof(binlog_index_t));
+}
+
+int binlog_index_iterate(const binlog_index_t * index, const picoquic_connection_id_t * cid,
+    int (*cb)(bytestream*, void*), void * cbptr)
+{
+    int ret = 0;
+    picohash_item* item = picohash_retrieve(index->cid_table, cid);
+
+    if (item != NULL) {
+        const binlog_index_cid_t* cid_entry = (const binlog_index_cid_t*)item->key;
+
+        for (size_t i = 0; ret == 0 && i < cid_entry->nb_events; i++) {
+            const uint8_t* head = index->map.bytes + index->event_offsets[cid_entry->first_event + i];
+            uint32_t len = (head[0] << 24) | (head[1] << 16) | (head[2] << 8) | head[3];
+            bytestream stream;
+            bytestream* s = bytestream_ref_init(&stream, head + 4, len);
+
+            ret = cb(s, cbptr);
+        }
+    }
+
+    return ret;
+}
+
+int binlog_convert_indexed(const binlog_index_t * index, const picoquic_connection_id_t * cid, binlog_convert_cb_t * callbacks)
+{
+    convert_log_file_event_t ctx;
+    ctx.cid = cid;
+    ctx.callbacks = callbacks;
+
+    return binlog_index_iterate(index, cid, binlog_convert_event, &ctx);
+}
+
 static int binlog_list_cids_cb(bytestream * s, void * cbptr)
 {
     picoquic_connection_id_t cid;
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include "picoquic_internal.h"
+#include "picohash.h"
 #include "bytestream.h"
 
 #ifdef __cplusplus
@@ -86,6 +87,68 @@ int binlog_convert(FILE * f_binlog, const picoquic_connection_id_t * cid, binlog
  */
 int binlog_list_cids(FILE * binlog, picohash_table * cids);
 
+/*! \brief Read only view of a binary log file. The file is memory mapped
+ *         if the platform allows it, or else read in a heap buffer.
+ */
+typedef struct st_binlog_map_t {
+    const uint8_t * bytes;
+    size_t length;
+    int is_mapped;
+#ifdef _WINDOWS
+    HANDLE h_map;
+#endif
+} binlog_map_t;
+
+int binlog_map_open(binlog_map_t * map, FILE * f_binlog);
+void binlog_map_close(binlog_map_t * map);
+
+/*! \brief Index of the events of a binary log file by connection id.
+ *
+ *  The index is built in a single pass over the mapped file. The offsets of
+ *  the events are grouped by connection, in file order, so that converting
+ *  one connection only reads the events of that connection. Converting all
+ *  connections of the file is thus proportional to the file size instead of
+ *  the file size times the number of connections. Once built, the index is
+ *  read only, and can be shared by several conversion threads.
+ */
+typedef struct st_binlog_index_cid_t {
+    picoquic_connection_id_t cid; /* Must be first, used as key in the cid table */
+    size_t first_event;
+    size_t nb_events;
+} binlog_index_cid_t;
+
+typedef struct st_binlog_index_t {
+    binlog_map_t map;
+    picohash_table * cid_table;
+    binlog_index_cid_t ** cids; /* In order of first appearance in the file */
+    size_t nb_cids;
+    uint64_t * event_offsets;
+    size_t nb_events;
+    int is_truncated; /* The last event is incomplete, and not indexed */
+} binlog_index_t;
+
+/*! \brief Map the binary log file and build the index of its events.
+ *         If the file ends with an incomplete event, e.g., because the
+ *         program that wrote it did not exit properly, the previous events
+ *         are indexed and is_truncated is set.
+ *
+ *  \param index    The index to initialize. It must be released with
+ *                  binlog_index_close, even if this function fails.
+ *  \param f_binlog The file handle of the opened binary log file.
+ */
+int binlog_index_open(binlog_index_t * index, FILE * f_binlog);
+void binlog_index_close(binlog_index_t * index);
+
+/*! \brief Call the callback function for each event of the specified
+ *         connection, in file order. Same callback as fileread_binlog.
+ */
+int binlog_index_iterate(const binlog_index_t * index, const picoquic_connection_id_t * cid,
+    int (*cb)(bytestream*, void*), void * cbptr);
+
+/*! \brief Same as binlog_convert, but only reads the indexed events of the connection.
+ */
+int binlog_convert_indexed(const binlog_index_t * index, const picoquic_connection_id_t * cid, binlog_convert_cb_t * callbacks);
+
 /*! \brief Return the file handle of the output file for log file conversion.
  *
  *  \param cid_name The initial connection id converted to a string. This will
@@ -105,6 +168,7 @@ FILE * open_outfile(const char * cid_name, const char * binlog_name, const char
 FILE * picoquic_open_cc_log_file_for_read(char const * bin_cc_log_name, uint16_t * flags, uint64_t * log_time);
 
 int picoquic_cc_log_file_to_csv(char const * bin_cc_log_name, char const * csv_cc_log_name);
+int picoquic_cc_bin_to_csv_indexed(const binlog_index_t * index, const picoquic_connection_id_t * cid, FILE * f_csvlog);
 
 #ifdef __cplusplus
 }
@@ -1496,7 +1496,8 @@ int qlog_connection_end(uint64_t time, void * ptr)
     return 0;
 }
 
-int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char* binlog_name, const char* txt_name, const char* out_dir, uint16_t flags)
+static int qlog_convert_ex(const picoquic_connection_id_t* cid, FILE* f_binlog, const binlog_index_t* index,
+    const char* binlog_name, const char* txt_name, const char* out_dir, uint16_t flags)
 {
     int ret = 0;
     FILE* f_txtlog = NULL;
@@ -1545,7 +1546,7 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
         ctx.info_message = qlog_info_message;
         ctx.ptr = &qlog;
 
-        ret = binlog_convert(f_binlog, cid, &ctx);
+        ret = (index != NULL) ? binlog_convert_indexed(index, cid, &ctx) : binlog_convert(f_binlog, cid, &ctx);
 
         if (qlog.state == 1) {
             qlog_connection_end(0, &qlog);
@@ -1556,3 +1557,13 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
 
     return ret;
 }
+
+int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char* binlog_name, const char* txt_name, const char* out_dir, uint16_t flags)
+{
+    return qlog_convert_ex(cid, f_binlog, NULL, binlog_name, txt_name, out_dir, flags);
+}
+
+int qlog_convert_indexed(const picoquic_connection_id_t* cid, const binlog_index_t* index, const char* binlog_name, const char* txt_name, const char* out_dir, uint16_t flags)
+{
+    return qlog_convert_ex(cid, NULL, index, binlog_name, txt_name, out_dir, flags);
+}
@@ -198,7 +198,8 @@ int svg_info_message(uint64_t time, bytestream* s, void* ptr)
     return 0;
 }
 
-int svg_convert(const picoquic_connection_id_t * cid, FILE * f_binlog, FILE * f_template, const char * binlog_name, const char * out_dir)
+static int svg_convert_ex(const picoquic_connection_id_t * cid, FILE * f_binlog, const binlog_index_t * index,
+    FILE * f_template, const char * binlog_name, const char * out_dir)
 {
     int ret = 0;
 
@@ -237,9 +238,19 @@ int svg_convert(const picoquic_connection_id_t * cid, FILE * f_binlog, FILE * f_
             /* Copy the template to the SVG file */
             fprintf(svg.f_txtlog, "%s", line);
         } else {
-            ret = binlog_convert(f_binlog, cid, &ctx);
+            ret = (index != NULL) ? binlog_convert_indexed(index, cid, &ctx) : binlog_convert(f_binlog, cid, &ctx);
         }
     }
 
     return ret;
 }
+
+int svg_convert(const picoquic_connection_id_t * cid, FILE * f_binlog, FILE * f_template, const char * binlog_name, const char * out_dir)
+{
+    return svg_convert_ex(cid, f_binlog, NULL, f_template, binlog_name, out_dir);
+}
+
+int svg_convert_indexed(const picoquic_connection_id_t * cid, const binlog_index_t * index, FILE * f_template, const char * binlog_name, const char * out_dir)
+{
+    return svg_convert_ex(cid, NULL, index, f_template, binlog_name, out_dir);
+}
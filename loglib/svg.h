@@ -25,6 +25,7 @@
 
 #include "picoquic_internal.h"
 #include "bytestream.h"
+#include "logreader.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +54,7 @@ int svg_packet_frame(bytestream * s, void * ptr);
 int svg_packet_end(void * ptr);
 
 int svg_convert(const picoquic_connection_id_t * cid, FILE * f_binlog, FILE * f_template, const char * binlog_name, const char * out_dir);
+int svg_convert_indexed(const picoquic_connection_id_t * cid, const binlog_index_t * index, FILE * f_template, const char * binlog_name, const char * out_dir);
 
 #ifdef __cplusplus
 }
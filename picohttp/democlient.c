@@ -115,9 +115,7 @@ int picoquic_demo_client_get_alpn_and_version_from_tickets(picoquic_quic_t* quic
     *ticket_alpn = NULL;
     if (sni != NULL) {
         uint16_t sni_length = (uint16_t) strlen(sni);
-        uint8_t* ticket = NULL;
-        uint16_t ticket_length = 0;
-        picoquic_tp_t tp;
+        picoquic_stored_ticket_t* stored_ticket;
 
         if (alpn == NULL) {
             for (size_t i = 0; i < nb_alpn_list; i++) {
@@ -125,9 +123,10 @@ int picoquic_demo_client_get_alpn_and_version_from_tickets(picoquic_quic_t* quic
                 if ((alpn_list[i].alpn_code == picoquic_alpn_http_3 ||
                     alpn_list[i].alpn_code == picoquic_alpn_http_0_9) &&
                     alpn_list[i].alpn_val != NULL) {
-                    if (picoquic_get_ticket_and_version(quic->p_first_ticket, current_time,
-                        sni, sni_length, alpn_list[i].alpn_val, (uint16_t)strlen(alpn_list[i].alpn_val), proposed_version, ticket_version,
-                        &ticket, &ticket_length, &tp, 0) == 0){
+                    if ((stored_ticket = picoquic_get_session_ticket(quic, current_time,
+                        sni, sni_length, alpn_list[i].alpn_val, (uint16_t)strlen(alpn_list[i].alpn_val),
+                        proposed_version, 0, 0)) != NULL) {
+                        *ticket_version = stored_ticket->version;
                         ret = 0;
                         *ticket_alpn = alpn_list[i].alpn_val;
                         break;
@@ -136,9 +135,9 @@ int picoquic_demo_client_get_alpn_and_version_from_tickets(picoquic_quic_t* quic
             }
         }
         else if (proposed_version == 0) {
-            if (picoquic_get_ticket_and_version(quic->p_first_ticket, current_time,
-                sni, sni_length, alpn, (uint16_t)strlen(alpn), proposed_version, ticket_version,
-                &ticket, &ticket_length, &tp, 0) == 0) {
+            if ((stored_ticket = picoquic_get_session_ticket(quic, current_time,
+                sni, sni_length, alpn, (uint16_t)strlen(alpn), proposed_version, 0, 0)) != NULL) {
+                *ticket_version = stored_ticket->version;
                 ret = 0;
             }
         }
@@ -36,6 +36,16 @@
 
 static const char* bad_request_message = "<html><head><title>Bad Request</title></head><body>Bad request. Why don't you try \"GET /456789\"?</body></html>";
 
+/* The canned pages are static strings, queued without copy. There is
+ * nothing to release once they are sent. */
+static void picoquic_h09_static_page_release(void* release_ctx, uint8_t* data)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(release_ctx);
+    UNREFERENCED_PARAMETER(data);
+#endif
+}
+
 static char* strip_endofline(char* buf, size_t bufmax, char const* line)
 {
     for (size_t i = 0; i < bufmax; i++) {
@@ -427,8 +437,8 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
                     stream_id, strip_endofline(buf, sizeof(buf), (char*)&stream_ctx->frame));
 
                 stream_ctx->response_length = strlen(bad_request_message);
-                (void)picoquic_add_to_stream_with_ctx(cnx, stream_ctx->stream_id, (const uint8_t*)bad_request_message,
-                    (size_t)stream_ctx->response_length, 1, (void*)stream_ctx);
+                (void)picoquic_add_to_stream_zero_copy(cnx, stream_ctx->stream_id, (uint8_t*)bad_request_message,
+                    (size_t)stream_ctx->response_length, 1, (void*)stream_ctx, picoquic_h09_static_page_release, NULL);
             }
             else {
                 /* If this is HTTP1, send an HTTP1 OK message, with the appropriate content type */
@@ -443,8 +453,8 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
                 if (stream_ctx->response_length == 0 && stream_ctx->echo_length == 0) {
                     /* Send the canned index.html response */
                     stream_ctx->response_length = strlen(h3zero_server_default_page);
-                    picoquic_add_to_stream_with_ctx(cnx, stream_id, (uint8_t*)h3zero_server_default_page,
-                        (size_t)stream_ctx->response_length, 1, (void*)stream_ctx);
+                    picoquic_add_to_stream_zero_copy(cnx, stream_id, (uint8_t*)h3zero_server_default_page,
+                        (size_t)stream_ctx->response_length, 1, (void*)stream_ctx, picoquic_h09_static_page_release, NULL);
                 }
                 else if (stream_ctx->echo_length == 0 && stream_ctx->response_length < sizeof(post_response)) {
                     /* For short responses, post directly.
@@ -477,6 +477,18 @@ uint8_t * h3zero_parse_qpack_header_value(uint8_t * bytes, uint8_t * bytes_max,
                         decoded_length, &parts->protocol, &parts->protocol_length);
                 }
                 break;
+            case http_header_priority: {
+                /* A priority header that cannot be parsed is ignored */
+                uint8_t urgency = H3ZERO_URGENCY_DEFAULT;
+                int is_incremental = 0;
+
+                if (h3zero_parse_priority_field(decoded, decoded_length, &urgency, &is_incremental) == 0) {
+                    parts->urgency = urgency;
+                    parts->is_incremental = is_incremental;
+                    parts->priority_found = 1;
+                }
+                break;
+            }
             default:
                 break;
             }
@@ -490,14 +502,125 @@ uint8_t * h3zero_parse_qpack_header_value(uint8_t * bytes, uint8_t * bytes_max,
     return bytes;
 }
 
+/* Parsing of the priority field, RFC 9218.
+ * The field is a structured field dictionary (RFC 8941). The member "u"
+ * carries the urgency, an integer from 0 to 7, and the member "i" the
+ * incremental flag, a boolean. Other members, parameters, and values of
+ * unexpected types or out of range are ignored. The urgency and incremental
+ * flag are only updated if the corresponding member is present.
+ * Returns -1 if the syntax of the dictionary is invalid.
+ */
+static size_t h3zero_priority_skip_to_next_member(uint8_t const* value, size_t length, size_t i)
+{
+    int in_string = 0;
+
+    while (i < length && (in_string || value[i] != ',')) {
+        if (value[i] == '"') {
+            in_string = !in_string;
+        }
+        else if (in_string && value[i] == '\\') {
+            i++;
+        }
+        i++;
+    }
+
+    return i;
+}
+
+int h3zero_parse_priority_field(uint8_t const* value, size_t length, uint8_t* urgency, int* is_incremental)
+{
+    int ret = 0;
+    int u = -1;
+    int inc = -1;
+    size_t i = 0;
+
+    while (ret == 0 && i < length) {
+        size_t key_start;
+        size_t key_length;
+        int64_t v_int = -1;
+        int v_bool = 1; /* A member without value is a boolean true */
+        int is_bool = 1;
+
+        while (i < length && (value[i] == ' ' || value[i] == '\t')) {
+            i++;
+        }
+        if (i >= length) {
+            break;
+        }
+        key_start = i;
+        if (!((value[i] >= 'a' && value[i] <= 'z') || value[i] == '*')) {
+            ret = -1;
+            break;
+        }
+        while (i < length && ((value[i] >= 'a' && value[i] <= 'z') || (value[i] >= '0' && value[i] <= '9') ||
+            value[i] == '_' || value[i] == '-' || value[i] == '.' || value[i] == '*')) {
+            i++;
+        }
+        key_length = i - key_start;
+
+        if (i < length && value[i] == '=') {
+            i++;
+            is_bool = 0;
+            if (i + 1 < length && value[i] == '?' && (value[i + 1] == '0' || value[i + 1] == '1')) {
+                is_bool = 1;
+                v_bool = value[i + 1] - '0';
+                i += 2;
+            }
+            else if (i < length && value[i] >= '0' && value[i] <= '9') {
+                int nb_digits = 0;
+
+                v_int = 0;
+                while (i < length && value[i] >= '0' && value[i] <= '9' && nb_digits < 15) {
+                    v_int = 10 * v_int + (value[i] - '0');
+                    nb_digits++;
+                    i++;
+                }
+                if (i < length && (value[i] == '.' || (value[i] >= '0' && value[i] <= '9'))) {
+                    /* Decimal or oversized number, not a valid urgency */
+                    v_int = -1;
+                }
+            }
+        }
+
+        if (key_length == 1 && value[key_start] == 'u') {
+            if (v_int >= 0 && v_int <= H3ZERO_URGENCY_MAX) {
+                u = (int)v_int;
+            }
+        }
+        else if (key_length == 1 && value[key_start] == 'i') {
+            if (is_bool) {
+                inc = v_bool;
+            }
+        }
+
+        i = h3zero_priority_skip_to_next_member(value, length, i);
+        if (i < length) {
+            /* skip the comma */
+            i++;
+        }
+    }
+
+    if (ret == 0) {
+        if (u >= 0) {
+            *urgency = (uint8_t)u;
+        }
+        if (inc >= 0) {
+            *is_incremental = inc;
+        }
+    }
+
+    return ret;
+}
+
 int h3zero_get_interesting_header_type(uint8_t * name, size_t name_length, int is_huffman)
 {
     char const  * interesting_header_name[] = {
-     ":method", ":path", ":status", "content-type", ":protocol", "origin", NULL};
+     ":method", ":path", ":status", "content-type", ":protocol", "origin", "priority", NULL};
     const http_header_enum_t interesting_header[] = {
         http_pseudo_header_method, http_pseudo_header_path,
         http_pseudo_header_status, http_header_content_type,
-        http_pseudo_header_protocol, http_header_origin
+        http_pseudo_header_protocol, http_header_origin,
+        http_header_priority
     };
     http_header_enum_t val = http_header_unknown;
     uint8_t deHuff[256];
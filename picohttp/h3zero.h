@@ -51,6 +51,8 @@ extern "C" {
 #define H3ZERO_USER_AGENT_STRING "H3Zero/1.0"
 
 #define H3ZERO_CAPSULE_CLOSE_WEBTRANSPORT_SESSION 0x2843
+#define H3ZERO_URGENCY_DEFAULT 3 /* RFC 9218 default urgency */
+#define H3ZERO_URGENCY_MAX 7
 
 typedef enum {
 	h3zero_frame_data = 0,
@@ -62,7 +64,9 @@ typedef enum {
     h3zero_frame_max_push_id = 0xd,
     h3zero_frame_reserved_base = 0xb,
     h3zero_frame_reserved_delta = 0x1f,
-    h3zero_frame_webtransport_stream = 0x41
+    h3zero_frame_webtransport_stream = 0x41,
+    h3zero_frame_priority_update_request = 0xF0700,
+    h3zero_frame_priority_update_push = 0xF0701
 } h3zero_frame_type_enum_t;
 
 typedef enum {
@@ -128,6 +132,7 @@ typedef enum {
     http_header_user_agent,
     http_header_x_forwarded_for,
     http_header_x_frame_options,
+    http_header_priority,
 	http_header_max
 } http_header_enum_t;
 
@@ -187,6 +192,9 @@ typedef struct st_h3zero_header_parts_t {
     h3zero_content_type_enum content_type;
     uint8_t const * protocol;
     size_t protocol_length;
+    uint8_t urgency; /* RFC 9218 priority, if "priority_found" */
+    unsigned int is_incremental : 1;
+    unsigned int priority_found : 1;
     unsigned int path_is_huffman : 1;
 } h3zero_header_parts_t;
 
@@ -222,6 +230,7 @@ uint8_t * h3zero_qpack_int_decode(uint8_t * bytes, uint8_t * bytes_max,
 
 uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     h3zero_header_parts_t * parts);
+int h3zero_parse_priority_field(uint8_t const* value, size_t length, uint8_t* urgency, int* is_incremental);
 uint8_t * h3zero_create_request_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     uint8_t const * path, size_t path_length, char const * host);
 uint8_t* h3zero_create_request_header_frame_ex(uint8_t* bytes, uint8_t* bytes_max,
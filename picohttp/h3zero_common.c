@@ -396,7 +396,67 @@ static void h3zero_reset_control_stream_state(h3zero_data_stream_state_t* stream
 	}
 }
 
-static uint8_t* h3zero_parse_control_stream(uint8_t* bytes, uint8_t* bytes_max,
+/* Set the priority of the response, per RFC 9218: the priority from the last
+ * PRIORITY_UPDATE frame if one was received, else from the priority header
+ * of the request, else the default urgency. Incremental responses share the
+ * bandwidth of their urgency level byte per byte.
+ */
+static void h3zero_set_response_priority(picoquic_cnx_t* cnx, h3zero_stream_ctx_t* stream_ctx)
+{
+	uint8_t urgency = H3ZERO_URGENCY_DEFAULT;
+	int is_incremental = 0;
+
+	if (stream_ctx->is_priority_updated) {
+		urgency = stream_ctx->urgency;
+		is_incremental = stream_ctx->is_incremental;
+	}
+	else if (stream_ctx->ps.stream_state.header.priority_found) {
+		urgency = stream_ctx->ps.stream_state.header.urgency;
+		is_incremental = stream_ctx->ps.stream_state.header.is_incremental;
+	}
+	if (picoquic_set_stream_urgency(cnx, stream_ctx->stream_id, urgency, is_incremental) == 0) {
+		(void)picoquic_set_stream_weight(cnx, stream_ctx->stream_id, (is_incremental) ? 1 : 0);
+	}
+}
+
+/* Process a PRIORITY_UPDATE frame received by the server. The new priority
+ * is remembered in the stream context, and applied to the stream. Updates
+ * for request streams that are not yet open are ignored.
+ */
+static int h3zero_process_priority_update(picoquic_cnx_t* cnx, const uint8_t* bytes, const uint8_t* bytes_max,
+	h3zero_callback_ctx_t* ctx, uint64_t* error_found)
+{
+	int ret = 0;
+	uint64_t stream_id;
+	uint8_t urgency;
+	int is_incremental;
+
+	if (picoquic_is_client(cnx)) {
+		*error_found = H3ZERO_FRAME_UNEXPECTED;
+		ret = -1;
+	}
+	else if (h3zero_parse_priority_update_frame(bytes, bytes_max, &stream_id, &urgency, &is_incremental) == NULL) {
+		*error_found = H3ZERO_GENERAL_PROTOCOL_ERROR;
+		ret = -1;
+	}
+	else if (!IS_CLIENT_STREAM_ID(stream_id) || !IS_BIDIR_STREAM_ID(stream_id)) {
+		*error_found = H3ZERO_ID_ERROR;
+		ret = -1;
+	}
+	else {
+		h3zero_stream_ctx_t* stream_ctx = h3zero_find_stream(ctx, stream_id);
+
+		if (stream_ctx != NULL) {
+			stream_ctx->urgency = urgency;
+			stream_ctx->is_incremental = is_incremental;
+			stream_ctx->is_priority_updated = 1;
+			h3zero_set_response_priority(cnx, stream_ctx);
+		}
+	}
+	return ret;
+}
+
+static uint8_t* h3zero_parse_control_stream(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max,
 	h3zero_data_stream_state_t* stream_state, h3zero_callback_ctx_t* ctx, uint64_t* error_found)
 {
 	while (bytes != NULL && bytes < bytes_max) {
@@ -427,7 +487,8 @@ static uint8_t* h3zero_parse_control_stream(uint8_t* bytes, uint8_t* bytes_max,
 					bytes = NULL;
 					continue;
 				}
-				else if (stream_state->current_frame_type != h3zero_frame_settings) {
+				else if (stream_state->current_frame_type != h3zero_frame_settings &&
+					stream_state->current_frame_type != h3zero_frame_priority_update_request) {
 					stream_state->is_current_frame_ignored = 1;
 				}
 			}
@@ -465,6 +526,12 @@ static uint8_t* h3zero_parse_control_stream(uint8_t* bytes, uint8_t* bytes_max,
 						ctx->settings.settings_received = 1;
 					}
 				}
+				else if (stream_state->current_frame_type == h3zero_frame_priority_update_request) {
+					if (h3zero_process_priority_update(cnx, stream_state->current_frame,
+						stream_state->current_frame + stream_state->current_frame_length, ctx, error_found) != 0) {
+						bytes = NULL;
+					}
+				}
 				h3zero_reset_control_stream_state(stream_state);
 			}
 		}
@@ -553,7 +620,7 @@ uint8_t* h3zero_parse_remote_unidir_stream(
 	}
 	switch (stream_state->stream_type) {
 	case h3zero_stream_type_control: /* used to send/receive setting frame and other control frames. */
-		bytes = h3zero_parse_control_stream(bytes, bytes_max, stream_state, ctx, error_found);
+		bytes = h3zero_parse_control_stream(stream_ctx->cnx, bytes, bytes_max, stream_state, ctx, error_found);
 		break;
 	case h3zero_stream_type_push: /* Push type not supported in current implementation */
 		bytes = bytes_max;
@@ -937,6 +1004,11 @@ int h3zero_process_request_frame(
 	*o_bytes++ = h3zero_frame_header;
 	o_bytes += 2; /* reserve two bytes for frame length */
 
+	if (stream_ctx->ps.stream_state.header.method == h3zero_method_get ||
+		stream_ctx->ps.stream_state.header.method == h3zero_method_post) {
+		h3zero_set_response_priority(cnx, stream_ctx);
+	}
+
 	if (stream_ctx->ps.stream_state.header.method == h3zero_method_get) {
 		/* Manage GET */
 		if (h3zero_server_parse_path(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length,
@@ -1896,6 +1968,65 @@ const uint8_t* h3zero_settings_decode(const uint8_t* bytes, const uint8_t* bytes
 }
 
 
+/* PRIORITY_UPDATE frame, RFC 9218.
+ * The frame content is the ID of the request stream, followed by the priority
+ * field value, e.g., "u=1, i". The default values are not encoded.
+ */
+uint8_t* h3zero_create_priority_update_frame(uint8_t* bytes, uint8_t* bytes_max, uint64_t stream_id,
+	uint8_t urgency, int is_incremental)
+{
+	uint8_t field[8];
+	size_t field_length = 0;
+
+	if (urgency > H3ZERO_URGENCY_MAX) {
+		return NULL;
+	}
+	if (urgency != H3ZERO_URGENCY_DEFAULT) {
+		field[field_length++] = 'u';
+		field[field_length++] = '=';
+		field[field_length++] = (uint8_t)('0' + urgency);
+	}
+	if (is_incremental) {
+		if (field_length > 0) {
+			field[field_length++] = ',';
+			field[field_length++] = ' ';
+		}
+		field[field_length++] = 'i';
+	}
+
+	if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, h3zero_frame_priority_update_request)) != NULL &&
+		(bytes = picoquic_frames_varint_encode(bytes, bytes_max,
+			picoquic_frames_varint_encode_length(stream_id) + field_length)) != NULL &&
+		(bytes = picoquic_frames_varint_encode(bytes, bytes_max, stream_id)) != NULL) {
+		if (bytes + field_length > bytes_max) {
+			bytes = NULL;
+		}
+		else {
+			memcpy(bytes, field, field_length);
+			bytes += field_length;
+		}
+	}
+	return bytes;
+}
+
+const uint8_t* h3zero_parse_priority_update_frame(const uint8_t* bytes, const uint8_t* bytes_max,
+	uint64_t* stream_id, uint8_t* urgency, int* is_incremental)
+{
+	/* Members that are not present take their default value */
+	*urgency = H3ZERO_URGENCY_DEFAULT;
+	*is_incremental = 0;
+
+	if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, stream_id)) != NULL) {
+		if (h3zero_parse_priority_field(bytes, bytes_max - bytes, urgency, is_incremental) != 0) {
+			bytes = NULL;
+		}
+		else {
+			bytes = bytes_max;
+		}
+	}
+	return bytes;
+}
+
 /* TLV buffer accumulator.
 * This is commonly used when parsing data streams.
 */
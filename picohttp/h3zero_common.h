@@ -50,6 +50,10 @@ extern "C" {
 
     struct st_h3zero_stream_ctx_t;
 
+    /* The data passed with picohttp_callback_post_data or picohttp_callback_post_fin
+     * points into the buffer delivered by the QUIC stack. If stream data borrowing
+     * is enabled on the connection, the callback may retain it with
+     * picoquic_retain_stream_data and forward it later without copying. */
     typedef int (*picohttp_post_data_cb_fn)(picoquic_cnx_t* cnx,
         uint8_t* bytes, size_t length,
         picohttp_call_back_event_t fin_or_event,
@@ -115,6 +119,10 @@ extern "C" {
         FILE* F;
         picohttp_post_data_cb_fn path_callback;
         void* path_callback_ctx;
+        /* Priority set by the last PRIORITY_UPDATE frame, RFC 9218 */
+        uint8_t urgency;
+        unsigned int is_incremental : 1;
+        unsigned int is_priority_updated : 1;
     } h3zero_stream_ctx_t;
 
     /* Parsing of a data stream. This is implemented as a filter, with a set of states:
@@ -162,6 +170,13 @@ extern "C" {
     const uint8_t* h3zero_settings_components_decode(const uint8_t* bytes, const uint8_t* bytes_max, h3zero_settings_t* settings);
     const uint8_t* h3zero_settings_decode(const uint8_t* bytes, const uint8_t* bytes_max, h3zero_settings_t* settings);
 
+    /* handling of PRIORITY_UPDATE frames, RFC 9218. The decoder is applied to the frame
+     * content, after the type and length. */
+    uint8_t* h3zero_create_priority_update_frame(uint8_t* bytes, uint8_t* bytes_max, uint64_t stream_id,
+        uint8_t urgency, int is_incremental);
+    const uint8_t* h3zero_parse_priority_update_frame(const uint8_t* bytes, const uint8_t* bytes_max,
+        uint64_t* stream_id, uint8_t* urgency, int* is_incremental);
+
     /* Handling of stream prefixes, for applications that use it.
      */
     typedef struct st_h3zero_stream_prefix_t {
@@ -79,6 +79,7 @@ static const picoquic_test_def_t test_table[] = {
     { "h09_multi_file_loss", h09_multi_file_loss_test },
     { "h09_multi_file_preemptive", h09_multi_file_preemptive_test },
     { "h3zero_settings", h3zero_settings_test },
+    { "h3zero_priority", h3zero_priority_test },
     { "http_stress", http_stress_test },
 #if 0
     { "http_corrupt", http_corrupt_test},
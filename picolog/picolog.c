@@ -42,6 +42,8 @@ typedef struct app_conversion_context_st
 
     const char * binlog_name;
     FILE * f_binlog;
+    binlog_index_t index;
+    int nb_threads;
 
     const char * template_name;
     FILE * f_template;
@@ -53,21 +55,24 @@ typedef struct app_conversion_context_st
 int convert_csv(const picoquic_connection_id_t * cid, void * ptr);
 int convert_svg(const picoquic_connection_id_t * cid, void * ptr);
 int convert_qlog(const picoquic_connection_id_t * cid, void * ptr);
+int convert_parallel(picohash_table * cids, int (*convert_fn)(const picoquic_connection_id_t *, void *),
+    app_conversion_context_t * appctx);
 int filedump_binlog(FILE* bin_log, FILE* bin_dump);
 
 int usage();
 void usage_formats();
 
-/* - Open binary log file and find all connection ids it contains by:
- *   - read each event
- *   - read connection id of the event
- *   - store connection id in the hashtable if it doesn't contain it already
+/* - Open binary log file and index all the events it contains by:
+ *   - map the file in memory
+ *   - read the connection id of each event
+ *   - group the event offsets by connection id
  * - Print all connection ids found.
  * - Check if user provided a connection id on the command line and verify it is
  *   contained in the hashtable. If so, replace the hashtable of connection ids
  *   with a new hashtable only containing the user provided connection id.
  * - Iterate over all connection ids in the hashtable and for each connection id
- *   convert all events for that connection id into the specified format.
+ *   convert the indexed events for that connection id into the specified format.
+ *   If several threads are requested, the connections are converted in parallel.
  */
 
 int main(int argc, char ** argv)
@@ -83,7 +88,7 @@ int main(int argc, char ** argv)
     appctx.out_format = "csv";
 
     int opt;
-    while ((opt = getopt(argc, argv, "o:f:t:c:h")) != -1) {
+    while ((opt = getopt(argc, argv, "o:f:t:c:j:h")) != -1) {
         switch (opt) {
         case 'o':
             appctx.out_dir = optarg;
@@ -97,6 +102,12 @@ int main(int argc, char ** argv)
         case 'c':
             cid_name = optarg;
             break;
+        case 'j':
+            if ((appctx.nb_threads = atoi(optarg)) < 1) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                return usage();
+            }
+            break;
         case 'h':
         default:
             return usage();
@@ -156,8 +167,18 @@ int main(int argc, char ** argv)
                 }
             }
 
+            if (ret == 0 && binlog_index_open(&appctx.index, appctx.f_binlog) != 0) {
+                fprintf(stderr, "Could not index log file %s\n", appctx.binlog_name);
+                ret = -1;
+            }
+            else if (ret == 0 && appctx.index.is_truncated) {
+                fprintf(stderr, "Warning: %s is truncated, the last event is ignored\n", appctx.binlog_name);
+            }
+
             if (ret == 0) {
-                binlog_list_cids(appctx.f_binlog, cids);
+                for (size_t i = 0; ret == 0 && i < appctx.index.nb_cids; i++) {
+                    ret = cidset_insert(cids, &appctx.index.cids[i]->cid);
+                }
 
                 fprintf(stderr, "%s contains %"PRIst" connection(s):\n\n", appctx.binlog_name, cids->count);
                 cidset_print(stderr, cids);
@@ -183,7 +204,7 @@ int main(int argc, char ** argv)
 
             if (ret == 0) {
                 if (strcmp(appctx.out_format, "csv") == 0) {
-                    ret = cidset_iterate(cids, convert_csv, &appctx);
+                    ret = convert_parallel(cids, convert_csv, &appctx);
                 }
                 else if (strcmp(appctx.out_format, "svg") == 0) {
                     if (appctx.f_template == NULL) {
@@ -195,7 +216,7 @@ int main(int argc, char ** argv)
                     }
                 }
                 else if (strcmp(appctx.out_format, "qlog") == 0) {
-                    ret = cidset_iterate(cids, convert_qlog, &appctx);
+                    ret = convert_parallel(cids, convert_qlog, &appctx);
                 }
                 else {
                     fprintf(stderr, "Invalid output format '%s'. Valid formats are\n\n", appctx.out_format);
@@ -206,6 +227,7 @@ int main(int argc, char ** argv)
         }
     }
 
+    binlog_index_close(&appctx.index);
     (void)picoquic_file_close(appctx.f_binlog);
     (void)picoquic_file_close(appctx.f_template);
     (void)cidset_delete(cids);
@@ -224,6 +246,8 @@ int usage()
     usage_formats();
     fprintf(stderr, "  -t template-file      template file for svg format conversion\n");
     fprintf(stderr, "  -c connection-id      only convert logs of specified connection id\n");
+    fprintf(stderr, "  -j threads            convert connections in parallel, csv and qlog formats\n");
+    fprintf(stderr, "                        only, requires an output directory\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "picolog converts binary log files into the format specified. Output files are\n");
     fprintf(stderr, "placed in the specified directory with their connection-id as file name.\n");
@@ -254,8 +278,17 @@ int convert_csv(const picoquic_connection_id_t * cid, void * ptr)
     }
 
     if (ret == 0) {
-        ret = picoquic_cc_bin_to_csv(appctx->f_binlog,
-            open_outfile(cid_name, appctx->binlog_name, appctx->out_dir, "csv"));
+        FILE* f_csvlog = open_outfile(cid_name, appctx->binlog_name, appctx->out_dir, "csv");
+
+        if (f_csvlog == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = picoquic_cc_bin_to_csv_indexed(&appctx->index, cid, f_csvlog);
+            if (f_csvlog != stdout) {
+                (void)picoquic_file_close(f_csvlog);
+            }
+        }
     }
 
     return ret;
@@ -264,13 +297,114 @@ int convert_csv(const picoquic_connection_id_t * cid, void * ptr)
 int convert_svg(const picoquic_connection_id_t * cid, void * ptr)
 {
     const app_conversion_context_t* appctx = (const app_conversion_context_t*)ptr;
-    return svg_convert(cid, appctx->f_binlog, appctx->f_template, appctx->binlog_name, appctx->out_dir);
+    return svg_convert_indexed(cid, &appctx->index, appctx->f_template, appctx->binlog_name, appctx->out_dir);
 }
 
 int convert_qlog(const picoquic_connection_id_t * cid, void * ptr)
 {
     const app_conversion_context_t* appctx = (const app_conversion_context_t*)ptr;
-    return qlog_convert(cid, appctx->f_binlog, appctx->binlog_name, NULL, appctx->out_dir, appctx->flags);
+    return qlog_convert_indexed(cid, &appctx->index, appctx->binlog_name, NULL, appctx->out_dir, appctx->flags);
+}
+
+/* Parallel conversion. The index is read only, and each connection is
+ * converted to its own output file, so the worker threads only share
+ * the rank of the next connection to convert. */
+typedef struct st_convert_parallel_ctx_t {
+    app_conversion_context_t* appctx;
+    int (*convert_fn)(const picoquic_connection_id_t*, void*);
+    const picoquic_connection_id_t** cid_list;
+    size_t nb_cids;
+    size_t next_cid;
+    picoquic_mutex_t mutex;
+    int ret;
+} convert_parallel_ctx_t;
+
+static int convert_parallel_list_cid(const picoquic_connection_id_t* cid, void* ptr)
+{
+    convert_parallel_ctx_t* ctx = (convert_parallel_ctx_t*)ptr;
+    ctx->cid_list[ctx->nb_cids++] = cid;
+    return 0;
+}
+
+static picoquic_thread_return_t convert_parallel_thread(void* ptr)
+{
+    convert_parallel_ctx_t* ctx = (convert_parallel_ctx_t*)ptr;
+
+    while (1) {
+        const picoquic_connection_id_t* cid = NULL;
+        int ret;
+
+        picoquic_lock_mutex(&ctx->mutex);
+        if (ctx->ret == 0 && ctx->next_cid < ctx->nb_cids) {
+            cid = ctx->cid_list[ctx->next_cid++];
+        }
+        picoquic_unlock_mutex(&ctx->mutex);
+
+        if (cid == NULL) {
+            break;
+        }
+        if ((ret = ctx->convert_fn(cid, ctx->appctx)) != 0) {
+            picoquic_lock_mutex(&ctx->mutex);
+            if (ctx->ret == 0) {
+                ctx->ret = ret;
+            }
+            picoquic_unlock_mutex(&ctx->mutex);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+int convert_parallel(picohash_table * cids, int (*convert_fn)(const picoquic_connection_id_t *, void *),
+    app_conversion_context_t * appctx)
+{
+    int ret = 0;
+    int nb_started = 0;
+    convert_parallel_ctx_t ctx;
+    picoquic_thread_t* threads = NULL;
+
+    if (appctx->nb_threads <= 1 || appctx->out_dir == NULL || cids->count <= 1) {
+        /* Output to stdout, or nothing to share between threads */
+        return cidset_iterate(cids, convert_fn, appctx);
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.appctx = appctx;
+    ctx.convert_fn = convert_fn;
+    ctx.cid_list = (const picoquic_connection_id_t**)malloc(cids->count * sizeof(picoquic_connection_id_t*));
+    threads = (picoquic_thread_t*)malloc(appctx->nb_threads * sizeof(picoquic_thread_t));
+
+    if (ctx.cid_list == NULL || threads == NULL || picoquic_create_mutex(&ctx.mutex) != 0) {
+        ret = -1;
+    }
+    else {
+        (void)cidset_iterate(cids, convert_parallel_list_cid, &ctx);
+
+        for (int i = 0; i < appctx->nb_threads; i++) {
+            if (picoquic_create_thread(&threads[i], convert_parallel_thread, &ctx) != 0) {
+                fprintf(stderr, "Could not start conversion thread %d\n", i);
+                break;
+            }
+            nb_started++;
+        }
+        if (nb_started == 0) {
+            /* Convert in this thread instead */
+            (void)convert_parallel_thread(&ctx);
+        }
+        for (int i = 0; i < nb_started; i++) {
+            picoquic_wait_thread(threads[i]);
+#ifdef _WINDOWS
+            CloseHandle(threads[i]);
+#endif
+        }
+        ret = ctx.ret;
+        (void)picoquic_delete_mutex(&ctx.mutex);
+    }
+
+    free(threads);
+    free((void*)ctx.cid_list);
+
+    return ret;
 }
 
 int filedump_binlog(FILE* bin_log, FILE* bin_dump)
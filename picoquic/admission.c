@@ -0,0 +1,202 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Admission control of incoming Initial packets.
+ * This filter runs before the creation of a connection context, and must thus
+ * be cheap: one keyed hash of the source prefix, one table lookup, and a few
+ * comparisons. See the description of picoquic_admission_t.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "tls_api.h"
+
+static uint64_t picoquic_admission_hash(picoquic_admission_t* adm, const struct sockaddr* addr)
+{
+    uint64_t x = 0;
+
+    if (addr->sa_family == AF_INET) {
+        const uint8_t* a = (const uint8_t*)&((struct sockaddr_in*)addr)->sin_addr;
+        /* IPv4 /24 */
+        x = (4ull << 56) | ((uint64_t)a[0] << 16) | ((uint64_t)a[1] << 8) | (uint64_t)a[2];
+    }
+    else if (addr->sa_family == AF_INET6) {
+        const uint8_t* a = (const uint8_t*)&((struct sockaddr_in6*)addr)->sin6_addr;
+        /* IPv6 /48 */
+        x = 6ull << 56;
+        for (int i = 0; i < 6; i++) {
+            x |= ((uint64_t)a[i]) << (8 * (5 - i));
+        }
+    }
+    /* Keyed mix, so that attackers cannot choose prefixes that collide */
+    x ^= adm->hash_key;
+    x *= 0x9E3779B97F4A7C15ull;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 32;
+
+    return x | 1;
+}
+
+/* Per prefix rate limit, the cheapest check, done before looking at the token */
+static int picoquic_admission_rate_check(picoquic_admission_t* adm, const struct sockaddr* addr_from, uint64_t current_time)
+{
+    int ret = 0;
+
+    adm->nb_initials_checked++;
+
+    if (adm->table != NULL) {
+        uint64_t tag = picoquic_admission_hash(adm, addr_from);
+        picoquic_admission_entry_t* entry = &adm->table[(tag >> 1) & (PICOQUIC_ADMISSION_TABLE_SIZE - 1)];
+
+        if (entry->tag != tag || entry->tat < current_time) {
+            entry->tag = tag;
+            entry->tat = current_time;
+        }
+        if (entry->tat > current_time + adm->tolerance) {
+            adm->nb_rate_limited++;
+            ret = PICOQUIC_ERROR_INITIAL_RATE_LIMITED;
+        }
+        else {
+            entry->tat += adm->interval;
+        }
+    }
+
+    return ret;
+}
+
+static int picoquic_admission_retry_required(picoquic_admission_t* adm)
+{
+    return adm->retry_load_threshold > 0 && adm->load_permille >= adm->retry_load_threshold;
+}
+
+static int picoquic_admission_load_check(picoquic_admission_t* adm, int has_token)
+{
+    int ret = 0;
+
+    if (!has_token && picoquic_admission_retry_required(adm)) {
+        adm->nb_stateless_retry++;
+        ret = PICOQUIC_ERROR_STATELESS_RETRY;
+    }
+    else {
+        adm->nb_admitted++;
+    }
+
+    return ret;
+}
+
+int picoquic_admission_check(picoquic_quic_t* quic, const struct sockaddr* addr_from, int has_token, uint64_t current_time)
+{
+    picoquic_admission_t* adm = &quic->admission;
+    int ret = picoquic_admission_rate_check(adm, addr_from, current_time);
+
+    if (ret == 0) {
+        ret = picoquic_admission_load_check(adm, has_token);
+    }
+
+    return ret;
+}
+
+/* Admission of an Initial packet. The token is only decrypted if the packet
+ * passed the rate limit and the load requires a retry; otherwise it is left
+ * to the full verification in picoquic_incoming_client_initial. The packet
+ * number is still protected, so it is not checked here.
+ */
+int picoquic_admission_check_initial(picoquic_quic_t* quic, const struct sockaddr* addr_from,
+    picoquic_packet_header* ph, uint64_t current_time)
+{
+    picoquic_admission_t* adm = &quic->admission;
+    int ret = picoquic_admission_rate_check(adm, addr_from, current_time);
+
+    if (ret == 0) {
+        int has_token = 0;
+
+        if (ph->token_length > 0 && picoquic_admission_retry_required(adm)) {
+            int is_new_token = 0;
+            picoquic_connection_id_t odcid;
+
+            has_token = picoquic_verify_retry_token(quic, addr_from, current_time, &is_new_token, &odcid,
+                &ph->dest_cnx_id, UINT32_MAX, ph->token_bytes, ph->token_length, 0) == 0;
+        }
+        ret = picoquic_admission_load_check(adm, has_token);
+    }
+
+    return ret;
+}
+
+void picoquic_admission_release(picoquic_admission_t* adm)
+{
+    if (adm->table != NULL) {
+        free(adm->table);
+        adm->table = NULL;
+    }
+}
+
+int picoquic_set_admission_parameters(picoquic_quic_t* quic, uint64_t initial_rate, uint64_t initial_burst,
+    uint32_t retry_load_threshold)
+{
+    picoquic_admission_t* adm = &quic->admission;
+    int ret = 0;
+
+    adm->retry_load_threshold = retry_load_threshold;
+
+    if (initial_rate == 0) {
+        picoquic_admission_release(adm);
+        adm->interval = 0;
+        adm->tolerance = 0;
+    }
+    else {
+        if (adm->table == NULL) {
+            adm->table = (picoquic_admission_entry_t*)malloc(
+                PICOQUIC_ADMISSION_TABLE_SIZE * sizeof(picoquic_admission_entry_t));
+            if (adm->table == NULL) {
+                ret = -1;
+            }
+            else {
+                adm->hash_key = picoquic_public_random_64();
+            }
+        }
+        if (adm->table != NULL) {
+            memset(adm->table, 0, PICOQUIC_ADMISSION_TABLE_SIZE * sizeof(picoquic_admission_entry_t));
+            adm->interval = (initial_rate >= 1000000) ? 1 : 1000000 / initial_rate;
+            adm->tolerance = (initial_burst > 1) ? adm->interval * (initial_burst - 1) : 0;
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_set_admission_load(picoquic_quic_t* quic, uint32_t load_permille)
+{
+    quic->admission.load_permille = load_permille;
+}
+
+void picoquic_get_admission_stats(picoquic_quic_t* quic, picoquic_admission_stats_t* stats)
+{
+    picoquic_admission_t* adm = &quic->admission;
+
+    stats->nb_initials_checked = adm->nb_initials_checked;
+    stats->nb_admitted = adm->nb_admitted;
+    stats->nb_rate_limited = adm->nb_rate_limited;
+    stats->nb_stateless_retry = adm->nb_stateless_retry;
+    stats->load_permille = adm->load_permille;
+}
@@ -0,0 +1,185 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Anti-replay filter for new tokens and retry tokens.
+ * A token is identified by its expiry time and by its last 8 bytes, which are
+ * normally taken from the AEAD checksum. The token is registered in the Bloom
+ * filter of the bucket that covers its expiry time. The ring of buckets spans
+ * the longest token lifetime, so that the buckets of all the tokens that
+ * have not expired are distinct. The filters are only allocated when the
+ * first token is registered.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+void picoquic_anti_replay_init(picoquic_anti_replay_t* ar, size_t memory_max, unsigned int false_positive_log2)
+{
+    uint64_t nb_bits;
+
+    picoquic_anti_replay_release(ar);
+    if (memory_max < PICOQUIC_ANTI_REPLAY_NB_BUCKETS * sizeof(uint64_t)) {
+        memory_max = PICOQUIC_ANTI_REPLAY_NB_BUCKETS * sizeof(uint64_t);
+    }
+    if (false_positive_log2 == 0) {
+        false_positive_log2 = 1;
+    }
+    else if (false_positive_log2 > PICOQUIC_ANTI_REPLAY_FP_LOG2_MAX) {
+        false_positive_log2 = PICOQUIC_ANTI_REPLAY_FP_LOG2_MAX;
+    }
+    ar->memory_max = memory_max;
+    ar->false_positive_log2 = false_positive_log2;
+    ar->nb_words_per_bucket = memory_max / (PICOQUIC_ANTI_REPLAY_NB_BUCKETS * sizeof(uint64_t));
+    /* Each of the tokens registered in a bucket expires within the lifetime of the longest token */
+    ar->bucket_duration = (PICOQUIC_TOKEN_DELAY_LONG + PICOQUIC_ANTI_REPLAY_NB_BUCKETS - 2) /
+        (PICOQUIC_ANTI_REPLAY_NB_BUCKETS - 1);
+    /* With k = log2(1/p) hash functions, the rate p is met for up to m*ln(2)/k tokens */
+    ar->nb_hashes = false_positive_log2;
+    nb_bits = 64 * (uint64_t)ar->nb_words_per_bucket;
+    ar->bucket_capacity = (nb_bits * 69) / (100 * (uint64_t)ar->nb_hashes);
+}
+
+void picoquic_anti_replay_release(picoquic_anti_replay_t* ar)
+{
+    if (ar->bits != NULL) {
+        free(ar->bits);
+        ar->bits = NULL;
+    }
+    memset(ar->buckets, 0, sizeof(ar->buckets));
+}
+
+static void picoquic_anti_replay_clear_bucket(picoquic_anti_replay_t* ar, size_t bucket_index, uint64_t epoch)
+{
+    picoquic_anti_replay_bucket_t* bucket = &ar->buckets[bucket_index];
+
+    if (bucket->nb_tokens > 0) {
+        memset(ar->bits + bucket_index * ar->nb_words_per_bucket, 0, ar->nb_words_per_bucket * sizeof(uint64_t));
+        bucket->nb_tokens = 0;
+        ar->nb_buckets_expired++;
+    }
+    bucket->epoch = epoch;
+}
+
+int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
+    const uint8_t * token, size_t token_length, uint64_t expiry_time)
+{
+    int ret = -1;
+    picoquic_anti_replay_t* ar = &quic->token_anti_replay;
+
+    if (token_length >= 8) {
+        uint64_t epoch = expiry_time / ar->bucket_duration;
+        size_t bucket_index = (size_t)(epoch % PICOQUIC_ANTI_REPLAY_NB_BUCKETS);
+        picoquic_anti_replay_bucket_t* bucket = &ar->buckets[bucket_index];
+
+        if (ar->bits == NULL) {
+            ar->bits = (uint64_t*)malloc(PICOQUIC_ANTI_REPLAY_NB_BUCKETS * ar->nb_words_per_bucket * sizeof(uint64_t));
+            if (ar->bits != NULL) {
+                memset(ar->bits, 0, PICOQUIC_ANTI_REPLAY_NB_BUCKETS * ar->nb_words_per_bucket * sizeof(uint64_t));
+            }
+        }
+
+        if (ar->bits == NULL) {
+            DBG_PRINTF("%s", "Cannot allocate the anti-replay filters");
+        }
+        else if (bucket->nb_tokens > 0 && bucket->epoch > epoch) {
+            /* The bucket was reused for more recent tokens, this one expired long ago */
+            ar->nb_tokens_out_of_window++;
+        }
+        else {
+            uint64_t* bits = ar->bits + bucket_index * ar->nb_words_per_bucket;
+            uint64_t nb_bits = 64 * (uint64_t)ar->nb_words_per_bucket;
+            uint64_t h1 = picohash_hash_mix(PICOPARSE_64(token + token_length - 8), expiry_time);
+            uint64_t h2 = picohash_hash_mix(h1, 0x9E3779B97F4A7C15ull) | 1;
+            int is_present = 1;
+
+            if (bucket->epoch != epoch) {
+                /* All the tokens in the previous epoch of the bucket have expired */
+                picoquic_anti_replay_clear_bucket(ar, bucket_index, epoch);
+            }
+            /* Double hashing: the k probes are h1, h1 + h2, h1 + 2*h2, etc. */
+            for (unsigned int i = 0; i < ar->nb_hashes; i++) {
+                uint64_t bit = (h1 + i * h2) % nb_bits;
+                uint64_t mask = 1ull << (bit & 63);
+
+                if ((bits[bit >> 6] & mask) == 0) {
+                    is_present = 0;
+                    bits[bit >> 6] |= mask;
+                }
+            }
+
+            if (is_present) {
+                ar->nb_replays_detected++;
+                DBG_PRINTF("Token reuse detected, total=%" PRIu64, ar->nb_replays_detected);
+            }
+            else {
+                bucket->nb_tokens++;
+                ar->nb_tokens_registered++;
+                if (bucket->nb_tokens > ar->bucket_capacity) {
+                    ar->nb_tokens_over_capacity++;
+                }
+                ret = 0;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Clear the buckets in which all tokens expire before expiry_time_max */
+void picoquic_registered_token_clear(picoquic_quic_t* quic, uint64_t expiry_time_max)
+{
+    picoquic_anti_replay_t* ar = &quic->token_anti_replay;
+    uint64_t epoch_max = expiry_time_max / ar->bucket_duration;
+
+    for (size_t i = 0; i < PICOQUIC_ANTI_REPLAY_NB_BUCKETS; i++) {
+        if (ar->buckets[i].nb_tokens > 0 && ar->buckets[i].epoch < epoch_max) {
+            picoquic_anti_replay_clear_bucket(ar, i, ar->buckets[i].epoch);
+        }
+    }
+}
+
+void picoquic_set_anti_replay_parameters(picoquic_quic_t* quic, size_t memory_max, unsigned int false_positive_log2)
+{
+    picoquic_anti_replay_init(&quic->token_anti_replay,
+        (memory_max == 0) ? PICOQUIC_ANTI_REPLAY_MEMORY_DEFAULT : memory_max,
+        (false_positive_log2 == 0) ? PICOQUIC_ANTI_REPLAY_FP_LOG2_DEFAULT : false_positive_log2);
+}
+
+void picoquic_get_anti_replay_stats(picoquic_quic_t* quic, picoquic_anti_replay_stats_t* stats)
+{
+    picoquic_anti_replay_t* ar = &quic->token_anti_replay;
+
+    memset(stats, 0, sizeof(picoquic_anti_replay_stats_t));
+    stats->nb_tokens_registered = ar->nb_tokens_registered;
+    stats->nb_replays_detected = ar->nb_replays_detected;
+    stats->nb_tokens_over_capacity = ar->nb_tokens_over_capacity;
+    stats->nb_tokens_out_of_window = ar->nb_tokens_out_of_window;
+    stats->nb_buckets_expired = ar->nb_buckets_expired;
+    stats->bucket_capacity = ar->bucket_capacity;
+    stats->bytes_allocated = (ar->bits == NULL) ? 0 : PICOQUIC_ANTI_REPLAY_NB_BUCKETS * ar->nb_words_per_bucket * sizeof(uint64_t);
+    for (size_t i = 0; i < PICOQUIC_ANTI_REPLAY_NB_BUCKETS; i++) {
+        stats->nb_tokens_in_filters += ar->buckets[i].nb_tokens;
+    }
+    stats->nb_issued_tickets = quic->table_issued_tickets_nb;
+    stats->nb_issued_tickets_expired = quic->nb_issued_tickets_expired;
+    stats->nb_issued_tickets_evicted = quic->nb_issued_tickets_evicted;
+}
@@ -199,6 +199,10 @@ int picoquic_flow_control_check_stream_offset(picoquic_cnx_t* cnx, picoquic_stre
             ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FLOW_CONTROL_ERROR, 0);
         } else {
             cnx->data_received += new_bytes;
+            if (stream->direct_receive_fn != NULL) {
+                /* Direct receive passes the data to the application on arrival */
+                cnx->data_consumed += new_bytes;
+            }
             stream->fin_offset = new_fin_offset;
         }
     }
@@ -233,12 +237,10 @@ uint8_t * picoquic_format_stream_reset_frame(picoquic_cnx_t* cnx, picoquic_strea
             while (stream->send_queue != NULL) {
                 picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
 
-                if (stream->send_queue->bytes != NULL) {
-                    free(stream->send_queue->bytes);
-                }
-                free(stream->send_queue);
+                picoquic_stream_queue_node_free(stream->send_queue);
                 stream->send_queue = next;
             }
+            picoquic_stream_sent_queue_free(stream);
             (void)picoquic_delete_stream_if_closed(cnx, stream);
         }
         else {
@@ -747,7 +749,7 @@ const uint8_t* picoquic_decode_new_token_frame(picoquic_cnx_t* cnx, const uint8_
         uint8_t * ip_addr;
         uint8_t ip_addr_length;
         picoquic_get_ip_addr(addr_to, &ip_addr, &ip_addr_length);
-        (void)picoquic_store_token(&cnx->quic->p_first_token, current_time, cnx->sni, (uint16_t)strlen(cnx->sni),
+        (void)picoquic_store_retry_token(cnx->quic, current_time, cnx->sni, (uint16_t)strlen(cnx->sni),
             ip_addr, ip_addr_length, token, (uint16_t)length);
     }
 
@@ -904,13 +906,70 @@ int picoquic_parse_stream_header(const uint8_t* bytes, size_t bytes_max,
     return ret;
 }
 
+/* Stream reference frames are only found in sent packets, after
+ * picoquic_compact_sent_packet replaced a stream frame whose data is kept in
+ * the sent queue of the stream. The encoding has a fixed size, so the frame
+ * can be updated in place after part of the data was retransmitted:
+ * type (1), fin (1), stream ID (8), offset (8), data length (4).
+ */
+uint8_t* picoquic_format_stream_ref_frame(uint8_t* bytes, uint8_t* bytes_max,
+    uint64_t stream_id, uint64_t offset, size_t data_length, int fin)
+{
+    if (bytes + PICOQUIC_STREAM_REF_FRAME_SIZE > bytes_max || data_length > UINT32_MAX) {
+        bytes = NULL;
+    }
+    else {
+        bytes[0] = picoquic_frame_type_stream_ref;
+        bytes[1] = (fin) ? 1 : 0;
+        picoformat_64(bytes + 2, stream_id);
+        picoformat_64(bytes + 10, offset);
+        picoformat_32(bytes + 18, (uint32_t)data_length);
+        bytes += PICOQUIC_STREAM_REF_FRAME_SIZE;
+    }
+
+    return bytes;
+}
+
+/* Parse the header of either a stream frame or a stream reference frame.
+ * For stream frames, the data follows the "consumed" header bytes. For
+ * reference frames, "consumed" covers the whole frame.
+ */
+int picoquic_parse_stream_or_ref_header(const uint8_t* bytes, size_t bytes_max,
+    uint64_t* stream_id, uint64_t* offset, size_t* data_length, int* fin,
+    size_t* consumed, int* is_ref)
+{
+    int ret = 0;
+
+    *is_ref = (bytes[0] == picoquic_frame_type_stream_ref);
+    if (!*is_ref) {
+        ret = picoquic_parse_stream_header(bytes, bytes_max, stream_id, offset, data_length, fin, consumed);
+    }
+    else if (bytes_max < PICOQUIC_STREAM_REF_FRAME_SIZE) {
+        *data_length = 0;
+        *consumed = bytes_max;
+        ret = -1;
+    }
+    else {
+        *fin = bytes[1];
+        *stream_id = PICOPARSE_64(bytes + 2);
+        *offset = PICOPARSE_64(bytes + 10);
+        *data_length = PICOPARSE_32(bytes + 18);
+        *consumed = PICOQUIC_STREAM_REF_FRAME_SIZE;
+    }
+
+    return ret;
+}
+
+/* Pass a chunk of data to the application. The node "data_node" holds the
+ * bytes, and can be retained by the application if borrowing is enabled. */
 static void picoquic_stream_data_chunk_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream,
-    const uint8_t * bytes, size_t data_length)
+    const uint8_t * bytes, size_t data_length, picoquic_stream_data_node_t* data_node)
 {
     picoquic_call_back_event_t fin_now = picoquic_callback_stream_data;
     int call_back_needed = data_length > 0;
 
     stream->consumed_offset += data_length;
+    cnx->data_consumed += data_length;
 
     if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled) {
         fin_now = picoquic_callback_stream_fin;
@@ -918,12 +977,19 @@ static void picoquic_stream_data_chunk_callback(picoquic_cnx_t* cnx, picoquic_st
         call_back_needed = 1;
     }
 
-    if (call_back_needed && !stream->stop_sending_requested && !stream->is_discarded &&
-        cnx->callback_fn(cnx, stream->stream_id, (uint8_t *)bytes, data_length, fin_now,
-        cnx->callback_ctx, stream->app_stream_ctx) != 0) {
-        picoquic_log_app_message(cnx, "Data callback (%d, l=%zu) on stream %" PRIu64 " returns error 0x%x",
-            fin_now, data_length, stream->stream_id, PICOQUIC_TRANSPORT_INTERNAL_ERROR);
-        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+    if (call_back_needed && !stream->stop_sending_requested && !stream->is_discarded) {
+        picoquic_stream_data_node_t* previous_node = cnx->delivered_data_node;
+        int ret;
+
+        cnx->delivered_data_node = data_node;
+        ret = cnx->callback_fn(cnx, stream->stream_id, (uint8_t*)bytes, data_length, fin_now,
+            cnx->callback_ctx, stream->app_stream_ctx);
+        cnx->delivered_data_node = previous_node;
+        if (ret != 0) {
+            picoquic_log_app_message(cnx, "Data callback (%d, l=%zu) on stream %" PRIu64 " returns error 0x%x",
+                fin_now, data_length, stream->stream_id, PICOQUIC_TRANSPORT_INTERNAL_ERROR);
+            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+        }
     }
 }
 
@@ -935,53 +1001,121 @@ void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t*
         size_t start = (size_t)(stream->consumed_offset - data->offset);
         if (data->length >= start) {
             size_t data_length = data->length - start;
-            picoquic_stream_data_chunk_callback(cnx, stream, data->bytes + start, data_length);
+            picoquic_stream_data_chunk_callback(cnx, stream, data->bytes + start, data_length, data);
         }
         picosplay_delete_hint(&stream->stream_data_tree, &data->stream_data_node);
     }
 
     /* handle the case where the fin frame does not carry any data */
-    picoquic_stream_data_chunk_callback(cnx, stream, NULL, 0);
+    picoquic_stream_data_chunk_callback(cnx, stream, NULL, 0, NULL);
 }
 
-static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t offset,
-    size_t length, const uint8_t* bytes, int* chunk_added, picoquic_stream_data_node_t * received_data)
+/* Charge the connection for a node inserted in a reassembly tree. The charge
+ * is released when the node is recycled. */
+static void picoquic_stream_data_node_account(picoquic_cnx_t* cnx, picoquic_stream_data_node_t* node)
+{
+    if (cnx != NULL) {
+        node->accounted_cnx = cnx;
+        node->accounted_bytes = (node->is_compact) ?
+            offsetof(struct st_picoquic_stream_data_node_t, data) + node->data_max : sizeof(picoquic_stream_data_node_t);
+        picoquic_memory_account(cnx, picoquic_memory_reassembly, node->accounted_bytes);
+    }
+}
+
+/* Append data at the end of a compact node, replacing the node by a larger one
+ * if needed. Returns the node holding the data, or NULL if the node is not
+ * compact or would grow larger than PICOQUIC_STREAM_DATA_CHUNK_MAX. */
+static picoquic_stream_data_node_t* picoquic_stream_data_node_extend(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
+    picosplay_tree_t* tree, picoquic_stream_data_node_t* node, const uint8_t* bytes, size_t length)
+{
+    if (!node->is_compact || node->length + length > PICOQUIC_STREAM_DATA_CHUNK_MAX) {
+        return NULL;
+    }
+
+    if (node->length + length > node->data_max) {
+        size_t data_max = 2 * node->data_max;
+        picoquic_stream_data_node_t* larger;
+
+        if (data_max < node->length + length) {
+            data_max = node->length + length;
+        }
+        if (data_max > PICOQUIC_STREAM_DATA_CHUNK_MAX) {
+            data_max = PICOQUIC_STREAM_DATA_CHUNK_MAX;
+        }
+        if ((larger = picoquic_stream_data_node_alloc_compact(quic, data_max)) == NULL) {
+            return NULL;
+        }
+        memcpy(larger->data, node->bytes, node->length);
+        larger->offset = node->offset;
+        larger->length = node->length;
+        picosplay_delete_hint(tree, &node->stream_data_node);
+        picosplay_insert(tree, larger);
+        picoquic_stream_data_node_account(cnx, larger);
+        node = larger;
+    }
+
+    memcpy(node->data + node->length, bytes, length);
+    node->length += length;
+
+    return node;
+}
+
+/* Add a chunk of data to the tree. The chunk is appended to the previous node "*last"
+ * if it is adjacent, and the next node is absorbed if the chunk ends just before it.
+ * The packet buffer "received_data" is only kept if the chunk is large enough to justify
+ * it, otherwise the data is copied in a compact node. */
+static int add_chunk_node(picoquic_quic_t * quic, picoquic_cnx_t* cnx, picosplay_tree_t* tree, uint64_t offset,
+    size_t length, const uint8_t* bytes, int* chunk_added, picoquic_stream_data_node_t * received_data,
+    picoquic_stream_data_node_t** last, picoquic_stream_data_node_t* next, int* next_merged)
 {
     int ret = 0;
+    picoquic_stream_data_node_t* node = NULL;
 
-    picoquic_stream_data_node_t* node = received_data;
-    
-    if (received_data == NULL || received_data->bytes != NULL) {
-        node = picoquic_stream_data_node_alloc(quic);
-        if (node == NULL) {
+    if (*last != NULL && (*last)->offset + (*last)->length == offset) {
+        node = picoquic_stream_data_node_extend(quic, cnx, tree, *last, bytes, length);
+    }
+
+    if (node == NULL) {
+        if (received_data != NULL && received_data->bytes == NULL && length >= PICOQUIC_STREAM_DATA_PIN_MIN) {
+            /* The pointer "bytes" is inside the received data packet. */
+            node = received_data;
+            node->bytes = bytes;
+        }
+        else if ((node = picoquic_stream_data_node_alloc_compact(quic, (length + 0x3F) & ~((size_t)0x3F))) == NULL) {
             ret = PICOQUIC_ERROR_MEMORY;
         }
         else {
-            node->bytes = node->data;
-            /* Using memmove instead of memcpy, because the algorithm will
-             * sometimes try to "pack" frames from same packet. */
-            memmove(node->data, bytes, length);
+            /* The compact node is freshly allocated, it cannot overlap the packet data */
+            memcpy(node->data, bytes, length);
+        }
+
+        if (node != NULL) {
             node->offset = offset;
             node->length = length;
+            picosplay_insert(tree, node);
+            picoquic_stream_data_node_account(cnx, node);
         }
     }
-    else {
-        /* The pointer "bytes" is inside the received data packet. */
-        node->bytes = bytes;
-        node->offset = offset;
-        node->length = length;
-    }
 
-    if (node != NULL){
-        picosplay_insert(tree, node);
+    if (node != NULL) {
         *chunk_added = 1;
+        if (next != NULL && next->is_compact && node->offset + node->length == next->offset) {
+            picoquic_stream_data_node_t* merged = picoquic_stream_data_node_extend(quic, cnx, tree, node, next->bytes, next->length);
+            if (merged != NULL) {
+                node = merged;
+                picosplay_delete_hint(tree, &next->stream_data_node);
+                *next_merged = 1;
+            }
+        }
+        *last = node;
     }
 
     return ret;
 }
 
-/* Common code to data stream and crypto hs stream */
-int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t consumed_offset,
+/* Common code to data stream and crypto hs stream.
+ * The nodes added to the tree are charged to the connection "cnx", if not NULL. */
+int picoquic_queue_network_input(picoquic_quic_t * quic, picoquic_cnx_t* cnx, picosplay_tree_t* tree, uint64_t consumed_offset,
     uint64_t frame_data_offset, const uint8_t* bytes, size_t length, picoquic_stream_data_node_t* received_data, int* new_data_available)
 {
     const uint64_t input_begin = frame_data_offset;
@@ -1012,6 +1146,7 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
         picoquic_stream_data_node_t* next = (prev == NULL) ?
             (picoquic_stream_data_node_t*)picosplay_first(tree) :
             (picoquic_stream_data_node_t*)picosplay_next(&prev->stream_data_node);
+        picoquic_stream_data_node_t* last = prev;
 
         /* Check whether parts of the new frame are covered by already received chunks */
         while (ret == 0 && frame_data_offset < input_end && next != NULL && next->offset < input_end) {
@@ -1019,21 +1154,30 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
             /* the tail of the frame overlaps with the next frame received */
             const uint64_t chunk_ofs = frame_data_offset;
             const uint64_t chunk_len = next->offset > frame_data_offset ? next->offset - frame_data_offset : 0;
+            picoquic_stream_data_node_t* next_next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
+            int next_merged = 0;
+
+            frame_data_offset = next->offset + next->length;
 
             if (chunk_len > 0) {
                 /* There is a gap between previous and next frame, and it will be at least partially filled */
-                ret = add_chunk_node(quic, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available, received_data);
+                ret = add_chunk_node(quic, cnx, tree, chunk_ofs, (size_t)chunk_len, bytes + chunk_ofs - input_begin, new_data_available,
+                    received_data, &last, next, &next_merged);
             }
 
-            frame_data_offset = next->offset + next->length;
-            next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
+            if (!next_merged) {
+                last = next;
+            }
+            next = next_next;
         }
 
         /* no further already received chunk within the new frame */
         if (ret == 0 && frame_data_offset < input_end) {
             const uint64_t chunk_ofs = frame_data_offset;
             const uint64_t chunk_len = input_end - frame_data_offset;
-            ret = add_chunk_node(quic, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available, received_data);
+            int next_merged = 0;
+            ret = add_chunk_node(quic, cnx, tree, chunk_ofs, (size_t)chunk_len, bytes + frame_data_offset - input_begin, new_data_available,
+                received_data, &last, next, &next_merged);
         }
     }
 
@@ -1099,7 +1243,7 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
                 uint64_t data_length = length - delivered_index;
 
                 /* Ugly cast, but the callback requires a non-const pointer */
-                picoquic_stream_data_chunk_callback(cnx, stream, (uint8_t *)bytes + delivered_index, (size_t)data_length);
+                picoquic_stream_data_chunk_callback(cnx, stream, (uint8_t *)bytes + delivered_index, (size_t)data_length, received_data);
                 /* Adjust the tree if needed */
                 picoquic_stream_data_callback(cnx, stream);
             }
@@ -1109,7 +1253,7 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
         } else {
             int new_data_available = 0;
 
-            ret = picoquic_queue_network_input(cnx->quic, &stream->stream_data_tree, stream->consumed_offset,
+            ret = picoquic_queue_network_input(cnx->quic, cnx, &stream->stream_data_tree, stream->consumed_offset,
                 offset, bytes, length, received_data, &new_data_available);
             if (ret != 0) {
                 ret = picoquic_connection_error(cnx, (int64_t)ret, 0);
@@ -1138,7 +1282,7 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
 
         if (!is_deleted) {
             if (!stream->fin_signalled) {
-                if (!stream->fin_received && !stream->reset_received && 2 * stream->consumed_offset > stream->maxdata_local) {
+                if (!stream->fin_received && !stream->reset_received && picoquic_is_max_stream_data_needed(cnx, stream)) {
                     cnx->max_stream_data_needed = 1;
                 }
             }
@@ -1176,66 +1320,68 @@ const uint8_t* picoquic_decode_stream_frame(picoquic_cnx_t* cnx, const uint8_t*
     return bytes;
 }
 
+/* Find the next stream to serve. The priority levels that have ready streams
+ * are examined in order of priority. The ready list of a level is kept in
+ * service order, FIFO for odd priorities and round robin for even priorities,
+ * so the first stream that can send data is selected. Streams that have
+ * nothing to send are parked until the application provides data.
+ */
 picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, picoquic_path_t * path_x)
 {
-    picoquic_stream_head_t* first_stream = cnx->first_output_stream;
-    picoquic_stream_head_t* stream = first_stream;
     picoquic_stream_head_t* found_stream = NULL;
+    int priority = 0;
 
+    while (found_stream == NULL) {
+        picoquic_output_level_t* level = picoquic_next_ready_output_level(cnx, priority);
+        picoquic_stream_head_t* stream;
 
-    /* Look for a ready stream */
-    while (stream != NULL) {
-        int has_data = 0;
-        picoquic_stream_head_t* next_stream = stream->next_output_stream;
-
-        if (found_stream != NULL && stream->stream_priority > found_stream->stream_priority) {
-            /* All the streams at that priority level have been examined,
-             * the current selection is validated */
+        if (level == NULL) {
             break;
         }
-        has_data = (cnx->maxdata_remote > cnx->data_sent && stream->sent_offset < stream->maxdata_remote && (stream->is_active ||
-                (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
-                (stream->fin_requested && !stream->fin_sent)));
-        if (has_data && path_x != NULL && stream->affinity_path != path_x && stream->affinity_path != NULL) {
-            /* Only consider the streams that meet path affinity requirements */
-            has_data = 0;
-        }
-        if ((stream->reset_requested && !stream->reset_sent) ||
-            (stream->stop_sending_requested && !stream->stop_sending_sent)) {
-            /* urgent action is needed, this takes precedence over FIFO vs round-robin processing */
-            found_stream = stream;
-            break;
-        } else if (has_data) {
-            /* Check that this stream is actually available for sending data */
-            if (stream->sent_offset == 0) {
-                if (IS_CLIENT_STREAM_ID(stream->stream_id) == cnx->client_mode) {
-                    if (stream->stream_id > ((IS_BIDIR_STREAM_ID(stream->stream_id)) ? cnx->max_stream_id_bidir_remote : cnx->max_stream_id_unidir_remote)) {
-                        has_data = 0;
+        priority = level->priority + 1;
+        stream = level->first_ready;
+
+        /* Look for a ready stream */
+        while (stream != NULL) {
+            int has_data = 0;
+            int has_queued_data = (stream->is_active ||
+                (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset));
+            picoquic_stream_head_t* next_stream = stream->next_ready_stream;
+
+            has_data = (cnx->maxdata_remote > cnx->data_sent && stream->sent_offset < stream->maxdata_remote &&
+                (has_queued_data || (stream->fin_requested && !stream->fin_sent)));
+            if (has_data && path_x != NULL && stream->affinity_path != path_x && stream->affinity_path != NULL) {
+                /* Only consider the streams that meet path affinity requirements */
+                has_data = 0;
+            }
+            if ((stream->reset_requested && !stream->reset_sent) ||
+                (stream->stop_sending_requested && !stream->stop_sending_sent)) {
+                /* urgent action is needed, this takes precedence over FIFO vs round-robin processing */
+                found_stream = stream;
+                break;
+            }
+            else if (has_data) {
+                /* Check that this stream is actually available for sending data */
+                if (stream->sent_offset == 0) {
+                    if (IS_CLIENT_STREAM_ID(stream->stream_id) == cnx->client_mode) {
+                        if (stream->stream_id > ((IS_BIDIR_STREAM_ID(stream->stream_id)) ? cnx->max_stream_id_bidir_remote : cnx->max_stream_id_unidir_remote)) {
+                            has_data = 0;
+                        }
                     }
                 }
-            }
-            if (has_data) {
-                /* Something can be sent */
-                if ((stream->stream_priority & 1) != 0) {
-                    /* This priority level requests FIFO processing, so we return the first available stream */
+                if (has_data) {
+                    /* Something can be sent */
                     found_stream = stream;
                     break;
                 }
-                else if (found_stream == NULL || stream->last_time_data_sent < found_stream->last_time_data_sent) {
-                    /* Select this stream, but need to check if another stream should go before in round robin order */
-                    found_stream = stream;
-                }
             }
-        }
-        else if (((stream->fin_requested && stream->fin_sent) || (stream->reset_requested && stream->reset_sent)) && (!stream->stop_sending_requested || stream->stop_sending_sent)) {
-            /* If stream is exhausted, remove from output list */
-            picoquic_remove_output_stream(cnx, stream);
+            else if (((stream->fin_requested && stream->fin_sent) || (stream->reset_requested && stream->reset_sent)) && (!stream->stop_sending_requested || stream->stop_sending_sent)) {
+                /* If stream is exhausted, remove from output list */
+                picoquic_remove_output_stream(cnx, stream);
 
-            picoquic_delete_stream_if_closed(cnx, stream);
-        }
-        else {
-            if (stream->is_active ||
-                (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset)) {
+                picoquic_delete_stream_if_closed(cnx, stream);
+            }
+            else if (has_queued_data) {
                 if (stream->sent_offset >= stream->maxdata_remote) {
                     cnx->stream_blocked = 1;
                 }
@@ -1243,8 +1389,12 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
                     cnx->flow_blocked = 1;
                 }
             }
+            else if (!stream->fin_requested) {
+                /* Nothing to send until the application provides data */
+                picoquic_park_output_stream(cnx, stream);
+            }
+            stream = next_stream;
         }
-        stream = next_stream;
     }
 
     return found_stream;
@@ -1267,6 +1417,7 @@ uint8_t * picoquic_format_data_blocked_frame(picoquic_cnx_t * cnx, uint8_t* byte
         (bytes = picoquic_frames_varint_encode(bytes, bytes_max, cnx->maxdata_remote)) != NULL) {
         *is_pure_ack = 0;
         cnx->sent_blocked_frame = 1;
+        cnx->nb_data_blocked_sent++;
     }
     else {
         *more_data = 1;
@@ -1359,6 +1510,9 @@ uint8_t * picoquic_format_one_blocked_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
             if (stream->sent_offset >= stream->maxdata_remote && !stream->stream_data_blocked_sent) {
                 /* Prepare a stream data blocked frame */
                 bytes = picoquic_format_stream_data_blocked_frame(bytes, bytes_max, more_data, is_pure_ack, stream);
+                if (stream->stream_data_blocked_sent) {
+                    cnx->nb_stream_data_blocked_sent++;
+                }
             }
         }
     }
@@ -1557,6 +1711,7 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                     bytes = bytes0 + stream_data_context.byte_index + stream_data_context.length;
                     stream->sent_offset += stream_data_context.length;
                     stream->last_time_data_sent = picoquic_get_quic_time(cnx->quic);
+                    picoquic_served_output_stream(cnx, stream, stream_data_context.length);
                     cnx->data_sent += stream_data_context.length;
 
                     if (stream_data_context.length > 0) {
@@ -1615,16 +1770,14 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                     memcpy(&bytes0[byte_index], stream->send_queue->bytes + stream->send_queue->offset, length);
                     byte_index += length;
 
+                    stream->sent_offset += length;
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
-                        picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
-                        stream->send_queue = next;
+                        picoquic_stream_data_node_sent(cnx, stream);
                     }
 
-                    stream->sent_offset += length;
                     stream->last_time_data_sent = picoquic_get_quic_time(cnx->quic);
+                    picoquic_served_output_stream(cnx, stream, length);
                     cnx->data_sent += length;
                 }
 
@@ -1790,20 +1943,22 @@ int picoquic_queue_data_repeat_adjust(picoquic_cnx_t* cnx, picoquic_packet_t* pa
     int ret = 0;
     while (packet->data_repeat_frame < packet->length) {
         uint8_t* data_byte = packet->bytes + packet->data_repeat_frame;
-        if (*data_byte >= picoquic_frame_type_stream_range_min && *data_byte <= picoquic_frame_type_stream_range_max) {
+        if ((*data_byte >= picoquic_frame_type_stream_range_min && *data_byte <= picoquic_frame_type_stream_range_max) ||
+            *data_byte == picoquic_frame_type_stream_ref) {
             /* next frame is a stream data frame. Make sure that the pointers point to it,
             * and adjust the packet priority */
             size_t consumed;
             int fin;
+            int is_ref;
 
             packet->data_repeat_priority = 0;
             packet->data_repeat_stream_id = 0;
             packet->data_repeat_stream_offset = 0;
             packet->data_repeat_stream_data_length = 0;
 
-            if (picoquic_parse_stream_header(data_byte, packet->length - packet->data_repeat_frame,
+            if (picoquic_parse_stream_or_ref_header(data_byte, packet->length - packet->data_repeat_frame,
                 &packet->data_repeat_stream_id, &packet->data_repeat_stream_offset, 
-                &packet->data_repeat_stream_data_length, &fin, &consumed) == 0) {
+                &packet->data_repeat_stream_data_length, &fin, &consumed, &is_ref) == 0) {
                 /* Find the stream and its priority */
                 picoquic_stream_head_t* stream = picoquic_find_stream(cnx, packet->data_repeat_stream_id);
                 if (stream == NULL) {
@@ -1822,7 +1977,7 @@ int picoquic_queue_data_repeat_adjust(picoquic_cnx_t* cnx, picoquic_packet_t* pa
         else {
             int forget_about_ack = 0;
             size_t consumed = 0;
-            if (picoquic_skip_frame(data_byte, packet->length - packet->data_repeat_frame, &consumed, &forget_about_ack) != 0) {
+            if (picoquic_skip_sent_frame(data_byte, packet->length - packet->data_repeat_frame, &consumed, &forget_about_ack) != 0) {
                 /* Malformed frame, internal error! */
                 ret = -1;
                 break;
@@ -1874,8 +2029,9 @@ uint8_t* picoquic_copy_stream_frame_for_retransmit(
     size_t consumed;
     size_t bytes_not_sent = 0;
     int fin;
+    int is_ref;
 
-    if (picoquic_parse_stream_header(frame, frame_length_max, &stream_id, &offset, &data_length, &fin, &consumed) != 0) {
+    if (picoquic_parse_stream_or_ref_header(frame, frame_length_max, &stream_id, &offset, &data_length, &fin, &consumed, &is_ref) != 0) {
         /* Malformed stream frame. Error. */
         bytes_next = NULL;
     }
@@ -1883,9 +2039,13 @@ uint8_t* picoquic_copy_stream_frame_for_retransmit(
         uint8_t* bytes_first = bytes_next;
         /* Need to find out how much is really available, based on the index in the packet */
         size_t data_available = data_length;
-        uint8_t* frame_bytes = frame + consumed;
+        const uint8_t* frame_bytes = frame + consumed;
         int is_needed = 1;
-        if (packet->data_repeat_index > packet->data_repeat_frame + consumed) {
+        if (is_ref) {
+            /* The progress of reference frames is recorded in the frame itself */
+            frame_bytes = NULL;
+        }
+        else if (packet->data_repeat_index > packet->data_repeat_frame + consumed) {
             size_t already_sent = packet->data_repeat_index - packet->data_repeat_frame - consumed;
             if (already_sent <= data_length) {
                 offset += already_sent;
@@ -1913,6 +2073,15 @@ uint8_t* picoquic_copy_stream_frame_for_retransmit(
                 /* That frame is not needed anymore */
                 is_needed = 0;
             }
+            else if (is_ref && data_available > 0 &&
+                (frame_bytes = picoquic_stream_sent_data(stream, offset, data_available)) == NULL) {
+                /* The data is only released after being acknowledged */
+                DBG_PRINTF("Data of stream %" PRIu64 " at offset %" PRIu64 " is not available", stream_id, offset);
+                is_needed = 0;
+            }
+        }
+        else if (is_ref) {
+            is_needed = 0;
         }
         if (is_needed) {
             /* Need to check how much can be encoded in the packet:
@@ -1963,9 +2132,16 @@ uint8_t* picoquic_copy_stream_frame_for_retransmit(
 
         if (bytes_not_sent == 0) {
             /* Progress frame index to next byte after data frame */
-            packet->data_repeat_index = packet->data_repeat_frame + consumed + data_length;
+            packet->data_repeat_index = packet->data_repeat_frame + consumed + ((is_ref) ? 0 : data_length);
             packet->data_repeat_frame = packet->data_repeat_index;
         }
+        else if (is_ref) {
+            if (bytes_not_sent < data_length) {
+                /* Keep only the data not yet sent in the reference */
+                (void)picoquic_format_stream_ref_frame(frame, frame + consumed, stream_id,
+                    offset + data_length - bytes_not_sent, bytes_not_sent, fin);
+            }
+        }
         else if (bytes_not_sent < data_length) {
             /* Progress index to next byte not sent */
             packet->data_repeat_index = packet->data_repeat_frame + consumed + data_length - bytes_not_sent;
@@ -1975,6 +2151,41 @@ uint8_t* picoquic_copy_stream_frame_for_retransmit(
     return bytes_next;
 }
 
+/* Rebuild the stream frame described by a stream reference frame, using the
+ * data kept in the sent queue of the stream. Returns NULL if the frame does
+ * not fit, or if the data is not available.
+ */
+uint8_t* picoquic_format_stream_frame_from_ref(picoquic_cnx_t* cnx, const uint8_t* ref, size_t ref_length,
+    uint8_t* bytes, uint8_t* bytes_max)
+{
+    uint8_t* bytes0 = bytes;
+    uint64_t stream_id;
+    uint64_t offset;
+    size_t data_length;
+    size_t consumed;
+    int fin;
+    int is_ref;
+    picoquic_stream_head_t* stream;
+    const uint8_t* data;
+
+    if (picoquic_parse_stream_or_ref_header(ref, ref_length, &stream_id, &offset, &data_length, &fin, &consumed, &is_ref) != 0 ||
+        !is_ref || (stream = picoquic_find_stream(cnx, stream_id)) == NULL ||
+        (data = picoquic_stream_sent_data(stream, offset, data_length)) == NULL ||
+        (bytes = picoquic_format_stream_frame_header(bytes, bytes_max, stream_id, offset)) == NULL ||
+        (bytes = picoquic_frames_varint_encode(bytes, bytes_max, data_length)) == NULL ||
+        bytes + data_length > bytes_max) {
+        bytes = NULL;
+    }
+    else {
+        *bytes0 |= 2; /* length is present */
+        *bytes0 |= (fin) ? 1 : 0;
+        memcpy(bytes, data, data_length);
+        bytes += data_length;
+    }
+
+    return bytes;
+}
+
 /* Copying a frame will:
 * 1- Copy the bytes from the stream frame.
 * 2- If this does not exhaust the frame, reset the "index", return.
@@ -1998,7 +2209,8 @@ uint8_t* picoquic_copy_single_stream_frame_for_retransmit(picoquic_cnx_t* cnx, p
     if (packet->data_repeat_frame < packet->length) {
         /* Copy the current stream frame. */
         uint8_t* data_byte = packet->bytes + packet->data_repeat_frame;
-        if (*data_byte >= picoquic_frame_type_stream_range_min && *data_byte <= picoquic_frame_type_stream_range_max) {
+        if ((*data_byte >= picoquic_frame_type_stream_range_min && *data_byte <= picoquic_frame_type_stream_range_max) ||
+            *data_byte == picoquic_frame_type_stream_ref) {
             /* next frame is a stream data frame. Try to add its content */
             uint8_t* bytes_first = bytes_next;
             bytes_next = picoquic_copy_stream_frame_for_retransmit(cnx, packet, bytes_next, bytes_max);
@@ -2121,7 +2333,7 @@ const uint8_t* picoquic_decode_crypto_hs_frame(picoquic_cnx_t* cnx, const uint8_
     } else {
         picoquic_stream_head_t* stream = &cnx->tls_stream[epoch];
         int new_data_available;
-        int ret = picoquic_queue_network_input(cnx->quic, &stream->stream_data_tree, stream->consumed_offset,
+        int ret = picoquic_queue_network_input(cnx->quic, cnx, &stream->stream_data_tree, stream->consumed_offset,
             offset, data_bytes, (size_t)data_length, received_data, &new_data_available);
         if (ret != 0) {
             picoquic_connection_error(cnx, (int64_t)ret, picoquic_frame_type_crypto_hs);
@@ -2245,8 +2457,7 @@ uint8_t* picoquic_format_crypto_hs_frame(picoquic_stream_head_t* stream, uint8_t
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
                         picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
+                        picoquic_stream_queue_node_free(stream->send_queue);
                         stream->send_queue = next;
                     }
 
@@ -2356,8 +2567,8 @@ picoquic_packet_t* picoquic_check_spurious_retransmission(picoquic_cnx_t* cnx,
                  */
                 picoquic_record_ack_packet_data(packet_data, p);
 
-                if (p->length + p->checksum_overhead > old_path->send_mtu) {
-                    old_path->send_mtu = p->length + p->checksum_overhead;
+                if (PICOQUIC_PACKET_SENT_LENGTH(p) + p->checksum_overhead > old_path->send_mtu) {
+                    old_path->send_mtu = PICOQUIC_PACKET_SENT_LENGTH(p) + p->checksum_overhead;
                     if (old_path->send_mtu > old_path->send_mtu_max_tried) {
                         old_path->send_mtu_max_tried = old_path->send_mtu;
                     }
@@ -2380,8 +2591,8 @@ picoquic_packet_t* picoquic_check_spurious_retransmission(picoquic_cnx_t* cnx,
                     old_path->nb_losses_found--;
                 }
 
-                if (old_path->total_bytes_lost > p->length) {
-                    old_path->total_bytes_lost -= p->length;
+                if (old_path->total_bytes_lost > PICOQUIC_PACKET_SENT_LENGTH(p)) {
+                    old_path->total_bytes_lost -= PICOQUIC_PACKET_SENT_LENGTH(p);
                 }
                 else {
                     old_path->total_bytes_lost = 0;
@@ -2727,7 +2938,7 @@ void picoquic_record_ack_packet_data(picoquic_packet_data_t* packet_data, picoqu
             packet_data->path_ack[path_i].rs_is_path_limited = acked_packet->delivered_app_limited;
             packet_data->path_ack[path_i].is_set = 1;
         }
-        packet_data->path_ack[path_i].data_acked += acked_packet->length;
+        packet_data->path_ack[path_i].data_acked += PICOQUIC_PACKET_SENT_LENGTH(acked_packet);
     }
 }
 
@@ -2956,9 +3167,11 @@ int picoquic_check_frame_needs_repeat(picoquic_cnx_t* cnx, const uint8_t* bytes,
 
     *no_need_to_repeat = 0;
 
-    if (PICOQUIC_IN_RANGE(bytes[0], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-        ret = picoquic_parse_stream_header(bytes, bytes_max,
-            &stream_id, &offset, &data_length, &fin, &consumed);
+    if (PICOQUIC_IN_RANGE(bytes[0], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max) ||
+        bytes[0] == picoquic_frame_type_stream_ref) {
+        int is_ref;
+        ret = picoquic_parse_stream_or_ref_header(bytes, bytes_max,
+            &stream_id, &offset, &data_length, &fin, &consumed, &is_ref);
 
         if (ret == 0) {
             stream = picoquic_find_stream(cnx, stream_id);
@@ -3177,23 +3390,27 @@ int picoquic_process_ack_of_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
 {
     int ret;
     int fin;
+    int is_ref;
     size_t data_length;
     uint64_t stream_id;
     uint64_t offset;
     picoquic_stream_head_t* stream = NULL;
 
     /* skip stream frame */
-    ret = picoquic_parse_stream_header(bytes, bytes_max,
-        &stream_id, &offset, &data_length, &fin, consumed);
+    ret = picoquic_parse_stream_or_ref_header(bytes, bytes_max,
+        &stream_id, &offset, &data_length, &fin, consumed, &is_ref);
 
     if (ret == 0) {
-        *consumed += data_length;
+        if (!is_ref) {
+            *consumed += data_length;
+        }
 
         /* record the ack range for the stream */
         stream = picoquic_find_stream(cnx, stream_id);
         if (stream != NULL) {
             (void)picoquic_update_sack_list(&stream->sack_list,
                 offset, offset + data_length - ((fin) ? 0 : 1), 0);
+            picoquic_stream_release_acked_data(stream);
 
             picoquic_delete_stream_if_closed(cnx, stream);
         }
@@ -3262,7 +3479,7 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
             byte_index += frame_length;
             break;
         case picoquic_frame_type_new_token:
-            ret = picoquic_skip_frame(&p->bytes[byte_index],
+            ret = picoquic_skip_sent_frame(&p->bytes[byte_index],
                 p->length - byte_index, &frame_length, &frame_is_pure_ack);
             byte_index += frame_length;
             cnx->is_new_token_acked = 1;
@@ -3285,7 +3502,8 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
             byte_index += frame_length;
             break;
         default:
-            if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+            if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max) ||
+                ftype == picoquic_frame_type_stream_ref) {
                 ret = picoquic_process_ack_of_stream_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
                 byte_index += frame_length;
                 if (p->send_path != NULL) {
@@ -3314,7 +3532,7 @@ void picoquic_process_ack_of_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p,
                     }
                 }
 
-                ret = picoquic_skip_frame(&p->bytes[byte_index],
+                ret = picoquic_skip_sent_frame(&p->bytes[byte_index],
                     p->length - byte_index, &frame_length, &frame_is_pure_ack);
                 byte_index += frame_length;
             }
@@ -3346,7 +3564,7 @@ static int picoquic_process_ack_range(
                 }
 
                 if (old_path != NULL) {
-                    old_path->delivered += p->length;
+                    old_path->delivered += PICOQUIC_PACKET_SENT_LENGTH(p);
                     /* Reset the flags tracking loss of ack only packets and corresponding ping */
                     old_path->is_ack_lost = 0;
                     old_path->is_ack_expected = 0;
@@ -3373,14 +3591,14 @@ static int picoquic_process_ack_range(
                     if (cnx->congestion_alg != NULL) {
                         cnx->congestion_alg->alg_notify(cnx, old_path,
                             picoquic_congestion_notification_acknowledgement,
-                            0, 0, p->length, 0, current_time);
+                            0, 0, PICOQUIC_PACKET_SENT_LENGTH(p), 0, current_time);
                     }
 
                     /* If packet is larger than the current MTU, update the MTU */
-                    if ((p->length + p->checksum_overhead) == old_path->send_mtu) {
+                    if ((PICOQUIC_PACKET_SENT_LENGTH(p) + p->checksum_overhead) == old_path->send_mtu) {
                         old_path->nb_mtu_losses = 0;
-                    } else if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
-                        old_path->send_mtu = p->length + p->checksum_overhead;
+                    } else if ((PICOQUIC_PACKET_SENT_LENGTH(p) + p->checksum_overhead) > old_path->send_mtu) {
+                        old_path->send_mtu = PICOQUIC_PACKET_SENT_LENGTH(p) + p->checksum_overhead;
                         old_path->mtu_probe_sent = 0;
                     }
                 }
@@ -3961,6 +4179,43 @@ const uint8_t* picoquic_decode_application_close_frame(picoquic_cnx_t* cnx, cons
 #define PICOQUIC_MAX_MAXDATA_1K (PICOQUIC_MAX_MAXDATA >> 10)
 #define PICOQUIC_MAX_MAXDATA_1K_MASK (PICOQUIC_MAX_MAXDATA << 10)
 
+/* Auto tuning of the receive windows, see picoquic_fc_autotune_t */
+uint64_t picoquic_fc_autotune_window(picoquic_cnx_t* cnx, picoquic_fc_autotune_t* fc, uint64_t drained,
+    uint64_t window_min, uint64_t current_time)
+{
+    uint64_t rtt = cnx->path[0]->smoothed_rtt;
+
+    if (rtt < PICOQUIC_FC_AUTOTUNE_RTT_MIN) {
+        rtt = PICOQUIC_FC_AUTOTUNE_RTT_MIN;
+    }
+    if (fc->window < window_min) {
+        fc->window = window_min;
+    }
+
+    if (current_time < fc->epoch_time || drained < fc->epoch_drained) {
+        fc->epoch_time = current_time;
+        fc->epoch_drained = drained;
+    }
+    else if (current_time >= fc->epoch_time + rtt) {
+        /* Bytes drained per RTT during the past epoch */
+        uint64_t sample = (uint64_t)(((double)(drained - fc->epoch_drained) * (double)rtt) /
+            (double)(current_time - fc->epoch_time));
+
+        if (2 * sample > fc->window) {
+            fc->window = 2 * sample;
+            cnx->nb_fc_window_increases++;
+        }
+        fc->epoch_time = current_time;
+        fc->epoch_drained = drained;
+    }
+
+    if (fc->window > cnx->quic->fc_autotune_window_max && cnx->quic->fc_autotune_window_max >= window_min) {
+        fc->window = cnx->quic->fc_autotune_window_max;
+    }
+
+    return picoquic_memory_pressure_window(cnx->quic, fc->window);
+}
+
 uint8_t * picoquic_format_max_data_frame(picoquic_cnx_t* cnx, uint8_t * bytes, uint8_t * bytes_max,
     int * more_data, int * is_pure_ack, uint64_t maxdata_increase)
 {
@@ -4101,20 +4356,51 @@ int picoquic_process_ack_of_max_stream_data_frame(picoquic_cnx_t* cnx, const uin
     return ret;
 }
 
+static uint64_t picoquic_stream_initial_window(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (IS_BIDIR_STREAM_ID(stream->stream_id)) {
+        return (IS_LOCAL_STREAM_ID(stream->stream_id, cnx->client_mode)) ?
+            cnx->local_parameters.initial_max_stream_data_bidi_local :
+            cnx->local_parameters.initial_max_stream_data_bidi_remote;
+    }
+    return cnx->local_parameters.initial_max_stream_data_uni;
+}
+
+/* With auto tuning, the stream limit is updated when less than half the window
+ * remains. Otherwise, when the application consumed more than half the limit. */
+int picoquic_is_max_stream_data_needed(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (cnx->quic->fc_autotune_window_max != 0) {
+        uint64_t window = (stream->fc_autotune.window > 0) ? stream->fc_autotune.window :
+            picoquic_stream_initial_window(cnx, stream);
+        return stream->consumed_offset + window / 2 > stream->maxdata_local;
+    }
+    return 2 * stream->consumed_offset > stream->maxdata_local;
+}
+
 uint8_t * picoquic_format_required_max_stream_data_frames(picoquic_cnx_t* cnx,
-    uint8_t* bytes, uint8_t * bytes_max, int * more_data, int * is_pure_ack)
+    uint8_t* bytes, uint8_t * bytes_max, int * more_data, int * is_pure_ack, uint64_t current_time)
 {
     uint8_t* bytes0;
     picoquic_stream_head_t* stream = picoquic_first_stream(cnx);
 
     while (stream != NULL) {
-        if (!stream->fin_received) {
-            uint64_t new_window = picoquic_cc_increased_window(cnx, stream->maxdata_local);
+        if (!stream->fin_received && !stream->reset_received && picoquic_is_max_stream_data_needed(cnx, stream)) {
+            uint64_t new_max_data;
+
+            if (cnx->quic->fc_autotune_window_max != 0) {
+                new_max_data = stream->consumed_offset + picoquic_fc_autotune_window(cnx, &stream->fc_autotune,
+                    stream->consumed_offset, picoquic_stream_initial_window(cnx, stream), current_time);
+            }
+            else {
+                new_max_data = stream->maxdata_local +
+                    picoquic_memory_pressure_window(cnx->quic, picoquic_cc_increased_window(cnx, stream->maxdata_local));
+            }
 
-            if (!stream->reset_received && 2 * stream->consumed_offset > stream->maxdata_local) {
+            if (new_max_data > stream->maxdata_local) {
                 bytes0 = bytes;
 
-                if ((bytes = picoquic_format_max_stream_data_frame(cnx, stream, bytes, bytes_max, more_data, is_pure_ack, stream->maxdata_local + new_window)) == bytes0) {
+                if ((bytes = picoquic_format_max_stream_data_frame(cnx, stream, bytes, bytes_max, more_data, is_pure_ack, new_max_data)) == bytes0) {
                     /* not enough space for this frame. */
                     break;
                 }
@@ -4478,6 +4764,9 @@ const uint8_t* picoquic_decode_blocked_frame(picoquic_cnx_t* cnx, const uint8_t*
         picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, 
             picoquic_frame_type_data_blocked);
     }
+    else {
+        cnx->nb_data_blocked_received++;
+    }
     return bytes;
 }
 
@@ -4491,6 +4780,9 @@ const uint8_t* picoquic_decode_stream_blocked_frame(picoquic_cnx_t* cnx, const u
         picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, 
             picoquic_frame_type_stream_data_blocked);
     }
+    else {
+        cnx->nb_stream_data_blocked_received++;
+    }
     return bytes;
 }
 
@@ -4674,6 +4966,17 @@ int picoquic_queue_datagram_frame(picoquic_cnx_t * cnx, size_t length, const uin
     if (length > PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH) {
         ret = PICOQUIC_ERROR_DATAGRAM_TOO_LONG;
     }
+    else if (cnx->datagram_ring.slots != NULL) {
+        uint8_t* buffer = picoquic_get_datagram_ring_buffer(cnx, length, UINT64_MAX, (uint8_t)cnx->datagram_priority);
+
+        if (buffer == NULL) {
+            ret = PICOQUIC_ERROR_DATAGRAM_RING_FULL;
+        }
+        else {
+            memcpy(buffer, src, length);
+            ret = 0;
+        }
+    }
     else {
         size_t consumed = 0;
         uint8_t frame_buffer[PICOQUIC_MAX_PACKET_SIZE];
@@ -4706,6 +5009,201 @@ uint8_t * picoquic_format_first_datagram_frame(picoquic_cnx_t* cnx, uint8_t* byt
     return bytes;
 }
 
+/* Management of the datagram send ring */
+static void picoquic_datagram_ring_reset(picoquic_datagram_ring_t* ring)
+{
+    ring->first_queued = PICOQUIC_DATAGRAM_SLOT_NONE;
+    ring->last_queued = PICOQUIC_DATAGRAM_SLOT_NONE;
+    ring->first_free = (ring->nb_slots > 0) ? 0 : PICOQUIC_DATAGRAM_SLOT_NONE;
+    ring->nb_queued = 0;
+    for (size_t i = 0; i < ring->nb_slots; i++) {
+        ring->slots[i].is_queued = 0;
+        ring->slots[i].next_index = (i + 1 < ring->nb_slots) ? i + 1 : PICOQUIC_DATAGRAM_SLOT_NONE;
+    }
+}
+
+/* Remove a slot from the queue and put it back in the free list */
+static void picoquic_datagram_ring_dequeue(picoquic_datagram_ring_t* ring, size_t index)
+{
+    picoquic_datagram_slot_t* slot = &ring->slots[index];
+
+    if (slot->previous_index == PICOQUIC_DATAGRAM_SLOT_NONE) {
+        ring->first_queued = slot->next_index;
+    }
+    else {
+        ring->slots[slot->previous_index].next_index = slot->next_index;
+    }
+    if (slot->next_index == PICOQUIC_DATAGRAM_SLOT_NONE) {
+        ring->last_queued = slot->previous_index;
+    }
+    else {
+        ring->slots[slot->next_index].previous_index = slot->previous_index;
+    }
+    slot->is_queued = 0;
+    slot->next_index = ring->first_free;
+    ring->first_free = index;
+    ring->nb_queued--;
+}
+
+void picoquic_datagram_ring_release(picoquic_cnx_t* cnx)
+{
+    picoquic_datagram_ring_t* ring = &cnx->datagram_ring;
+
+    if (ring->slots != NULL) {
+        picoquic_memory_release(cnx, picoquic_memory_send_queue, ring->nb_slots * sizeof(picoquic_datagram_slot_t));
+        free(ring->slots);
+        ring->slots = NULL;
+    }
+    ring->nb_slots = 0;
+    picoquic_datagram_ring_reset(ring);
+}
+
+int picoquic_set_datagram_ring(picoquic_cnx_t* cnx, size_t nb_slots)
+{
+    int ret = 0;
+    picoquic_datagram_ring_t* ring = &cnx->datagram_ring;
+
+    if (ring->nb_queued > 0) {
+        ret = -1;
+    }
+    else {
+        picoquic_datagram_ring_release(cnx);
+        if (nb_slots > 0) {
+            ring->slots = (picoquic_datagram_slot_t*)malloc(nb_slots * sizeof(picoquic_datagram_slot_t));
+            if (ring->slots == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else {
+                memset(ring->slots, 0, nb_slots * sizeof(picoquic_datagram_slot_t));
+                ring->nb_slots = nb_slots;
+                picoquic_datagram_ring_reset(ring);
+                picoquic_memory_account(cnx, picoquic_memory_send_queue, nb_slots * sizeof(picoquic_datagram_slot_t));
+            }
+        }
+    }
+
+    return ret;
+}
+
+uint8_t* picoquic_get_datagram_ring_buffer(picoquic_cnx_t* cnx, size_t length, uint64_t deadline, uint8_t priority)
+{
+    picoquic_datagram_ring_t* ring = &cnx->datagram_ring;
+    uint8_t* buffer = NULL;
+
+    if (length > PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH || ring->slots == NULL || ring->first_free == PICOQUIC_DATAGRAM_SLOT_NONE) {
+        ring->nb_refused++;
+    }
+    else {
+        size_t index = ring->first_free;
+        picoquic_datagram_slot_t* slot = &ring->slots[index];
+
+        ring->first_free = slot->next_index;
+        slot->deadline = deadline;
+        slot->length = (uint16_t)length;
+        slot->priority = priority;
+        slot->is_queued = 1;
+        slot->next_index = PICOQUIC_DATAGRAM_SLOT_NONE;
+        slot->previous_index = ring->last_queued;
+        if (ring->last_queued == PICOQUIC_DATAGRAM_SLOT_NONE) {
+            ring->first_queued = index;
+        }
+        else {
+            ring->slots[ring->last_queued].next_index = index;
+        }
+        ring->last_queued = index;
+        ring->nb_queued++;
+        buffer = slot->bytes;
+        if (ring->nb_queued == 1) {
+            picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
+        }
+    }
+
+    return buffer;
+}
+
+void picoquic_get_datagram_ring_stats(picoquic_cnx_t* cnx, picoquic_datagram_ring_stats_t* stats)
+{
+    stats->nb_slots = cnx->datagram_ring.nb_slots;
+    stats->nb_queued = cnx->datagram_ring.nb_queued;
+    stats->nb_sent = cnx->datagram_ring.nb_sent;
+    stats->nb_expired = cnx->datagram_ring.nb_expired;
+    stats->nb_refused = cnx->datagram_ring.nb_refused;
+}
+
+/* Drop the datagrams queued past their deadline, and return the
+ * priority of the next datagram to send, or UINT64_MAX if none. */
+uint64_t picoquic_datagram_ring_expire(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    picoquic_datagram_ring_t* ring = &cnx->datagram_ring;
+    uint64_t priority = UINT64_MAX;
+    size_t index = ring->first_queued;
+
+    while (index != PICOQUIC_DATAGRAM_SLOT_NONE) {
+        picoquic_datagram_slot_t* slot = &ring->slots[index];
+        size_t next_index = slot->next_index;
+
+        if (slot->deadline < current_time) {
+            /* The slot stays queued during the callback, so that a replacement
+             * queued by the application does not reuse it, and so that the ring
+             * cannot be resized. The replacement may be linked after the slot. */
+            ring->nb_expired++;
+            if (cnx->callback_fn != NULL) {
+                (void)cnx->callback_fn(cnx, 0, slot->bytes, slot->length, picoquic_callback_datagram_expired,
+                    cnx->callback_ctx, NULL);
+            }
+            next_index = slot->next_index;
+            picoquic_datagram_ring_dequeue(ring, index);
+        }
+        else if (slot->priority < priority) {
+            priority = slot->priority;
+        }
+        index = next_index;
+    }
+
+    return priority;
+}
+
+/* Format the queued datagrams by priority order, until the packet is full.
+ * If the next datagram does not fit, try the smaller ones. */
+uint8_t* picoquic_format_ring_datagram_frames(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max,
+    int* more_data, int* is_pure_ack)
+{
+    picoquic_datagram_ring_t* ring = &cnx->datagram_ring;
+    size_t max_length = PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH;
+
+    while (ring->nb_queued > 0) {
+        uint8_t* bytes0 = bytes;
+        size_t next = PICOQUIC_DATAGRAM_SLOT_NONE;
+        size_t index = ring->first_queued;
+
+        while (index != PICOQUIC_DATAGRAM_SLOT_NONE) {
+            picoquic_datagram_slot_t* slot = &ring->slots[index];
+            if (slot->length <= max_length && slot->length < (size_t)(bytes_max - bytes) &&
+                (next == PICOQUIC_DATAGRAM_SLOT_NONE || slot->priority < ring->slots[next].priority)) {
+                next = index;
+            }
+            index = slot->next_index;
+        }
+
+        if (next == PICOQUIC_DATAGRAM_SLOT_NONE) {
+            *more_data = 1;
+            break;
+        }
+
+        bytes = picoquic_format_datagram_frame(bytes, bytes_max, more_data, is_pure_ack,
+            ring->slots[next].length, ring->slots[next].bytes);
+        if (bytes == bytes0) {
+            max_length = (size_t)ring->slots[next].length - 1;
+        }
+        else {
+            picoquic_datagram_ring_dequeue(ring, next);
+            ring->nb_sent++;
+        }
+    }
+
+    return bytes;
+}
+
 /* Provide a datagram buffer for the length specified by the application.
  * The stack called with a pointer to the available space, which may extend
  * to the end of the packet. There are several interesting cases:
@@ -5370,7 +5868,7 @@ uint8_t* picoquic_format_bdp_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t*
     }
     else {
         /* Client sends bdp back to the server */
-        picoquic_stored_ticket_t* stored_ticket = picoquic_get_stored_ticket(cnx->quic->p_first_ticket,
+        picoquic_stored_ticket_t* stored_ticket = picoquic_get_session_ticket(cnx->quic,
             current_time, cnx->sni, (uint16_t)strlen(cnx->sni), cnx->alpn, (uint16_t)strlen(cnx->alpn),
             picoquic_supported_versions[cnx->version_index].version, 1, 0);
         if (stored_ticket != NULL) {
@@ -5955,6 +6453,30 @@ int picoquic_skip_frame(const uint8_t* bytes, size_t bytes_maxsize, size_t* cons
     return bytes == NULL;
 }
 
+/* Skip a frame in a packet that we sent. These packets may contain the
+ * internal stream reference frames, which are never accepted on the wire.
+ */
+int picoquic_skip_sent_frame(const uint8_t* bytes, size_t bytes_maxsize, size_t* consumed, int* pure_ack)
+{
+    int ret = 0;
+
+    if (bytes[0] == picoquic_frame_type_stream_ref) {
+        *pure_ack = 0;
+        if (bytes_maxsize < PICOQUIC_STREAM_REF_FRAME_SIZE) {
+            *consumed = bytes_maxsize;
+            ret = 1;
+        }
+        else {
+            *consumed = PICOQUIC_STREAM_REF_FRAME_SIZE;
+        }
+    }
+    else {
+        ret = picoquic_skip_frame(bytes, bytes_maxsize, consumed, pure_ack);
+    }
+
+    return ret;
+}
+
 int picoquic_decode_closing_frames(picoquic_cnx_t * cnx, uint8_t* bytes, size_t bytes_max, int* closing_received)
 {
     int ret = 0;
@@ -0,0 +1,445 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Asynchronous binary log ring.
+ * The ring is a power of 2 array of bytes, in which the protocol thread
+ * appends records made of a header and of the encoded event. The head
+ * and tail are 64 bit positions that only increase, the offset in the
+ * ring being the position modulo the ring size. The head is only written
+ * by the protocol thread, the tail only by the writer thread, so that no
+ * lock is needed. If a record does not fit before the end of the ring,
+ * a "wrap" record fills the remaining space and the record is written at
+ * the beginning of the ring.
+ *
+ * The writer thread copies consecutive events for the same file into a
+ * staging buffer, and writes the staging buffer with a single fwrite when
+ * the file changes, when the buffer is full or when the ring is empty.
+ * The writer is woken up when the ring fills past a quarter of its size,
+ * and otherwise polls the ring every PICOQUIC_BINLOG_RING_POLL_DELAY.
+ *
+ * A close record may carry a qlog conversion request, made of the
+ * conversion function, of the request parameters and of the file names.
+ * The writer copies the request, releases the record, and runs the
+ * conversion after closing the file, so the protocol thread neither
+ * waits for the conversion nor for the ring to drain.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+
+#define PICOQUIC_BINLOG_RING_POLL_DELAY 10000
+#define PICOQUIC_BINLOG_RING_DRAIN_DELAY 1000
+#define PICOQUIC_BINLOG_RECORD_ALIGN 16
+#define PICOQUIC_BINLOG_RECORD_ROUND(x) (((x) + PICOQUIC_BINLOG_RECORD_ALIGN - 1) & ~((size_t)PICOQUIC_BINLOG_RECORD_ALIGN - 1))
+#define PICOQUIC_BINLOG_RECORD_DATA 0
+#define PICOQUIC_BINLOG_RECORD_WRAP 1
+#define PICOQUIC_BINLOG_RECORD_CLOSE 2
+
+#ifdef _WINDOWS
+#define picoquic_binlog_ring_load(x) ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)(x), 0, 0))
+#define picoquic_binlog_ring_store(x, v) (void)InterlockedExchange64((volatile LONG64*)(x), (LONG64)(v))
+#else
+#define picoquic_binlog_ring_load(x) __atomic_load_n((x), __ATOMIC_ACQUIRE)
+#define picoquic_binlog_ring_store(x, v) __atomic_store_n((x), (v), __ATOMIC_RELEASE)
+#endif
+
+typedef struct st_picoquic_binlog_record_t {
+    FILE* f;
+    uint32_t length;
+    uint32_t record_type;
+} picoquic_binlog_record_t;
+
+typedef struct st_picoquic_binlog_conversion_t {
+    picoquic_autoqlog_fn autoqlog_fn;
+    picoquic_autoqlog_request_t request;
+} picoquic_binlog_conversion_t;
+
+struct st_picoquic_binlog_ring_t {
+    uint8_t* buffer;
+    size_t size;
+    uint64_t head;
+    uint64_t tail;
+    picoquic_binlog_drop_policy_enum drop_policy;
+    uint64_t should_stop;
+    picoquic_thread_t thread;
+    picoquic_event_t wake_event;
+    picoquic_event_t drain_event;
+    /* Writer thread state */
+    FILE* staging_f;
+    size_t staging_length;
+    uint8_t staging[PICOQUIC_BINLOG_RING_STAGING_SIZE];
+    /* Counters updated by the protocol thread */
+    size_t bytes_queued_max;
+    uint64_t nb_events_queued;
+    uint64_t nb_bytes_queued;
+    uint64_t nb_events_dropped;
+    uint64_t nb_bytes_dropped;
+    uint64_t nb_producer_waits;
+    uint64_t nb_conversions_queued;
+    /* Counters updated by the writer thread, read with picoquic_binlog_ring_load */
+    uint64_t nb_writes;
+    uint64_t nb_bytes_written;
+    uint64_t nb_files_closed;
+    uint64_t nb_conversions_done;
+};
+
+static void picoquic_binlog_ring_write_staging(picoquic_binlog_ring_t* ring)
+{
+    if (ring->staging_length > 0) {
+        (void)fwrite(ring->staging, 1, ring->staging_length, ring->staging_f);
+        picoquic_binlog_ring_store(&ring->nb_writes, ring->nb_writes + 1);
+        picoquic_binlog_ring_store(&ring->nb_bytes_written, ring->nb_bytes_written + ring->staging_length);
+        ring->staging_length = 0;
+    }
+    ring->staging_f = NULL;
+}
+
+/* Run the conversion queued in a close record. The strings follow the
+ * conversion parameters in the record data. */
+static void picoquic_binlog_ring_run_conversion(uint8_t* data)
+{
+    picoquic_binlog_conversion_t conversion;
+    char const* binlog_file_name = (char const*)(data + sizeof(picoquic_binlog_conversion_t));
+
+    memcpy(&conversion, data, sizeof(picoquic_binlog_conversion_t));
+    conversion.request.binlog_file_name = binlog_file_name;
+    conversion.request.qlog_dir = binlog_file_name + strlen(binlog_file_name) + 1;
+    (void)conversion.autoqlog_fn(&conversion.request);
+}
+
+/* Copy the conversion request out of the ring, release the close record
+ * so that the protocol thread can reuse its space, then convert. */
+static void picoquic_binlog_ring_convert(picoquic_binlog_ring_t* ring, uint8_t* data, size_t length, uint64_t next_tail)
+{
+    uint8_t* copy = (uint8_t*)malloc(length);
+
+    if (copy == NULL) {
+        picoquic_binlog_ring_run_conversion(data);
+        picoquic_binlog_ring_store(&ring->tail, next_tail);
+    }
+    else {
+        memcpy(copy, data, length);
+        picoquic_binlog_ring_store(&ring->tail, next_tail);
+        (void)picoquic_signal_event(&ring->drain_event);
+        picoquic_binlog_ring_run_conversion(copy);
+        free(copy);
+    }
+    picoquic_binlog_ring_store(&ring->nb_conversions_done, ring->nb_conversions_done + 1);
+    (void)picoquic_signal_event(&ring->drain_event);
+}
+
+/* Process the records between tail and head, and return the new tail. */
+static uint64_t picoquic_binlog_ring_drain(picoquic_binlog_ring_t* ring, uint64_t tail, uint64_t head)
+{
+    while (tail < head) {
+        size_t offset = (size_t)(tail & (ring->size - 1));
+        picoquic_binlog_record_t* record = (picoquic_binlog_record_t*)(ring->buffer + offset);
+        uint8_t* data = ring->buffer + offset + PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t));
+
+        if (record->record_type == PICOQUIC_BINLOG_RECORD_WRAP) {
+            tail += ring->size - offset;
+            continue;
+        }
+
+        if (record->f != ring->staging_f || record->record_type == PICOQUIC_BINLOG_RECORD_CLOSE ||
+            ring->staging_length + record->length > PICOQUIC_BINLOG_RING_STAGING_SIZE) {
+            picoquic_binlog_ring_write_staging(ring);
+            /* Release the space of the records already written */
+            picoquic_binlog_ring_store(&ring->tail, tail);
+        }
+
+        if (record->record_type == PICOQUIC_BINLOG_RECORD_CLOSE) {
+            (void)picoquic_file_close(record->f);
+            picoquic_binlog_ring_store(&ring->nb_files_closed, ring->nb_files_closed + 1);
+            if (record->length > 0) {
+                picoquic_binlog_ring_convert(ring, data, record->length,
+                    tail + PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t) + record->length));
+            }
+        }
+        else if (record->length > PICOQUIC_BINLOG_RING_STAGING_SIZE) {
+            (void)fwrite(data, 1, record->length, record->f);
+            picoquic_binlog_ring_store(&ring->nb_writes, ring->nb_writes + 1);
+            picoquic_binlog_ring_store(&ring->nb_bytes_written, ring->nb_bytes_written + record->length);
+        }
+        else {
+            memcpy(ring->staging + ring->staging_length, data, record->length);
+            ring->staging_length += record->length;
+            ring->staging_f = record->f;
+        }
+        tail += PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t) + record->length);
+    }
+    picoquic_binlog_ring_write_staging(ring);
+
+    return tail;
+}
+
+static picoquic_thread_return_t picoquic_binlog_ring_thread(void* v_ring)
+{
+    picoquic_binlog_ring_t* ring = (picoquic_binlog_ring_t*)v_ring;
+    uint64_t tail = ring->tail;
+
+    while (1) {
+        uint64_t head = picoquic_binlog_ring_load(&ring->head);
+
+        if (tail < head) {
+            tail = picoquic_binlog_ring_drain(ring, tail, head);
+            picoquic_binlog_ring_store(&ring->tail, tail);
+            (void)picoquic_signal_event(&ring->drain_event);
+        }
+        else if (picoquic_binlog_ring_load(&ring->should_stop)) {
+            /* The stop flag is set after the last event, check the head again */
+            if (picoquic_binlog_ring_load(&ring->head) == tail) {
+                break;
+            }
+        }
+        else {
+            (void)picoquic_wait_for_event(&ring->wake_event, PICOQUIC_BINLOG_RING_POLL_DELAY);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+picoquic_binlog_ring_t* picoquic_binlog_ring_create(size_t ring_size, picoquic_binlog_drop_policy_enum drop_policy)
+{
+    picoquic_binlog_ring_t* ring = (picoquic_binlog_ring_t*)malloc(sizeof(picoquic_binlog_ring_t));
+    size_t size = PICOQUIC_BINLOG_RING_SIZE_MIN;
+
+    while (size < ring_size && size < (SIZE_MAX >> 1)) {
+        size <<= 1;
+    }
+
+    if (ring != NULL) {
+        memset(ring, 0, sizeof(picoquic_binlog_ring_t));
+        ring->size = size;
+        ring->drop_policy = drop_policy;
+        ring->buffer = (uint8_t*)malloc(size);
+        if (ring->buffer == NULL) {
+            free(ring);
+            ring = NULL;
+        }
+        else if (picoquic_create_event(&ring->wake_event) != 0) {
+            free(ring->buffer);
+            free(ring);
+            ring = NULL;
+        }
+        else if (picoquic_create_event(&ring->drain_event) != 0) {
+            picoquic_delete_event(&ring->wake_event);
+            free(ring->buffer);
+            free(ring);
+            ring = NULL;
+        }
+        else if (picoquic_create_thread(&ring->thread, picoquic_binlog_ring_thread, ring) != 0) {
+            DBG_PRINTF("%s", "Cannot create the binary log writer thread");
+            picoquic_delete_event(&ring->drain_event);
+            picoquic_delete_event(&ring->wake_event);
+            free(ring->buffer);
+            free(ring);
+            ring = NULL;
+        }
+    }
+
+    return ring;
+}
+
+/* Wait until the writer thread has processed all the records queued so far,
+ * including the qlog conversions */
+void picoquic_binlog_ring_flush(picoquic_binlog_ring_t* ring)
+{
+    uint64_t head = ring->head;
+    uint64_t nb_conversions = ring->nb_conversions_queued;
+
+    while (picoquic_binlog_ring_load(&ring->tail) < head ||
+        picoquic_binlog_ring_load(&ring->nb_conversions_done) < nb_conversions) {
+        (void)picoquic_signal_event(&ring->wake_event);
+        (void)picoquic_wait_for_event(&ring->drain_event, PICOQUIC_BINLOG_RING_DRAIN_DELAY);
+    }
+}
+
+/* Reserve space for a record of the specified length, and return a pointer
+ * to the record, or NULL if the ring is full. The head is not updated until
+ * the record is committed. */
+static picoquic_binlog_record_t* picoquic_binlog_ring_reserve(picoquic_binlog_ring_t* ring, size_t record_size,
+    uint64_t* next_head)
+{
+    picoquic_binlog_record_t* record = NULL;
+    uint64_t head = ring->head;
+    size_t offset = (size_t)(head & (ring->size - 1));
+    size_t contiguous = ring->size - offset;
+    size_t needed = (contiguous < record_size) ? contiguous + record_size : record_size;
+    uint64_t queued = head - picoquic_binlog_ring_load(&ring->tail);
+
+    if (ring->size - queued >= needed) {
+        if (contiguous < record_size) {
+            picoquic_binlog_record_t* wrap = (picoquic_binlog_record_t*)(ring->buffer + offset);
+            wrap->f = NULL;
+            wrap->length = 0;
+            wrap->record_type = PICOQUIC_BINLOG_RECORD_WRAP;
+            offset = 0;
+        }
+        record = (picoquic_binlog_record_t*)(ring->buffer + offset);
+        *next_head = head + needed;
+        if (queued + needed > ring->bytes_queued_max) {
+            ring->bytes_queued_max = (size_t)(queued + needed);
+        }
+    }
+
+    return record;
+}
+
+static void picoquic_binlog_ring_commit(picoquic_binlog_ring_t* ring, uint64_t next_head)
+{
+    uint64_t quarter = ring->size / 4;
+    uint64_t queued_before = ring->head - picoquic_binlog_ring_load(&ring->tail);
+    uint64_t queued_after = queued_before + (next_head - ring->head);
+
+    picoquic_binlog_ring_store(&ring->head, next_head);
+
+    if (queued_before < quarter && queued_after >= quarter) {
+        (void)picoquic_signal_event(&ring->wake_event);
+    }
+}
+
+int picoquic_binlog_ring_write(picoquic_binlog_ring_t* ring, FILE* f, const uint8_t* head, size_t head_length,
+    const uint8_t* msg, size_t msg_length)
+{
+    int ret = 0;
+    size_t length = head_length + msg_length;
+    size_t record_size = PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t) + length);
+    picoquic_binlog_record_t* record = NULL;
+    uint64_t next_head = 0;
+
+    if (record_size <= ring->size / 2) {
+        while ((record = picoquic_binlog_ring_reserve(ring, record_size, &next_head)) == NULL &&
+            ring->drop_policy == picoquic_binlog_wait_for_space) {
+            ring->nb_producer_waits++;
+            (void)picoquic_signal_event(&ring->wake_event);
+            (void)picoquic_wait_for_event(&ring->drain_event, PICOQUIC_BINLOG_RING_DRAIN_DELAY);
+        }
+    }
+
+    if (record == NULL) {
+        ring->nb_events_dropped++;
+        ring->nb_bytes_dropped += length;
+        ret = -1;
+    }
+    else {
+        uint8_t* data = ((uint8_t*)record) + PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t));
+
+        record->f = f;
+        record->length = (uint32_t)length;
+        record->record_type = PICOQUIC_BINLOG_RECORD_DATA;
+        if (head_length > 0) {
+            memcpy(data, head, head_length);
+        }
+        memcpy(data + head_length, msg, msg_length);
+        ring->nb_events_queued++;
+        ring->nb_bytes_queued += length;
+        picoquic_binlog_ring_commit(ring, next_head);
+    }
+
+    return ret;
+}
+
+/* Queue a request to close the file after its last event is written, and
+ * if autoqlog_fn is set, to convert the file to qlog after closing it.
+ * If the ring is full, wait until it is drained. A request too large for
+ * the ring is converted by the calling thread after the file is closed. */
+void picoquic_binlog_ring_close_file(picoquic_binlog_ring_t* ring, FILE* f,
+    picoquic_autoqlog_fn autoqlog_fn, picoquic_autoqlog_request_t const* request)
+{
+    size_t length = 0;
+    size_t name_length = 0;
+    size_t dir_length = 0;
+    size_t record_size = 0;
+    picoquic_binlog_record_t* record = NULL;
+    uint64_t next_head = 0;
+
+    if (autoqlog_fn != NULL) {
+        name_length = strlen(request->binlog_file_name) + 1;
+        dir_length = strlen(request->qlog_dir) + 1;
+        length = sizeof(picoquic_binlog_conversion_t) + name_length + dir_length;
+        if (PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t) + length) > ring->size / 2) {
+            length = 0;
+        }
+    }
+    record_size = PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t) + length);
+
+    while ((record = picoquic_binlog_ring_reserve(ring, record_size, &next_head)) == NULL) {
+        picoquic_binlog_ring_flush(ring);
+    }
+    record->f = f;
+    record->length = (uint32_t)length;
+    record->record_type = PICOQUIC_BINLOG_RECORD_CLOSE;
+    if (length > 0) {
+        uint8_t* data = ((uint8_t*)record) + PICOQUIC_BINLOG_RECORD_ROUND(sizeof(picoquic_binlog_record_t));
+        picoquic_binlog_conversion_t conversion;
+
+        memset(&conversion, 0, sizeof(picoquic_binlog_conversion_t));
+        conversion.autoqlog_fn = autoqlog_fn;
+        conversion.request = *request;
+        memcpy(data, &conversion, sizeof(picoquic_binlog_conversion_t));
+        memcpy(data + sizeof(picoquic_binlog_conversion_t), request->binlog_file_name, name_length);
+        memcpy(data + sizeof(picoquic_binlog_conversion_t) + name_length, request->qlog_dir, dir_length);
+        ring->nb_conversions_queued++;
+    }
+    picoquic_binlog_ring_commit(ring, next_head);
+
+    if (autoqlog_fn != NULL && length == 0) {
+        picoquic_binlog_ring_flush(ring);
+        (void)autoqlog_fn(request);
+    }
+}
+
+void picoquic_binlog_ring_get_stats(picoquic_binlog_ring_t* ring, picoquic_binlog_async_stats_t* stats)
+{
+    memset(stats, 0, sizeof(picoquic_binlog_async_stats_t));
+    stats->ring_size = ring->size;
+    stats->bytes_queued_max = ring->bytes_queued_max;
+    stats->nb_events_queued = ring->nb_events_queued;
+    stats->nb_bytes_queued = ring->nb_bytes_queued;
+    stats->nb_events_dropped = ring->nb_events_dropped;
+    stats->nb_bytes_dropped = ring->nb_bytes_dropped;
+    stats->nb_producer_waits = ring->nb_producer_waits;
+    stats->nb_writes = picoquic_binlog_ring_load(&ring->nb_writes);
+    stats->nb_bytes_written = picoquic_binlog_ring_load(&ring->nb_bytes_written);
+    stats->nb_files_closed = picoquic_binlog_ring_load(&ring->nb_files_closed);
+}
+
+/* Stop the writer thread after it has written all the queued events, then
+ * free the ring. */
+void picoquic_binlog_ring_delete(picoquic_binlog_ring_t* ring)
+{
+    picoquic_binlog_ring_store(&ring->should_stop, 1);
+    (void)picoquic_signal_event(&ring->wake_event);
+    (void)picoquic_wait_thread(ring->thread);
+#ifdef _WINDOWS
+    CloseHandle(ring->thread);
+#endif
+    picoquic_delete_event(&ring->drain_event);
+    picoquic_delete_event(&ring->wake_event);
+    free(ring->buffer);
+    free(ring);
+}
@@ -31,6 +31,12 @@
 #include "picoquic_unified_log.h"
 #include "picoquic_binlog.h"
 
+/* Packet events are composed in memory before being written, so that the
+ * length of the event is known. The frames are logged with at most a few
+ * bytes of content, the worst case being a sequence of one byte frames.
+ */
+#define BINLOG_PACKET_EVENT_MAX (3 * PICOQUIC_MAX_PACKET_SIZE)
+
 static const uint8_t* picoquic_log_fixed_skip(const uint8_t* bytes, const uint8_t* bytes_max, size_t size)
 {
     return bytes == NULL ? NULL : ((bytes += size) <= bytes_max ? bytes : NULL);
@@ -58,18 +64,20 @@ static const uint8_t* picoquic_log_length(const uint8_t* bytes, const uint8_t* b
     return (len == 0 || *nsz != n64) ? NULL : bytes + len;
 }
 
-static void picoquic_binlog_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static void picoquic_binlog_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     if (bytes != NULL && bytes_max != NULL) {
         size_t len = bytes_max - bytes;
         uint8_t varlen[8];
         size_t l_varlen = picoquic_varint_encode(varlen, 8, len);
-        fwrite(varlen, 1, l_varlen, f);
-        fwrite(bytes, 1, len, f);
+        if (l_varlen + len <= bytestream_remain(s)) {
+            (void)bytewrite_buffer(s, varlen, l_varlen);
+            (void)bytewrite_buffer(s, bytes, len);
+        }
     }
 }
 
-static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stream_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -101,7 +109,7 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
             extra_bytes = length;
         }
         if (has_length) {
-            picoquic_binlog_frame(f, bytes_begin, bytes + extra_bytes);
+            picoquic_binlog_frame(s, bytes_begin, bytes + extra_bytes);
         }
         else {
             uint8_t* log_next = log_buffer;
@@ -112,10 +120,10 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
             if ((log_next = picoquic_frames_varint_encode(log_next, log_buffer + 256, length)) != NULL) {
                 memcpy(log_next, bytes, extra_bytes);
                 log_next += extra_bytes;
-                picoquic_binlog_frame(f, log_buffer, log_next);
+                picoquic_binlog_frame(s, log_buffer, log_next);
             }
             else {
-                picoquic_binlog_frame(f, log_buffer, log_buffer + l_head);
+                picoquic_binlog_frame(s, log_buffer, log_buffer + l_head);
             }
         }
 
@@ -127,12 +135,12 @@ static const uint8_t* picoquic_log_stream_frame(FILE* f, const uint8_t* bytes, c
         if (length > 26) {
             length = 26;
         }
-        picoquic_binlog_frame(f, bytes_begin, bytes_begin + length);
+        picoquic_binlog_frame(s, bytes_begin, bytes_begin + length);
     }
     return bytes;
 }
 
-static const uint8_t* picoquic_log_ack_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_ack_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint64_t ftype = 0;
@@ -163,11 +171,11 @@ static const uint8_t* picoquic_log_ack_frame(FILE* f, const uint8_t* bytes, cons
         bytes = picoquic_log_varint_skip(bytes, bytes_max);
     }
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_reset_stream_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_reset_stream_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t * bytes_begin = bytes;
 
@@ -176,11 +184,11 @@ static const uint8_t* picoquic_log_reset_stream_frame(FILE* f, const uint8_t* by
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_stop_sending_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stop_sending_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -188,11 +196,11 @@ static const uint8_t* picoquic_log_stop_sending_frame(FILE* f, const uint8_t* by
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_close_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_close_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -203,11 +211,11 @@ static const uint8_t* picoquic_log_close_frame(FILE* f, const uint8_t* bytes, co
     bytes = picoquic_log_length(bytes, bytes_max, &length);
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_app_close_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_app_close_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -217,22 +225,22 @@ static const uint8_t* picoquic_log_app_close_frame(FILE* f, const uint8_t* bytes
     bytes = picoquic_log_length(bytes, bytes_max, &length);
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_data_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_data_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_stream_data_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_stream_data_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -240,33 +248,33 @@ static const uint8_t* picoquic_log_max_stream_data_frame(FILE* f, const uint8_t*
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_max_stream_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_max_stream_id_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_blocked_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_stream_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_stream_blocked_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -274,22 +282,22 @@ static const uint8_t* picoquic_log_stream_blocked_frame(FILE* f, const uint8_t*
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_streams_blocked_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_streams_blocked_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_new_connection_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_new_connection_id_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -302,22 +310,22 @@ static const uint8_t* picoquic_log_new_connection_id_frame(FILE* f, const uint8_
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, PICOQUIC_RESET_SECRET_SIZE);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_retire_connection_id_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_retire_connection_id_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_new_token_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_new_token_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -327,21 +335,21 @@ static const uint8_t* picoquic_log_new_token_frame(FILE* f, const uint8_t* bytes
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_path_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_path_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1 + 8);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_crypto_hs_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_crypto_hs_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t length = 0;
@@ -350,24 +358,24 @@ static const uint8_t* picoquic_log_crypto_hs_frame(FILE* f, const uint8_t* bytes
     bytes = picoquic_log_varint_skip(bytes, bytes_max);
     bytes = picoquic_log_length(bytes, bytes_max, &length);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
     return bytes;
 }
 
 
-static const uint8_t* picoquic_log_handshake_done_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_handshake_done_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, 1);
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_datagram_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_datagram_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     uint8_t ftype = bytes[0];
@@ -381,46 +389,46 @@ static const uint8_t* picoquic_log_datagram_frame(FILE* f, const uint8_t* bytes,
         length = bytes_max - bytes;
     }
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, length);
     return bytes;
 }
 
-static const uint8_t* picoquic_log_time_stamp_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_time_stamp_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* time stamp as varint */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_path_abandon_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_path_abandon_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
     bytes = picoquic_skip_path_abandon_frame(bytes, bytes_max); /* skip abandon frame */
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_path_available_or_standby_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_path_available_or_standby_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
     bytes = picoquic_skip_path_available_or_standby_frame(bytes, bytes_max); /* skip available or standby frame */
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
 
-static const uint8_t* picoquic_log_ack_frequency_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_ack_frequency_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
@@ -430,34 +438,34 @@ static const uint8_t* picoquic_log_ack_frequency_frame(FILE* f, const uint8_t* b
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* Max ACK delay */
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* Reordering threshold */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_immediate_ack_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_immediate_ack_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
 
     bytes = picoquic_log_varint_skip(bytes, bytes_max); /* frame type as varint */
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-static const uint8_t* picoquic_log_erroring_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_erroring_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     size_t frame_size = bytes_max - bytes;
     size_t copied = (frame_size > 8) ? 8 : frame_size;
 
-    picoquic_binlog_frame(f, bytes, bytes + copied);
+    picoquic_binlog_frame(s, bytes, bytes + copied);
 
     return NULL;
 }
 
-static const uint8_t* picoquic_log_padding(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_padding(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
-    picoquic_binlog_frame(f, bytes, bytes + 1);
+    picoquic_binlog_frame(s, bytes, bytes + 1);
 
     uint8_t ftype = bytes[0];
     while (bytes < bytes_max && bytes[0] == ftype) {
@@ -467,7 +475,7 @@ static const uint8_t* picoquic_log_padding(FILE* f, const uint8_t* bytes, const
     return bytes;
 }
 
-static const uint8_t* picoquic_log_bdp_frame(FILE* f, const uint8_t* bytes, const uint8_t* bytes_max)
+static const uint8_t* picoquic_log_bdp_frame(bytestream* s, const uint8_t* bytes, const uint8_t* bytes_max)
 {
     const uint8_t* bytes_begin = bytes;
     size_t ip_len = 0;
@@ -479,12 +487,12 @@ static const uint8_t* picoquic_log_bdp_frame(FILE* f, const uint8_t* bytes, cons
     bytes = picoquic_log_length(bytes, bytes_max, &ip_len); /*  IP Address length */
     bytes = picoquic_log_fixed_skip(bytes, bytes_max, ip_len); /* IP address value */
 
-    picoquic_binlog_frame(f, bytes_begin, bytes);
+    picoquic_binlog_frame(s, bytes_begin, bytes);
 
     return bytes;
 }
 
-void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
+static void picoquic_binlog_frames_compose(bytestream* s, const uint8_t* bytes, size_t length)
 {
     const uint8_t* bytes_max = bytes + length;
 
@@ -504,7 +512,7 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
         }
 
         if (PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-            bytes = picoquic_log_stream_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stream_frame(s, bytes, bytes_max);
             continue;
         }
 
@@ -513,93 +521,103 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
         case picoquic_frame_type_ack_ecn:
         case picoquic_frame_type_ack_mp:
         case picoquic_frame_type_ack_mp_ecn:
-            bytes = picoquic_log_ack_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_ack_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_retire_connection_id:
-            bytes = picoquic_log_retire_connection_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_retire_connection_id_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_padding:
         case picoquic_frame_type_ping:
-            bytes = picoquic_log_padding(f, bytes, bytes_max);
+            bytes = picoquic_log_padding(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_reset_stream:
-            bytes = picoquic_log_reset_stream_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_reset_stream_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_connection_close:
-            bytes = picoquic_log_close_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_close_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_application_close:
-            bytes = picoquic_log_app_close_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_app_close_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_data:
-            bytes = picoquic_log_max_data_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_data_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_stream_data:
-            bytes = picoquic_log_max_stream_data_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_stream_data_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_max_streams_bidir:
         case picoquic_frame_type_max_streams_unidir:
-            bytes = picoquic_log_max_stream_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_max_stream_id_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_data_blocked:
-            bytes = picoquic_log_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_blocked_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_stream_data_blocked:
-            bytes = picoquic_log_stream_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stream_blocked_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_streams_blocked_bidir:
         case picoquic_frame_type_streams_blocked_unidir:
-            bytes = picoquic_log_streams_blocked_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_streams_blocked_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_new_connection_id:
-            bytes = picoquic_log_new_connection_id_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_new_connection_id_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_stop_sending:
-            bytes = picoquic_log_stop_sending_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_stop_sending_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_path_challenge:
         case picoquic_frame_type_path_response:
-            bytes = picoquic_log_path_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_path_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_crypto_hs:
-            bytes = picoquic_log_crypto_hs_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_crypto_hs_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_new_token:
-            bytes = picoquic_log_new_token_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_new_token_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_handshake_done:
-            bytes = picoquic_log_handshake_done_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_handshake_done_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_datagram:
         case picoquic_frame_type_datagram_l:
-            bytes = picoquic_log_datagram_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_datagram_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_ack_frequency:
-            bytes = picoquic_log_ack_frequency_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_ack_frequency_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_immediate_ack:
-            bytes = picoquic_log_immediate_ack_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_immediate_ack_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_time_stamp:
-            bytes = picoquic_log_time_stamp_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_time_stamp_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_path_abandon:
-            bytes = picoquic_log_path_abandon_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_path_abandon_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_path_standby:
         case picoquic_frame_type_path_available:
-            bytes = picoquic_log_path_available_or_standby_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_path_available_or_standby_frame(s, bytes, bytes_max);
             break;
         case picoquic_frame_type_bdp:
-            bytes = picoquic_log_bdp_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_bdp_frame(s, bytes, bytes_max);
             break;
         default:
-            bytes = picoquic_log_erroring_frame(f, bytes, bytes_max);
+            bytes = picoquic_log_erroring_frame(s, bytes, bytes_max);
             break;
         }
     }
 }
 
+void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
+{
+    uint8_t buffer[BINLOG_PACKET_EVENT_MAX];
+    bytestream stream_msg;
+    bytestream* msg = bytestream_ref_init(&stream_msg, buffer, sizeof(buffer));
+
+    picoquic_binlog_frames_compose(msg, bytes, length);
+    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+}
+
 static void binlog_compose_event_header(bytestream* msg, const picoquic_connection_id_t* cid, uint64_t current_time,
     uint64_t path_id, picoquic_log_event_type event_type)
 {
@@ -626,12 +644,35 @@ static uint64_t binlog_get_path_id(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
     return path_id;
 }
 
-void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
-    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+/* Write an event to the binary log of the connection. If the QUIC context
+ * uses an asynchronous log ring, the event is queued for the writer thread.
+ */
+static void binlog_write_event(picoquic_cnx_t* cnx, const uint8_t* head, size_t head_length,
+    const uint8_t* msg, size_t msg_length)
 {
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+    if (cnx->quic->binlog_ring != NULL) {
+        (void)picoquic_binlog_ring_write(cnx->quic->binlog_ring, cnx->f_binlog, head, head_length, msg, msg_length);
+    }
+    else {
+        if (head_length > 0) {
+            (void)fwrite(head, head_length, 1, cnx->f_binlog);
+        }
+        (void)fwrite(msg, msg_length, 1, cnx->f_binlog);
+    }
+}
 
+/* Write an event preceded by its 32 bits length */
+static void binlog_write_message(picoquic_cnx_t* cnx, bytestream* msg)
+{
+    uint8_t head[4];
+
+    picoformat_32(head, (uint32_t)bytestream_length(msg));
+    binlog_write_event(cnx, head, sizeof(head), bytestream_data(msg), bytestream_length(msg));
+}
+
+static void binlog_compose_pdu(bytestream* msg, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+{
     /* Common chunk header */
     binlog_compose_event_header(msg, cid, current_time, 0, picoquic_log_event_pdu_sent + receiving);
 
@@ -639,6 +680,15 @@ void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uin
     bytewrite_addr(msg, addr_peer);
     bytewrite_vint(msg, packet_length);
     bytewrite_addr(msg, addr_local);
+}
+
+void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+{
+    bytestream_buf stream_msg;
+    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+
+    binlog_compose_pdu(msg, cid, receiving, current_time, addr_peer, addr_local, packet_length);
 
     uint8_t head[4] = { 0 };
     picoformat_32(head, (uint32_t)bytestream_length(msg));
@@ -651,21 +701,17 @@ static void binlog_pdu_ex(picoquic_cnx_t* cnx, int receiving, uint64_t current_t
     const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_pdu(cnx->f_binlog, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
+        bytestream_buf stream_msg;
+        bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+
+        binlog_compose_pdu(msg, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
+        binlog_write_message(cnx, msg);
     }
 }
 
-void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
-    const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
+static void binlog_compose_packet(bytestream* msg, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving,
+    uint64_t current_time, const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
-    long fpos0 = ftell(f);
-
-    uint8_t head[4] = { 0 };
-    (void)fwrite(head, 4, 1, f);
-
-    bytestream_buf stream_msg;
-    bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
-
     /* Common chunk header */
     binlog_compose_event_header(msg, cid, current_time, path_id, picoquic_log_event_packet_sent + receiving);
 
@@ -691,31 +737,47 @@ void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_i
         bytewrite_buffer(msg, ph->token_bytes, ph->token_length);
     }
 
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
-
     /* frame information */
     if (ph->ptype == picoquic_packet_version_negotiation || ph->ptype == picoquic_packet_retry) {
-        picoquic_binlog_frame(f, bytes + ph->offset, bytes + bytes_max);
+        picoquic_binlog_frame(msg, bytes + ph->offset, bytes + bytes_max);
     }
     else if (ph->ptype != picoquic_packet_error) {
-        picoquic_binlog_frames(f, bytes + ph->offset, ph->payload_length);
+        picoquic_binlog_frames_compose(msg, bytes + ph->offset, ph->payload_length);
     }
+}
+
+void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
+    const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
+{
+    uint8_t buffer[BINLOG_PACKET_EVENT_MAX];
+    bytestream stream_msg;
+    bytestream* msg = bytestream_ref_init(&stream_msg, buffer, sizeof(buffer));
+
+    binlog_compose_packet(msg, cid, path_id, receiving, current_time, ph, bytes, bytes_max);
+
+    uint8_t head[4] = { 0 };
+    picoformat_32(head, (uint32_t)bytestream_length(msg));
 
-    /* re-write chunk size field */
-    long fpos1 = ftell(f);
+    (void)fwrite(head, sizeof(head), 1, f);
+    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+}
 
-    picoformat_32(head, (uint32_t)(fpos1 - fpos0 - 4));
+static void binlog_packet_cnx(picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving,
+    uint64_t current_time, const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
+{
+    uint8_t buffer[BINLOG_PACKET_EVENT_MAX];
+    bytestream stream_msg;
+    bytestream* msg = bytestream_ref_init(&stream_msg, buffer, sizeof(buffer));
 
-    (void)fseek(f, fpos0, SEEK_SET);
-    (void)fwrite(head, 4, 1, f);
-    (void)fseek(f, 0, SEEK_END);
+    binlog_compose_packet(msg, cid, path_id, receiving, current_time, ph, bytes, bytes_max);
+    binlog_write_message(cnx, msg);
 }
 
 static void binlog_packet_ex(picoquic_cnx_t* cnx, picoquic_path_t * path_x, int receiving, uint64_t current_time,
     picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_packet(cnx->f_binlog, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x),
+        binlog_packet_cnx(cnx, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x),
             receiving, current_time, ph, bytes, bytes_max);
     }
 }
@@ -724,7 +786,6 @@ void binlog_dropped_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     picoquic_packet_header* ph,  size_t packet_size, int err,
     uint8_t * raw_data, uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
     size_t raw_size = packet_size;
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
@@ -749,13 +810,12 @@ void binlog_dropped_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     /* write the frame length at the reserved spot, and save to log file*/
     picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, NULL, 0, bytestream_data(msg), bytestream_length(msg));
 }
 
 void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x, 
     picoquic_packet_type_enum ptype, uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
 
@@ -769,7 +829,7 @@ void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     /* write the frame length at the reserved spot, and save to log file*/
     picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, NULL, 0, bytestream_data(msg), bytestream_length(msg));
 }
 
 
@@ -777,8 +837,6 @@ void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
     uint8_t * bytes, uint64_t sequence_number, size_t pn_length, size_t length,
     uint8_t* send_buffer, size_t send_length, uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
-
     picoquic_cnx_t* pcnx = cnx;
     picoquic_packet_header ph;
     size_t checksum_length = 16;
@@ -819,7 +877,7 @@ void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
         }
     }
 
-    binlog_packet(f, cnxid, binlog_get_path_id(cnx, path_x),  0, current_time, &ph, bytes, length);
+    binlog_packet_cnx(cnx, cnxid, binlog_get_path_id(cnx, path_x), 0, current_time, &ph, bytes, length);
 }
 
 void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
@@ -827,8 +885,6 @@ void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     picoquic_connection_id_t * dcid, size_t packet_size,
     uint64_t current_time)
 {
-    FILE* f = cnx->f_binlog;
-
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
 
@@ -849,7 +905,7 @@ void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     /* write the frame length at the reserved spot, and save to log file*/
     picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, NULL, 0, bytestream_data(msg), bytestream_length(msg));
 }
 
 
@@ -857,8 +913,6 @@ void binlog_negotiated_alpn(picoquic_cnx_t* cnx, int is_local,
     uint8_t const * sni, size_t sni_len, uint8_t const* alpn, size_t alpn_len,
     const ptls_iovec_t* alpn_list, size_t alpn_count)
 {
-    FILE* f = cnx->f_binlog;
-
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
@@ -883,19 +937,12 @@ void binlog_negotiated_alpn(picoquic_cnx_t* cnx, int is_local,
         bytewrite_buffer(msg, alpn, alpn_len);
     }
 
-    bytestream_buf stream_head;
-    bytestream* head = bytestream_buf_init(&stream_head, 4);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_message(cnx, msg);
 }
 
 void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
     size_t param_length, uint8_t* params)
 {
-    FILE* f = cnx->f_binlog;
-
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
@@ -908,24 +955,26 @@ void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
         bytewrite_buffer(msg, params, param_length);
     }
 
-    bytestream_buf stream_head;
-    bytestream* head = bytestream_buf_init(&stream_head, 4);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_message(cnx, msg);
 }
 
-void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+static void binlog_compose_picotls_ticket(bytestream* msg, picoquic_connection_id_t cnx_id,
     uint8_t* ticket, uint16_t ticket_length)
 {
-    bytestream_buf stream_msg;
-    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
     binlog_compose_event_header(msg, &cnx_id, 0, 0, picoquic_log_event_tls_key_update);
 
     bytewrite_vint(msg, ticket_length);
     bytewrite_buffer(msg, ticket, ticket_length);
+}
+
+void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+    uint8_t* ticket, uint16_t ticket_length)
+{
+    bytestream_buf stream_msg;
+    bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+
+    binlog_compose_picotls_ticket(msg, cnx_id, ticket, ticket_length);
 
     bytestream_buf stream_head;
     bytestream * head = bytestream_buf_init(&stream_head, 8);
@@ -939,12 +988,32 @@ static void binlog_picotls_ticket_ex(picoquic_cnx_t* cnx,
     uint8_t* ticket, uint16_t ticket_length)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_picotls_ticket(cnx->f_binlog, cnx->initial_cnxid, ticket, ticket_length);
+        bytestream_buf stream_msg;
+        bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
+
+        binlog_compose_picotls_ticket(msg, cnx->initial_cnxid, ticket, ticket_length);
+        binlog_write_message(cnx, msg);
     }
 }
 
 FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int multipath_enabled);
 
+/* Close the log file of the connection. With the asynchronous log ring,
+ * the file is closed by the writer thread after its last queued event.
+ */
+static void binlog_release_file(picoquic_cnx_t* cnx)
+{
+    if (cnx->f_binlog != NULL) {
+        if (cnx->quic->binlog_ring != NULL) {
+            picoquic_binlog_ring_close_file(cnx->quic->binlog_ring, cnx->f_binlog, NULL, NULL);
+            cnx->f_binlog = NULL;
+        }
+        else {
+            cnx->f_binlog = picoquic_file_close(cnx->f_binlog);
+        }
+    }
+}
+
 void binlog_new_connection(picoquic_cnx_t * cnx)
 {
     char const* bin_dir = (cnx->quic->binlog_dir == NULL) ? cnx->quic->qlog_dir : cnx->quic->binlog_dir;
@@ -959,7 +1028,7 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
 
     int ret = 0;
 
-    cnx->f_binlog = picoquic_file_close(cnx->f_binlog);
+    binlog_release_file(cnx);
     
     char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
     if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
@@ -1014,19 +1083,13 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
         bytewrite_cstr(msg, cnx->congestion_alg->congestion_algorithm_id);
         bytewrite_vint(msg, cnx->spin_policy);
 
-        bytestream_buf stream_head;
-        bytestream * head = bytestream_buf_init(&stream_head, 8);
-        bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-        (void)fwrite(bytestream_data(head), bytestream_length(head), 1, cnx->f_binlog);
-        (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, cnx->f_binlog);
+        binlog_write_message(cnx, msg);
     }
 }
 
 void binlog_close_connection(picoquic_cnx_t * cnx)
 {
-    FILE * f = cnx->f_binlog;
-    if (f == NULL) {
+    if (cnx->f_binlog == NULL) {
         return;
     }
 
@@ -1035,19 +1098,32 @@ void binlog_close_connection(picoquic_cnx_t * cnx)
     /* Common chunk header */
     binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_connection_close);
 
-    bytestream_buf stream_head;
-    bytestream * head = bytestream_buf_init(&stream_head, 8);
-    bytewrite_int32(head, (uint32_t)bytestream_length(msg));
-
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
-
-    fflush(f);
-
-    cnx->f_binlog = picoquic_file_close(cnx->f_binlog);
+    binlog_write_message(cnx, msg);
 
     if (cnx->quic->qlog_dir != NULL && cnx->quic->autoqlog_fn != NULL) {
-        (void)cnx->quic->autoqlog_fn(cnx);
+        picoquic_autoqlog_request_t request;
+
+        memset(&request, 0, sizeof(picoquic_autoqlog_request_t));
+        request.cid = cnx->initial_cnxid;
+        request.binlog_file_name = cnx->binlog_file_name;
+        request.qlog_dir = cnx->quic->qlog_dir;
+        request.log_unique = cnx->log_unique;
+        request.client_mode = cnx->client_mode;
+        request.use_unique_log_names = cnx->quic->use_unique_log_names;
+        request.delete_binlog = (cnx->quic->binlog_dir == NULL);
+
+        if (cnx->quic->binlog_ring != NULL) {
+            /* The writer thread converts the log after writing its last event */
+            picoquic_binlog_ring_close_file(cnx->quic->binlog_ring, cnx->f_binlog, cnx->quic->autoqlog_fn, &request);
+            cnx->f_binlog = NULL;
+        }
+        else {
+            binlog_release_file(cnx);
+            (void)cnx->quic->autoqlog_fn(&request);
+        }
+    }
+    else {
+        binlog_release_file(cnx);
     }
     cnx->binlog_file_name = picoquic_string_free(cnx->binlog_file_name);
     if (cnx->quic->current_number_of_open_logs > 0) {
@@ -1169,13 +1245,7 @@ void binlog_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
         bytewrite_vint(ps_msg, path->peak_bandwidth_estimate);
         bytewrite_vint(ps_msg, path->bytes_in_transit);
 
-        bytestream_buf stream_head;
-        bytestream* ps_head = bytestream_buf_init(&stream_head, BYTESTREAM_MAX_BUFFER_SIZE);
-
-        bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
-
-        (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->f_binlog);
-        (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->f_binlog);
+        binlog_write_message(cnx, ps_msg);
     }
 }
 
@@ -1211,13 +1281,7 @@ void picoquic_binlog_message_v(picoquic_cnx_t* cnx, const char* fmt, va_list var
 #endif
     ps_msg->ptr += message_len;
 
-    bytestream_buf stream_head;
-    bytestream* ps_head = bytestream_buf_init(&stream_head, BYTESTREAM_MAX_BUFFER_SIZE);
-
-    bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
-
-    (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->f_binlog);
-    (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->f_binlog);
+    binlog_write_message(cnx, ps_msg);
 }
 
 /* Log an event that cannot be attached to a specific connection */
@@ -1252,12 +1316,15 @@ static void binlog_app_message(picoquic_cnx_t* cnx, const char* fmt, va_list var
     }
 }
 
-/* Return from close with nothing, as this is per connection only */
+/* The log files are per connection, only the asynchronous ring needs to be
+ * closed, after the writer thread has written all the queued events.
+ */
 void binlog_close(picoquic_quic_t* quic)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(quic);
-#endif
+    if (quic->binlog_ring != NULL) {
+        picoquic_binlog_ring_delete(quic->binlog_ring);
+        quic->binlog_ring = NULL;
+    }
 }
 
 struct st_picoquic_unified_logging_t binlog_functions = {
@@ -1293,3 +1360,37 @@ void picoquic_enable_binlog(picoquic_quic_t* quic)
 {
     quic->bin_log_fns = &binlog_functions;
 }
+
+int picoquic_set_binlog_async(picoquic_quic_t* quic, size_t ring_size, picoquic_binlog_drop_policy_enum drop_policy)
+{
+    int ret = 0;
+
+    binlog_close(quic);
+
+    if (ring_size > 0) {
+        if ((quic->binlog_ring = picoquic_binlog_ring_create(ring_size, drop_policy)) == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            /* Make sure that the ring is deleted when the context is freed */
+            quic->bin_log_fns = &binlog_functions;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_get_binlog_async_stats(picoquic_quic_t* quic, picoquic_binlog_async_stats_t* stats)
+{
+    int ret = -1;
+
+    if (quic->binlog_ring != NULL) {
+        picoquic_binlog_ring_get_stats(quic->binlog_ring, stats);
+        ret = 0;
+    }
+    else {
+        memset(stats, 0, sizeof(picoquic_binlog_async_stats_t));
+    }
+
+    return ret;
+}
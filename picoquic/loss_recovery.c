@@ -716,7 +716,7 @@ int picoquic_copy_before_retransmit(picoquic_packet_t * old_p,
             /* MTU probe was lost, presumably because of packet too big */
             old_p->send_path->mtu_probe_sent = 0;
             if (!force_queue) {
-                old_p->send_path->send_mtu_max_tried = old_p->length + old_p->checksum_overhead;
+                old_p->send_path->send_mtu_max_tried = PICOQUIC_PACKET_SENT_LENGTH(old_p) + old_p->checksum_overhead;
             }
         }
         /* MTU probes should not be retransmitted */
@@ -740,7 +740,7 @@ int picoquic_copy_before_retransmit(picoquic_packet_t * old_p,
         byte_index = old_p->offset;
 
         while (ret == 0 && byte_index < old_p->length) {
-            ret = picoquic_skip_frame(&old_p->bytes[byte_index],
+            ret = picoquic_skip_sent_frame(&old_p->bytes[byte_index],
                 old_p->length - byte_index, &frame_length, &frame_is_pure_ack);
 
             /* Check whether the data was already acked, which may happen in
@@ -772,7 +772,8 @@ int picoquic_copy_before_retransmit(picoquic_packet_t * old_p,
             /* Prepare retransmission if needed */
             if (ret == 0) {
                 if (!frame_is_pure_ack) {
-                    if (PICOQUIC_IN_RANGE(old_p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+                    if (PICOQUIC_IN_RANGE(old_p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max) ||
+                        old_p->bytes[byte_index] == picoquic_frame_type_stream_ref) {
                         * add_to_data_repeat_queue = 1;
                     }
                     else {
@@ -881,7 +882,7 @@ static void picoquic_check_path_mtu_on_losses(
     picoquic_cnx_t* cnx, picoquic_packet_t* old_p, int timer_based_retransmit)
 {
     if (old_p->send_path != NULL &&
-        ((old_p->length + old_p->checksum_overhead) == old_p->send_path->send_mtu || timer_based_retransmit) &&
+        ((PICOQUIC_PACKET_SENT_LENGTH(old_p) + old_p->checksum_overhead) == old_p->send_path->send_mtu || timer_based_retransmit) &&
         cnx->cnx_state >= picoquic_state_ready) {
         old_p->send_path->nb_mtu_losses++;
         if (old_p->send_path->nb_mtu_losses > PICOQUIC_MTU_LOSS_THRESHOLD || timer_based_retransmit) {
@@ -906,7 +907,7 @@ static void picoquic_count_and_notify_loss(
         picoquic_log_packet_lost(cnx, old_p->send_path, old_p->ptype, old_p->sequence_number,
             (timer_based_retransmit) ? "timer" : "repeat",
             (old_p->send_path == NULL) ? NULL : &old_p->send_path->p_remote_cnxid->cnx_id,
-            old_p->length, current_time);
+            PICOQUIC_PACKET_SENT_LENGTH(old_p), current_time);
 
         if (!old_p->is_preemptive_repeat) {
             cnx->nb_retransmission_total++;
@@ -915,7 +916,7 @@ static void picoquic_count_and_notify_loss(
 
     if (old_p->send_path != NULL) {
         old_p->send_path->nb_losses_found++;
-        old_p->send_path->total_bytes_lost += old_p->length;
+        old_p->send_path->total_bytes_lost += PICOQUIC_PACKET_SENT_LENGTH(old_p);
 
         if (cnx->congestion_alg != NULL && cnx->cnx_state >= picoquic_state_ready && old_p->send_path != NULL) {
             cnx->congestion_alg->alg_notify(cnx, old_p->send_path,
@@ -941,7 +942,7 @@ static int picoquic_is_packet_ack_eliciting(picoquic_packet_t * packet)
 
             while (byte_index < packet->length) {
                 int frame_is_pure_ack = 0;
-                if (picoquic_skip_frame(&packet->bytes[byte_index],
+                if (picoquic_skip_sent_frame(&packet->bytes[byte_index],
                     packet->length - byte_index, &frame_length, &frame_is_pure_ack) != 0) {
                     /* Malformed packet. Ignore it. Do not expect an ack */
                     break;
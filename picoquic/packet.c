@@ -298,7 +298,13 @@ int picoquic_parse_short_packet_header(
         /* TODO: should consider using combination of CNX ID and ADDR_FROM */
         if (*pcnx == NULL)
         {
-            if (quic->local_cnxid_length > 0) {
+            if (receiving && quic->unprotect_batch != NULL && quic->unprotect_batch->bytes == bytes &&
+                quic->unprotect_batch->cnx != NULL) {
+                /* The connection was already found for the whole batch */
+                *pcnx = quic->unprotect_batch->cnx;
+                ph->l_cid = quic->unprotect_batch->l_cid;
+            }
+            else if (quic->local_cnxid_length > 0) {
                 *pcnx = picoquic_cnx_by_id(quic, ph->dest_cnx_id, &ph->l_cid);
             }
             else {
@@ -450,6 +456,7 @@ int picoquic_remove_header_protection(picoquic_cnx_t* cnx,
     int ret = 0;
     size_t length = ph->offset + ph->payload_length; /* this may change after decrypting the PN */
     void * pn_enc = NULL;
+    picoquic_unprotect_batch_t* batch = cnx->quic->unprotect_batch;
 
     pn_enc = cnx->crypto_context[ph->epoch].pn_dec;
 
@@ -480,7 +487,13 @@ int picoquic_remove_header_protection(picoquic_cnx_t* cnx,
             uint32_t pn_val = 0;
 
             memcpy(decrypted_bytes, bytes, ph->pn_offset);
-            picoquic_pn_encrypt(pn_enc, bytes + sample_offset, mask_bytes, mask_bytes, mask_length);
+            if (batch != NULL && batch->bytes == bytes && batch->mask != NULL && batch->pn_dec == pn_enc) {
+                /* The mask was computed with the other packets of the batch */
+                memcpy(mask_bytes, batch->mask, mask_length);
+            }
+            else {
+                picoquic_pn_encrypt(pn_enc, bytes + sample_offset, mask_bytes, mask_bytes, mask_length);
+            }
             /* Decode the first byte */
             first_byte ^= (mask_bytes[0] & first_mask);
             pn_l = (first_byte & 3) + 1;
@@ -739,8 +752,14 @@ int picoquic_parse_header_and_decrypt(
                         ret = PICOQUIC_ERROR_INITIAL_CID_TOO_SHORT;
                     }
                     else if (!quic->enforce_client_only) {
-                        /* if listening is OK, listen */
+                        /* if listening is OK, listen, unless the admission control refuses the packet */
+                        ret = picoquic_admission_check_initial(quic, addr_from, ph, current_time);
+                    }
+                    else {
+                        DBG_PRINTF("%s", "Refuse to create connection context\n");
+                    }
 
+                    if (ret == 0 && !quic->enforce_client_only) {
                         *pcnx = picoquic_create_cnx(quic, ph->dest_cnx_id, ph->srce_cnx_id, addr_from, current_time, ph->vn, NULL, NULL, 0);
                         /* If an incoming connection was created, register the ICID */
                         *new_ctx_created = (*pcnx == NULL) ? 0 : 1;
@@ -748,9 +767,6 @@ int picoquic_parse_header_and_decrypt(
                             DBG_PRINTF("%s", "Cannot create connection context\n");
                         }
                     }
-                    else {
-                        DBG_PRINTF("%s", "Refuse to create connection context\n");
-                    }
                 }
             }
             else if (!(*pcnx)->client_mode && ph->ptype == picoquic_packet_initial && packet_length < PICOQUIC_ENFORCED_INITIAL_MTU) {
@@ -1073,40 +1089,44 @@ void picoquic_process_unexpected_cnxid(
 }
 
 /*
- * Queue a stateless retry packet
+ * Format a stateless retry packet. The header is formatted as specified for
+ * the version: DCID is the source CID chosen by the client, SCID is the retry
+ * source CID. In the old drafts, there is no header protection and the sender
+ * copies the ODCID in the packet. In the recent drafts, the ODCID is not sent
+ * but is verified as part of integrity checksum.
  */
 
-void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
-    picoquic_packet_header* ph, struct sockaddr* addr_from,
-    struct sockaddr* addr_to,
-    unsigned long if_index_to,
-    uint8_t * token,
-    size_t token_length)
+static picoquic_stateless_packet_t* picoquic_create_stateless_retry(picoquic_quic_t* quic,
+    int version_index, int do_grease_quic_bit,
+    const picoquic_connection_id_t* dcid, const picoquic_connection_id_t* rcid,
+    const picoquic_connection_id_t* odcid,
+    struct sockaddr* addr_from, struct sockaddr* addr_to, unsigned long if_index_to,
+    const uint8_t* token, size_t token_length)
 {
-    picoquic_stateless_packet_t* sp = picoquic_create_stateless_packet(cnx->quic);
-    void * integrity_aead = picoquic_find_retry_protection_context(cnx, 1);
-    size_t checksum_length = (integrity_aead == NULL) ? 0 : picoquic_aead_get_checksum_length(integrity_aead);
+    picoquic_stateless_packet_t* sp = picoquic_create_stateless_packet(quic);
 
     if (sp != NULL) {
+        void* integrity_aead = picoquic_find_retry_protection_context_by_version(quic, version_index, 1);
+        size_t checksum_length = (integrity_aead == NULL) ? 0 : picoquic_aead_get_checksum_length(integrity_aead);
         uint8_t* bytes = sp->bytes;
         size_t byte_index = 0;
-        size_t header_length = 0;
-        size_t pn_offset;
-        size_t pn_length;
-
-        cnx->path[0]->p_remote_cnxid->cnx_id = ph->srce_cnx_id;
 
-        byte_index = header_length = picoquic_create_packet_header(cnx, picoquic_packet_retry,
-            0, cnx->path[0], 0,
-            bytes, &pn_offset, &pn_length);
+        bytes[byte_index] = picoquic_create_long_packet_type(picoquic_packet_retry, version_index);
+        if (do_grease_quic_bit) {
+            bytes[byte_index] &= 0xBF;
+        }
+        byte_index++;
+        picoformat_32(&bytes[byte_index], picoquic_supported_versions[version_index].version);
+        byte_index += 4;
+        bytes[byte_index++] = dcid->id_len;
+        byte_index += picoquic_format_connection_id(&bytes[byte_index], PICOQUIC_MAX_PACKET_SIZE - byte_index, *dcid);
+        bytes[byte_index++] = rcid->id_len;
+        byte_index += picoquic_format_connection_id(&bytes[byte_index], PICOQUIC_MAX_PACKET_SIZE - byte_index, *rcid);
 
-        /* In the old drafts, there is no header protection and the sender copies the ODCID
-         * in the packet. In the recent draft, the ODCID is not sent but
-         * is verified as part of integrity checksum */
         if (integrity_aead == NULL) {
-            bytes[byte_index++] = cnx->initial_cnxid.id_len;
+            bytes[byte_index++] = odcid->id_len;
             byte_index += picoquic_format_connection_id(bytes + byte_index,
-                PICOQUIC_MAX_PACKET_SIZE - byte_index - checksum_length, cnx->initial_cnxid);
+                PICOQUIC_MAX_PACKET_SIZE - byte_index - checksum_length, *odcid);
         }
 
         /* Add the token */
@@ -1114,25 +1134,93 @@ void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
         byte_index += token_length;
 
         /* Encode the retry integrity protection if required. */
-        byte_index = picoquic_encode_retry_protection(integrity_aead, bytes, PICOQUIC_MAX_PACKET_SIZE, byte_index, &cnx->initial_cnxid);
+        byte_index = picoquic_encode_retry_protection(integrity_aead, bytes, PICOQUIC_MAX_PACKET_SIZE, byte_index, odcid);
 
         sp->length = byte_index;
-
-        sp->ptype = picoquic_packet_1rtt_protected;
-
         picoquic_store_addr(&sp->addr_to, addr_from);
         picoquic_store_addr(&sp->addr_local, addr_to);
         sp->if_index_local = if_index_to;
+    }
+
+    return sp;
+}
+
+/*
+ * Queue a stateless retry packet
+ */
+
+void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
+    picoquic_packet_header* ph, struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    unsigned long if_index_to,
+    uint8_t * token,
+    size_t token_length)
+{
+    picoquic_stateless_packet_t* sp;
+
+    cnx->path[0]->p_remote_cnxid->cnx_id = ph->srce_cnx_id;
+
+    sp = picoquic_create_stateless_retry(cnx->quic, cnx->version_index, cnx->do_grease_quic_bit,
+        &ph->srce_cnx_id, &cnx->path[0]->p_local_cnxid->cnx_id, &cnx->initial_cnxid,
+        addr_from, addr_to, if_index_to, token, token_length);
+
+    if (sp != NULL) {
+        sp->ptype = picoquic_packet_1rtt_protected;
         sp->cnxid_log64 = picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx));
 
         picoquic_log_outgoing_packet(cnx, cnx->path[0],
-            bytes, 0, pn_length, sp->length,
-            bytes, sp->length, picoquic_get_quic_time(cnx->quic));
+            sp->bytes, 0, 0, sp->length,
+            sp->bytes, sp->length, picoquic_get_quic_time(cnx->quic));
 
         picoquic_queue_stateless_packet(cnx->quic, sp);
     }
 }
 
+/*
+ * Queue a stateless retry in response to an Initial packet, without creating
+ * a connection context. This is used by the admission control when the server
+ * is overloaded. The retry source CID is the CID that the client will use in
+ * its next Initial packet.
+ * The packet number of the Initial is still protected at this stage, so the
+ * token records 0: the client does not reset its packet numbers after a
+ * retry, and the next Initial will have a larger number.
+ */
+
+static void picoquic_queue_stateless_retry_for_initial(picoquic_quic_t* quic,
+    picoquic_packet_header* ph, struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    unsigned long if_index_to,
+    uint64_t current_time)
+{
+    picoquic_connection_id_t rcid = picoquic_null_connection_id;
+    uint8_t token_buffer[256];
+    size_t token_size = 0;
+    picoquic_stateless_packet_t* sp = NULL;
+
+    if (quic->local_cnxid_length > 0) {
+        picoquic_crypto_random(quic, rcid.id, quic->local_cnxid_length);
+        rcid.id_len = quic->local_cnxid_length;
+        if (quic->cnx_id_callback_fn) {
+            quic->cnx_id_callback_fn(quic, rcid, ph->dest_cnx_id, quic->cnx_id_callback_ctx, &rcid);
+        }
+    }
+
+    if (picoquic_prepare_retry_token(quic, addr_from,
+        current_time + PICOQUIC_TOKEN_DELAY_SHORT, &ph->dest_cnx_id, &rcid, 0,
+        token_buffer, sizeof(token_buffer), &token_size) == 0 &&
+        (sp = picoquic_create_stateless_retry(quic, ph->version_index, 0,
+            &ph->srce_cnx_id, &rcid, &ph->dest_cnx_id,
+            addr_from, addr_to, if_index_to, token_buffer, token_size)) != NULL) {
+        sp->ptype = picoquic_packet_retry;
+        sp->initial_cid = ph->dest_cnx_id;
+        sp->cnxid_log64 = picoquic_val64_connection_id(sp->initial_cid);
+
+        picoquic_log_context_free_app_message(quic, &sp->initial_cid, "Server overloaded, sending stateless retry.\n");
+
+        picoquic_queue_stateless_packet(quic, sp);
+    }
+}
+
 /* Queue a close message for an incoming connection attemt that was rejected.
  * The connection context can then be immediately frees.
  */
@@ -1267,6 +1355,10 @@ int picoquic_incoming_client_initial(
     }
 
     if (ret == 0) {
+        /* The memory budget check sums the memory categories, only do it once */
+        int is_memory_exceeded = ((*pcnx)->cnx_state == picoquic_state_server_init &&
+            picoquic_is_memory_budget_exceeded((*pcnx)->quic));
+
         if ((*pcnx)->path[0]->p_local_cnxid->cnx_id.id_len > 0 &&
             picoquic_compare_connection_id(&ph->dest_cnx_id, &(*pcnx)->path[0]->p_local_cnxid->cnx_id) == 0) {
             (*pcnx)->initial_validated = 1;
@@ -1284,7 +1376,11 @@ int picoquic_incoming_client_initial(
 
         if ((*pcnx)->cnx_state == picoquic_state_server_init && 
             ((*pcnx)->quic->server_busy || 
-            (*pcnx)->quic->current_number_connections > (*pcnx)->quic->tentative_max_number_connections)) {
+            (*pcnx)->quic->current_number_connections > (*pcnx)->quic->tentative_max_number_connections ||
+            is_memory_exceeded)) {
+            if (is_memory_exceeded) {
+                (*pcnx)->quic->nb_cnx_refused_memory++;
+            }
             (*pcnx)->local_error = PICOQUIC_TRANSPORT_SERVER_BUSY;
             (*pcnx)->cnx_state = picoquic_state_handshake_failure;
         }
@@ -2099,7 +2195,7 @@ int  picoquic_incoming_not_decrypted(
             if (length <= PICOQUIC_MAX_PACKET_SIZE &&
                 ((ph->ptype == picoquic_packet_handshake && cnx->client_mode) || ph->ptype == picoquic_packet_1rtt_protected)) {
                 /* stash a copy of the incoming message for processing once the keys are available */
-                picoquic_stateless_packet_t* packet = picoquic_create_stateless_packet(cnx->quic);
+                picoquic_stateless_packet_t* packet = picoquic_create_sooner_packet();
 
                 if (packet != NULL) {
                     packet->length = length;
@@ -2233,6 +2329,11 @@ int picoquic_incoming_segment(
                 picoquic_prepare_version_negotiation(quic, addr_from, addr_to, if_index_to, &ph, raw_bytes);
             }
         }
+    } else if (ret == PICOQUIC_ERROR_STATELESS_RETRY) {
+        /* The admission control requires address validation before creating a context */
+        if (quic->is_port_blocking_disabled || !picoquic_check_addr_blocked(addr_from)) {
+            picoquic_queue_stateless_retry_for_initial(quic, &ph, addr_from, addr_to, if_index_to, current_time);
+        }
     } else if (ret == 0) {
         if (cnx == NULL) {
             /* Unexpected packet. Reject, drop and log. */
@@ -2380,6 +2481,8 @@ int picoquic_incoming_segment(
         ret == PICOQUIC_ERROR_CONNECTION_DELETED ||
         ret == PICOQUIC_ERROR_CNXID_SEGMENT ||
         ret == PICOQUIC_ERROR_VERSION_NOT_SUPPORTED ||
+        ret == PICOQUIC_ERROR_INITIAL_RATE_LIMITED ||
+        ret == PICOQUIC_ERROR_STATELESS_RETRY ||
         ret == PICOQUIC_ERROR_PACKET_TOO_LONG ||
         ret == PICOQUIC_ERROR_DUPLICATE ||
         ret == PICOQUIC_ERROR_AEAD_NOT_READY) {
@@ -2475,6 +2578,120 @@ int picoquic_incoming_packet(
     return ret;
 }
 
+/* Number of datagrams at the start of the vector that can be processed as
+ * one batch: short header packets with the same destination CID. A short
+ * header packet runs to the end of the datagram, so there is no coalescing.
+ */
+static size_t picoquic_incoming_batch_length(picoquic_quic_t* quic,
+    picoquic_incoming_datagram_t* datagrams, size_t nb_datagrams)
+{
+    size_t nb_batch = 1;
+    size_t cid_end = 1 + (size_t)quic->local_cnxid_length;
+
+    if (quic->local_cnxid_length > 0 && datagrams[0].length >= cid_end &&
+        (datagrams[0].bytes[0] & 0x80) == 0) {
+        while (nb_batch < nb_datagrams && nb_batch < PICOQUIC_PROTECT_BATCH_MAX &&
+            datagrams[nb_batch].length >= cid_end && (datagrams[nb_batch].bytes[0] & 0x80) == 0 &&
+            memcmp(datagrams[nb_batch].bytes + 1, datagrams[0].bytes + 1, cid_end - 1) == 0) {
+            nb_batch++;
+        }
+    }
+
+    return nb_batch;
+}
+
+/* Find the connection of the batch and compute the header protection masks
+ * of all its packets. If the connection is unknown or does not yet have the
+ * 1-RTT keys, the packets are processed one by one.
+ */
+static void picoquic_unprotect_batch_prepare(picoquic_quic_t* quic, picoquic_unprotect_batch_t* batch,
+    picoquic_incoming_datagram_t* datagrams, size_t nb_datagrams)
+{
+    picoquic_connection_id_t dest_cnx_id;
+    size_t sample_offset = 1 + (size_t)quic->local_cnxid_length + 4;
+
+    (void)picoquic_parse_connection_id(datagrams[0].bytes + 1, quic->local_cnxid_length, &dest_cnx_id);
+    batch->cnx = picoquic_cnx_by_id(quic, dest_cnx_id, &batch->l_cid);
+    batch->pn_dec = NULL;
+
+    if (batch->cnx != NULL && batch->cnx->crypto_context[picoquic_epoch_1rtt].pn_dec != NULL) {
+        picoquic_crypto_context_t* crypto_context = &batch->cnx->crypto_context[picoquic_epoch_1rtt];
+
+        for (size_t i = 0; i < nb_datagrams; i++) {
+            uint8_t* sample = batch->samples + i * PICOQUIC_HP_SAMPLE_SIZE;
+
+            if (datagrams[i].length >= sample_offset + PICOQUIC_HP_SAMPLE_SIZE) {
+                memcpy(sample, datagrams[i].bytes + sample_offset, PICOQUIC_HP_SAMPLE_SIZE);
+            }
+            else {
+                /* Too short, will be rejected when removing header protection */
+                memset(sample, 0, PICOQUIC_HP_SAMPLE_SIZE);
+            }
+        }
+        picoquic_hp_mask_batch(crypto_context->pn_dec, batch->masks, batch->samples, nb_datagrams);
+        batch->pn_dec = crypto_context->pn_dec;
+        batch->nb_batches++;
+        batch->nb_packets_batched += nb_datagrams;
+    }
+}
+
+int picoquic_incoming_packet_batch(
+    picoquic_quic_t* quic,
+    picoquic_incoming_datagram_t* datagrams,
+    size_t nb_datagrams,
+    uint64_t current_time)
+{
+    int ret = 0;
+    size_t next_datagram = 0;
+
+    while (next_datagram < nb_datagrams) {
+        picoquic_incoming_datagram_t* first = &datagrams[next_datagram];
+        size_t nb_batch = picoquic_incoming_batch_length(quic, first, nb_datagrams - next_datagram);
+        picoquic_unprotect_batch_t* batch = NULL;
+
+        if (nb_batch > 1) {
+            if (quic->unprotect_batch == NULL) {
+                quic->unprotect_batch = (picoquic_unprotect_batch_t*)malloc(sizeof(picoquic_unprotect_batch_t));
+                if (quic->unprotect_batch != NULL) {
+                    memset(quic->unprotect_batch, 0, sizeof(picoquic_unprotect_batch_t));
+                }
+            }
+            batch = quic->unprotect_batch;
+            if (batch != NULL) {
+                picoquic_unprotect_batch_prepare(quic, batch, first, nb_batch);
+            }
+        }
+
+        /* Process the packets in order, as if they were received one by one */
+        for (size_t i = 0; i < nb_batch; i++) {
+            picoquic_cnx_t* first_cnx = NULL;
+            int packet_ret;
+
+            if (batch != NULL) {
+                batch->bytes = first[i].bytes;
+                batch->mask = (batch->pn_dec == NULL) ? NULL : batch->masks + i * PICOQUIC_HP_SAMPLE_SIZE;
+            }
+            packet_ret = picoquic_incoming_packet_ex(quic, first[i].bytes, first[i].length,
+                first[i].addr_from, first[i].addr_to, first[i].if_index_to, first[i].received_ecn,
+                &first_cnx, current_time);
+            if (ret == 0) {
+                ret = packet_ret;
+            }
+        }
+
+        if (batch != NULL) {
+            batch->cnx = NULL;
+            batch->l_cid = NULL;
+            batch->pn_dec = NULL;
+            batch->bytes = NULL;
+            batch->mask = NULL;
+        }
+        next_datagram += nb_batch;
+    }
+
+    return ret;
+}
+
 /* Processing of stashed packets after acquiring encryption context */
 void picoquic_process_sooner_packets(picoquic_cnx_t* cnx, uint64_t current_time)
 {
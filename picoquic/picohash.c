@@ -25,6 +25,13 @@
 #include "picohash.h"
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PICOHASH_OA_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 picohash_table* picohash_create_ex(size_t nb_bin,
     uint64_t (*picohash_hash)(const void*),
@@ -189,3 +196,342 @@ uint64_t picohash_bytes(const uint8_t* key, uint32_t length)
     return hash;
 }
 
+
+/*
+ * Open addressing table.
+ */
+#define PICOHASH_OA_EMPTY 0x80
+#define PICOHASH_OA_DELETED 0xFE
+#define PICOHASH_OA_UNUSED 0xFF
+#define PICOHASH_OA_ALIGN 64
+#define PICOHASH_OA_MIGRATE_GROUPS 4
+
+/* The hash functions used by picoquic do not mix all the bits, e.g. the
+ * hash of a CID is derived from its first 8 bytes. The position and tag
+ * are derived from a mixed version of the hash. */
+static uint64_t picohash_oa_mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/* Return a bit mask of the control bytes equal to x */
+static uint32_t picohash_oa_match(const uint8_t* ctrl, uint8_t x)
+{
+#ifdef PICOHASH_OA_SSE2
+    __m128i group = _mm_loadl_epi64((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)x))) & 0xFF;
+#else
+    /* Compare the 8 bytes in a 64 bit word: the bytes equal to x become zero,
+     * the zero bytes get their high bit set, and the high bits are gathered. */
+    uint64_t v;
+    memcpy(&v, ctrl, 8);
+    v ^= 0x0101010101010101ull * x;
+    v = ~(((v & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | v | 0x7F7F7F7F7F7F7F7Full);
+    return (uint32_t)(((v >> 7) * 0x0102040810204080ull) >> 56);
+#endif
+}
+
+static int picohash_oa_first_bit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+static int picohash_oa_array_init(picohash_oa_array_t* a, size_t nb_items)
+{
+    size_t nb_groups = 1;
+
+    while (nb_groups * PICOHASH_OA_GROUP_SIZE * 7 < nb_items * 8) {
+        nb_groups *= 2;
+    }
+
+    memset(a, 0, sizeof(picohash_oa_array_t));
+    a->allocated = malloc(nb_groups * sizeof(picohash_oa_group_t) + PICOHASH_OA_ALIGN);
+    if (a->allocated == NULL) {
+        return -1;
+    }
+    a->groups = (picohash_oa_group_t*)(((uintptr_t)a->allocated + PICOHASH_OA_ALIGN - 1) & ~((uintptr_t)PICOHASH_OA_ALIGN - 1));
+    for (size_t g = 0; g < nb_groups; g++) {
+        memset(a->groups[g].ctrl, PICOHASH_OA_EMPTY, PICOHASH_OA_GROUP_SIZE);
+        a->groups[g].ctrl[PICOHASH_OA_GROUP_SIZE] = PICOHASH_OA_UNUSED;
+    }
+    a->nb_groups = nb_groups;
+    return 0;
+}
+
+static void picohash_oa_array_clear(picohash_oa_array_t* a)
+{
+    free(a->allocated);
+    memset(a, 0, sizeof(picohash_oa_array_t));
+}
+
+/* Find the group and slot holding the key, or NULL. If "item" is set, find
+ * the slot holding that item instead of comparing keys. */
+static picohash_oa_group_t* picohash_oa_array_find(picohash_oa_table* t, picohash_oa_array_t* a,
+    const void* key, uint64_t hash, const picohash_item* item, int* bit)
+{
+    uint64_t mixed = picohash_oa_mix(hash);
+    uint8_t tag = (uint8_t)(mixed & 0x7F);
+    size_t group = (size_t)(mixed >> 7) & (a->nb_groups - 1);
+
+    for (size_t step = 0; step < a->nb_groups; step++) {
+        picohash_oa_group_t* g = &a->groups[group];
+        uint32_t mask = picohash_oa_match(g->ctrl, tag);
+
+        while (mask != 0) {
+            picohash_item* x;
+
+            *bit = picohash_oa_first_bit(mask);
+            x = g->slots[*bit];
+            if ((item != NULL) ? x == item : (x->hash == hash && t->picohash_compare(key, x->key) == 0)) {
+                return g;
+            }
+            mask &= mask - 1;
+        }
+        if (picohash_oa_match(g->ctrl, PICOHASH_OA_EMPTY) != 0) {
+            break;
+        }
+        group = (group + step + 1) & (a->nb_groups - 1);
+    }
+
+    return NULL;
+}
+
+/* Place the item in the first empty or deleted slot. The caller makes sure
+ * that the array is not full. */
+static void picohash_oa_array_place(picohash_oa_array_t* a, picohash_item* item)
+{
+    uint64_t mixed = picohash_oa_mix(item->hash);
+    size_t group = (size_t)(mixed >> 7) & (a->nb_groups - 1);
+
+    for (size_t step = 0; step < a->nb_groups; step++) {
+        picohash_oa_group_t* g = &a->groups[group];
+        uint32_t mask = picohash_oa_match(g->ctrl, PICOHASH_OA_EMPTY) | picohash_oa_match(g->ctrl, PICOHASH_OA_DELETED);
+
+        if (mask != 0) {
+            int bit = picohash_oa_first_bit(mask);
+
+            if (g->ctrl[bit] == PICOHASH_OA_EMPTY) {
+                a->nb_used++;
+            }
+            g->ctrl[bit] = (uint8_t)(mixed & 0x7F);
+            g->slots[bit] = item;
+            break;
+        }
+        group = (group + step + 1) & (a->nb_groups - 1);
+    }
+}
+
+static void picohash_oa_array_remove(picohash_oa_array_t* a, picohash_oa_group_t* g, int bit)
+{
+    /* If the group has an empty slot, no probe sequence ever went past it,
+     * and the slot can be marked empty. Otherwise, mark it deleted. */
+    if (picohash_oa_match(g->ctrl, PICOHASH_OA_EMPTY) != 0) {
+        g->ctrl[bit] = PICOHASH_OA_EMPTY;
+        a->nb_used--;
+    }
+    else {
+        g->ctrl[bit] = PICOHASH_OA_DELETED;
+    }
+    g->slots[bit] = NULL;
+}
+
+/* Move a few groups from the previous array to the current one. The moved
+ * slots are marked deleted, not empty, so that the probe sequences of the
+ * items not yet moved are not cut. */
+static void picohash_oa_migrate(picohash_oa_table* t, size_t nb_groups)
+{
+    while (t->previous.nb_groups > 0 && nb_groups > 0) {
+        picohash_oa_group_t* g = &t->previous.groups[t->migrate_index];
+
+        for (int bit = 0; bit < PICOHASH_OA_GROUP_SIZE; bit++) {
+            if ((g->ctrl[bit] & 0x80) == 0) {
+                picohash_oa_array_place(&t->current, g->slots[bit]);
+                g->ctrl[bit] = PICOHASH_OA_DELETED;
+                g->slots[bit] = NULL;
+            }
+        }
+        t->migrate_index++;
+        nb_groups--;
+        if (t->migrate_index >= t->previous.nb_groups) {
+            picohash_oa_array_clear(&t->previous);
+            t->migrate_index = 0;
+        }
+    }
+}
+
+/* Allocate a new array when the current one is too loaded. The size is
+ * doubled, unless most used slots are deleted entries. */
+static int picohash_oa_grow_if_needed(picohash_oa_table* t)
+{
+    int ret = 0;
+    size_t capacity = t->current.nb_groups * PICOHASH_OA_GROUP_SIZE;
+
+    if ((t->current.nb_used + 1) * 8 > capacity * 7) {
+        picohash_oa_array_t larger;
+        size_t nb_items = (t->count + 1) * 2 > capacity ? 2 * capacity : capacity;
+
+        /* Complete a pending migration before starting a new one */
+        picohash_oa_migrate(t, t->previous.nb_groups);
+
+        if ((ret = picohash_oa_array_init(&larger, (nb_items * 7) / 8)) == 0) {
+            t->previous = t->current;
+            t->current = larger;
+            t->migrate_index = 0;
+        }
+    }
+
+    return ret;
+}
+
+picohash_oa_table* picohash_oa_create(size_t nb_items,
+    uint64_t(*picohash_hash)(const void*),
+    int (*picohash_compare)(const void*, const void*),
+    picohash_item* (*picohash_key_to_item)(const void*))
+{
+    picohash_oa_table* t = (picohash_oa_table*)malloc(sizeof(picohash_oa_table));
+
+    if (t != NULL) {
+        memset(t, 0, sizeof(picohash_oa_table));
+        if (picohash_oa_array_init(&t->current, nb_items) != 0) {
+            free(t);
+            t = NULL;
+        }
+        else {
+            t->picohash_hash = picohash_hash;
+            t->picohash_compare = picohash_compare;
+            t->picohash_key_to_item = picohash_key_to_item;
+        }
+    }
+
+    return t;
+}
+
+picohash_item* picohash_oa_retrieve(picohash_oa_table* hash_table, const void* key)
+{
+    uint64_t hash = hash_table->picohash_hash(key);
+    int bit = 0;
+    picohash_oa_group_t* g = picohash_oa_array_find(hash_table, &hash_table->current, key, hash, NULL, &bit);
+
+    if (g == NULL && hash_table->previous.nb_groups > 0) {
+        g = picohash_oa_array_find(hash_table, &hash_table->previous, key, hash, NULL, &bit);
+    }
+
+    return (g == NULL) ? NULL : g->slots[bit];
+}
+
+int picohash_oa_insert(picohash_oa_table* hash_table, const void* key)
+{
+    int ret = 0;
+    picohash_item* item = NULL;
+
+    picohash_oa_migrate(hash_table, PICOHASH_OA_MIGRATE_GROUPS);
+
+    if (picohash_oa_grow_if_needed(hash_table) != 0) {
+        ret = -1;
+    }
+    else if (hash_table->picohash_key_to_item == NULL) {
+        item = (picohash_item*)malloc(sizeof(picohash_item));
+    }
+    else {
+        item = hash_table->picohash_key_to_item(key);
+    }
+
+    if (ret == 0) {
+        if (item == NULL) {
+            ret = -1;
+        }
+        else {
+            item->hash = hash_table->picohash_hash(key);
+            item->key = key;
+            item->next_in_bin = NULL;
+            picohash_oa_array_place(&hash_table->current, item);
+            hash_table->count++;
+        }
+    }
+
+    return ret;
+}
+
+void picohash_oa_delete_item(picohash_oa_table* hash_table, picohash_item* item, int delete_key_too)
+{
+    const void* shall_delete = item->key;
+    int bit = 0;
+    picohash_oa_group_t* g = picohash_oa_array_find(hash_table, &hash_table->current, NULL, item->hash, item, &bit);
+
+    if (g != NULL) {
+        picohash_oa_array_remove(&hash_table->current, g, bit);
+        hash_table->count--;
+    }
+    else if (hash_table->previous.nb_groups > 0 &&
+        (g = picohash_oa_array_find(hash_table, &hash_table->previous, NULL, item->hash, item, &bit)) != NULL) {
+        picohash_oa_array_remove(&hash_table->previous, g, bit);
+        hash_table->count--;
+    }
+
+    if (hash_table->picohash_key_to_item == NULL) {
+        free(item);
+    }
+
+    if (delete_key_too) {
+        free((void*)shall_delete);
+    }
+
+    picohash_oa_migrate(hash_table, PICOHASH_OA_MIGRATE_GROUPS);
+}
+
+void picohash_oa_delete_key(picohash_oa_table* hash_table, void* key, int delete_key_too)
+{
+    picohash_item* item = picohash_oa_retrieve(hash_table, key);
+
+    if (item != NULL) {
+        picohash_oa_delete_item(hash_table, item, delete_key_too);
+    }
+    else if (delete_key_too) {
+        free(key);
+    }
+}
+
+void picohash_oa_delete(picohash_oa_table* hash_table, int delete_key_too)
+{
+    picohash_oa_array_t* arrays[2] = { &hash_table->current, &hash_table->previous };
+
+    for (int i = 0; i < 2; i++) {
+        for (size_t group = 0; group < arrays[i]->nb_groups; group++) {
+            picohash_oa_group_t* g = &arrays[i]->groups[group];
+
+            for (int bit = 0; bit < PICOHASH_OA_GROUP_SIZE; bit++) {
+                if ((g->ctrl[bit] & 0x80) == 0) {
+                    const void* key_to_delete = g->slots[bit]->key;
+
+                    if (hash_table->picohash_key_to_item == NULL) {
+                        free(g->slots[bit]);
+                    }
+                    if (delete_key_too) {
+                        free((void*)key_to_delete);
+                    }
+                }
+            }
+        }
+        picohash_oa_array_clear(arrays[i]);
+    }
+
+    free(hash_table);
+}
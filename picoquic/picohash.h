@@ -68,6 +68,57 @@ void picohash_delete_key(picohash_table* hash_table, void* key, int delete_key_t
 
 void picohash_delete(picohash_table* hash_table, int delete_key_too);
 
+/*
+ * Open addressing hash table, used for the connection lookup tables.
+ * Uses the same item, hash and compare conventions as picohash_table.
+ * Slots are organized in groups of PICOHASH_OA_GROUP_SIZE, each with one
+ * control byte per slot holding 7 bits of the hash. A group with its control
+ * bytes fits in a 64 bytes cache line, so that a lookup typically touches
+ * one line for the group and one for the matching item. Lookups compare the
+ * control bytes of a group in parallel, and call the compare function only
+ * when the stored hash matches. The table grows when the load exceeds 7/8,
+ * and the old slots are migrated a few groups at a time by subsequent
+ * insertions and deletions.
+ */
+#define PICOHASH_OA_GROUP_SIZE 7
+
+typedef struct st_picohash_oa_group_t {
+    uint8_t ctrl[8]; /* The last byte is unused */
+    picohash_item* slots[PICOHASH_OA_GROUP_SIZE];
+} picohash_oa_group_t;
+
+typedef struct st_picohash_oa_array_t {
+    void* allocated;
+    picohash_oa_group_t* groups;
+    size_t nb_groups;
+    size_t nb_used; /* Slots that are either full or deleted */
+} picohash_oa_array_t;
+
+typedef struct picohash_oa_table {
+    picohash_oa_array_t current;
+    picohash_oa_array_t previous; /* Being migrated after a resize */
+    size_t migrate_index;
+    size_t count;
+    uint64_t (*picohash_hash)(const void*);
+    int (*picohash_compare)(const void*, const void*);
+    picohash_item* (*picohash_key_to_item)(const void*);
+} picohash_oa_table;
+
+picohash_oa_table* picohash_oa_create(size_t nb_items,
+    uint64_t(*picohash_hash)(const void*),
+    int (*picohash_compare)(const void*, const void*),
+    picohash_item* (*picohash_key_to_item)(const void*));
+
+picohash_item* picohash_oa_retrieve(picohash_oa_table* hash_table, const void* key);
+
+int picohash_oa_insert(picohash_oa_table* hash_table, const void* key);
+
+void picohash_oa_delete_item(picohash_oa_table* hash_table, picohash_item* item, int delete_key_too);
+
+void picohash_oa_delete_key(picohash_oa_table* hash_table, void* key, int delete_key_too);
+
+void picohash_oa_delete(picohash_oa_table* hash_table, int delete_key_too);
+
 uint64_t picohash_hash_mix(uint64_t hash, uint64_t h2);
 
 uint64_t picohash_bytes(const uint8_t* key, uint32_t length);
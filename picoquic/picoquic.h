@@ -101,6 +101,10 @@ extern "C" {
 #define PICOQUIC_ERROR_PACKET_WRONG_VERSION (PICOQUIC_ERROR_CLASS + 57)
 #define PICOQUIC_ERROR_PORT_BLOCKED (PICOQUIC_ERROR_CLASS + 58)
 #define PICOQUIC_ERROR_DATAGRAM_TOO_LONG (PICOQUIC_ERROR_CLASS + 59)
+#define PICOQUIC_ERROR_INVALID_PRIORITY (PICOQUIC_ERROR_CLASS + 60)
+#define PICOQUIC_ERROR_INITIAL_RATE_LIMITED (PICOQUIC_ERROR_CLASS + 61)
+#define PICOQUIC_ERROR_STATELESS_RETRY (PICOQUIC_ERROR_CLASS + 62)
+#define PICOQUIC_ERROR_DATAGRAM_RING_FULL (PICOQUIC_ERROR_CLASS + 63)
 
 /*
  * Protocol errors defined in the QUIC spec
@@ -258,7 +262,8 @@ typedef enum {
     picoquic_callback_path_available, /* A new path is available, or a suspended path is available again */
     picoquic_callback_path_suspended, /* An available path is suspended */
     picoquic_callback_path_deleted, /* An existing path has been deleted */
-    picoquic_callback_path_quality_changed /* Some path quality parameters have changed */
+    picoquic_callback_path_quality_changed, /* Some path quality parameters have changed */
+    picoquic_callback_datagram_expired /* Datagram in send ring dropped after its deadline; bytes=datagram, len=length */
 } picoquic_call_back_event_t;
 
 typedef struct st_picoquic_tp_prefered_address_t {
@@ -683,10 +688,16 @@ int picoquic_is_local_cid(picoquic_quic_t* quic, picoquic_connection_id_t* cid);
 /* Manage session tickets and retry tokens.
  * There is no explicit call to load tickets, this must be done by passing
  * the ticket store name as an argument to picoquic_create().
+ * The store files are read at the first access to the tickets or tokens.
+ * Saving to the same file appends the changes since the last save, and
+ * only rewrites the file when most of its records are obsolete.
  */
 int picoquic_load_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename);
 int picoquic_save_session_tickets(picoquic_quic_t* quic, char const* ticket_store_filename);
 int picoquic_save_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename);
+/* Set the maximum number of session tickets and retry tokens kept in the stores,
+ * 0 for the default. The least recently used entries are evicted first. */
+void picoquic_set_ticket_store_max(picoquic_quic_t* quic, size_t max_tickets, size_t max_tokens);
 
 /* Manage bdps */
 void picoquic_set_default_bdp_frame_option(picoquic_quic_t* quic, int enable_bdp_frame);
@@ -716,6 +727,154 @@ uint64_t picoquic_get_default_connection_id_ttl(picoquic_quic_t* quic);
 void picoquic_set_mtu_max(picoquic_quic_t* quic, uint32_t mtu_max);
 
 
+/* Packet pool management.
+ * Sent packets are kept in memory until acknowledged. The packet metadata
+ * and the packet bytes are allocated from slabs of fixed size objects, with
+ * several size classes for the packet bytes. The pool retains at most
+ * "max_packets_in_pool" free objects per size class, and returns the
+ * extra slabs to the system. The default is PICOQUIC_DEFAULT_PACKETS_IN_POOL.
+ * The statistics describe the state of each size class.
+ */
+#define PICOQUIC_DEFAULT_PACKETS_IN_POOL 0x2000
+#define PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES 3
+
+typedef struct st_picoquic_pool_class_stats_t {
+    size_t object_size;
+    size_t nb_slabs;
+    size_t nb_slabs_max;
+    size_t nb_in_use;
+    size_t nb_in_use_max;
+    size_t nb_free;
+    size_t bytes_allocated;
+} picoquic_pool_class_stats_t;
+
+typedef struct st_picoquic_packet_pool_stats_t {
+    picoquic_pool_class_stats_t packets;
+    picoquic_pool_class_stats_t bytes[PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES];
+    uint64_t nb_packet_bytes_shrunk;
+    uint64_t nb_stream_bytes_by_reference;
+    size_t bytes_allocated;
+} picoquic_packet_pool_stats_t;
+
+void picoquic_set_max_packets_in_pool(picoquic_quic_t* quic, size_t max_packets_in_pool);
+void picoquic_get_packet_pool_stats(picoquic_quic_t* quic, picoquic_packet_pool_stats_t* stats);
+
+/* Stateless packets (version negotiation, retry, stateless reset) are
+ * prepared in a fixed pool of pre-allocated slots, and dropped if the
+ * pool is full. The pool size can only be changed while no slot is in
+ * use; the function returns -1 otherwise. A size of 0 restores the default.
+ */
+typedef struct st_picoquic_stateless_packet_stats_t {
+    size_t pool_size;
+    size_t nb_in_use;
+    size_t nb_in_use_max;
+    uint64_t nb_queued;
+    uint64_t nb_sent;
+    uint64_t nb_dropped;
+} picoquic_stateless_packet_stats_t;
+
+int picoquic_set_stateless_pool_size(picoquic_quic_t* quic, size_t pool_size);
+void picoquic_get_stateless_packet_stats(picoquic_quic_t* quic, picoquic_stateless_packet_stats_t* stats);
+
+/* Anti-replay protection of new tokens and retry tokens.
+ * The server remembers the tokens that it accepted in a ring of Bloom filters,
+ * using at most "memory_max" bytes, sized so that a fresh token is rejected as
+ * a replay with a probability of 2^-false_positive_log2 at most. Passing 0 selects
+ * the defaults. Changing the parameters clears the filters, so this should be
+ * done before the server accepts connections.
+ * The statistics also describe the server-side record of issued session tickets,
+ * which expire after the ticket lifetime or are evicted when there are more
+ * than the maximum number of connections.
+ */
+typedef struct st_picoquic_anti_replay_stats_t {
+    uint64_t nb_tokens_registered;
+    uint64_t nb_replays_detected;
+    uint64_t nb_tokens_over_capacity;
+    uint64_t nb_tokens_out_of_window;
+    uint64_t nb_buckets_expired;
+    uint64_t nb_tokens_in_filters;
+    uint64_t bucket_capacity;
+    size_t bytes_allocated;
+    size_t nb_issued_tickets;
+    uint64_t nb_issued_tickets_expired;
+    uint64_t nb_issued_tickets_evicted;
+} picoquic_anti_replay_stats_t;
+
+void picoquic_set_anti_replay_parameters(picoquic_quic_t* quic, size_t memory_max, unsigned int false_positive_log2);
+void picoquic_get_anti_replay_stats(picoquic_quic_t* quic, picoquic_anti_replay_stats_t* stats);
+
+/* Memory accounting and memory budget.
+ * The stack counts the bytes held in the stream send queues, in the stream
+ * reassembly trees and in the packets queued for retransmission, per connection
+ * and for the whole context. If a memory budget is set, the flow control windows
+ * advertised to the peers shrink once the total exceeds half the budget, and new
+ * connections are refused with SERVER_BUSY while it exceeds the budget.
+ * A budget of 0 means no limit, which is the default.
+ * The packet pool bytes and the count of refused connections are only
+ * reported for the context.
+ */
+typedef struct st_picoquic_memory_stats_t {
+    uint64_t send_queue_bytes;
+    uint64_t reassembly_bytes;
+    uint64_t retransmit_bytes;
+    uint64_t total_bytes;
+    uint64_t packet_pool_bytes;
+    uint64_t memory_budget;
+    uint64_t nb_cnx_refused;
+} picoquic_memory_stats_t;
+
+void picoquic_set_memory_budget(picoquic_quic_t* quic, uint64_t memory_budget);
+void picoquic_get_memory_stats(picoquic_quic_t* quic, picoquic_memory_stats_t* stats);
+void picoquic_get_cnx_memory_stats(picoquic_cnx_t* cnx, picoquic_memory_stats_t* stats);
+
+/* Auto tuning of the receive flow control windows.
+ * When enabled, the connection and stream windows advertised in MAX_DATA and
+ * MAX_STREAM_DATA frames start at the values of the transport parameters, and
+ * grow once per RTT to twice the amount of data that the application consumed
+ * during the previous RTT, up to "window_max". The windows are reduced when
+ * the memory budget is under pressure (see picoquic_set_memory_budget).
+ * Setting "window_max" to 0 disables the auto tuning, which is the default.
+ * The statistics count the DATA_BLOCKED and STREAM_DATA_BLOCKED frames received
+ * from the peer, i.e., how often the peer was blocked by the local windows,
+ * and those sent to the peer.
+ */
+typedef struct st_picoquic_flow_control_stats_t {
+    uint64_t max_data_window;
+    uint64_t nb_window_increases;
+    uint64_t nb_data_blocked_received;
+    uint64_t nb_stream_data_blocked_received;
+    uint64_t nb_data_blocked_sent;
+    uint64_t nb_stream_data_blocked_sent;
+} picoquic_flow_control_stats_t;
+
+void picoquic_set_flow_control_autotune(picoquic_quic_t* quic, uint64_t window_max);
+void picoquic_get_flow_control_stats(picoquic_cnx_t* cnx, picoquic_flow_control_stats_t* stats);
+
+/* Protection against floods of Initial packets.
+ * The server limits the rate of Initial packets that would create a connection
+ * to "initial_rate" per second for each source prefix (IPv4 /24, IPv6 /48),
+ * with bursts of up to "initial_burst" packets. Packets above the rate are
+ * dropped before any connection context is created. A rate of 0 disables the
+ * limit, which is the default.
+ * The application reports the load of the server, in per mille, for example
+ * the CPU usage. When the load reaches "retry_load_threshold", the server
+ * answers every Initial packet without a valid token with a stateless retry, again
+ * without creating a connection context. A threshold of 0 disables this mode.
+ * The function returns -1 if the rate limit table cannot be allocated.
+ */
+typedef struct st_picoquic_admission_stats_t {
+    uint64_t nb_initials_checked;
+    uint64_t nb_admitted;
+    uint64_t nb_rate_limited;
+    uint64_t nb_stateless_retry;
+    uint32_t load_permille;
+} picoquic_admission_stats_t;
+
+int picoquic_set_admission_parameters(picoquic_quic_t* quic, uint64_t initial_rate, uint64_t initial_burst,
+    uint32_t retry_load_threshold);
+void picoquic_set_admission_load(picoquic_quic_t* quic, uint32_t load_permille);
+void picoquic_get_admission_stats(picoquic_quic_t* quic, picoquic_admission_stats_t* stats);
+
 /* Set the ALPN function used to verify incoming ALPN */
 void picoquic_set_alpn_select_fn(picoquic_quic_t* quic, picoquic_alpn_select_fn alpn_select_fn);
 
@@ -926,6 +1085,25 @@ picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_
 
 uint64_t picoquic_get_next_wake_time(picoquic_quic_t* quic, uint64_t current_time);
 
+/* Selection of the scheduler used to find the next connection to wake.
+ * The default splay tree keeps connections exactly sorted by wake time.
+ * The timing wheel provides O(1) insertion and expiry, which scales better
+ * with large numbers of connections. When using the wheel, the
+ * connections that become due in the same microsecond are served in
+ * arrival order, and picoquic_get_next_wake_time may return a time slightly
+ * earlier than the actual next wake time.
+ */
+typedef enum {
+    picoquic_wake_scheduler_splay = 0,
+    picoquic_wake_scheduler_wheel
+} picoquic_wake_scheduler_enum;
+
+void picoquic_set_wake_scheduler(picoquic_quic_t* quic, picoquic_wake_scheduler_enum scheduler, uint64_t current_time);
+picoquic_wake_scheduler_enum picoquic_get_wake_scheduler(picoquic_quic_t* quic);
+/* Get up to nb_max connections due at current time, returns the number found. */
+size_t picoquic_get_cnx_to_wake_batch(picoquic_quic_t* quic, uint64_t current_time,
+    picoquic_cnx_t** cnx_array, size_t nb_max);
+
 picoquic_state_enum picoquic_get_cnx_state(picoquic_cnx_t* cnx);
 
 void picoquic_cnx_set_padding_policy(picoquic_cnx_t * cnx, uint32_t padding_multiple, uint32_t padding_minsize);
@@ -992,6 +1170,36 @@ int picoquic_queue_misc_frame(picoquic_cnx_t* cnx, const uint8_t* bytes, size_t
 #define PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH 1200
 int picoquic_queue_datagram_frame(picoquic_cnx_t* cnx, size_t length, const uint8_t* bytes);
 
+/* Datagram send ring.
+ * picoquic_set_datagram_ring allocates a ring of "nb_slots" slots of
+ * PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH bytes for the connection. Setting 0 slots
+ * releases the ring. The ring cannot be resized while datagrams are queued.
+ * picoquic_get_datagram_ring_buffer queues a datagram of "length" bytes and
+ * returns the slot buffer, in which the application writes the datagram
+ * before returning control to the stack. It returns NULL if the ring is full
+ * or if the length is too large. Datagrams are sent by increasing "priority",
+ * in order of queuing for the same priority; if a datagram does not fit in
+ * the packet, smaller datagrams are sent first. The priority is compared to stream
+ * priorities as set by picoquic_set_datagram_priority. Datagrams still queued
+ * at their "deadline" are dropped, and reported with the callback event
+ * picoquic_callback_datagram_expired. Use UINT64_MAX for no deadline. The
+ * application may queue a replacement from that callback, but not resize the ring.
+ * Once the ring is set, picoquic_queue_datagram_frame copies datagrams into
+ * the ring with no deadline and the connection datagram priority, and returns
+ * PICOQUIC_ERROR_DATAGRAM_RING_FULL if no slot is available.
+ */
+typedef struct st_picoquic_datagram_ring_stats_t {
+    uint64_t nb_slots;
+    uint64_t nb_queued;
+    uint64_t nb_sent;
+    uint64_t nb_expired;
+    uint64_t nb_refused;
+} picoquic_datagram_ring_stats_t;
+
+int picoquic_set_datagram_ring(picoquic_cnx_t* cnx, size_t nb_slots);
+uint8_t* picoquic_get_datagram_ring_buffer(picoquic_cnx_t* cnx, size_t length, uint64_t deadline, uint8_t priority);
+void picoquic_get_datagram_ring_stats(picoquic_cnx_t* cnx, picoquic_datagram_ring_stats_t* stats);
+
 /* The incoming packet API is used to pass incoming packets to a 
  * Quic context. The API handles the decryption of the packets
  * and their processing in the context of connections.
@@ -1018,6 +1226,27 @@ int picoquic_incoming_packet_ex(
     picoquic_cnx_t** first_cnx,
     uint64_t current_time);
 
+/* Batch version of the incoming packet API, for use when the socket loop
+ * receives several datagrams at once, e.g., with recvmmsg or GRO. Successive
+ * 1-RTT datagrams with the same destination CID are processed as one batch:
+ * the connection is found once and the header protection masks are computed
+ * together. The packets are still decrypted and processed in order.
+ */
+typedef struct st_picoquic_incoming_datagram_t {
+    uint8_t* bytes;
+    size_t length;
+    struct sockaddr* addr_from;
+    struct sockaddr* addr_to;
+    int if_index_to;
+    unsigned char received_ecn;
+} picoquic_incoming_datagram_t;
+
+int picoquic_incoming_packet_batch(
+    picoquic_quic_t* quic,
+    picoquic_incoming_datagram_t* datagrams,
+    size_t nb_datagrams,
+    uint64_t current_time);
+
 /* Applications must regularly poll the "next packet" API to obtain the
  * next packet that will be set over the network. The API for that is
  * picoquic_prepare_next_packet", which operates on a "quic context".
@@ -1173,6 +1402,32 @@ int picoquic_set_stream_priority(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_
 int picoquic_mark_high_priority_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, int is_high_priority);
 
+/*
+ * Extensible priorities, as defined in RFC 9218.
+ *
+ * The urgency ranges from 0 (most urgent) to 7, with a default of 3. It
+ * is mapped to a pair of priority levels: an odd level (FIFO) for the
+ * non incremental streams, followed by an even level (round robin) for
+ * the incremental streams. Urgency 0 maps to priorities 3 and 4, urgency 7
+ * to priorities 17 and 18, and the default urgency 3 maps non incremental
+ * streams to PICOQUIC_DEFAULT_STREAM_PRIORITY. Non incremental streams are
+ * thus sent one at a time in order of stream ID, before the incremental
+ * streams of the same urgency.
+ *
+ * In round robin levels, the stream weight sets how many bytes a stream
+ * may send before yielding to the next one, in units of
+ * PICOQUIC_STREAM_WEIGHT_QUANTUM bytes. The default weight 0 yields
+ * after each stream frame, which was the behavior before weights were
+ * introduced.
+ */
+#define PICOQUIC_URGENCY_MAX 7
+#define PICOQUIC_URGENCY_DEFAULT 3
+#define PICOQUIC_STREAM_PRIORITY_FROM_URGENCY(urgency, is_incremental) ((uint8_t)(2*(urgency) + (((is_incremental) != 0) ? 4 : 3)))
+#define PICOQUIC_STREAM_WEIGHT_QUANTUM 1024
+
+int picoquic_set_stream_urgency(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t urgency, int is_incremental);
+int picoquic_set_stream_weight(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t weight);
+
 /* 
 * Handling of datagram priorities
 * 
@@ -1232,6 +1487,19 @@ void picoquic_reset_stream_ctx(picoquic_cnx_t* cnx, uint64_t stream_id);
  */
 int picoquic_add_to_stream_with_ctx(picoquic_cnx_t * cnx, uint64_t stream_id, const uint8_t * data, size_t length, int set_fin, void * app_stream_ctx);
 
+/* Zero copy variant of picoquic_add_to_stream_with_ctx. The stack keeps a
+ * reference to the data instead of copying it, and the STREAM frames are
+ * copied directly from that buffer when packets are formatted. Once all
+ * the data has been sent (acknowledged, if retransmission by reference is
+ * enabled), or if the stream is reset or deleted, the stack
+ * calls release_fn(release_ctx, data). If release_fn is NULL, the buffer
+ * must have been allocated with malloc() and is released with free().
+ * If the call returns an error, the buffer remains owned by the application.
+ */
+typedef void (*picoquic_stream_data_release_fn)(void* release_ctx, uint8_t* data);
+int picoquic_add_to_stream_zero_copy(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* data, size_t length,
+    int set_fin, void* app_stream_ctx, picoquic_stream_data_release_fn release_fn, void* release_ctx);
+
 /* Reset a stream, indicating that no more data will be sent on 
  * that stream and that any data currently queued can be abandoned. */
 int picoquic_reset_stream(picoquic_cnx_t* cnx,
@@ -1354,6 +1622,38 @@ void picoquic_set_optimistic_ack_policy(picoquic_quic_t* quic, uint32_t sequence
 void picoquic_set_preemptive_repeat_policy(picoquic_quic_t* quic, int do_repeat);
 void picoquic_set_preemptive_repeat_per_cnx(picoquic_cnx_t* cnx, int do_repeat);
 
+/* Retransmission by reference. When enabled, the stream data queued by
+ * the application is kept in the stream until it is acknowledged, and
+ * the sent packets only keep a short reference to the stream data
+ * instead of a copy. This reduces the memory used by the retransmission
+ * queue at high BDP. Data provided directly through
+ * picoquic_provide_stream_data_buffer is not kept by reference. */
+void picoquic_set_retransmit_by_reference_policy(picoquic_quic_t* quic, int by_reference);
+void picoquic_set_retransmit_by_reference_per_cnx(picoquic_cnx_t* cnx, int by_reference);
+
+/* Batch protection of packet trains. When enabled, the 1-RTT packets of a
+ * train prepared with picoquic_prepare_next_packet_ex (or with a non NULL
+ * send_msg_size) are encrypted together at the end of the train, then the
+ * header protection masks are computed and applied. Returns
+ * PICOQUIC_ERROR_MEMORY if the batch context cannot be allocated. */
+int picoquic_set_protect_batch_policy(picoquic_quic_t* quic, int do_batch);
+
+/* Borrowing of received stream data. If borrowing is enabled, the application
+ * may call picoquic_retain_stream_data while processing a
+ * picoquic_callback_stream_data or picoquic_callback_stream_fin event, passing
+ * the "bytes" pointer of the event. The stack then keeps the underlying packet
+ * or data chunk until the application calls picoquic_release_stream_data,
+ * so the data can be forwarded without an intermediate copy. The function
+ * returns NULL if borrowing is not enabled or not possible, in which case
+ * the data has to be copied as usual. All retained data must be released
+ * before the QUIC context is deleted.
+ */
+typedef struct st_picoquic_stream_data_node_t picoquic_stream_data_ref_t;
+void picoquic_set_default_stream_data_borrowing(picoquic_quic_t* quic, int enabled);
+void picoquic_set_stream_data_borrowing(picoquic_cnx_t* cnx, int enabled);
+picoquic_stream_data_ref_t* picoquic_retain_stream_data(picoquic_cnx_t* cnx, const uint8_t* bytes);
+void picoquic_release_stream_data(picoquic_stream_data_ref_t* stream_data_ref);
+
 /* Enables keep alive for a connection.
  * Keep alive interval is expressed in microseconds.
  * If `interval` is `0`, it is set to `idle_timeout / 2`.
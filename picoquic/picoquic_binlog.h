@@ -112,6 +112,20 @@ int picoquic_set_binlog(picoquic_quic_t* quic, char const* binlog_dir);
 /* Enable binary logs, e.g. if autoqlog is requests */
 void picoquic_enable_binlog(picoquic_quic_t* quic);
 
+/* Write the binary logs from a background thread. The protocol thread
+ * queues the encoded events in a ring of ring_size bytes, rounded up to a
+ * power of 2. The drop policy specifies whether events that do not fit
+ * in the ring are dropped, or whether the protocol thread waits for the
+ * writer. Set ring_size to 0 to revert to synchronous writes, after all
+ * queued events are written. If qlog conversion is enabled, the writer
+ * thread also converts the log of each connection after closing it.
+ */
+int picoquic_set_binlog_async(picoquic_quic_t* quic, size_t ring_size, picoquic_binlog_drop_policy_enum drop_policy);
+
+/* Get the counters of the asynchronous log writer. Returns -1 if the
+ * logs are written synchronously. */
+int picoquic_get_binlog_async_stats(picoquic_quic_t* quic, picoquic_binlog_async_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,7 +47,7 @@ extern "C" {
 #define PICOQUIC_DEFAULT_0RTT_WINDOW (10*PICOQUIC_ENFORCED_INITIAL_MTU)
 #define PICOQUIC_NB_PATH_TARGET 8
 #define PICOQUIC_NB_PATH_DEFAULT 2
-#define PICOQUIC_MAX_PACKETS_IN_POOL 0x2000
+#define PICOQUIC_MAX_PACKETS_IN_POOL PICOQUIC_DEFAULT_PACKETS_IN_POOL
 #define PICOQUIC_STORED_IP_MAX 16
 
 #define PICOQUIC_INITIAL_RTT 250000ull /* 250 ms */
@@ -141,6 +141,7 @@ typedef enum {
     picoquic_frame_type_connection_close = 0x1c,
     picoquic_frame_type_application_close = 0x1d,
     picoquic_frame_type_handshake_done = 0x1e,
+    picoquic_frame_type_stream_ref = 0x1f, /* Internal only, never sent: see picoquic_compact_sent_packet */
     picoquic_frame_type_datagram = 0x30,
     picoquic_frame_type_datagram_l = 0x31,
     picoquic_frame_type_ack_frequency = 0xAF,
@@ -326,10 +327,18 @@ extern picoquic_spinbit_def_t picoquic_spin_function_table[];
 /*
 * The stateless packet structure is used to temporarily store
 * stateless packets before they can be sent by servers.
+* The version negotiation, retry, stateless reset and immediate close
+* packets are carved out of a fixed pool of slots, allocated once when
+* first needed. If all slots are in use, new stateless packets are dropped,
+* as the network would drop them. The same structure is used to stash
+* packets received before the keys are available; these are allocated
+* separately, so they do not compete with the stateless responses.
 */
+#define PICOQUIC_STATELESS_POOL_SIZE_DEFAULT 64
 
 typedef struct st_picoquic_stateless_packet_t {
     struct st_picoquic_stateless_packet_t* next_packet;
+    picoquic_quic_t* pool_quic; /* Context owning the slot, NULL if not from the pool */
     struct sockaddr_storage addr_to;
     struct sockaddr_storage addr_local;
     int if_index_local;
@@ -345,11 +354,24 @@ typedef struct st_picoquic_stateless_packet_t {
 
 /* Handling of stateless packets */
 picoquic_stateless_packet_t* picoquic_create_stateless_packet(picoquic_quic_t* quic);
+picoquic_stateless_packet_t* picoquic_create_sooner_packet(void);
 void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_packet_t* sp);
 picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic);
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp);
 
-/* Data structure used to hold chunk of stream data before in sequence delivery */
+/* Data structure used to hold chunk of stream data before in sequence delivery.
+ * Nodes obtained from picoquic_stream_data_node_alloc hold a full packet, and
+ * are used to receive and decrypt packets. Out of order fragments that are too
+ * small to justify keeping the whole packet are copied into "compact" nodes,
+ * allocated with just "data_max" bytes of data, and merged with adjacent
+ * compact nodes up to PICOQUIC_STREAM_DATA_CHUNK_MAX bytes.
+ * If stream data borrowing is enabled, the application may retain the node
+ * from which data is delivered. The node is only recycled when both the stack
+ * and the application have released it.
+ */
+#define PICOQUIC_STREAM_DATA_PIN_MIN 512
+#define PICOQUIC_STREAM_DATA_CHUNK_MAX 4096
+
 typedef struct st_picoquic_stream_data_node_t {
     picosplay_node_t stream_data_node;
     picoquic_quic_t* quic;
@@ -357,6 +379,12 @@ typedef struct st_picoquic_stream_data_node_t {
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
     const uint8_t* bytes;
+    unsigned int is_compact : 1; /* Allocated with data_max bytes of data */
+    unsigned int is_released_by_stack : 1; /* Recycle deferred until application releases */
+    uint32_t nb_borrowed; /* Number of references held by the application */
+    size_t data_max;
+    picoquic_cnx_t* accounted_cnx; /* Connection charged for the node while in a reassembly tree */
+    size_t accounted_bytes;
     uint8_t data[PICOQUIC_MAX_PACKET_SIZE];
 } picoquic_stream_data_node_t;
 
@@ -364,16 +392,196 @@ typedef struct st_picoquic_stream_data_node_t {
 typedef struct st_picoquic_stream_queue_node_t {
     picoquic_quic_t* quic;
     struct st_picoquic_stream_queue_node_t* next_stream_data;
-    uint64_t offset;  /* Stream offset of the first octet in "bytes" */
+    uint64_t offset;  /* Number of octets of "bytes" already sent */
+    uint64_t stream_offset; /* Stream offset of the first octet in "bytes", set once fully sent */
     size_t length;    /* Number of octets in "bytes" */
     uint8_t* bytes;
+    picoquic_stream_data_release_fn release_fn; /* Releases "bytes" if not NULL, else free() */
+    void* release_ctx;
+    picoquic_cnx_t* accounted_cnx; /* Connection charged for the node */
+    size_t accounted_bytes;
 } picoquic_stream_queue_node_t;
 
+void picoquic_stream_queue_node_free(picoquic_stream_queue_node_t* stream_data);
+
+/* Memory accounting.
+ * The bytes held by a connection are charged to the connection and to the
+ * context when a structure is queued, and released when it is freed. The
+ * structures record the charged connection, which is only valid while the
+ * connection exists: all charged structures are released when the
+ * connection is deleted.
+ */
+typedef enum {
+    picoquic_memory_send_queue = 0,
+    picoquic_memory_reassembly,
+    picoquic_memory_retransmit,
+    picoquic_memory_nb_categories
+} picoquic_memory_category_enum;
+
+#define PICOQUIC_MEMORY_PRESSURE_WINDOW_MIN 0x4000
+
+void picoquic_memory_account(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t bytes);
+void picoquic_memory_release(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t bytes);
+uint64_t picoquic_memory_total(const uint64_t* memory_bytes);
+int picoquic_is_memory_budget_exceeded(picoquic_quic_t* quic);
+uint64_t picoquic_memory_pressure_window(picoquic_quic_t* quic, uint64_t window);
+
+/* Auto tuning of the receive flow control windows.
+ * Once per RTT, the bytes drained by the application during the past epoch
+ * give a sample of the rate at which the flow could proceed. The window
+ * grows to twice that sample, so that it covers a full RTT of data plus the
+ * growth of the sender during the next RTT. The window never shrinks below
+ * its initial value, is capped by "fc_autotune_window_max", and is then
+ * scaled down by the memory pressure.
+ */
+#define PICOQUIC_FC_AUTOTUNE_RTT_MIN 1000
+
+typedef struct st_picoquic_fc_autotune_t {
+    uint64_t window;
+    uint64_t epoch_time;
+    uint64_t epoch_drained;
+} picoquic_fc_autotune_t;
+
+uint64_t picoquic_fc_autotune_window(picoquic_cnx_t* cnx, picoquic_fc_autotune_t* fc, uint64_t drained,
+    uint64_t window_min, uint64_t current_time);
+
+/* Slab allocator, used by the packet pool.
+ * Objects of the same size class are carved out of slabs of
+ * PICOQUIC_SLAB_NB_OBJECTS objects. Allocation and release are O(1). When
+ * all the objects in a slab are free and the class retains more than
+ * nb_free_max free objects, the slab is returned to the system.
+ */
+#define PICOQUIC_SLAB_NB_OBJECTS 32
+
+typedef struct st_picoquic_slab_t picoquic_slab_t;
+
+typedef struct st_picoquic_slab_class_t {
+    size_t object_size;
+    size_t nb_free_max;
+    picoquic_slab_t* first_available;
+    picoquic_slab_t* first_full;
+    size_t nb_slabs;
+    size_t nb_slabs_max;
+    size_t nb_in_use;
+    size_t nb_in_use_max;
+    size_t nb_free;
+} picoquic_slab_class_t;
+
+void picoquic_slab_class_init(picoquic_slab_class_t* sc, size_t object_size, size_t nb_free_max);
+void* picoquic_slab_alloc(picoquic_slab_class_t* sc);
+void picoquic_slab_free(picoquic_slab_class_t* sc, void* object);
+void picoquic_slab_class_clear(picoquic_slab_class_t* sc);
+size_t picoquic_slab_class_bytes(picoquic_slab_class_t* sc);
+
+/* Hierarchical timing wheel, used as alternative to the splay tree for
+ * scheduling connection wake up. Insert, remove and expiry are O(1).
+ * Nodes with a wake time not later than the current time of the wheel
+ * are kept in the "due" list, in the order in which they became due.
+ */
+#define PICOQUIC_WHEEL_LEVEL_BITS 6
+#define PICOQUIC_WHEEL_LEVEL_SLOTS (1 << PICOQUIC_WHEEL_LEVEL_BITS)
+#define PICOQUIC_WHEEL_NB_LEVELS 5
+#define PICOQUIC_WHEEL_SLOT_NONE 0
+#define PICOQUIC_WHEEL_SLOT_DUE (1 + PICOQUIC_WHEEL_NB_LEVELS*PICOQUIC_WHEEL_LEVEL_SLOTS)
+#define PICOQUIC_WHEEL_SLOT_OVERFLOW (PICOQUIC_WHEEL_SLOT_DUE + 1)
+#define PICOQUIC_WHEEL_SLOT_NEVER (PICOQUIC_WHEEL_SLOT_DUE + 2)
+#define PICOQUIC_WHEEL_NB_SLOTS (PICOQUIC_WHEEL_SLOT_DUE + 3)
+
+typedef struct st_picoquic_wheel_node_t {
+    struct st_picoquic_wheel_node_t* next;
+    struct st_picoquic_wheel_node_t* previous;
+    uint64_t wake_time;
+    int slot;
+} picoquic_wheel_node_t;
+
+typedef struct st_picoquic_wheel_t {
+    uint64_t current_time;
+    uint64_t overflow_min;
+    uint64_t occupied[PICOQUIC_WHEEL_NB_LEVELS];
+    picoquic_wheel_node_t* first[PICOQUIC_WHEEL_NB_SLOTS];
+    picoquic_wheel_node_t* last_due;
+    size_t nb_nodes;
+} picoquic_wheel_t;
+
+void picoquic_wheel_init(picoquic_wheel_t* wheel, uint64_t current_time);
+void picoquic_wheel_insert(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node, uint64_t wake_time);
+void picoquic_wheel_remove(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node);
+void picoquic_wheel_advance(picoquic_wheel_t* wheel, uint64_t current_time);
+picoquic_wheel_node_t* picoquic_wheel_first_due(picoquic_wheel_t* wheel);
+uint64_t picoquic_wheel_next_time(picoquic_wheel_t* wheel);
+picoquic_wheel_node_t* picoquic_wheel_earliest(picoquic_wheel_t* wheel);
+
+/* Callback for converting binary log to quic log at the end of a connection. 
+ * This is kept private for now; and will only be set through the "set quic log"
+ * API. The request copies the connection parameters used by the conversion,
+ * so that it can run after the connection is deleted.
+ */
+typedef struct st_picoquic_autoqlog_request_t {
+    picoquic_connection_id_t cid;
+    char const* binlog_file_name;
+    char const* qlog_dir;
+    uint16_t log_unique;
+    unsigned int client_mode : 1;
+    unsigned int use_unique_log_names : 1;
+    unsigned int delete_binlog : 1;
+} picoquic_autoqlog_request_t;
+
+typedef int (*picoquic_autoqlog_fn)(picoquic_autoqlog_request_t const* request);
+
+/* Asynchronous binary log ring.
+ * The protocol thread appends the encoded log events to a single producer
+ * ring, and a background thread drains the ring to the log files. The
+ * memory used by the ring is bounded by its size. When an event does not
+ * fit, it is either dropped, or the protocol thread waits for the writer
+ * to free space, depending on the drop policy. Requests to close a file
+ * are never dropped, so that files are closed after their last event.
+ * A close request may carry a qlog conversion, which the writer thread
+ * runs after closing the file.
+ */
+#define PICOQUIC_BINLOG_RING_SIZE_MIN 0x4000
+#define PICOQUIC_BINLOG_RING_SIZE_DEFAULT 0x400000
+#define PICOQUIC_BINLOG_RING_STAGING_SIZE 0x10000
+
+typedef enum {
+    picoquic_binlog_drop_newest = 0, /* drop the events that do not fit in the ring */
+    picoquic_binlog_wait_for_space /* block the protocol thread until space is available */
+} picoquic_binlog_drop_policy_enum;
+
+typedef struct st_picoquic_binlog_async_stats_t {
+    size_t ring_size;
+    size_t bytes_queued_max;
+    uint64_t nb_events_queued;
+    uint64_t nb_bytes_queued;
+    uint64_t nb_events_dropped;
+    uint64_t nb_bytes_dropped;
+    uint64_t nb_producer_waits;
+    uint64_t nb_writes;
+    uint64_t nb_bytes_written;
+    uint64_t nb_files_closed;
+} picoquic_binlog_async_stats_t;
+
+typedef struct st_picoquic_binlog_ring_t picoquic_binlog_ring_t;
+
+picoquic_binlog_ring_t* picoquic_binlog_ring_create(size_t ring_size, picoquic_binlog_drop_policy_enum drop_policy);
+int picoquic_binlog_ring_write(picoquic_binlog_ring_t* ring, FILE* f, const uint8_t* head, size_t head_length,
+    const uint8_t* msg, size_t msg_length);
+void picoquic_binlog_ring_close_file(picoquic_binlog_ring_t* ring, FILE* f,
+    picoquic_autoqlog_fn autoqlog_fn, picoquic_autoqlog_request_t const* request);
+void picoquic_binlog_ring_flush(picoquic_binlog_ring_t* ring);
+void picoquic_binlog_ring_get_stats(picoquic_binlog_ring_t* ring, picoquic_binlog_async_stats_t* stats);
+void picoquic_binlog_ring_delete(picoquic_binlog_ring_t* ring);
+
 /*
  * The simple packet structure is used to store packets that
  * have been sent but are not yet acknowledged.
  * Packets are stored in unencrypted format.
  * The checksum length is the difference between encrypted and unencrypted.
+ * The packet metadata and the packet bytes are allocated separately from
+ * the packet pool. Packets are created with a buffer of PICOQUIC_MAX_PACKET_SIZE
+ * bytes, and the content is moved to a buffer of the smallest fitting size class
+ * when the packet is queued for retransmission, so that ACK and small control
+ * packets do not hold a full size buffer while waiting for acknowledgement.
+ * If bytes_max is zero, the bytes are not managed by the packet pool.
  */
 
 typedef struct st_picoquic_packet_t {
@@ -417,23 +625,159 @@ typedef struct st_picoquic_packet_t {
     unsigned int is_queued_for_retransmit : 1;
     unsigned int is_queued_for_spurious_detection : 1;
     unsigned int is_queued_for_data_repeat : 1;
+    unsigned int is_from_pool : 1;
 
-    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    size_t compacted_length; /* Stream data removed from "bytes" by picoquic_compact_sent_packet */
+    size_t bytes_max;
+    uint8_t* bytes;
+    picoquic_cnx_t* accounted_cnx; /* Connection charged for the packet once queued for retransmit */
+    size_t accounted_bytes;
 } picoquic_packet_t;
 
+/* Length of the packet when it was sent, excluding the checksum */
+#define PICOQUIC_PACKET_SENT_LENGTH(p) ((p)->length + (p)->compacted_length)
+
 picoquic_packet_t* picoquic_create_packet(picoquic_quic_t* quic);
 void picoquic_recycle_packet(picoquic_quic_t* quic, picoquic_packet_t* packet);
+void picoquic_packet_pool_init(picoquic_quic_t* quic);
+void picoquic_packet_pool_clear(picoquic_quic_t* quic);
+void picoquic_packet_shrink_bytes(picoquic_quic_t* quic, picoquic_packet_t* packet);
+void picoquic_compact_sent_packet(picoquic_cnx_t* cnx, picoquic_packet_t* packet);
+
+/* Batch of 1-RTT packets waiting for protection in the send buffer. When
+ * a train of packets is prepared, the packet headers and the clear text
+ * payloads are written in the send buffer, and the AEAD encryption and the
+ * header protection are applied to the whole train before it is sent.
+ */
+#define PICOQUIC_PROTECT_BATCH_MAX 64
+#define PICOQUIC_HP_SAMPLE_SIZE 16
+
+typedef struct st_picoquic_protect_batch_packet_t {
+    uint8_t* bytes; /* Start of the packet in the send buffer */
+    size_t header_length;
+    size_t pn_offset;
+    size_t payload_length; /* Clear text, excluding header and checksum */
+    uint64_t sequence_number;
+    uint64_t path_id;
+    uint8_t first_mask;
+    unsigned int is_multipath : 1;
+    /* Logging after encryption, if the connection is logging */
+    picoquic_cnx_t* log_cnx;
+    picoquic_path_t* log_path;
+    size_t log_pn_length;
+    uint64_t log_time;
+} picoquic_protect_batch_packet_t;
+
+typedef struct st_picoquic_protect_batch_t {
+    void* aead_context;
+    void* pn_enc;
+    size_t nb_packets;
+    unsigned int is_open : 1; /* A train is being prepared */
+    uint64_t nb_batches;
+    uint64_t nb_packets_batched;
+    picoquic_protect_batch_packet_t packets[PICOQUIC_PROTECT_BATCH_MAX];
+    uint8_t samples[PICOQUIC_PROTECT_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+    uint8_t masks[PICOQUIC_PROTECT_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+    uint8_t log_clear[PICOQUIC_MAX_PACKET_SIZE]; /* Clear text copy of a logged packet */
+} picoquic_protect_batch_t;
+
+void picoquic_protect_batch_init(picoquic_protect_batch_t* batch, void* aead_context, void* pn_enc);
+int picoquic_protect_batch_add(picoquic_protect_batch_t* batch, uint8_t* bytes, size_t header_length,
+    size_t pn_offset, size_t payload_length, uint64_t sequence_number, uint8_t first_mask,
+    int is_multipath, uint64_t path_id);
+void picoquic_protect_batch_apply(picoquic_protect_batch_t* batch);
+void picoquic_protect_batch_flush(picoquic_quic_t* quic);
+
+/* Batch of received 1-RTT datagrams with the same destination CID, see
+ * picoquic_incoming_packet_batch. The connection is looked up once and the
+ * header protection masks of all the packets are computed together.
+ * The packets are then processed in order, each one using the connection
+ * and the mask prepared for its address in the receive buffer.
+ */
+typedef struct st_picoquic_unprotect_batch_t {
+    picoquic_cnx_t* cnx;
+    struct st_picoquic_local_cnxid_t* l_cid;
+    void* pn_dec; /* Key used to compute the masks, NULL if not computed */
+    const uint8_t* bytes; /* Packet being processed, NULL if none */
+    const uint8_t* mask;
+    uint64_t nb_batches;
+    uint64_t nb_packets_batched;
+    uint8_t samples[PICOQUIC_PROTECT_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+    uint8_t masks[PICOQUIC_PROTECT_BATCH_MAX * PICOQUIC_HP_SAMPLE_SIZE];
+} picoquic_unprotect_batch_t;
 
 /* Definition of the token register used to prevent repeated usage of
  * the same new token, retry token, or session ticket.
+ * The tokens are registered in a ring of Bloom filters, one per time bucket,
+ * selected by the expiry time of the token. The ring covers the longest token
+ * lifetime, and a bucket is cleared in one step when all the tokens that it
+ * holds have expired. The size of the filters is set by the memory cap, and
+ * the number of hash functions by the false positive budget. The budget is
+ * only met up to the capacity of the bucket; the tokens registered beyond
+ * that are counted as "over capacity".
  */
-
-typedef struct st_picoquic_registered_token_t {
-    picosplay_node_t registered_token_node;
-    uint64_t token_time;
-    uint64_t token_hash; /* The last 8 bytes of the token, normally taken from AEAD checksum */
-    int count;
-} picoquic_registered_token_t;
+#define PICOQUIC_ANTI_REPLAY_NB_BUCKETS 16
+#define PICOQUIC_ANTI_REPLAY_MEMORY_DEFAULT 0x400000 /* 4 MB */
+#define PICOQUIC_ANTI_REPLAY_FP_LOG2_DEFAULT 16 /* one false positive per 65536 tokens */
+#define PICOQUIC_ANTI_REPLAY_FP_LOG2_MAX 32
+
+typedef struct st_picoquic_anti_replay_bucket_t {
+    uint64_t epoch; /* expiry time of the tokens divided by the bucket duration */
+    uint64_t nb_tokens;
+} picoquic_anti_replay_bucket_t;
+
+typedef struct st_picoquic_anti_replay_t {
+    uint64_t* bits;
+    size_t nb_words_per_bucket;
+    uint64_t bucket_duration;
+    uint64_t bucket_capacity;
+    unsigned int nb_hashes;
+    size_t memory_max;
+    unsigned int false_positive_log2;
+    picoquic_anti_replay_bucket_t buckets[PICOQUIC_ANTI_REPLAY_NB_BUCKETS];
+    uint64_t nb_tokens_registered;
+    uint64_t nb_replays_detected;
+    uint64_t nb_tokens_over_capacity;
+    uint64_t nb_tokens_out_of_window;
+    uint64_t nb_buckets_expired;
+} picoquic_anti_replay_t;
+
+void picoquic_anti_replay_init(picoquic_anti_replay_t* ar, size_t memory_max, unsigned int false_positive_log2);
+void picoquic_anti_replay_release(picoquic_anti_replay_t* ar);
+
+/* Admission control of the Initial packets that would create a connection.
+ * The rate is limited per source prefix, IPv4 /24 or IPv6 /48. The prefixes
+ * are hashed with a secret key into a direct mapped table, in which each entry
+ * holds the "theoretical arrival time" of a generic cell rate algorithm. This
+ * is equivalent to a token bucket of the same rate and burst, but only needs
+ * one time stamp. A collision in the table simply resets the entry.
+ * When the load reported by the application reaches the threshold, Initial
+ * packets without a token are answered with a stateless retry.
+ */
+#define PICOQUIC_ADMISSION_TABLE_SIZE 4096 /* must be a power of 2 */
+
+typedef struct st_picoquic_admission_entry_t {
+    uint64_t tag;
+    uint64_t tat;
+} picoquic_admission_entry_t;
+
+typedef struct st_picoquic_admission_t {
+    picoquic_admission_entry_t* table;
+    uint64_t hash_key;
+    uint64_t interval; /* microseconds between two Initial packets at the nominal rate */
+    uint64_t tolerance; /* burst allowance, in microseconds */
+    uint32_t retry_load_threshold; /* per mille, 0 if stateless retry is not forced */
+    uint32_t load_permille;
+    uint64_t nb_initials_checked;
+    uint64_t nb_admitted;
+    uint64_t nb_rate_limited;
+    uint64_t nb_stateless_retry;
+} picoquic_admission_t;
+
+int picoquic_admission_check(picoquic_quic_t* quic, const struct sockaddr* addr_from, int has_token, uint64_t current_time);
+int picoquic_admission_check_initial(picoquic_quic_t* quic, const struct sockaddr* addr_from,
+    picoquic_packet_header* ph, uint64_t current_time);
+void picoquic_admission_release(picoquic_admission_t* adm);
 
 /*
  * Definition of the session ticket store and connection token
@@ -457,6 +801,9 @@ typedef enum {
 
 typedef struct st_picoquic_stored_ticket_t {
     struct st_picoquic_stored_ticket_t* next_ticket;
+    struct st_picoquic_stored_ticket_t* previous_ticket; /* Only set in the indexed store */
+    struct st_picoquic_stored_ticket_t* next_in_bin;
+    uint64_t key_hash;
     char* sni;
     char* alpn;
     uint8_t* ip_addr;
@@ -500,9 +847,61 @@ int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
 void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket);
 void picoquic_seed_ticket(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time);
 
+/* Indexed stores of tickets and tokens in the QUIC context.
+ * The entries are kept in a hash table, and in a doubly linked list in
+ * LRU order starting at quic->p_first_ticket or quic->p_first_token, so
+ * that the list functions can still be used to read them. The number of
+ * entries is bounded, the least recently used ones are evicted first.
+ * The store files are journals: the new entries and the "used" marks are
+ * serialized as they happen, and appended to the file when the store is
+ * saved. The file is only rewritten when most of its records are obsolete.
+ * The pending records are dropped when an entry is evicted or when there
+ * are more of them than the store can hold entries, and the file is then
+ * rewritten from the index at the next save.
+ * The file is loaded at the first access to the store.
+ */
+#define PICOQUIC_STORE_INDEX_NB_BINS_MIN 64
+#define PICOQUIC_STORED_TICKETS_MAX_DEFAULT 4096
+#define PICOQUIC_STORED_TOKENS_MAX_DEFAULT 4096
+
+typedef struct st_picoquic_store_journal_t {
+    uint8_t* bytes;
+    size_t length;
+    size_t size;
+    size_t nb_records; /* Records in the file, including the obsolete ones */
+    size_t nb_pending; /* Records in the buffer, not yet in the file */
+    unsigned int is_loaded : 1;
+    unsigned int is_rewrite_required : 1; /* Records dropped, the next save rewrites the file */
+} picoquic_store_journal_t;
+
+typedef struct st_picoquic_ticket_index_t {
+    picoquic_stored_ticket_t** bins;
+    size_t nb_bins;
+    picoquic_stored_ticket_t* last_ticket;
+    size_t nb_tickets;
+    size_t nb_tickets_max;
+    picoquic_store_journal_t journal;
+} picoquic_ticket_index_t;
+
+int picoquic_store_session_ticket(picoquic_quic_t* quic, uint64_t current_time,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
+    uint32_t version, const uint8_t* ip_addr, uint8_t ip_addr_length,
+    const uint8_t* ip_addr_client, uint8_t ip_addr_client_length,
+    uint8_t* ticket, uint16_t ticket_length, picoquic_tp_t const* tp);
+picoquic_stored_ticket_t* picoquic_get_session_ticket(picoquic_quic_t* quic,
+    uint64_t current_time, char const* sni, uint16_t sni_length,
+    char const* alpn, uint16_t alpn_length, uint32_t version, int need_unused, uint64_t ticket_id);
+void picoquic_mark_session_ticket_used(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored);
+void picoquic_ticket_index_load(picoquic_quic_t* quic);
+void picoquic_ticket_index_journal(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored);
+void picoquic_free_session_tickets(picoquic_quic_t* quic);
+
 
 typedef struct st_picoquic_stored_token_t {
     struct st_picoquic_stored_token_t* next_token;
+    struct st_picoquic_stored_token_t* previous_token; /* Only set in the indexed store */
+    struct st_picoquic_stored_token_t* next_in_bin;
+    uint64_t key_hash;
     char const* sni;
     uint8_t const* token;
     uint8_t const* ip_addr;
@@ -530,6 +929,33 @@ int picoquic_load_tokens(picoquic_stored_token_t** pp_first_token,
     uint64_t current_time, char const* token_file_name);
 void picoquic_free_tokens(picoquic_stored_token_t** pp_first_token);
 
+typedef struct st_picoquic_token_index_t {
+    picoquic_stored_token_t** bins;
+    size_t nb_bins;
+    picoquic_stored_token_t* last_token;
+    size_t nb_tokens;
+    size_t nb_tokens_max;
+    picoquic_store_journal_t journal;
+} picoquic_token_index_t;
+
+int picoquic_store_retry_token(picoquic_quic_t* quic, uint64_t current_time,
+    char const* sni, uint16_t sni_length, uint8_t const* ip_addr, uint8_t ip_addr_length,
+    uint8_t const* token, uint16_t token_length);
+int picoquic_get_retry_token(picoquic_quic_t* quic, uint64_t current_time,
+    char const* sni, uint16_t sni_length, uint8_t const* ip_addr, uint8_t ip_addr_length,
+    uint8_t** token, uint16_t* token_length, int mark_used);
+void picoquic_free_retry_tokens(picoquic_quic_t* quic);
+void picoquic_token_index_trim(picoquic_quic_t* quic);
+
+int picoquic_store_journal_add(picoquic_store_journal_t* journal, const uint8_t* record, size_t record_size,
+    size_t nb_entries_max);
+void picoquic_store_journal_drop(picoquic_store_journal_t* journal);
+int picoquic_store_journal_append(picoquic_store_journal_t* journal, char const* file_name);
+int picoquic_store_journal_replay(picoquic_store_journal_t* journal, char const* file_name,
+    int (*replay_fn)(void* ctx, uint8_t* bytes, size_t length), void* ctx);
+int picoquic_store_journal_is_compact(picoquic_store_journal_t* journal, size_t nb_entries);
+void picoquic_store_journal_clear(picoquic_store_journal_t* journal);
+
 /* Remember the tickets issued by a server, and the last
  * congestion control parameters for the corresponding connection
  */
@@ -547,7 +973,11 @@ typedef struct st_picoquic_issued_ticket_t {
     uint8_t ip_addr_length;
 } picoquic_issued_ticket_t;
 
+/* The issued tickets are kept in creation order, and expire after the ticket lifetime */
+#define PICOQUIC_ISSUED_TICKET_LIFETIME (100000ull * 1000000ull)
+
 int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
+    uint64_t current_time,
     uint64_t ticket_id,
     uint64_t rtt,
     uint64_t cwin,
@@ -595,12 +1025,6 @@ typedef uint64_t picoquic_tp_enum;
 #define picoquic_tp_version_negotiation 0x11
 #define picoquic_tp_enable_bdp_frame 0xebd9 /* per draft-kuhn-quic-0rtt-bdp-09 */
 
-/* Callback for converting binary log to quic log at the end of a connection. 
- * This is kept private for now; and will only be set through the "set quic log"
- * API.
- */
-typedef int (*picoquic_autoqlog_fn)(picoquic_cnx_t * cnx);
-
 /* Callback used for the performance log
  */
 typedef int (*picoquic_performance_log_fn)(picoquic_quic_t* quic, picoquic_cnx_t* cnx, int should_delete);
@@ -621,7 +1045,10 @@ typedef struct st_picoquic_quic_t {
     char const* token_file_name;
     picoquic_stored_ticket_t * p_first_ticket;
     picoquic_stored_token_t * p_first_token;
-    picosplay_tree_t token_reuse_tree; /* detection of token reuse */
+    picoquic_ticket_index_t ticket_index;
+    picoquic_token_index_t token_index;
+    picoquic_anti_replay_t token_anti_replay; /* detection of token reuse */
+    picoquic_admission_t admission; /* rate limiting of incoming Initial packets */
     uint8_t local_cnxid_length;
     uint8_t default_stream_priority;
     uint8_t default_datagram_priority;
@@ -666,13 +1093,25 @@ typedef struct st_picoquic_quic_t {
     unsigned int use_constant_challenges : 1; /* Use predictable challenges when producing constant logs. */
     unsigned int use_low_memory : 1; /* if possible, use low memory alternatives, e.g. for AES */
     unsigned int is_preemptive_repeat_enabled : 1; /* enable premptive repeat on new connections */
+    unsigned int is_retransmit_by_reference_enabled : 1; /* retransmit stream data by reference on new connections */
     unsigned int default_send_receive_bdp_frame : 1; /* enable sending and receiving BDP frame */
     unsigned int enforce_client_only : 1; /* Do not authorize incoming connections */
     unsigned int test_large_server_flight : 1; /* Use TP to ensure server flight is at least 8K */
     unsigned int is_port_blocking_disabled : 1; /* Do not check client port on incoming connections */
     unsigned int are_path_callbacks_enabled : 1; /* Enable path specific callbacks by default */
+    unsigned int use_wake_wheel : 1; /* Schedule connections with the timing wheel instead of the splay */
+    unsigned int is_stream_data_borrowing_enabled : 1; /* Default for new connections */
 
     picoquic_stateless_packet_t* pending_stateless_packet;
+    picoquic_stateless_packet_t* pending_stateless_last;
+    picoquic_stateless_packet_t* stateless_pool;
+    picoquic_stateless_packet_t* stateless_pool_free;
+    size_t stateless_pool_size;
+    size_t stateless_pool_nb_in_use;
+    size_t stateless_pool_nb_in_use_max;
+    uint64_t nb_stateless_queued;
+    uint64_t nb_stateless_sent;
+    uint64_t nb_stateless_dropped;
 
     picoquic_congestion_algorithm_t const* default_congestion_alg;
     uint64_t wifi_shadow_rtt;
@@ -680,28 +1119,38 @@ typedef struct st_picoquic_quic_t {
     struct st_picoquic_cnx_t* cnx_list;
     struct st_picoquic_cnx_t* cnx_last;
     picosplay_tree_t cnx_wake_tree;
+    picoquic_wheel_t cnx_wake_wheel;
 
     struct st_picoquic_cnx_t* cnx_in_progress;
 
-    picohash_table* table_cnx_by_id;
-    picohash_table* table_cnx_by_net;
-    picohash_table* table_cnx_by_icid;
+    picohash_oa_table* table_cnx_by_id;
+    picohash_oa_table* table_cnx_by_net;
+    picohash_oa_table* table_cnx_by_icid;
     picohash_table* table_cnx_by_secret;
 
     picohash_table* table_issued_tickets;
     picoquic_issued_ticket_t* table_issued_tickets_first;
     picoquic_issued_ticket_t* table_issued_tickets_last;
     size_t table_issued_tickets_nb;
+    uint64_t nb_issued_tickets_expired;
+    uint64_t nb_issued_tickets_evicted;
 
-    picoquic_packet_t * p_first_packet;
-    int nb_packets_in_pool;
-    int nb_packets_allocated;
-    int nb_packets_allocated_max;
+    picoquic_slab_class_t packet_pool;
+    picoquic_slab_class_t packet_bytes_pool[PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES];
+    uint64_t nb_packet_bytes_shrunk;
+    uint64_t nb_stream_bytes_by_reference;
+    picoquic_protect_batch_t* protect_batch;
+    picoquic_unprotect_batch_t* unprotect_batch;
 
     picoquic_stream_data_node_t* p_first_data_node;
     int nb_data_nodes_in_pool;
     int nb_data_nodes_allocated;
     int nb_data_nodes_allocated_max;
+    int nb_data_nodes_borrowed;
+
+    uint64_t memory_bytes[picoquic_memory_nb_categories];
+    uint64_t memory_budget;
+    uint64_t nb_cnx_refused_memory;
 
     picoquic_connection_id_cb_fn cnx_id_callback_fn;
     void* cnx_id_callback_ctx;
@@ -723,6 +1172,7 @@ typedef struct st_picoquic_quic_t {
 
     /* Global flow control enforcement */
     uint64_t max_data_limit;
+    uint64_t fc_autotune_window_max; /* 0 if the windows are not auto tuned */
 
     /* Path quality callback. These variables store the default values
     * of the min deltas required to perform path quality signaling.
@@ -737,6 +1187,7 @@ typedef struct st_picoquic_quic_t {
     picoquic_autoqlog_fn autoqlog_fn;
     struct st_picoquic_unified_logging_t* text_log_fns;
     struct st_picoquic_unified_logging_t* bin_log_fns;
+    picoquic_binlog_ring_t* binlog_ring;
     struct st_picoquic_unified_logging_t* qlog_fns;
     picoquic_performance_log_fn perflog_fn;
     void* v_perflog_ctx;
@@ -801,6 +1252,8 @@ typedef struct st_picoquic_stream_head_t {
     picosplay_node_t stream_node; /* splay of streams in connection context */
     struct st_picoquic_stream_head_t * next_output_stream; /* link in the list of output streams */
     struct st_picoquic_stream_head_t * previous_output_stream;
+    struct st_picoquic_stream_head_t * next_ready_stream; /* link in the ready list of the priority level */
+    struct st_picoquic_stream_head_t * previous_ready_stream;
     picoquic_cnx_t * cnx;
     uint64_t stream_id;
     struct st_picoquic_path_t * affinity_path; /* Path for which affinity is set, or NULL if none */
@@ -808,6 +1261,7 @@ typedef struct st_picoquic_stream_head_t {
     uint64_t fin_offset; /* If the fin mark is received, index of the byte after last */
     uint64_t maxdata_local; /* flow control limit of how much the peer is authorized to send */
     uint64_t maxdata_local_acked; /* highest value in max stream data frame acked by the peer */
+    picoquic_fc_autotune_t fc_autotune; /* receive window, if auto tuning is enabled */
     uint64_t maxdata_remote; /* flow control limit of how much we authorize the peer to send */
     uint64_t local_error;
     uint64_t remote_error;
@@ -817,12 +1271,17 @@ typedef struct st_picoquic_stream_head_t {
     picosplay_tree_t stream_data_tree; /* splay of received stream segments */
     uint64_t sent_offset; /* Amount of data sent in the stream */
     picoquic_stream_queue_node_t* send_queue; /* if the stream is not "active", list of data segments ready to send */
+    picoquic_stream_queue_node_t* sent_queue; /* data segments sent but not yet acknowledged, if retransmit by reference */
+    picoquic_stream_queue_node_t* sent_queue_last;
     void * app_stream_ctx;
     picoquic_stream_direct_receive_fn direct_receive_fn; /* direct receive function, if not NULL */
     void* direct_receive_ctx; /* direct receive context */
     picoquic_sack_list_t sack_list; /* Track which parts of the stream were acknowledged by the peer */
     /* Stream priority -- lowest is most urgent */
     uint8_t stream_priority;
+    uint8_t output_priority; /* Priority level under which the stream is listed for output */
+    uint8_t stream_weight; /* Round robin quota, in units of PICOQUIC_STREAM_WEIGHT_QUANTUM bytes */
+    uint32_t bytes_in_turn; /* Bytes sent since the stream was last moved to the end of the ready list */
     /* Flags describing the state of the stream */
     unsigned int is_active : 1; /* The application is actively managing data sending through callbacks */
     unsigned int fin_requested : 1; /* Application has requested Fin of sending stream */
@@ -841,6 +1300,7 @@ typedef struct st_picoquic_stream_head_t {
     unsigned int max_stream_updated : 1; /* After stream was closed in both directions, the max stream id number was updated */
     unsigned int stream_data_blocked_sent : 1; /* If stream_data_blocked has been sent to peer, and no data sent on stream since */
     unsigned int is_output_stream : 1; /* If stream is listed in the output list */
+    unsigned int is_output_ready : 1; /* If stream is listed in the ready list of its priority level */
     unsigned int is_closed : 1; /* Stream is closed, closure is accouted for */
     unsigned int is_discarded : 1; /* There should be no more callback for that stream, the application has discarded it */
 } picoquic_stream_head_t;
@@ -848,9 +1308,49 @@ typedef struct st_picoquic_stream_head_t {
 #define IS_CLIENT_STREAM_ID(id) (unsigned int)(((id) & 1) == 0)
 #define IS_BIDIR_STREAM_ID(id)  (unsigned int)(((id) & 2) == 0)
 #define IS_LOCAL_STREAM_ID(id, client_mode)  (unsigned int)(((id)^(client_mode)) & 1)
+
+/* Direct lookup of the streams of one type (client or server, bidir or unidir).
+ * The stream of index "stream_id >> 2" is held in the slot "index & (nb_slots - 1)"
+ * if the index is in the window [base_index, base_index + nb_slots[. Every
+ * stream of the type with an index at or above base_index is in the window;
+ * the streams below it, such as streams created out of order after the window
+ * moved, are only found in the stream tree. The window grows up to
+ * PICOQUIC_STREAM_TABLE_SLOTS_MAX slots and then slides forward. The bottom of
+ * the window also slides forward as the oldest streams are deleted.
+ */
+#define PICOQUIC_STREAM_TABLE_SLOTS_MIN 16
+#define PICOQUIC_STREAM_TABLE_SLOTS_MAX 0x10000
+
+typedef struct st_picoquic_stream_table_t {
+    picoquic_stream_head_t** slots;
+    uint64_t base_index;
+    uint64_t nb_slots;
+} picoquic_stream_table_t;
+
+/* Output stream scheduler.
+ * The output list holds the streams ordered by priority and stream ID. The
+ * streams of the same priority form a level. Each level also keeps a "ready"
+ * list of the streams that may have something to send; streams found idle are
+ * parked out of it until the application queues data, marks them active, or
+ * requests a reset or stop sending. Odd priorities are served in FIFO order,
+ * and the ready list is then ordered by stream ID. Even priorities are served
+ * in round robin, and the ready list holds first the streams that never sent
+ * data, by stream ID, followed by the other streams, least recently served
+ * first. A stream with a weight keeps its place until it has sent its quota
+ * of bytes. Bitmaps of the levels that are present and of the levels that
+ * have ready streams give direct access to the first level to serve.
+ */
+typedef struct st_picoquic_output_level_t {
+    uint8_t priority;
+    picoquic_stream_head_t* last_output; /* Last stream of the level in the output list */
+    picoquic_stream_head_t* first_ready;
+    picoquic_stream_head_t* last_ready;
+    picoquic_stream_head_t* last_unserved; /* Round robin: last ready stream that never sent data */
+} picoquic_output_level_t;
 #define STREAM_ID_FROM_RANK(rank, client_mode, is_unidir) ((((uint64_t)(rank)-(uint64_t)1)<<2)|(((uint64_t)is_unidir)<<1)|((uint64_t)(client_mode^1)))
 #define STREAM_RANK_FROM_ID(id) ((id + 4)>>2)
 #define STREAM_TYPE_FROM_ID(id) ((id)&3)
+#define STREAM_INDEX_FROM_ID(id) ((id)>>2)
 #define NEXT_STREAM_ID_FOR_TYPE(id) ((id)+4)
 
 /*
@@ -872,6 +1372,36 @@ typedef struct st_picoquic_misc_frame_header_t {
     int is_pure_ack;
 } picoquic_misc_frame_header_t;
 
+/* Datagram send ring, see picoquic_set_datagram_ring.
+ * The queued slots are chained in order of queuing, from "first_queued" to
+ * "last_queued". Sending or expiring a datagram returns its slot to the free
+ * list, from which any slot can be reused. The slots are allocated once when
+ * the ring is set, and accounted in the send queue memory.
+ */
+#define PICOQUIC_DATAGRAM_SLOT_NONE SIZE_MAX
+
+typedef struct st_picoquic_datagram_slot_t {
+    uint64_t deadline;
+    size_t next_index; /* Next queued slot, or next free slot */
+    size_t previous_index;
+    uint16_t length;
+    uint8_t priority;
+    uint8_t is_queued;
+    uint8_t bytes[PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH];
+} picoquic_datagram_slot_t;
+
+typedef struct st_picoquic_datagram_ring_t {
+    picoquic_datagram_slot_t* slots;
+    size_t nb_slots;
+    size_t first_queued;
+    size_t last_queued;
+    size_t first_free;
+    size_t nb_queued;
+    uint64_t nb_sent;
+    uint64_t nb_expired;
+    uint64_t nb_refused;
+} picoquic_datagram_ring_t;
+
 /* Per epoch sequence/packet context.
 * There are three such contexts:
 * 0: Application (0-RTT and 1-RTT)
@@ -1256,6 +1786,8 @@ typedef struct st_picoquic_cnx_t {
     unsigned int are_path_callbacks_enabled : 1; /* Enable path specific callbacks */
     unsigned int is_sending_large_buffer : 1; /* Buffer provided by application is sufficient for PMTUD */
     unsigned int is_preemptive_repeat_enabled : 1; /* Preemptive repat of packets to reduce transaction latency */
+    unsigned int is_retransmit_by_reference_enabled : 1; /* Keep sent stream data in the stream until acked */
+    unsigned int is_stream_data_borrowing_enabled : 1; /* Application may retain delivered stream data */
     unsigned int do_version_negotiation : 1; /* Whether compatible version negotiation is activated */
     unsigned int send_receive_bdp_frame : 1; /* enable sending and receiving BDP frame */
     unsigned int cwin_notified_from_seed : 1; /* cwin was reset from a seeded value */
@@ -1321,6 +1853,7 @@ typedef struct st_picoquic_cnx_t {
     /* Next time sending data is expected */
     uint64_t next_wake_time;
     picosplay_node_t cnx_wake_node;
+    picoquic_wheel_node_t cnx_wheel_node;
 
     /* TLS context, TLS Send Buffer, streams, epochs */
     void* tls_ctx;
@@ -1346,6 +1879,7 @@ typedef struct st_picoquic_cnx_t {
     picoquic_ack_context_t ack_ctx[picoquic_nb_packet_context];
 
     /* Statistics */
+    uint64_t memory_bytes[picoquic_memory_nb_categories];
     uint64_t nb_bytes_queued;
     uint32_t nb_zero_rtt_sent;
     uint32_t nb_zero_rtt_acked;
@@ -1391,8 +1925,15 @@ typedef struct st_picoquic_cnx_t {
     /* Flow control information */
     uint64_t data_sent;
     uint64_t data_received;
+    uint64_t data_consumed; /* Data passed to the application */
     uint64_t maxdata_local; /* Highest value sent to the peer */
     uint64_t maxdata_local_acked; /* Highest value acked by the peer */
+    picoquic_fc_autotune_t fc_autotune; /* receive window, if auto tuning is enabled */
+    uint64_t nb_fc_window_increases;
+    uint64_t nb_data_blocked_received;
+    uint64_t nb_stream_data_blocked_received;
+    uint64_t nb_data_blocked_sent;
+    uint64_t nb_stream_data_blocked_sent;
     uint64_t maxdata_remote; /* Highest value received from the peer */
     uint64_t max_stream_data_local;
     uint64_t max_stream_data_remote;
@@ -1411,10 +1952,18 @@ typedef struct st_picoquic_cnx_t {
 
     /* Management of streams */
     picosplay_tree_t stream_tree;
+    picoquic_stream_table_t stream_table[4]; /* Direct lookup, one table per stream type */
     picoquic_stream_head_t * first_output_stream;
     picoquic_stream_head_t * last_output_stream;
+    uint64_t output_level_bitmap[4]; /* Priority levels present in the output list */
+    uint64_t ready_level_bitmap[4]; /* Priority levels with at least one ready stream */
+    picoquic_output_level_t* output_levels; /* One entry per bit of output_level_bitmap, by priority */
+    size_t nb_output_levels;
+    size_t nb_output_levels_alloc;
     uint64_t high_priority_stream_id;
     uint64_t next_stream_id[4];
+    /* Node holding the stream data passed to the current data callback */
+    picoquic_stream_data_node_t* delivered_data_node;
 
     /* Repeat queue contains packets with data frames that should be
      * sent according to priority when congestion window opens. */
@@ -1429,6 +1978,7 @@ typedef struct st_picoquic_cnx_t {
      */
     picoquic_misc_frame_header_t* first_datagram;
     picoquic_misc_frame_header_t* last_datagram;
+    picoquic_datagram_ring_t datagram_ring;
     uint64_t datagram_priority;
     int datagram_conflicts_count;
     int datagram_conflicts_max;
@@ -1610,6 +2160,7 @@ size_t picoquic_decode_varint_length(uint8_t byte);
 /* Packet parsing */
 
 picoquic_packet_type_enum picoquic_parse_long_packet_type(uint8_t flags, int version_index);
+uint8_t picoquic_create_long_packet_type(picoquic_packet_type_enum pt, int version_index);
 
 int picoquic_parse_packet_header(
     picoquic_quic_t* quic,
@@ -1765,9 +2316,15 @@ picoquic_stream_head_t * picoquic_stream_from_node(picosplay_node_t * node);
 void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream);
 void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream);
 void picoquic_reorder_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
+void picoquic_ready_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
+void picoquic_park_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
+void picoquic_served_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, size_t length);
+picoquic_output_level_t* picoquic_next_ready_output_level(picoquic_cnx_t* cnx, int priority);
+void picoquic_clear_output_levels(picoquic_cnx_t* cnx);
 picoquic_stream_head_t * picoquic_first_stream(picoquic_cnx_t * cnx);
 picoquic_stream_head_t * picoquic_last_stream(picoquic_cnx_t * cnx);
 picoquic_stream_head_t * picoquic_next_stream(picoquic_stream_head_t * stream);
+picoquic_stream_head_t* picoquic_next_stream_of_type(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 picoquic_stream_head_t* picoquic_find_stream(picoquic_cnx_t* cnx, uint64_t stream_id);
 void picoquic_add_output_streams(picoquic_cnx_t * cnx, uint64_t old_limit, uint64_t new_limit, unsigned int is_bidir);
 picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
@@ -1843,6 +2400,17 @@ int picoquic_parse_stream_header(
     uint64_t* stream_id, uint64_t* offset, size_t* data_length, int* fin,
     size_t* consumed);
 
+/* Stream reference frames replace stream frames in sent packets when
+ * retransmitting by reference. They are never sent on the wire. */
+#define PICOQUIC_STREAM_REF_FRAME_SIZE 22
+uint8_t* picoquic_format_stream_ref_frame(uint8_t* bytes, uint8_t* bytes_max,
+    uint64_t stream_id, uint64_t offset, size_t data_length, int fin);
+int picoquic_parse_stream_or_ref_header(const uint8_t* bytes, size_t bytes_max,
+    uint64_t* stream_id, uint64_t* offset, size_t* data_length, int* fin,
+    size_t* consumed, int* is_ref);
+uint8_t* picoquic_format_stream_frame_from_ref(picoquic_cnx_t* cnx, const uint8_t* ref, size_t ref_length,
+    uint8_t* bytes, uint8_t* bytes_max);
+
 int picoquic_parse_ack_header(
     uint8_t const* bytes, size_t bytes_max,
     uint64_t* num_block, uint64_t* path_id, uint64_t* largest,
@@ -1854,14 +2422,20 @@ uint8_t* picoquic_format_crypto_hs_frame(picoquic_stream_head_t* stream, uint8_t
 uint8_t* picoquic_format_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, uint64_t current_time, picoquic_packet_context_enum pc, int is_opportunistic);
 uint8_t* picoquic_format_connection_close_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
 uint8_t* picoquic_format_application_close_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
-uint8_t* picoquic_format_required_max_stream_data_frames(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
+uint8_t* picoquic_format_required_max_stream_data_frames(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, uint64_t current_time);
+int picoquic_is_max_stream_data_needed(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 uint8_t* picoquic_format_max_data_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, uint64_t maxdata_increase);
 uint8_t* picoquic_format_max_stream_data_frame(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, uint64_t new_max_data);
 uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_window); /* Trigger sending more data if window increases */
 uint8_t* picoquic_format_max_streams_frame_if_needed(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
 void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data);
 picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* quic);
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_compact(picoquic_quic_t* quic, size_t data_max);
 void picoquic_clear_stream(picoquic_stream_head_t* stream);
+void picoquic_stream_data_node_sent(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
+const uint8_t* picoquic_stream_sent_data(picoquic_stream_head_t* stream, uint64_t offset, size_t length);
+void picoquic_stream_release_acked_data(picoquic_stream_head_t* stream);
+void picoquic_stream_sent_queue_free(picoquic_stream_head_t* stream);
 void picoquic_delete_stream(picoquic_cnx_t * cnx, picoquic_stream_head_t * stream);
 picoquic_local_cnxid_t* picoquic_create_local_cnxid(picoquic_cnx_t* cnx, picoquic_connection_id_t* suggested_value, uint64_t current_time);
 void picoquic_delete_local_cnxid(picoquic_cnx_t* cnx, picoquic_local_cnxid_t* l_cid);
@@ -1885,6 +2459,9 @@ void picoquic_delete_misc_or_dg(picoquic_misc_frame_header_t** first, picoquic_m
 void picoquic_clear_ack_ctx(picoquic_ack_context_t* ack_ctx);
 int picoquic_queue_handshake_done_frame(picoquic_cnx_t* cnx);
 uint8_t* picoquic_format_first_datagram_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
+uint64_t picoquic_datagram_ring_expire(picoquic_cnx_t* cnx, uint64_t current_time);
+uint8_t* picoquic_format_ring_datagram_frames(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack);
+void picoquic_datagram_ring_release(picoquic_cnx_t* cnx);
 uint8_t* picoquic_format_ready_datagram_frame(picoquic_cnx_t* cnx, picoquic_path_t * path_x, uint8_t* bytes, uint8_t* bytes_max, int* more_data, int* is_pure_ack, int* ret);
 uint8_t* picoquic_decode_datagram_frame_header(uint8_t* bytes, const uint8_t* bytes_max,
     uint8_t* frame_id, uint64_t* length);
@@ -1903,6 +2480,7 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, const
     int epoch, struct sockaddr* addr_from, struct sockaddr* addr_to, uint64_t pn64, int path_is_not_allocated, uint64_t current_time);
 
 int picoquic_skip_frame(const uint8_t* bytes, size_t bytes_max, size_t* consumed, int* pure_ack);
+int picoquic_skip_sent_frame(const uint8_t* bytes, size_t bytes_max, size_t* consumed, int* pure_ack);
 const uint8_t* picoquic_skip_path_abandon_frame(const uint8_t* bytes, const uint8_t* bytes_max);
 const uint8_t* picoquic_skip_path_available_or_standby_frame(const uint8_t* bytes, const uint8_t* bytes_max);
 int picoquic_queue_path_available_or_standby_frame(
@@ -32,6 +32,7 @@ extern "C" {
 #define PICOQUIC_PACKET_LOOP_SOCKETS_MAX 2
 #define PICOQUIC_PACKET_LOOP_SEND_MAX 10
 #define PICOQUIC_PACKET_LOOP_SEND_DELAY_MAX 2500
+#define PICOQUIC_PACKET_LOOP_SEND_BATCH_MAX 16
 
 /* The packet loop will call the application back after specific events.
  */
@@ -40,7 +41,8 @@ typedef enum {
     picoquic_packet_loop_after_receive, /* Argument type size_t*: nb packets received */
     picoquic_packet_loop_after_send, /* Argument type size_t*: nb packets sent */
     picoquic_packet_loop_port_update, /* argument type struct_sockaddr*: new address for wakeup */
-    picoquic_packet_loop_time_check /* argument type . Optional. */
+    picoquic_packet_loop_time_check, /* argument type . Optional. */
+    picoquic_packet_loop_after_receive_batch /* Argument type picoquic_packet_loop_batch_stats_t*. Optional. */
 } picoquic_packet_loop_cb_enum;
 
 typedef int (*picoquic_packet_loop_cb_fn)(picoquic_quic_t * quic, picoquic_packet_loop_cb_enum cb_mode, void * callback_ctx, void * callback_argv);
@@ -51,8 +53,27 @@ typedef int (*picoquic_packet_loop_cb_fn)(picoquic_quic_t * quic, picoquic_packe
  * the features that it supports */
 typedef struct st_picoquic_packet_loop_options_t {
     int do_time_check : 1; /* App should be polled for next time before sock select */
+    int do_batch_receive : 1; /* Receive batches of packets using recvmmsg and UDP GRO if available */
+    int do_batch_send : 1; /* Send packets for multiple connections using sendmmsg if available */
+    int do_epoll : 1; /* Wait for packets with epoll instead of select, if available */
+    int do_io_uring : 1; /* Receive packets with io_uring multishot recvmsg, if available; sends are unchanged */
 } picoquic_packet_loop_options_t;
 
+/* If the batch receive option is set, the application is called after each
+ * batch has been submitted to the stack, with statistics about that batch.
+ * The ratio of nb_packets_total to nb_recv_calls is the average number
+ * of packets processed per receive system call.
+ */
+typedef struct st_picoquic_packet_loop_batch_stats_t {
+    uint64_t batch_time; /* Time at which the batch was received */
+    uint64_t batch_duration; /* Time spent processing the batch, microseconds */
+    size_t nb_datagrams; /* Number of datagrams returned by the receive call */
+    size_t nb_packets; /* Number of packets after splitting GRO trains */
+    size_t bytes_received; /* Number of bytes in the batch */
+    uint64_t nb_recv_calls; /* Total number of batch receive calls */
+    uint64_t nb_packets_total; /* Total number of packets received in batches */
+} picoquic_packet_loop_batch_stats_t;
+
 /* The time check option passes as argument a pointer to a structure specifying
  * the current time and the proposed delta. The application uses the specified
  * current time to compute an updated delta.
@@ -74,6 +95,42 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     picoquic_packet_loop_cb_fn loop_callback,
     void * loop_callback_ctx);
 
+/* Sharded server loop.
+ * Runs one packet loop per shard, each in its own thread with its own QUIC
+ * context (quic[i]) and callback context (loop_callback_ctx[i]), and each with its
+ * own sockets bound to the same local port with SO_REUSEPORT. The connection IDs
+ * issued by shard i encode the value i using the load balancer compatible CID
+ * format. If the QUIC contexts do not have a CID callback, the loop configures a
+ * "clear" encoding with a one byte server ID. Short header packets received by
+ * the wrong shard are forwarded to the shard designated by their CID.
+ * The loop stops when any of the shards stops, and returns the first error.
+ * Only supported on platforms that implement SO_REUSEPORT.
+ */
+#define PICOQUIC_SHARDED_LOOP_MAX 64
+
+typedef struct st_picoquic_shard_stats_t {
+    uint64_t nb_packets_forwarded;
+    uint64_t nb_packets_received_forwarded;
+    uint64_t nb_forward_dropped;
+} picoquic_shard_stats_t;
+
+typedef struct st_picoquic_sharded_loop_param_t {
+    int nb_shards;
+    int local_port;
+    int local_af;
+    int dest_if;
+    int socket_buffer_size;
+    int do_not_use_gso;
+    int do_cpu_pinning; /* pin shard i to CPU (first_cpu + i) modulo the number of CPU */
+    int first_cpu;
+    picoquic_shard_stats_t stats[PICOQUIC_SHARDED_LOOP_MAX];
+} picoquic_sharded_loop_param_t;
+
+int picoquic_sharded_packet_loop(picoquic_quic_t** quic,
+    picoquic_sharded_loop_param_t* param,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void** loop_callback_ctx);
+
 #ifdef _WINDOWS
 int picoquic_packet_loop_win(picoquic_quic_t* quic,
     int local_port,
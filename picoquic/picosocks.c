@@ -19,8 +19,24 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#endif
 #include "picosocks.h"
 #include "picoquic_utils.h"
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup) && !defined(PICOQUIC_WITHOUT_IO_URING)
+#define PICOQUIC_WITH_IO_URING
+#endif
+#endif
 
 int picoquic_bind_to_port(SOCKET_TYPE fd, int af, int port)
 {
@@ -492,6 +508,13 @@ void picoquic_socks_cmsg_parse(
                 }
             }
         }
+#ifdef UDP_GRO
+        else if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+            if (udp_coalesced_size != NULL) {
+                *udp_coalesced_size = (size_t)(*((int*)CMSG_DATA(cmsg)));
+            }
+        }
+#endif
     }
 #endif
 }
@@ -1133,34 +1156,18 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
 }
 #endif
 
-int picoquic_select_ex(SOCKET_TYPE* sockets,
-    int nb_sockets,
-    struct sockaddr_storage* addr_from,
-    struct sockaddr_storage* addr_dest,
-    int* dest_if,
-    unsigned char * received_ecn,
-    uint8_t* buffer, int buffer_max,
-    int64_t delta_t,
-    int * socket_rank,
-    uint64_t* current_time)
+static int picoquic_select_wait(SOCKET_TYPE* sockets, int nb_sockets, int64_t delta_t, fd_set* readfds)
 {
-    fd_set readfds;
     struct timeval tv;
-    int ret_select = 0;
-    int bytes_recv = 0;
     int sockmax = 0;
 
-    if (received_ecn != NULL) {
-        *received_ecn = 0;
-    }
-
-    FD_ZERO(&readfds);
+    FD_ZERO(readfds);
 
     for (int i = 0; i < nb_sockets; i++) {
         if (sockmax < (int)sockets[i]) {
             sockmax = (int)sockets[i];
         }
-        FD_SET(sockets[i], &readfds);
+        FD_SET(sockets[i], readfds);
     }
 
     if (delta_t <= 0) {
@@ -1176,7 +1183,29 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
         }
     }
 
-    ret_select = select(sockmax + 1, &readfds, NULL, NULL, &tv);
+    return select(sockmax + 1, readfds, NULL, NULL, &tv);
+}
+
+int picoquic_select_ex(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char * received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int64_t delta_t,
+    int * socket_rank,
+    uint64_t* current_time)
+{
+    fd_set readfds;
+    int ret_select = 0;
+    int bytes_recv = 0;
+
+    if (received_ecn != NULL) {
+        *received_ecn = 0;
+    }
+
+    ret_select = picoquic_select_wait(sockets, nb_sockets, delta_t, &readfds);
 
     if (ret_select < 0) {
         bytes_recv = -1;
@@ -1228,6 +1257,1040 @@ int picoquic_select(SOCKET_TYPE* sockets,
         received_ecn, buffer, buffer_max, delta_t, &socket_rank, current_time);
 }
 
+/* Batch receive.
+ * The receive batch is allocated once per socket loop. The receive buffers
+ * are carved out of a single "ring" allocation. On Linux, the batch also
+ * holds the vector of message headers passed to recvmmsg, together with the
+ * iovec and control buffers of each message.
+ */
+#define PICOQUIC_RECV_BATCH_CMSG_SIZE 256
+
+#if defined(__linux__)
+typedef struct st_picoquic_recv_batch_os_ctx_t {
+    struct mmsghdr msgvec[PICOQUIC_RECV_BATCH_MAX];
+    struct iovec iov[PICOQUIC_RECV_BATCH_MAX];
+    char cmsg_buffer[PICOQUIC_RECV_BATCH_MAX][PICOQUIC_RECV_BATCH_CMSG_SIZE];
+} picoquic_recv_batch_os_ctx_t;
+#endif
+
+picoquic_recv_batch_t* picoquic_create_recv_batch(size_t nb_msg_max, size_t recv_buffer_size)
+{
+    picoquic_recv_batch_t* batch = (picoquic_recv_batch_t*)malloc(sizeof(picoquic_recv_batch_t));
+
+    if (batch != NULL) {
+        memset(batch, 0, sizeof(picoquic_recv_batch_t));
+        if (nb_msg_max == 0) {
+            nb_msg_max = 1;
+        }
+        else if (nb_msg_max > PICOQUIC_RECV_BATCH_MAX) {
+            nb_msg_max = PICOQUIC_RECV_BATCH_MAX;
+        }
+#if !defined(__linux__)
+        /* No recvmmsg support, receive one message at a time */
+        nb_msg_max = 1;
+#endif
+        batch->nb_msg_max = nb_msg_max;
+        batch->recv_buffer_size = recv_buffer_size;
+        batch->buffer_ring = (uint8_t*)malloc(nb_msg_max * recv_buffer_size);
+        if (batch->buffer_ring == NULL) {
+            picoquic_delete_recv_batch(batch);
+            batch = NULL;
+        }
+        else {
+            for (size_t i = 0; i < nb_msg_max; i++) {
+                batch->msg[i].buffer = batch->buffer_ring + i * recv_buffer_size;
+            }
+#if defined(__linux__)
+            batch->os_msg_ctx = malloc(sizeof(picoquic_recv_batch_os_ctx_t));
+            if (batch->os_msg_ctx == NULL) {
+                picoquic_delete_recv_batch(batch);
+                batch = NULL;
+            }
+            else {
+                picoquic_recv_batch_os_ctx_t* os_ctx = (picoquic_recv_batch_os_ctx_t*)batch->os_msg_ctx;
+                memset(os_ctx, 0, sizeof(picoquic_recv_batch_os_ctx_t));
+                for (size_t i = 0; i < nb_msg_max; i++) {
+                    os_ctx->iov[i].iov_base = batch->msg[i].buffer;
+                    os_ctx->iov[i].iov_len = recv_buffer_size;
+                    os_ctx->msgvec[i].msg_hdr.msg_iov = &os_ctx->iov[i];
+                    os_ctx->msgvec[i].msg_hdr.msg_iovlen = 1;
+                }
+            }
+#endif
+        }
+    }
+
+    return batch;
+}
+
+void picoquic_delete_recv_batch(picoquic_recv_batch_t* batch)
+{
+    if (batch->buffer_ring != NULL) {
+        free(batch->buffer_ring);
+        batch->buffer_ring = NULL;
+    }
+    if (batch->os_msg_ctx != NULL) {
+        free(batch->os_msg_ctx);
+        batch->os_msg_ctx = NULL;
+    }
+    free(batch);
+}
+
+/* Ask the kernel to coalesce incoming UDP segments from the same flow.
+ * Returns 0 if the option is set, -1 if it is not supported. The
+ * receive buffers must then be large enough to hold a full GRO train,
+ * see PICOQUIC_RECV_GRO_BUFFER_SIZE.
+ */
+int picoquic_socket_set_gro_options(SOCKET_TYPE sd, int af)
+{
+    int ret = -1;
+#if defined(__linux__) && defined(UDP_GRO)
+    int val = 1;
+    ret = setsockopt(sd, IPPROTO_UDP, UDP_GRO, &val, sizeof(val));
+#ifdef UNREFERENCED_PARAMETER
+    UNREFERENCED_PARAMETER(af);
+#endif
+#else
+#ifdef UNREFERENCED_PARAMETER
+    UNREFERENCED_PARAMETER(af);
+    UNREFERENCED_PARAMETER(sd);
+#endif
+#endif
+    return ret;
+}
+
+/* Receive up to nb_msg_max messages in a single call, without blocking.
+ * Returns the total number of bytes received, 0 if no message was
+ * available, or -1 in case of socket error. The number of messages
+ * received is set in batch->nb_msg.
+ */
+int picoquic_recvmmsg(SOCKET_TYPE fd, picoquic_recv_batch_t* batch)
+#if defined(__linux__)
+{
+    picoquic_recv_batch_os_ctx_t* os_ctx = (picoquic_recv_batch_os_ctx_t*)batch->os_msg_ctx;
+    int bytes_recv = 0;
+    int nb_msg;
+
+    batch->nb_msg = 0;
+
+    for (size_t i = 0; i < batch->nb_msg_max; i++) {
+        struct msghdr* msg = &os_ctx->msgvec[i].msg_hdr;
+        msg->msg_name = (struct sockaddr*)&batch->msg[i].addr_from;
+        msg->msg_namelen = sizeof(struct sockaddr_storage);
+        msg->msg_control = (void*)os_ctx->cmsg_buffer[i];
+        msg->msg_controllen = PICOQUIC_RECV_BATCH_CMSG_SIZE;
+        msg->msg_flags = 0;
+        os_ctx->msgvec[i].msg_len = 0;
+    }
+
+    nb_msg = recvmmsg(fd, os_ctx->msgvec, (unsigned int)batch->nb_msg_max, MSG_DONTWAIT, NULL);
+
+    if (nb_msg < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            bytes_recv = 0;
+        }
+        else {
+            DBG_PRINTF("Could not receive batch on UDP socket %d, err = %d!\n", (int)fd, errno);
+            bytes_recv = -1;
+        }
+    }
+    else {
+        for (int i = 0; i < nb_msg; i++) {
+            picoquic_recv_msg_t* r_msg = &batch->msg[i];
+
+            r_msg->bytes_recv = (size_t)os_ctx->msgvec[i].msg_len;
+            r_msg->dest_if = 0;
+            r_msg->received_ecn = 0;
+            r_msg->udp_coalesced_size = 0;
+            memset(&r_msg->addr_dest, 0, sizeof(struct sockaddr_storage));
+            picoquic_socks_cmsg_parse(&os_ctx->msgvec[i].msg_hdr, &r_msg->addr_dest, &r_msg->dest_if,
+                &r_msg->received_ecn, &r_msg->udp_coalesced_size);
+            bytes_recv += (int)r_msg->bytes_recv;
+        }
+        batch->nb_msg = (size_t)nb_msg;
+    }
+
+    return bytes_recv;
+}
+#else
+{
+    picoquic_recv_msg_t* r_msg = &batch->msg[0];
+    int bytes_recv;
+
+    r_msg->dest_if = 0;
+    r_msg->received_ecn = 0;
+    r_msg->udp_coalesced_size = 0;
+    batch->nb_msg = 0;
+
+    bytes_recv = picoquic_recvmsg(fd, &r_msg->addr_from, &r_msg->addr_dest, &r_msg->dest_if,
+        &r_msg->received_ecn, r_msg->buffer, (int)batch->recv_buffer_size);
+    if (bytes_recv > 0) {
+        r_msg->bytes_recv = (size_t)bytes_recv;
+        batch->nb_msg = 1;
+    }
+
+    return bytes_recv;
+}
+#endif
+
+/* Wait until one of the sockets is readable or the timer expires, then
+ * receive a batch of messages from that socket. Returns the number of
+ * bytes in the batch, or -1 in case of error.
+ */
+int picoquic_select_batch(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    picoquic_recv_batch_t* batch,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time)
+{
+    fd_set readfds;
+    int ret_select = 0;
+    int bytes_recv = 0;
+
+    batch->nb_msg = 0;
+
+    ret_select = picoquic_select_wait(sockets, nb_sockets, delta_t, &readfds);
+
+    if (ret_select < 0) {
+        bytes_recv = -1;
+        DBG_PRINTF("Error: select returns %d\n", ret_select);
+    }
+    else if (ret_select > 0) {
+        for (int i = 0; i < nb_sockets; i++) {
+            if (FD_ISSET(sockets[i], &readfds)) {
+                *socket_rank = i;
+                bytes_recv = picoquic_recvmmsg(sockets[i], batch);
+
+                if (bytes_recv <= 0) {
+#ifdef _WINDOWS
+                    int last_error = WSAGetLastError();
+
+                    if (last_error == WSAECONNRESET || last_error == WSAEMSGSIZE) {
+                        bytes_recv = 0;
+                        continue;
+                    }
+#endif
+                    DBG_PRINTF("Could not receive batch on UDP socket[%d]= %d!\n",
+                        i, (int)sockets[i]);
+                }
+                break;
+            }
+        }
+    }
+
+    *current_time = picoquic_current_time();
+
+    return bytes_recv;
+}
+
+/* Batch send.
+ * As for the receive batch, the send buffers are carved out of a single
+ * allocation, and on Linux the batch holds the vector of message headers
+ * passed to sendmmsg.
+ */
+#define PICOQUIC_SEND_BATCH_CMSG_SIZE 256
+
+#if defined(__linux__)
+typedef struct st_picoquic_send_batch_os_ctx_t {
+    struct mmsghdr msgvec[PICOQUIC_SEND_BATCH_MAX];
+    struct iovec iov[PICOQUIC_SEND_BATCH_MAX];
+    char cmsg_buffer[PICOQUIC_SEND_BATCH_MAX][PICOQUIC_SEND_BATCH_CMSG_SIZE];
+} picoquic_send_batch_os_ctx_t;
+#endif
+
+picoquic_send_batch_t* picoquic_create_send_batch(size_t nb_msg_max, size_t send_buffer_size)
+{
+    picoquic_send_batch_t* batch = (picoquic_send_batch_t*)malloc(sizeof(picoquic_send_batch_t));
+
+    if (batch != NULL) {
+        memset(batch, 0, sizeof(picoquic_send_batch_t));
+        if (nb_msg_max == 0) {
+            nb_msg_max = 1;
+        }
+        else if (nb_msg_max > PICOQUIC_SEND_BATCH_MAX) {
+            nb_msg_max = PICOQUIC_SEND_BATCH_MAX;
+        }
+        batch->nb_msg_max = nb_msg_max;
+        batch->send_buffer_size = send_buffer_size;
+        batch->buffer_ring = (uint8_t*)malloc(nb_msg_max * send_buffer_size);
+        if (batch->buffer_ring == NULL) {
+            picoquic_delete_send_batch(batch);
+            batch = NULL;
+        }
+        else {
+            for (size_t i = 0; i < nb_msg_max; i++) {
+                batch->msg[i].fd = INVALID_SOCKET;
+                batch->msg[i].buffer = batch->buffer_ring + i * send_buffer_size;
+            }
+#if defined(__linux__)
+            batch->os_msg_ctx = malloc(sizeof(picoquic_send_batch_os_ctx_t));
+            if (batch->os_msg_ctx == NULL) {
+                picoquic_delete_send_batch(batch);
+                batch = NULL;
+            }
+            else {
+                memset(batch->os_msg_ctx, 0, sizeof(picoquic_send_batch_os_ctx_t));
+            }
+#endif
+        }
+    }
+
+    return batch;
+}
+
+void picoquic_delete_send_batch(picoquic_send_batch_t* batch)
+{
+    if (batch->buffer_ring != NULL) {
+        free(batch->buffer_ring);
+        batch->buffer_ring = NULL;
+    }
+    if (batch->os_msg_ctx != NULL) {
+        free(batch->os_msg_ctx);
+        batch->os_msg_ctx = NULL;
+    }
+    free(batch);
+}
+
+#if defined(__linux__)
+/* Send the messages [first_msg, first_msg + nb_msg[ through the same socket.
+ * Retry after each partial send, so that an error on one message does not
+ * prevent sending the following ones.
+ */
+static void picoquic_sendmmsg_one_socket(picoquic_send_batch_t* batch, size_t first_msg, size_t nb_msg)
+{
+    picoquic_send_batch_os_ctx_t* os_ctx = (picoquic_send_batch_os_ctx_t*)batch->os_msg_ctx;
+    SOCKET_TYPE fd = batch->msg[first_msg].fd;
+    size_t next_msg = first_msg;
+
+    for (size_t i = first_msg; i < first_msg + nb_msg; i++) {
+        picoquic_send_msg_t* s_msg = &batch->msg[i];
+        struct msghdr* msg = &os_ctx->msgvec[i].msg_hdr;
+
+        os_ctx->iov[i].iov_base = s_msg->buffer;
+        os_ctx->iov[i].iov_len = s_msg->length;
+        memset(msg, 0, sizeof(struct msghdr));
+        msg->msg_name = (struct sockaddr*)&s_msg->addr_dest;
+        msg->msg_namelen = picoquic_addr_length((struct sockaddr*)&s_msg->addr_dest);
+        msg->msg_iov = &os_ctx->iov[i];
+        msg->msg_iovlen = 1;
+        msg->msg_control = (void*)os_ctx->cmsg_buffer[i];
+        msg->msg_controllen = PICOQUIC_SEND_BATCH_CMSG_SIZE;
+        picoquic_socks_cmsg_format(msg, s_msg->length, s_msg->send_msg_size,
+            (struct sockaddr*)&s_msg->addr_from, s_msg->dest_if);
+        os_ctx->msgvec[i].msg_len = 0;
+    }
+
+    while (next_msg < first_msg + nb_msg) {
+        int nb_sent = sendmmsg(fd, &os_ctx->msgvec[next_msg], (unsigned int)(first_msg + nb_msg - next_msg), 0);
+
+        if (nb_sent <= 0) {
+            /* The first message in the list could not be sent. */
+            int last_error = errno;
+            DBG_PRINTF("Could not send packet on UDP socket[AF=%d]= %d!\n",
+                batch->msg[next_msg].addr_dest.ss_family, last_error);
+            batch->msg[next_msg].bytes_sent = -1;
+            batch->msg[next_msg].sock_err = last_error;
+            next_msg++;
+        }
+        else {
+            for (int i = 0; i < nb_sent; i++) {
+                batch->msg[next_msg].bytes_sent = (int)os_ctx->msgvec[next_msg].msg_len;
+                batch->msg[next_msg].sock_err = 0;
+                next_msg++;
+            }
+        }
+    }
+}
+#endif
+
+/* Send all the messages in the batch. Returns the number of messages
+ * successfully sent.
+ */
+size_t picoquic_sendmmsg(picoquic_send_batch_t* batch)
+{
+    size_t nb_sent = 0;
+#if defined(__linux__)
+    size_t first_msg = 0;
+
+    while (first_msg < batch->nb_msg) {
+        size_t nb_msg = 1;
+
+        while (first_msg + nb_msg < batch->nb_msg &&
+            batch->msg[first_msg + nb_msg].fd == batch->msg[first_msg].fd) {
+            nb_msg++;
+        }
+        picoquic_sendmmsg_one_socket(batch, first_msg, nb_msg);
+        first_msg += nb_msg;
+    }
+#else
+    for (size_t i = 0; i < batch->nb_msg; i++) {
+        picoquic_send_msg_t* s_msg = &batch->msg[i];
+        s_msg->sock_err = 0;
+        s_msg->bytes_sent = picoquic_sendmsg(s_msg->fd, (struct sockaddr*)&s_msg->addr_dest,
+            (struct sockaddr*)&s_msg->addr_from, s_msg->dest_if, (const char*)s_msg->buffer,
+            (int)s_msg->length, (int)s_msg->send_msg_size, &s_msg->sock_err);
+    }
+#endif
+    for (size_t i = 0; i < batch->nb_msg; i++) {
+        if (batch->msg[i].bytes_sent > 0) {
+            nb_sent++;
+        }
+    }
+
+    return nb_sent;
+}
+
+/* Event backends.
+ * The event context holds the list of sockets registered with the
+ * backend. When the list passed by the caller differs, all sockets are
+ * unregistered and registered again. This only happens when the socket
+ * loop creates or replaces sockets, e.g., in migration tests.
+ */
+#if defined(PICOQUIC_WITH_IO_URING)
+#define PICOQUIC_URING_ENTRIES 64
+#define PICOQUIC_URING_NB_BUFFERS 64 /* must be a power of 2 */
+#define PICOQUIC_URING_CMSG_SIZE 256
+#define PICOQUIC_URING_BGID 0
+#define PICOQUIC_URING_CANCEL_TAG UINT64_MAX
+
+typedef struct st_picoquic_uring_t {
+    int ring_fd;
+    uint8_t* ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_entries;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int to_submit;
+    /* Provided buffers, registered with the kernel */
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    int buf_ring_registered;
+    uint16_t buf_ring_tail;
+    uint8_t* buffers;
+    size_t buffer_size;
+    /* Buffers lent to the last receive batch, recycled at the next call */
+    uint16_t lent_bids[PICOQUIC_RECV_BATCH_MAX];
+    size_t nb_lent;
+    /* Message template for multishot receive, must remain valid while armed */
+    struct msghdr msg_template;
+} picoquic_uring_t;
+#endif
+
+struct st_picoquic_event_ctx_t {
+    picoquic_event_backend_enum backend;
+    size_t recv_buffer_size;
+    int nb_registered;
+    SOCKET_TYPE registered[PICOQUIC_EVENT_SOCKETS_MAX];
+    int armed[PICOQUIC_EVENT_SOCKETS_MAX];
+#if defined(__linux__)
+    int epoll_fd;
+#endif
+#if defined(PICOQUIC_WITH_IO_URING)
+    picoquic_uring_t* uring;
+#endif
+};
+
+#if defined(PICOQUIC_WITH_IO_URING)
+static void picoquic_uring_delete(picoquic_uring_t* uring)
+{
+    if (uring->buf_ring_registered) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = PICOQUIC_URING_BGID;
+        (void)syscall(__NR_io_uring_register, uring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if (uring->buf_ring != NULL) {
+        munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->ring_ptr != NULL) {
+        munmap(uring->ring_ptr, uring->ring_size);
+    }
+    if (uring->ring_fd >= 0) {
+        close(uring->ring_fd);
+    }
+    if (uring->buffers != NULL) {
+        free(uring->buffers);
+    }
+    free(uring);
+}
+
+static void picoquic_uring_recycle_buffer(picoquic_uring_t* uring, uint16_t bid)
+{
+    struct io_uring_buf* buf = &uring->buf_ring->bufs[uring->buf_ring_tail & (PICOQUIC_URING_NB_BUFFERS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(uring->buffers + (size_t)bid * uring->buffer_size);
+    buf->len = (uint32_t)uring->buffer_size;
+    buf->bid = bid;
+    uring->buf_ring_tail++;
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+static picoquic_uring_t* picoquic_uring_create(size_t recv_buffer_size)
+{
+    picoquic_uring_t* uring = (picoquic_uring_t*)malloc(sizeof(picoquic_uring_t));
+    struct io_uring_params params;
+    int ret = 0;
+
+    if (uring == NULL) {
+        return NULL;
+    }
+    memset(uring, 0, sizeof(picoquic_uring_t));
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = (int)syscall(__NR_io_uring_setup, PICOQUIC_URING_ENTRIES, &params);
+
+    if (uring->ring_fd < 0 || (params.features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+        (params.features & IORING_FEAT_EXT_ARG) == 0) {
+        /* io_uring not available, or kernel too old */
+        ret = -1;
+    }
+    else {
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        uring->ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+        uring->ring_ptr = (uint8_t*)mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+        uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        uring->sqes = (struct io_uring_sqe*)mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+        if (uring->ring_ptr == MAP_FAILED || uring->sqes == MAP_FAILED) {
+            uring->ring_ptr = (uring->ring_ptr == MAP_FAILED) ? NULL : uring->ring_ptr;
+            uring->sqes = (uring->sqes == MAP_FAILED) ? NULL : uring->sqes;
+            ret = -1;
+        }
+        else {
+            uring->sq_head = (unsigned int*)(uring->ring_ptr + params.sq_off.head);
+            uring->sq_tail = (unsigned int*)(uring->ring_ptr + params.sq_off.tail);
+            uring->sq_mask = (unsigned int*)(uring->ring_ptr + params.sq_off.ring_mask);
+            uring->sq_entries = (unsigned int*)(uring->ring_ptr + params.sq_off.ring_entries);
+            uring->sq_array = (unsigned int*)(uring->ring_ptr + params.sq_off.array);
+            uring->cq_head = (unsigned int*)(uring->ring_ptr + params.cq_off.head);
+            uring->cq_tail = (unsigned int*)(uring->ring_ptr + params.cq_off.tail);
+            uring->cq_mask = (unsigned int*)(uring->ring_ptr + params.cq_off.ring_mask);
+            uring->cqes = (struct io_uring_cqe*)(uring->ring_ptr + params.cq_off.cqes);
+        }
+    }
+
+    if (ret == 0) {
+        /* Each buffer receives the recvmsg header, the peer address, the control data and the payload */
+        struct io_uring_buf_reg reg;
+
+        uring->buffer_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) +
+            PICOQUIC_URING_CMSG_SIZE + recv_buffer_size;
+        uring->buffers = (uint8_t*)malloc(PICOQUIC_URING_NB_BUFFERS * uring->buffer_size);
+        uring->buf_ring_size = PICOQUIC_URING_NB_BUFFERS * sizeof(struct io_uring_buf);
+        uring->buf_ring = (struct io_uring_buf_ring*)mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (uring->buf_ring == MAP_FAILED) {
+            uring->buf_ring = NULL;
+        }
+        if (uring->buffers == NULL || uring->buf_ring == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+            reg.ring_entries = PICOQUIC_URING_NB_BUFFERS;
+            reg.bgid = PICOQUIC_URING_BGID;
+            if (syscall(__NR_io_uring_register, uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+                /* Provided buffer rings require Linux 5.19 or later */
+                ret = -1;
+            }
+            else {
+                uring->buf_ring_registered = 1;
+                for (uint16_t bid = 0; bid < PICOQUIC_URING_NB_BUFFERS; bid++) {
+                    picoquic_uring_recycle_buffer(uring, bid);
+                }
+                uring->msg_template.msg_namelen = sizeof(struct sockaddr_storage);
+                uring->msg_template.msg_controllen = PICOQUIC_URING_CMSG_SIZE;
+            }
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_uring_delete(uring);
+        uring = NULL;
+    }
+
+    return uring;
+}
+
+static struct io_uring_sqe* picoquic_uring_get_sqe(picoquic_uring_t* uring)
+{
+    struct io_uring_sqe* sqe = NULL;
+    unsigned int tail = *uring->sq_tail;
+    unsigned int head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head < *uring->sq_entries) {
+        unsigned int index = tail & *uring->sq_mask;
+        sqe = &uring->sqes[index];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        uring->sq_array[index] = index;
+        __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        uring->to_submit++;
+    }
+    return sqe;
+}
+
+/* Submit the pending requests, and wait at most delta_t microseconds for a completion
+ * if none is already available */
+static int picoquic_uring_enter(picoquic_uring_t* uring, int64_t delta_t)
+{
+    int ret = 0;
+    int has_cqe = (*uring->cq_head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE));
+
+    if (uring->to_submit > 0 || (!has_cqe && delta_t > 0)) {
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        unsigned int flags = 0;
+        unsigned int min_complete = 0;
+
+        memset(&arg, 0, sizeof(arg));
+        if (!has_cqe && delta_t > 0) {
+            if (delta_t > 10000000) {
+                delta_t = 10000000;
+            }
+            ts.tv_sec = delta_t / 1000000;
+            ts.tv_nsec = (delta_t % 1000000) * 1000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+            min_complete = 1;
+        }
+        ret = (int)syscall(__NR_io_uring_enter, uring->ring_fd, uring->to_submit, min_complete, flags,
+            (flags == 0) ? NULL : &arg, (flags == 0) ? 0 : sizeof(arg));
+        if (ret >= 0) {
+            uring->to_submit -= ((unsigned int)ret < uring->to_submit) ? (unsigned int)ret : uring->to_submit;
+            ret = 0;
+        }
+        else if (errno == ETIME || errno == EINTR || errno == EBUSY) {
+            ret = 0;
+        }
+        else {
+            DBG_PRINTF("io_uring_enter returns error %d\n", errno);
+        }
+    }
+    return ret;
+}
+
+static int picoquic_uring_arm(picoquic_uring_t* uring, SOCKET_TYPE fd)
+{
+    struct io_uring_sqe* sqe = picoquic_uring_get_sqe(uring);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&uring->msg_template;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = PICOQUIC_URING_BGID;
+    sqe->user_data = (uint64_t)fd;
+    return 0;
+}
+
+static void picoquic_uring_cancel(picoquic_uring_t* uring, SOCKET_TYPE fd)
+{
+    struct io_uring_sqe* sqe = picoquic_uring_get_sqe(uring);
+
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)fd;
+        sqe->user_data = PICOQUIC_URING_CANCEL_TAG;
+    }
+}
+
+/* Return the buffers lent to the previous receive batch to the kernel, and
+ * point the messages of the batch to their own buffers again */
+static void picoquic_uring_recycle_lent(picoquic_uring_t* uring, picoquic_recv_batch_t* batch)
+{
+    for (size_t i = 0; i < uring->nb_lent; i++) {
+        picoquic_uring_recycle_buffer(uring, uring->lent_bids[i]);
+    }
+    uring->nb_lent = 0;
+    for (size_t i = 0; i < batch->nb_msg_max; i++) {
+        batch->msg[i].buffer = batch->buffer_ring + i * batch->recv_buffer_size;
+    }
+}
+
+/* Consume completions until a message is found. If required_rank is not negative,
+ * stop without consuming at a message received on a different socket.
+ * If is_lent is set, r_msg->buffer is set to the payload in the provided
+ * buffer, which is only recycled by picoquic_uring_recycle_lent. Otherwise,
+ * the payload is copied to r_msg->buffer and the buffer is recycled at once.
+ * Returns 1 if a message was received in r_msg, 0 otherwise.
+ */
+static int picoquic_uring_next_msg(picoquic_event_ctx_t* ev, SOCKET_TYPE* sockets, int nb_sockets,
+    int required_rank, picoquic_recv_msg_t* r_msg, size_t buffer_max, int is_lent, int* socket_rank)
+{
+    picoquic_uring_t* uring = ev->uring;
+    int found = 0;
+
+    while (!found) {
+        unsigned int head = *uring->cq_head;
+        struct io_uring_cqe* cqe;
+        int rank = -1;
+
+        if (head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        cqe = &uring->cqes[head & *uring->cq_mask];
+        if (cqe->user_data != PICOQUIC_URING_CANCEL_TAG) {
+            for (int i = 0; i < nb_sockets; i++) {
+                if ((uint64_t)sockets[i] == cqe->user_data) {
+                    rank = i;
+                    break;
+                }
+            }
+            if (rank >= 0 && required_rank >= 0 && rank != required_rank && cqe->res >= 0) {
+                break;
+            }
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+                /* The multishot request ended and has to be armed again */
+                for (int i = 0; i < ev->nb_registered; i++) {
+                    if ((uint64_t)ev->registered[i] == cqe->user_data) {
+                        ev->armed[i] = 0;
+                    }
+                }
+            }
+            if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+                uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                uint8_t* buf = uring->buffers + (size_t)bid * uring->buffer_size;
+                struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+                uint8_t* name = buf + sizeof(struct io_uring_recvmsg_out);
+                uint8_t* control = name + uring->msg_template.msg_namelen;
+                uint8_t* payload = control + uring->msg_template.msg_controllen;
+
+                if (rank >= 0 && (out->flags & MSG_TRUNC) == 0 && out->payloadlen <= buffer_max) {
+                    struct msghdr msg;
+                    size_t name_length = (out->namelen < sizeof(struct sockaddr_storage)) ?
+                        out->namelen : sizeof(struct sockaddr_storage);
+
+                    memset(&r_msg->addr_from, 0, sizeof(r_msg->addr_from));
+                    memcpy(&r_msg->addr_from, name, name_length);
+                    memset(&msg, 0, sizeof(msg));
+                    msg.msg_control = control;
+                    msg.msg_controllen = out->controllen;
+                    r_msg->dest_if = 0;
+                    r_msg->received_ecn = 0;
+                    r_msg->udp_coalesced_size = 0;
+                    memset(&r_msg->addr_dest, 0, sizeof(r_msg->addr_dest));
+                    picoquic_socks_cmsg_parse(&msg, &r_msg->addr_dest, &r_msg->dest_if,
+                        &r_msg->received_ecn, &r_msg->udp_coalesced_size);
+                    if (is_lent) {
+                        r_msg->buffer = payload;
+                        uring->lent_bids[uring->nb_lent++] = bid;
+                    }
+                    else {
+                        memcpy(r_msg->buffer, payload, out->payloadlen);
+                    }
+                    r_msg->bytes_recv = out->payloadlen;
+                    *socket_rank = rank;
+                    found = 1;
+                }
+                if (!found || !is_lent) {
+                    picoquic_uring_recycle_buffer(uring, bid);
+                }
+            }
+        }
+        __atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    return found;
+}
+#endif
+
+picoquic_event_ctx_t* picoquic_create_event_ctx(picoquic_event_backend_enum backend, size_t recv_buffer_size)
+{
+    picoquic_event_ctx_t* ev = (picoquic_event_ctx_t*)malloc(sizeof(picoquic_event_ctx_t));
+
+    if (ev != NULL) {
+        memset(ev, 0, sizeof(picoquic_event_ctx_t));
+        ev->backend = picoquic_event_backend_select;
+        ev->recv_buffer_size = recv_buffer_size;
+#if defined(__linux__)
+        ev->epoll_fd = -1;
+#if defined(PICOQUIC_WITH_IO_URING)
+        if (backend == picoquic_event_backend_io_uring) {
+            if ((ev->uring = picoquic_uring_create(recv_buffer_size)) != NULL) {
+                ev->backend = picoquic_event_backend_io_uring;
+            }
+            else {
+                DBG_PRINTF("%s", "io_uring not available, falling back to epoll\n");
+            }
+        }
+#endif
+        if (backend != picoquic_event_backend_select && ev->backend == picoquic_event_backend_select) {
+            if ((ev->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0) {
+                ev->backend = picoquic_event_backend_epoll;
+            }
+            else {
+                DBG_PRINTF("epoll_create1 fails, errno: %d, falling back to select\n", errno);
+            }
+        }
+#else
+        if (backend != picoquic_event_backend_select) {
+            DBG_PRINTF("Event backend %d not supported, using select\n", (int)backend);
+        }
+#endif
+    }
+
+    return ev;
+}
+
+void picoquic_delete_event_ctx(picoquic_event_ctx_t* ev)
+{
+#if defined(PICOQUIC_WITH_IO_URING)
+    if (ev->uring != NULL) {
+        picoquic_uring_delete(ev->uring);
+    }
+#endif
+#if defined(__linux__)
+    if (ev->epoll_fd >= 0) {
+        close(ev->epoll_fd);
+    }
+#endif
+    free(ev);
+}
+
+picoquic_event_backend_enum picoquic_event_ctx_backend(picoquic_event_ctx_t* ev)
+{
+    return (ev == NULL) ? picoquic_event_backend_select : ev->backend;
+}
+
+#if defined(__linux__)
+static void picoquic_event_sync_sockets(picoquic_event_ctx_t* ev, SOCKET_TYPE* sockets, int nb_sockets)
+{
+    if (nb_sockets > PICOQUIC_EVENT_SOCKETS_MAX) {
+        nb_sockets = PICOQUIC_EVENT_SOCKETS_MAX;
+    }
+    if (nb_sockets != ev->nb_registered ||
+        memcmp(sockets, ev->registered, nb_sockets * sizeof(SOCKET_TYPE)) != 0) {
+        for (int i = 0; i < ev->nb_registered; i++) {
+            if (ev->backend == picoquic_event_backend_epoll) {
+                /* Fails harmlessly if the socket was closed */
+                (void)epoll_ctl(ev->epoll_fd, EPOLL_CTL_DEL, ev->registered[i], NULL);
+            }
+#if defined(PICOQUIC_WITH_IO_URING)
+            else if (ev->armed[i]) {
+                picoquic_uring_cancel(ev->uring, ev->registered[i]);
+            }
+#endif
+            ev->armed[i] = 0;
+        }
+        for (int i = 0; i < nb_sockets; i++) {
+            ev->registered[i] = sockets[i];
+            if (ev->backend == picoquic_event_backend_epoll) {
+                struct epoll_event event;
+                memset(&event, 0, sizeof(event));
+                event.events = EPOLLIN;
+                event.data.fd = sockets[i];
+                if (epoll_ctl(ev->epoll_fd, EPOLL_CTL_ADD, sockets[i], &event) != 0 && errno != EEXIST) {
+                    DBG_PRINTF("Cannot add socket %d to epoll, errno: %d\n", (int)sockets[i], errno);
+                }
+            }
+        }
+        ev->nb_registered = nb_sockets;
+    }
+#if defined(PICOQUIC_WITH_IO_URING)
+    if (ev->backend == picoquic_event_backend_io_uring) {
+        for (int i = 0; i < ev->nb_registered; i++) {
+            if (!ev->armed[i] && picoquic_uring_arm(ev->uring, ev->registered[i]) == 0) {
+                ev->armed[i] = 1;
+            }
+        }
+    }
+#endif
+}
+
+/* Wait until one of the sockets is readable, return the rank of the
+ * first readable socket in the list, -1 if none, -2 if error */
+static int picoquic_epoll_wait_rank(picoquic_event_ctx_t* ev, SOCKET_TYPE* sockets, int nb_sockets, int64_t delta_t)
+{
+    struct epoll_event events[PICOQUIC_EVENT_SOCKETS_MAX];
+    int timeout_ms;
+    int nb_events;
+    int ready_rank = -1;
+
+    picoquic_event_sync_sockets(ev, sockets, nb_sockets);
+
+    if (delta_t <= 0) {
+        timeout_ms = 0;
+    }
+    else if (delta_t > 10000000) {
+        timeout_ms = 10000;
+    }
+    else {
+        /* Round up, so the loop does not spin before the timer expires */
+        timeout_ms = (int)((delta_t + 999) / 1000);
+    }
+
+    nb_events = epoll_wait(ev->epoll_fd, events, PICOQUIC_EVENT_SOCKETS_MAX, timeout_ms);
+    if (nb_events < 0) {
+        if (errno != EINTR) {
+            DBG_PRINTF("Error: epoll_wait returns %d, errno: %d\n", nb_events, errno);
+            ready_rank = -2;
+        }
+    }
+    else {
+        for (int e = 0; e < nb_events; e++) {
+            for (int i = 0; i < nb_sockets; i++) {
+                if (sockets[i] == events[e].data.fd && (ready_rank < 0 || i < ready_rank)) {
+                    ready_rank = i;
+                    break;
+                }
+            }
+        }
+    }
+
+    return ready_rank;
+}
+#endif
+
+int picoquic_event_select_ex(picoquic_event_ctx_t* ev,
+    SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time)
+{
+    int bytes_recv = 0;
+
+    if (ev == NULL || ev->backend == picoquic_event_backend_select) {
+        return picoquic_select_ex(sockets, nb_sockets, addr_from, addr_dest, dest_if, received_ecn,
+            buffer, buffer_max, delta_t, socket_rank, current_time);
+    }
+#if defined(PICOQUIC_WITH_IO_URING)
+    else if (ev->backend == picoquic_event_backend_io_uring) {
+        picoquic_recv_msg_t r_msg;
+
+        picoquic_event_sync_sockets(ev, sockets, nb_sockets);
+        r_msg.buffer = buffer;
+        r_msg.bytes_recv = 0;
+        /* Submit pending requests, only wait if no completion is available */
+        if (picoquic_uring_enter(ev->uring, delta_t) != 0) {
+            bytes_recv = -1;
+        }
+        else if (picoquic_uring_next_msg(ev, sockets, nb_sockets, -1, &r_msg, (size_t)buffer_max, 0, socket_rank)) {
+            picoquic_store_addr(addr_from, (struct sockaddr*)&r_msg.addr_from);
+            picoquic_store_addr(addr_dest, (struct sockaddr*)&r_msg.addr_dest);
+            *dest_if = r_msg.dest_if;
+            if (received_ecn != NULL) {
+                *received_ecn = r_msg.received_ecn;
+            }
+            bytes_recv = (int)r_msg.bytes_recv;
+        }
+    }
+#endif
+#if defined(__linux__)
+    else {
+        int ready_rank = picoquic_epoll_wait_rank(ev, sockets, nb_sockets, delta_t);
+
+        if (received_ecn != NULL) {
+            *received_ecn = 0;
+        }
+        if (ready_rank == -2) {
+            bytes_recv = -1;
+        }
+        else if (ready_rank >= 0) {
+            *socket_rank = ready_rank;
+            bytes_recv = picoquic_recvmsg(sockets[ready_rank], addr_from,
+                addr_dest, dest_if, received_ecn, buffer, buffer_max);
+            if (bytes_recv <= 0) {
+                DBG_PRINTF("Could not receive packet on UDP socket[%d]= %d!\n",
+                    ready_rank, (int)sockets[ready_rank]);
+            }
+        }
+    }
+#endif
+
+    *current_time = picoquic_current_time();
+
+    return bytes_recv;
+}
+
+int picoquic_event_select_batch(picoquic_event_ctx_t* ev,
+    SOCKET_TYPE* sockets,
+    int nb_sockets,
+    picoquic_recv_batch_t* batch,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time)
+{
+    int bytes_recv = 0;
+
+    if (ev == NULL || ev->backend == picoquic_event_backend_select) {
+        return picoquic_select_batch(sockets, nb_sockets, batch, delta_t, socket_rank, current_time);
+    }
+
+    batch->nb_msg = 0;
+#if defined(PICOQUIC_WITH_IO_URING)
+    if (ev->backend == picoquic_event_backend_io_uring) {
+        int rank = -1;
+
+        /* The previous batch has been processed, its buffers can be reused */
+        picoquic_uring_recycle_lent(ev->uring, batch);
+        picoquic_event_sync_sockets(ev, sockets, nb_sockets);
+        if (picoquic_uring_enter(ev->uring, delta_t) != 0) {
+            bytes_recv = -1;
+        }
+        else {
+            /* Collect the consecutive messages received on the same socket,
+             * leaving the payloads in the provided buffers */
+            while (batch->nb_msg < batch->nb_msg_max &&
+                picoquic_uring_next_msg(ev, sockets, nb_sockets, rank, &batch->msg[batch->nb_msg],
+                    batch->recv_buffer_size, 1, &rank)) {
+                bytes_recv += (int)batch->msg[batch->nb_msg].bytes_recv;
+                batch->nb_msg++;
+            }
+            if (batch->nb_msg > 0) {
+                *socket_rank = rank;
+            }
+        }
+    }
+#endif
+#if defined(__linux__)
+    if (ev->backend == picoquic_event_backend_epoll) {
+        int ready_rank = picoquic_epoll_wait_rank(ev, sockets, nb_sockets, delta_t);
+
+        if (ready_rank == -2) {
+            bytes_recv = -1;
+        }
+        else if (ready_rank >= 0) {
+            *socket_rank = ready_rank;
+            bytes_recv = picoquic_recvmmsg(sockets[ready_rank], batch);
+            if (bytes_recv <= 0) {
+                DBG_PRINTF("Could not receive batch on UDP socket[%d]= %d!\n",
+                    ready_rank, (int)sockets[ready_rank]);
+            }
+        }
+    }
+#endif
+
+    *current_time = picoquic_current_time();
+
+    return bytes_recv;
+}
+
 int picoquic_send_through_socket(
     SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
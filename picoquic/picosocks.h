@@ -213,6 +213,133 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     const char* bytes, int length,
     int send_msg_size, int * sock_err);
 
+/* Batch receive. On Linux, a single call to recvmmsg returns several datagrams,
+ * and if UDP GRO is enabled on the socket each of these datagrams may contain
+ * several coalesced UDP segments of size "udp_coalesced_size". The receive
+ * batch holds a ring of receive buffers and the metadata of each message.
+ * On platforms without recvmmsg, the batch functions fall back to receiving
+ * a single message per call.
+ */
+#define PICOQUIC_RECV_BATCH_MAX 32
+#define PICOQUIC_RECV_GRO_BUFFER_SIZE 0xFFFF
+
+typedef struct st_picoquic_recv_msg_t {
+    struct sockaddr_storage addr_from;
+    struct sockaddr_storage addr_dest;
+    int dest_if;
+    unsigned char received_ecn;
+    size_t udp_coalesced_size;
+    size_t bytes_recv;
+    uint8_t* buffer;
+} picoquic_recv_msg_t;
+
+typedef struct st_picoquic_recv_batch_t {
+    size_t nb_msg_max;
+    size_t recv_buffer_size;
+    size_t nb_msg;
+    picoquic_recv_msg_t msg[PICOQUIC_RECV_BATCH_MAX];
+    uint8_t* buffer_ring;
+    void* os_msg_ctx;
+} picoquic_recv_batch_t;
+
+picoquic_recv_batch_t* picoquic_create_recv_batch(size_t nb_msg_max, size_t recv_buffer_size);
+void picoquic_delete_recv_batch(picoquic_recv_batch_t* batch);
+int picoquic_socket_set_gro_options(SOCKET_TYPE sd, int af);
+int picoquic_recvmmsg(SOCKET_TYPE fd, picoquic_recv_batch_t* batch);
+
+int picoquic_select_batch(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    picoquic_recv_batch_t* batch,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time);
+
+/* Batch send. The send batch holds a pool of send buffers, each of which
+ * can hold a single packet or a GSO train, and the metadata of each message:
+ * socket, addresses and segment size. The messages may be sent through
+ * different sockets and to different peers. On Linux, consecutive messages
+ * through the same socket are sent with a single sendmmsg call. On other
+ * platforms, the messages are sent one by one. The result of the send is
+ * documented in "bytes_sent" and "sock_err" for each message.
+ */
+#define PICOQUIC_SEND_BATCH_MAX 32
+
+typedef struct st_picoquic_send_msg_t {
+    SOCKET_TYPE fd;
+    struct sockaddr_storage addr_dest;
+    struct sockaddr_storage addr_from;
+    int dest_if;
+    size_t length;
+    size_t send_msg_size;
+    int bytes_sent;
+    int sock_err;
+    uint8_t* buffer;
+} picoquic_send_msg_t;
+
+typedef struct st_picoquic_send_batch_t {
+    size_t nb_msg_max;
+    size_t send_buffer_size;
+    size_t nb_msg;
+    picoquic_send_msg_t msg[PICOQUIC_SEND_BATCH_MAX];
+    uint8_t* buffer_ring;
+    void* os_msg_ctx;
+} picoquic_send_batch_t;
+
+picoquic_send_batch_t* picoquic_create_send_batch(size_t nb_msg_max, size_t send_buffer_size);
+void picoquic_delete_send_batch(picoquic_send_batch_t* batch);
+size_t picoquic_sendmmsg(picoquic_send_batch_t* batch);
+
+/* Event backends. By default, the socket loop waits for incoming packets
+ * with select(), which rebuilds and rescans the socket set at each call.
+ * On Linux, an event context can instead wait with epoll, or receive
+ * through io_uring, using one multishot recvmsg request per socket and a
+ * ring of receive buffers registered with the kernel. With io_uring,
+ * picoquic_event_select_batch does not copy the payloads: the "buffer" of
+ * each message points into the registered ring, and remains valid until
+ * the next call with the same event context. Sends are not affected by
+ * the backend, they still use sendmsg or sendmmsg. If the requested
+ * backend is not available on the platform or the kernel, the event
+ * context falls back to epoll, then to select; the selected backend can be
+ * read with picoquic_event_ctx_backend.
+ * The socket list is passed at each call, as in picoquic_select_ex. The
+ * context keeps track of the sockets that it registered, so sockets can
+ * be added or replaced between calls. Passing a NULL event context is
+ * the same as calling the select based functions.
+ */
+#define PICOQUIC_EVENT_SOCKETS_MAX 8
+
+typedef enum {
+    picoquic_event_backend_select = 0,
+    picoquic_event_backend_epoll,
+    picoquic_event_backend_io_uring
+} picoquic_event_backend_enum;
+
+typedef struct st_picoquic_event_ctx_t picoquic_event_ctx_t;
+
+picoquic_event_ctx_t* picoquic_create_event_ctx(picoquic_event_backend_enum backend, size_t recv_buffer_size);
+void picoquic_delete_event_ctx(picoquic_event_ctx_t* ev);
+picoquic_event_backend_enum picoquic_event_ctx_backend(picoquic_event_ctx_t* ev);
+
+int picoquic_event_select_ex(picoquic_event_ctx_t* ev,
+    SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time);
+
+int picoquic_event_select_batch(picoquic_event_ctx_t* ev,
+    SOCKET_TYPE* sockets,
+    int nb_sockets,
+    picoquic_recv_batch_t* batch,
+    int64_t delta_t,
+    int* socket_rank,
+    uint64_t* current_time);
+
 int picoquic_send_through_socket(
     SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
@@ -31,6 +31,9 @@
 #ifndef _WINDOWS
 #include <sys/time.h>
 #endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 
 /*
@@ -466,6 +469,7 @@ static void picoquic_delete_issued_ticket(picoquic_quic_t* quic, picoquic_issued
 }
 
 int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
+    uint64_t current_time,
     uint64_t ticket_id,
     uint64_t rtt,
     uint64_t cwin,
@@ -480,13 +484,22 @@ int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
         picoquic_update_issued_ticket(ticket, rtt, cwin, ip_addr, ip_addr_length);
     }
     else {
-        while (quic->table_issued_tickets_nb > quic->max_number_connections) {
+        /* The oldest tickets are at the end of the list */
+        while (quic->table_issued_tickets_last != NULL &&
+            quic->table_issued_tickets_last->creation_time + PICOQUIC_ISSUED_TICKET_LIFETIME <= current_time) {
+            picoquic_delete_issued_ticket(quic, quic->table_issued_tickets_last);
+            quic->nb_issued_tickets_expired++;
+        }
+        while (quic->table_issued_tickets_last != NULL &&
+            quic->table_issued_tickets_nb >= quic->max_number_connections) {
             picoquic_delete_issued_ticket(quic, quic->table_issued_tickets_last);
+            quic->nb_issued_tickets_evicted++;
         }
         ticket = (picoquic_issued_ticket_t*)malloc(sizeof(picoquic_issued_ticket_t));
         if (ticket != NULL) {
             memset(ticket, 0, sizeof(picoquic_issued_ticket_t));
             ticket->ticket_id = ticket_id;
+            ticket->creation_time = current_time;
             picoquic_update_issued_ticket(ticket, rtt, cwin, ip_addr, ip_addr_length);
             ticket->next_ticket = quic->table_issued_tickets_first;
             quic->table_issued_tickets_first = ticket;
@@ -497,6 +510,7 @@ int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
                 ticket->next_ticket->previous_ticket = ticket;
             }
             picohash_insert(quic->table_issued_tickets, ticket);
+            quic->table_issued_tickets_nb++;
         }
         else {
             ret = PICOQUIC_ERROR_MEMORY;
@@ -506,92 +520,6 @@ int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
     return ret;
 }
 
-/* Token reuse management */
-
-static int64_t picoquic_registered_token_compare(void* l, void* r)
-{
-    /* STream values are from 0 to 2^62-1, which means we are not worried with rollover */
-    picoquic_registered_token_t* rt_l = (picoquic_registered_token_t*)l;
-    picoquic_registered_token_t* rt_r = (picoquic_registered_token_t*)r;
-    int64_t ret = 0;
-    if (rt_l->token_time == rt_r->token_time) {
-        if (rt_l->token_hash > rt_r->token_hash) {
-            ret = 1;
-        }
-        else if (rt_l->token_hash < rt_r->token_hash) {
-            ret = -1;
-        }
-    }
-    else if (rt_l->token_time > rt_r->token_time) {
-        ret = 1;
-    }
-    else {
-        ret = -1;
-    }
-    return ret;
-}
-
-static picosplay_node_t* picoquic_registered_token_create(void* value)
-{
-    return &((picoquic_registered_token_t*)value)->registered_token_node;
-}
-
-
-static void* picoquic_registered_token_value(picosplay_node_t* node)
-{
-    return (void*)((char*)node - offsetof(struct st_picoquic_registered_token_t, registered_token_node));
-}
-
-static void picoquic_registered_token_delete(void* tree, picosplay_node_t* node)
-{
-    picoquic_registered_token_t* rt = (picoquic_registered_token_t*)picoquic_registered_token_value(node);
-    free(rt);
-}
-
-int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
-    const uint8_t * token, size_t token_length, uint64_t expiry_time)
-{
-    int ret = -1;
-    if (token_length >= 8) {
-        picoquic_registered_token_t* rt = (picoquic_registered_token_t*)malloc(sizeof(picoquic_registered_token_t));
-        if (rt != NULL) {
-            picosplay_node_t* rt_n = NULL;
-            memset(rt, 0, sizeof(picoquic_registered_token_t));
-            rt->token_time = expiry_time;
-            rt->token_hash = PICOPARSE_64(token + token_length - 8);
-            rt->count = 1;
-            rt_n = picosplay_find(&quic->token_reuse_tree, rt);
-            if (rt_n != NULL) {
-                free(rt);
-                rt = (picoquic_registered_token_t*)picoquic_registered_token_value(rt_n);
-                rt->count++;
-                DBG_PRINTF("Token reuse detected, count=%d", rt->count);
-            }
-            else {
-                (void)picosplay_insert(&quic->token_reuse_tree, rt);
-                ret = 0;
-            }
-        }
-    }
-
-    return ret;
-}
-
-void picoquic_registered_token_clear(picoquic_quic_t* quic, uint64_t expiry_time_max)
-{
-    int end_reached = 0;
-    do {
-        picoquic_registered_token_t* rt_first = (picoquic_registered_token_t*)
-            picoquic_registered_token_value(picosplay_first(&quic->token_reuse_tree));
-        if (rt_first == NULL || rt_first->token_time >= expiry_time_max) {
-            end_reached = 1;
-        }
-        else {
-            picosplay_delete_hint(&quic->token_reuse_tree, &rt_first->registered_token_node);
-        }
-    } while (!end_reached);
-}
-
 int picoquic_adjust_max_connections(picoquic_quic_t * quic, uint32_t max_nb_connections)
 {
     if (max_nb_connections <= quic->max_number_connections) {
@@ -608,7 +536,7 @@ uint32_t picoquic_current_number_connections(picoquic_quic_t * quic)
 }
 
 /* Forward reference */
-static void picoquic_wake_list_init(picoquic_quic_t* quic);
+static void picoquic_wake_list_init(picoquic_quic_t* quic, uint64_t current_time);
 
 /* QUIC context create and dispose */
 picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
@@ -660,25 +588,17 @@ picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
         picoquic_init_transport_parameters(&quic->default_tp, 0);
 
         quic->random_initial = 1;
-        picoquic_wake_list_init(quic);
+        picoquic_wake_list_init(quic, current_time);
+        picoquic_packet_pool_init(quic);
 
         if (cnx_id_callback != NULL) {
             quic->unconditional_cnx_id = 1;
         }
 
-        if (ticket_file_name != NULL) {
-            quic->ticket_file_name = ticket_file_name;
-            ret = picoquic_load_tickets(&quic->p_first_ticket, current_time, ticket_file_name);
-
-            if (ret == PICOQUIC_ERROR_NO_SUCH_FILE) {
-                DBG_PRINTF("Ticket file <%s> not created yet.\n", ticket_file_name);
-                ret = 0;
-            }
-            else if (ret != 0) {
-                DBG_PRINTF("Cannot load tickets from <%s>\n", ticket_file_name);
-                ret = 0;
-            }
-        }
+        /* The ticket file is read at the first access to the tickets */
+        quic->ticket_file_name = ticket_file_name;
+        quic->ticket_index.nb_tickets_max = PICOQUIC_STORED_TICKETS_MAX_DEFAULT;
+        quic->token_index.nb_tokens_max = PICOQUIC_STORED_TOKENS_MAX_DEFAULT;
 
         if (ret == 0) {
             if (max_nb_connections == 0) {
@@ -688,13 +608,13 @@ picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
             quic->tentative_max_number_connections = max_nb_connections;
             quic->max_number_connections = max_nb_connections;
 
-            quic->table_cnx_by_id = picohash_create_ex((size_t)max_nb_connections * 4,
+            quic->table_cnx_by_id = picohash_oa_create((size_t)max_nb_connections * 4,
                 picoquic_local_cnxid_hash, picoquic_local_cnxid_compare, picoquic_local_cnxid_to_item);
 
-            quic->table_cnx_by_net = picohash_create_ex((size_t)max_nb_connections * 4,
+            quic->table_cnx_by_net = picohash_oa_create((size_t)max_nb_connections * 4,
                 picoquic_net_id_hash, picoquic_net_id_compare, picoquic_local_netid_to_item);
 
-            quic->table_cnx_by_icid = picohash_create_ex((size_t)max_nb_connections,
+            quic->table_cnx_by_icid = picohash_oa_create((size_t)max_nb_connections,
                 picoquic_net_icid_hash, picoquic_net_icid_compare, picoquic_net_icid_to_item);
 
             quic->table_cnx_by_secret = picohash_create_ex((size_t)max_nb_connections * 4,
@@ -703,8 +623,8 @@ picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
             quic->table_issued_tickets = picohash_create_ex((size_t)max_nb_connections,
                 picoquic_issued_ticket_hash, picoquic_issued_ticket_compare, picoquic_issued_ticket_key_to_item);
 
-            picosplay_init_tree(&quic->token_reuse_tree, picoquic_registered_token_compare,
-                picoquic_registered_token_create, picoquic_registered_token_delete, picoquic_registered_token_value);
+            picoquic_anti_replay_init(&quic->token_anti_replay, PICOQUIC_ANTI_REPLAY_MEMORY_DEFAULT,
+                PICOQUIC_ANTI_REPLAY_FP_LOG2_DEFAULT);
 
             if (quic->table_cnx_by_id == NULL || quic->table_cnx_by_net == NULL ||
                 quic->table_cnx_by_icid == NULL || quic->table_cnx_by_secret == NULL ||
@@ -743,26 +663,6 @@ picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
     return quic;
 }
 
-int picoquic_load_token_file(picoquic_quic_t* quic, char const * token_file_name)
-{
-    uint64_t current_time = picoquic_get_quic_time(quic);
-    int ret = picoquic_load_tokens(&quic->p_first_token, current_time, token_file_name);
-
-    if (ret == PICOQUIC_ERROR_NO_SUCH_FILE) {
-        DBG_PRINTF("Ticket file <%s> not created yet.\n", token_file_name);
-        ret = 0;
-    }
-    else if (ret != 0) {
-        DBG_PRINTF("Cannot load tickets from <%s>\n", token_file_name);
-    }
-
-    if (ret == 0) {
-        quic->token_file_name = token_file_name;
-    }
-
-    return ret;
-}
-
 int picoquic_set_default_tp(picoquic_quic_t* quic, picoquic_tp_t * tp)
 {
     int ret = 0;
@@ -835,6 +735,110 @@ void picoquic_set_max_data_control(picoquic_quic_t* quic, uint64_t max_data)
     }
 }
 
+void picoquic_set_flow_control_autotune(picoquic_quic_t* quic, uint64_t window_max)
+{
+    quic->fc_autotune_window_max = window_max;
+}
+
+void picoquic_get_flow_control_stats(picoquic_cnx_t* cnx, picoquic_flow_control_stats_t* stats)
+{
+    memset(stats, 0, sizeof(picoquic_flow_control_stats_t));
+    stats->max_data_window = (cnx->quic->fc_autotune_window_max != 0 && cnx->fc_autotune.window > 0) ?
+        cnx->fc_autotune.window : cnx->local_parameters.initial_max_data;
+    stats->nb_window_increases = cnx->nb_fc_window_increases;
+    stats->nb_data_blocked_received = cnx->nb_data_blocked_received;
+    stats->nb_stream_data_blocked_received = cnx->nb_stream_data_blocked_received;
+    stats->nb_data_blocked_sent = cnx->nb_data_blocked_sent;
+    stats->nb_stream_data_blocked_sent = cnx->nb_stream_data_blocked_sent;
+}
+
+/* Memory accounting */
+void picoquic_memory_account(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t bytes)
+{
+    if (cnx != NULL) {
+        cnx->memory_bytes[category] += bytes;
+        cnx->quic->memory_bytes[category] += bytes;
+    }
+}
+
+void picoquic_memory_release(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t bytes)
+{
+    if (cnx != NULL) {
+        cnx->memory_bytes[category] -= bytes;
+        cnx->quic->memory_bytes[category] -= bytes;
+    }
+}
+
+uint64_t picoquic_memory_total(const uint64_t* memory_bytes)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < picoquic_memory_nb_categories; i++) {
+        total += memory_bytes[i];
+    }
+    return total;
+}
+
+int picoquic_is_memory_budget_exceeded(picoquic_quic_t* quic)
+{
+    return quic->memory_budget != 0 && picoquic_memory_total(quic->memory_bytes) > quic->memory_budget;
+}
+
+/* Scale down a flow control window when the memory in use exceeds half the
+ * budget, linearly down to PICOQUIC_MEMORY_PRESSURE_WINDOW_MIN when the budget
+ * is reached. The window is never reduced to zero, so that the peers can
+ * still make progress once the memory is released. */
+uint64_t picoquic_memory_pressure_window(picoquic_quic_t* quic, uint64_t window)
+{
+    if (quic->memory_budget != 0) {
+        uint64_t total = picoquic_memory_total(quic->memory_bytes);
+        uint64_t half_budget = quic->memory_budget / 2;
+
+        if (total > half_budget) {
+            uint64_t margin = (total < quic->memory_budget) ? quic->memory_budget - total : 0;
+            uint64_t min_window = (window < PICOQUIC_MEMORY_PRESSURE_WINDOW_MIN) ? window : PICOQUIC_MEMORY_PRESSURE_WINDOW_MIN;
+
+            window = (uint64_t)(((double)window * (double)margin) / (double)(quic->memory_budget - half_budget));
+            if (window < min_window) {
+                window = min_window;
+            }
+        }
+    }
+    return window;
+}
+
+void picoquic_set_memory_budget(picoquic_quic_t* quic, uint64_t memory_budget)
+{
+    quic->memory_budget = memory_budget;
+}
+
+static void picoquic_fill_memory_stats(const uint64_t* memory_bytes, picoquic_memory_stats_t* stats)
+{
+    memset(stats, 0, sizeof(picoquic_memory_stats_t));
+    stats->send_queue_bytes = memory_bytes[picoquic_memory_send_queue];
+    stats->reassembly_bytes = memory_bytes[picoquic_memory_reassembly];
+    stats->retransmit_bytes = memory_bytes[picoquic_memory_retransmit];
+    stats->total_bytes = picoquic_memory_total(memory_bytes);
+}
+
+void picoquic_get_memory_stats(picoquic_quic_t* quic, picoquic_memory_stats_t* stats)
+{
+    picoquic_packet_pool_stats_t pool_stats;
+
+    picoquic_fill_memory_stats(quic->memory_bytes, stats);
+    picoquic_get_packet_pool_stats(quic, &pool_stats);
+    stats->packet_pool_bytes = pool_stats.bytes_allocated +
+        (uint64_t)quic->nb_data_nodes_allocated * sizeof(picoquic_stream_data_node_t);
+    stats->memory_budget = quic->memory_budget;
+    stats->nb_cnx_refused = quic->nb_cnx_refused_memory;
+}
+
+void picoquic_get_cnx_memory_stats(picoquic_cnx_t* cnx, picoquic_memory_stats_t* stats)
+{
+    picoquic_fill_memory_stats(cnx->memory_bytes, stats);
+    stats->memory_budget = cnx->quic->memory_budget;
+}
+
 void picoquic_set_default_idle_timeout(picoquic_quic_t* quic, uint64_t idle_timeout_ms)
 {
     quic->default_tp.max_idle_timeout = idle_timeout_ms;
@@ -924,21 +928,28 @@ void picoquic_free(picoquic_quic_t* quic)
         }
 
         /* delete the stored tickets */
-        picoquic_free_tickets(&quic->p_first_ticket);
+        picoquic_free_session_tickets(quic);
 
         /* Delete the stored tokens */
-        picoquic_free_tokens(&quic->p_first_token);
+        picoquic_free_retry_tokens(quic);
 
-        /* Deelete the reused tokens tree */
-        picosplay_empty_tree(&quic->token_reuse_tree);
+        /* Delete the token reuse filters */
+        picoquic_anti_replay_release(&quic->token_anti_replay);
+
+        /* Delete the admission control table */
+        picoquic_admission_release(&quic->admission);
 
         /* delete packets in pool */
-        while (quic->p_first_packet != NULL) {
-            picoquic_packet_t * p = quic->p_first_packet->packet_previous;
-            free(quic->p_first_packet);
-            quic->p_first_packet = p;
-            quic->nb_packets_allocated--;
-            quic->nb_packets_in_pool--;
+        picoquic_packet_pool_clear(quic);
+
+        if (quic->protect_batch != NULL) {
+            free(quic->protect_batch);
+            quic->protect_batch = NULL;
+        }
+
+        if (quic->unprotect_batch != NULL) {
+            free(quic->unprotect_batch);
+            quic->unprotect_batch = NULL;
         }
 
         /* delete data nodes in pool */
@@ -950,23 +961,30 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->nb_data_nodes_in_pool--;
         }
 
-        /* delete all pending stateless packets */
+        /* delete all pending stateless packets, then the pool */
         while (quic->pending_stateless_packet != NULL) {
             picoquic_stateless_packet_t* to_delete = quic->pending_stateless_packet;
             quic->pending_stateless_packet = to_delete->next_packet;
-            free(to_delete);
+            picoquic_delete_stateless_packet(to_delete);
+        }
+        quic->pending_stateless_last = NULL;
+
+        if (quic->stateless_pool != NULL) {
+            free(quic->stateless_pool);
+            quic->stateless_pool = NULL;
+            quic->stateless_pool_free = NULL;
         }
 
         if (quic->table_cnx_by_id != NULL) {
-            picohash_delete(quic->table_cnx_by_id, 0);
+            picohash_oa_delete(quic->table_cnx_by_id, 0);
         }
 
         if (quic->table_cnx_by_net != NULL) {
-            picohash_delete(quic->table_cnx_by_net, 0);
+            picohash_oa_delete(quic->table_cnx_by_net, 0);
         }
 
         if (quic->table_cnx_by_icid != NULL) {
-            picohash_delete(quic->table_cnx_by_icid, 0);
+            picohash_oa_delete(quic->table_cnx_by_icid, 0);
         }
 
         if (quic->table_issued_tickets != NULL) {
@@ -1041,29 +1059,85 @@ uint32_t picoquic_get_max_half_open_retry_threshold(picoquic_quic_t* quic)
     return quic->max_half_open_before_retry;
 }
 
+/* Allocate the slots of the stateless packet pool, and chain them in the free list */
+static int picoquic_stateless_pool_init(picoquic_quic_t* quic)
+{
+    size_t pool_size = (quic->stateless_pool_size == 0) ? PICOQUIC_STATELESS_POOL_SIZE_DEFAULT : quic->stateless_pool_size;
+
+    quic->stateless_pool = (picoquic_stateless_packet_t*)malloc(pool_size * sizeof(picoquic_stateless_packet_t));
+    if (quic->stateless_pool == NULL) {
+        return -1;
+    }
+    quic->stateless_pool_size = pool_size;
+    quic->stateless_pool_free = NULL;
+    for (size_t i = pool_size; i > 0; i--) {
+        picoquic_stateless_packet_t* sp = &quic->stateless_pool[i - 1];
+        sp->pool_quic = quic;
+        sp->next_packet = quic->stateless_pool_free;
+        quic->stateless_pool_free = sp;
+    }
+    return 0;
+}
+
 picoquic_stateless_packet_t* picoquic_create_stateless_packet(picoquic_quic_t* quic)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(quic);
-#endif
-    return (picoquic_stateless_packet_t*)malloc(sizeof(picoquic_stateless_packet_t));
+    picoquic_stateless_packet_t* sp = NULL;
+
+    if (quic->stateless_pool != NULL || picoquic_stateless_pool_init(quic) == 0) {
+        sp = quic->stateless_pool_free;
+    }
+
+    if (sp == NULL) {
+        quic->nb_stateless_dropped++;
+    }
+    else {
+        quic->stateless_pool_free = sp->next_packet;
+        sp->next_packet = NULL;
+        quic->stateless_pool_nb_in_use++;
+        if (quic->stateless_pool_nb_in_use > quic->stateless_pool_nb_in_use_max) {
+            quic->stateless_pool_nb_in_use_max = quic->stateless_pool_nb_in_use;
+        }
+    }
+
+    return sp;
 }
 
-void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp)
+picoquic_stateless_packet_t* picoquic_create_sooner_packet(void)
 {
-    free(sp);
+    picoquic_stateless_packet_t* sp = (picoquic_stateless_packet_t*)malloc(sizeof(picoquic_stateless_packet_t));
+
+    if (sp != NULL) {
+        sp->pool_quic = NULL;
+    }
+
+    return sp;
 }
 
-void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_packet_t* sp)
+void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp)
 {
-    picoquic_stateless_packet_t** pnext = &quic->pending_stateless_packet;
+    picoquic_quic_t* quic = sp->pool_quic;
 
-    while ((*pnext) != NULL) {
-        pnext = &(*pnext)->next_packet;
+    if (quic == NULL) {
+        free(sp);
+    }
+    else {
+        sp->next_packet = quic->stateless_pool_free;
+        quic->stateless_pool_free = sp;
+        quic->stateless_pool_nb_in_use--;
     }
+}
 
-    *pnext = sp;
+void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_packet_t* sp)
+{
     sp->next_packet = NULL;
+    if (quic->pending_stateless_packet == NULL) {
+        quic->pending_stateless_packet = sp;
+    }
+    else {
+        quic->pending_stateless_last->next_packet = sp;
+    }
+    quic->pending_stateless_last = sp;
+    quic->nb_stateless_queued++;
 }
 
 picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic)
@@ -1072,7 +1146,11 @@ picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t*
 
     if (sp != NULL) {
         quic->pending_stateless_packet = sp->next_packet;
+        if (quic->pending_stateless_packet == NULL) {
+            quic->pending_stateless_last = NULL;
+        }
         sp->next_packet = NULL;
+        quic->nb_stateless_sent++;
         picoquic_log_quic_pdu(quic, 0, picoquic_get_quic_time(quic), sp->cnxid_log64,
             (struct sockaddr*) & sp->addr_to, (struct sockaddr*) & sp->addr_local, sp->length);
     }
@@ -1080,6 +1158,35 @@ picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t*
     return sp;
 }
 
+int picoquic_set_stateless_pool_size(picoquic_quic_t* quic, size_t pool_size)
+{
+    int ret = 0;
+
+    if (quic->stateless_pool_nb_in_use > 0) {
+        ret = -1;
+    }
+    else {
+        if (quic->stateless_pool != NULL) {
+            free(quic->stateless_pool);
+            quic->stateless_pool = NULL;
+            quic->stateless_pool_free = NULL;
+        }
+        quic->stateless_pool_size = pool_size;
+    }
+
+    return ret;
+}
+
+void picoquic_get_stateless_packet_stats(picoquic_quic_t* quic, picoquic_stateless_packet_stats_t* stats)
+{
+    stats->pool_size = (quic->stateless_pool_size == 0) ? PICOQUIC_STATELESS_POOL_SIZE_DEFAULT : quic->stateless_pool_size;
+    stats->nb_in_use = quic->stateless_pool_nb_in_use;
+    stats->nb_in_use_max = quic->stateless_pool_nb_in_use_max;
+    stats->nb_queued = quic->nb_stateless_queued;
+    stats->nb_sent = quic->nb_stateless_sent;
+    stats->nb_dropped = quic->nb_stateless_dropped;
+}
+
 int picoquic_cnx_is_still_logging(picoquic_cnx_t* cnx)
 {
     int ret =
@@ -1094,12 +1201,12 @@ int picoquic_register_cnx_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picoqui
     int ret = 0;
     picohash_item* item;
 
-    item = picohash_retrieve(quic->table_cnx_by_id, l_cid);
+    item = picohash_oa_retrieve(quic->table_cnx_by_id, l_cid);
     if (item != NULL) {
         ret = -1;
     } else {
         l_cid->registered_cnx = cnx;
-        ret = picohash_insert(quic->table_cnx_by_id, l_cid);
+        ret = picohash_oa_insert(quic->table_cnx_by_id, l_cid);
     }
 
     return ret;
@@ -1108,9 +1215,9 @@ int picoquic_register_cnx_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picoqui
 void picoquic_unregister_net_id(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
 {
     if (path_x->net_id_hash_item.key != NULL) {
-        picohash_item* item = picohash_retrieve(cnx->quic->table_cnx_by_net, path_x);
+        picohash_item* item = picohash_oa_retrieve(cnx->quic->table_cnx_by_net, path_x);
         if (item != NULL) {
-            picohash_delete_item(cnx->quic->table_cnx_by_net, item, 0);
+            picohash_oa_delete_item(cnx->quic->table_cnx_by_net, item, 0);
         }
         memset(&path_x->registered_peer_addr, 0, sizeof(struct sockaddr_storage));
     }
@@ -1125,12 +1232,12 @@ int picoquic_register_net_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picoqui
     picoquic_unregister_net_id(cnx, path_x);
     /* Try registering the new address */
     picoquic_store_addr(&path_x->registered_peer_addr, (struct sockaddr *)&path_x->peer_addr);
-    item = picohash_retrieve(quic->table_cnx_by_net, path_x);
+    item = picohash_oa_retrieve(quic->table_cnx_by_net, path_x);
 
     if (item != NULL) {
         ret = -1;
     } else {
-        ret = picohash_insert(quic->table_cnx_by_net, path_x);
+        ret = picohash_oa_insert(quic->table_cnx_by_net, path_x);
     }
 
     return ret;
@@ -1169,13 +1276,13 @@ int picoquic_register_net_icid(picoquic_cnx_t* cnx)
     int ret = 0;
     picohash_item* item;
     picoquic_store_addr(&cnx->registered_icid_addr, (struct sockaddr*)&cnx->path[0]->peer_addr);
-    item = picohash_retrieve(cnx->quic->table_cnx_by_icid, cnx);
+    item = picohash_oa_retrieve(cnx->quic->table_cnx_by_icid, cnx);
 
     if (item != NULL) {
         ret = -1;
     }
     else {
-        ret = picohash_insert(cnx->quic->table_cnx_by_icid, cnx);
+        ret = picohash_oa_insert(cnx->quic->table_cnx_by_icid, cnx);
     }
     return ret;
 }
@@ -1183,7 +1290,7 @@ int picoquic_register_net_icid(picoquic_cnx_t* cnx)
 void picoquic_unregister_net_icid(picoquic_cnx_t* cnx)
 {
     if (cnx->registered_icid_item.key != 0) {
-        picohash_delete_item(cnx->quic->table_cnx_by_icid, &cnx->registered_icid_item, 0);
+        picohash_oa_delete_item(cnx->quic->table_cnx_by_icid, &cnx->registered_icid_item, 0);
         memset(&cnx->registered_icid_addr, 0, sizeof(struct sockaddr_storage));
         memset(&cnx->registered_icid_item, 0, sizeof(picohash_item));
     }
@@ -1321,20 +1428,36 @@ static void picoquic_wake_list_delete_node(void* tree, picosplay_node_t* node)
     memset(node, 0, sizeof(picosplay_node_t));
 }
 
-static void picoquic_wake_list_init(picoquic_quic_t * quic)
+static void picoquic_wake_list_init(picoquic_quic_t * quic, uint64_t current_time)
 {
     picosplay_init_tree(&quic->cnx_wake_tree, picoquic_wake_list_compare,
         picoquic_wake_list_create_node, picoquic_wake_list_delete_node, picoquic_wake_list_node_value);
+    picoquic_wheel_init(&quic->cnx_wake_wheel, current_time);
+}
+
+static picoquic_cnx_t* picoquic_wake_wheel_node_value(picoquic_wheel_node_t* node)
+{
+    return (node == NULL) ? NULL : (picoquic_cnx_t*)((char*)node - offsetof(struct st_picoquic_cnx_t, cnx_wheel_node));
 }
 
 static void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
 {
-    picosplay_delete_hint(&cnx->quic->cnx_wake_tree, &cnx->cnx_wake_node);
+    if (cnx->quic->use_wake_wheel) {
+        picoquic_wheel_remove(&cnx->quic->cnx_wake_wheel, &cnx->cnx_wheel_node);
+    }
+    else {
+        picosplay_delete_hint(&cnx->quic->cnx_wake_tree, &cnx->cnx_wake_node);
+    }
 }
 
 static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
 {
-    picosplay_insert(&quic->cnx_wake_tree, cnx);
+    if (quic->use_wake_wheel) {
+        picoquic_wheel_insert(&quic->cnx_wake_wheel, &cnx->cnx_wheel_node, cnx->next_wake_time);
+    }
+    else {
+        picosplay_insert(&quic->cnx_wake_tree, cnx);
+    }
 }
 
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time)
@@ -1344,17 +1467,114 @@ void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
     picoquic_insert_cnx_by_wake_time(quic, cnx);
 }
 
+/* Select the wake up scheduler. The connections already present are moved
+ * from the previous scheduler to the new one.
+ */
+void picoquic_set_wake_scheduler(picoquic_quic_t* quic, picoquic_wake_scheduler_enum scheduler, uint64_t current_time)
+{
+    unsigned int use_wake_wheel = (scheduler == picoquic_wake_scheduler_wheel) ? 1 : 0;
+
+    if (use_wake_wheel != quic->use_wake_wheel) {
+        picoquic_cnx_t* cnx = quic->cnx_list;
+
+        while (cnx != NULL) {
+            picoquic_remove_cnx_from_wake_list(cnx);
+            cnx = cnx->next_in_table;
+        }
+        quic->use_wake_wheel = use_wake_wheel;
+        if (use_wake_wheel) {
+            picoquic_wheel_init(&quic->cnx_wake_wheel, current_time);
+        }
+        cnx = quic->cnx_list;
+        while (cnx != NULL) {
+            picoquic_insert_cnx_by_wake_time(quic, cnx);
+            cnx = cnx->next_in_table;
+        }
+    }
+}
+
+picoquic_wake_scheduler_enum picoquic_get_wake_scheduler(picoquic_quic_t* quic)
+{
+    return (quic->use_wake_wheel) ? picoquic_wake_scheduler_wheel : picoquic_wake_scheduler_splay;
+}
+
+static picoquic_cnx_t* picoquic_get_earliest_cnx_in_wheel(picoquic_quic_t* quic, uint64_t max_wake_time)
+{
+    picoquic_cnx_t* cnx = NULL;
+
+    if (max_wake_time == 0) {
+        cnx = picoquic_wake_wheel_node_value(picoquic_wheel_earliest(&quic->cnx_wake_wheel));
+    }
+    else {
+        picoquic_wheel_node_t* node;
+
+        picoquic_wheel_advance(&quic->cnx_wake_wheel, max_wake_time);
+        node = picoquic_wheel_first_due(&quic->cnx_wake_wheel);
+        /* The due list only holds later nodes if time went backward */
+        while (node != NULL && node->wake_time > max_wake_time) {
+            node = node->next;
+        }
+        cnx = picoquic_wake_wheel_node_value(node);
+    }
+
+    return cnx;
+}
+
 picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_t max_wake_time)
 {
-    picoquic_cnx_t* cnx = (picoquic_cnx_t *)picoquic_wake_list_node_value(picosplay_first(&quic->cnx_wake_tree));
-    if (cnx != NULL && max_wake_time != 0 && cnx->next_wake_time > max_wake_time)
-    {
-        cnx = NULL;
+    picoquic_cnx_t* cnx;
+
+    if (quic->use_wake_wheel) {
+        cnx = picoquic_get_earliest_cnx_in_wheel(quic, max_wake_time);
+    }
+    else {
+        cnx = (picoquic_cnx_t*)picoquic_wake_list_node_value(picosplay_first(&quic->cnx_wake_tree));
+        if (cnx != NULL && max_wake_time != 0 && cnx->next_wake_time > max_wake_time)
+        {
+            cnx = NULL;
+        }
     }
 
     return cnx;
 }
 
+/* Fill the array with up to nb_max connections that are due at current_time,
+ * and return the number of connections found. The connections stay in the
+ * scheduler until they are processed and reinserted with a new wake time.
+ */
+size_t picoquic_get_cnx_to_wake_batch(picoquic_quic_t* quic, uint64_t current_time,
+    picoquic_cnx_t** cnx_array, size_t nb_max)
+{
+    size_t nb_cnx = 0;
+
+    if (quic->use_wake_wheel) {
+        picoquic_wheel_node_t* node;
+
+        picoquic_wheel_advance(&quic->cnx_wake_wheel, current_time);
+        node = picoquic_wheel_first_due(&quic->cnx_wake_wheel);
+        while (node != NULL && nb_cnx < nb_max) {
+            if (node->wake_time <= current_time) {
+                cnx_array[nb_cnx++] = picoquic_wake_wheel_node_value(node);
+            }
+            node = node->next;
+        }
+    }
+    else {
+        picosplay_node_t* node = picosplay_first(&quic->cnx_wake_tree);
+
+        while (node != NULL && nb_cnx < nb_max) {
+            picoquic_cnx_t* cnx = (picoquic_cnx_t*)picoquic_wake_list_node_value(node);
+            if (cnx->next_wake_time > current_time) {
+                break;
+            }
+            cnx_array[nb_cnx++] = cnx;
+            node = picosplay_next(node);
+        }
+    }
+
+    return nb_cnx;
+}
+
 uint64_t picoquic_get_next_wake_time(picoquic_quic_t* quic, uint64_t current_time)
 {
     uint64_t wake_time = UINT64_MAX;
@@ -1362,6 +1582,12 @@ uint64_t picoquic_get_next_wake_time(picoquic_quic_t* quic, uint64_t current_tim
     if (quic->pending_stateless_packet != NULL) {
         wake_time = current_time;
     }
+    else if (quic->use_wake_wheel) {
+        /* The wheel returns the start of the earliest occupied slot, which
+         * may be slightly earlier than the actual wake time. */
+        picoquic_wheel_advance(&quic->cnx_wake_wheel, current_time);
+        wake_time = picoquic_wheel_next_time(&quic->cnx_wake_wheel);
+    }
     else{
         picoquic_cnx_t* cnx_wake_first = (picoquic_cnx_t*)picoquic_wake_list_node_value(
             picosplay_first(&quic->cnx_wake_tree));
@@ -2701,7 +2927,19 @@ void* picoquic_stream_data_node_value(picosplay_node_t* node)
 
 void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data)
 {
-    if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
+    if (stream_data->accounted_cnx != NULL) {
+        picoquic_memory_release(stream_data->accounted_cnx, picoquic_memory_reassembly, stream_data->accounted_bytes);
+        stream_data->accounted_cnx = NULL;
+    }
+
+    if (stream_data->nb_borrowed > 0) {
+        /* The application still holds the data, defer until it releases it */
+        stream_data->is_released_by_stack = 1;
+    }
+    else if (stream_data->is_compact) {
+        free(stream_data);
+    }
+    else if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
         stream_data->next_stream_data = stream_data->quic->p_first_data_node;
         stream_data->quic->p_first_data_node = stream_data;
         stream_data->quic->nb_data_nodes_in_pool++;
@@ -2733,6 +2971,7 @@ picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* qu
              */
             memset(stream_data, 0, sizeof(picoquic_stream_data_node_t));
             stream_data->quic = quic;
+            stream_data->data_max = PICOQUIC_MAX_PACKET_SIZE;
             quic->nb_data_nodes_allocated++;
             if (quic->nb_data_nodes_allocated > quic->nb_data_nodes_allocated_max) {
                 quic->nb_data_nodes_allocated_max = quic->nb_data_nodes_allocated;
@@ -2743,45 +2982,198 @@ picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* qu
         quic->p_first_data_node = stream_data->next_stream_data;
         stream_data->next_stream_data = NULL;
         stream_data->bytes = NULL;
+        stream_data->is_released_by_stack = 0;
         quic->nb_data_nodes_in_pool--;
     }
 
     return stream_data;
 }
 
-
-/* Stream splay management */
-
-static int64_t picoquic_stream_node_compare(void *l, void *r)
+/* Borrowing of delivered stream data.
+ * While processing a picoquic_callback_stream_data or picoquic_callback_stream_fin
+ * event, the application may retain the buffer that it received, instead of
+ * copying the data. The buffer remains valid until the application releases it.
+ */
+void picoquic_set_default_stream_data_borrowing(picoquic_quic_t* quic, int enabled)
 {
-    /* STream values are from 0 to 2^62-1, which means we are not worried with rollover */
-    return ((picoquic_stream_head_t*)l)->stream_id - ((picoquic_stream_head_t*)r)->stream_id;
+    quic->is_stream_data_borrowing_enabled = (enabled) ? 1 : 0;
 }
 
-static picosplay_node_t * picoquic_stream_node_create(void * value)
+void picoquic_set_stream_data_borrowing(picoquic_cnx_t* cnx, int enabled)
 {
-    return &((picoquic_stream_head_t *)value)->stream_node;
+    cnx->is_stream_data_borrowing_enabled = (enabled) ? 1 : 0;
 }
 
-
-static void * picoquic_stream_node_value(picosplay_node_t * node)
+picoquic_stream_data_ref_t* picoquic_retain_stream_data(picoquic_cnx_t* cnx, const uint8_t* bytes)
 {
-    return (void*)((char*)node - offsetof(struct st_picoquic_stream_head_t, stream_node));
+    picoquic_stream_data_node_t* stream_data = cnx->delivered_data_node;
+
+    if (!cnx->is_stream_data_borrowing_enabled || stream_data == NULL || bytes < stream_data->data ||
+        bytes >= stream_data->data + stream_data->data_max) {
+        stream_data = NULL;
+    }
+    else {
+        stream_data->nb_borrowed++;
+        cnx->quic->nb_data_nodes_borrowed++;
+    }
+
+    return stream_data;
 }
 
-void picoquic_clear_stream(picoquic_stream_head_t* stream)
+void picoquic_release_stream_data(picoquic_stream_data_ref_t* stream_data)
 {
-    picoquic_stream_queue_node_t* ready = stream->send_queue;
-    picoquic_stream_queue_node_t* next;
-
-    while ((next = ready) != NULL) {
-        ready = next->next_stream_data;
-        if (next->bytes != NULL) {
-            free(next->bytes);
+    if (stream_data != NULL && stream_data->nb_borrowed > 0) {
+        stream_data->nb_borrowed--;
+        stream_data->quic->nb_data_nodes_borrowed--;
+        if (stream_data->nb_borrowed == 0 && stream_data->is_released_by_stack) {
+            stream_data->is_released_by_stack = 0;
+            picoquic_stream_data_node_recycle(stream_data);
         }
-        free(next);
+    }
+}
+
+/* Allocate a node holding only data_max bytes of data. Compact nodes are
+ * not kept in the pool, they are freed when recycled. */
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc_compact(picoquic_quic_t* quic, size_t data_max)
+{
+    picoquic_stream_data_node_t* stream_data = (picoquic_stream_data_node_t*)
+        malloc(offsetof(struct st_picoquic_stream_data_node_t, data) + data_max);
+
+    if (stream_data != NULL) {
+        memset(stream_data, 0, offsetof(struct st_picoquic_stream_data_node_t, data));
+        stream_data->quic = quic;
+        stream_data->is_compact = 1;
+        stream_data->data_max = data_max;
+        stream_data->bytes = stream_data->data;
+    }
+
+    return stream_data;
+}
+
+
+/* Stream splay management */
+
+static int64_t picoquic_stream_node_compare(void *l, void *r)
+{
+    /* STream values are from 0 to 2^62-1, which means we are not worried with rollover */
+    return ((picoquic_stream_head_t*)l)->stream_id - ((picoquic_stream_head_t*)r)->stream_id;
+}
+
+static picosplay_node_t * picoquic_stream_node_create(void * value)
+{
+    return &((picoquic_stream_head_t *)value)->stream_node;
+}
+
+
+static void * picoquic_stream_node_value(picosplay_node_t * node)
+{
+    return (void*)((char*)node - offsetof(struct st_picoquic_stream_head_t, stream_node));
+}
+
+void picoquic_stream_queue_node_free(picoquic_stream_queue_node_t* stream_data)
+{
+    picoquic_memory_release(stream_data->accounted_cnx, picoquic_memory_send_queue, stream_data->accounted_bytes);
+    if (stream_data->bytes != NULL) {
+        if (stream_data->release_fn != NULL) {
+            stream_data->release_fn(stream_data->release_ctx, stream_data->bytes);
+        }
+        else {
+            free(stream_data->bytes);
+        }
+    }
+    free(stream_data);
+}
+
+/* Called when the first node of the send queue has been fully sent. If
+ * retransmission by reference is enabled, the node is kept in the sent
+ * queue until the data is acknowledged. */
+void picoquic_stream_data_node_sent(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    picoquic_stream_queue_node_t* node = stream->send_queue;
+
+    stream->send_queue = node->next_stream_data;
+    if (cnx->is_retransmit_by_reference_enabled) {
+        node->stream_offset = stream->sent_offset - node->length;
+        node->next_stream_data = NULL;
+        if (stream->sent_queue_last == NULL) {
+            stream->sent_queue = node;
+        }
+        else {
+            stream->sent_queue_last->next_stream_data = node;
+        }
+        stream->sent_queue_last = node;
+    }
+    else {
+        picoquic_stream_queue_node_free(node);
+    }
+}
+
+/* Find the sent data between offset and offset + length. The data of a
+ * stream frame is always copied from a single node, either a node of the
+ * sent queue or the part of the first node of the send queue that was
+ * already sent. */
+const uint8_t* picoquic_stream_sent_data(picoquic_stream_head_t* stream, uint64_t offset, size_t length)
+{
+    const uint8_t* data = NULL;
+    picoquic_stream_queue_node_t* node = stream->sent_queue;
+
+    while (node != NULL && node->stream_offset + node->length <= offset) {
+        node = node->next_stream_data;
+    }
+
+    if (node != NULL) {
+        if (offset >= node->stream_offset && offset + length <= node->stream_offset + node->length) {
+            data = node->bytes + (offset - node->stream_offset);
+        }
+    }
+    else if ((node = stream->send_queue) != NULL && node->bytes != NULL && node->offset > 0) {
+        uint64_t node_offset = stream->sent_offset - node->offset;
+
+        if (offset >= node_offset && offset + length <= stream->sent_offset) {
+            data = node->bytes + (offset - node_offset);
+        }
+    }
+
+    return data;
+}
+
+/* Release the nodes at the head of the sent queue once acknowledged */
+void picoquic_stream_release_acked_data(picoquic_stream_head_t* stream)
+{
+    picoquic_stream_queue_node_t* node;
+
+    while ((node = stream->sent_queue) != NULL &&
+        picoquic_check_sack_list(&stream->sack_list, node->stream_offset, node->stream_offset + node->length - 1)) {
+        stream->sent_queue = node->next_stream_data;
+        if (stream->sent_queue == NULL) {
+            stream->sent_queue_last = NULL;
+        }
+        picoquic_stream_queue_node_free(node);
+    }
+}
+
+void picoquic_stream_sent_queue_free(picoquic_stream_head_t* stream)
+{
+    picoquic_stream_queue_node_t* next;
+
+    while ((next = stream->sent_queue) != NULL) {
+        stream->sent_queue = next->next_stream_data;
+        picoquic_stream_queue_node_free(next);
+    }
+    stream->sent_queue_last = NULL;
+}
+
+void picoquic_clear_stream(picoquic_stream_head_t* stream)
+{
+    picoquic_stream_queue_node_t* ready = stream->send_queue;
+    picoquic_stream_queue_node_t* next;
+
+    while ((next = ready) != NULL) {
+        ready = next->next_stream_data;
+        picoquic_stream_queue_node_free(next);
     }
     stream->send_queue = NULL;
+    picoquic_stream_sent_queue_free(stream);
     if (stream->is_output_stream) {
         picoquic_remove_output_stream(stream->cnx, stream);
     }
@@ -2844,71 +3236,363 @@ int picoquic_compare_stream_priority(picoquic_stream_head_t * stream, picoquic_s
     return ret;
 }
 
+/* Management of the output priority levels.
+ * The levels present in the output list are listed in "output_level_bitmap",
+ * and kept in the array "output_levels" by increasing priority. The index
+ * of a level in the array is the number of lower levels present.
+ */
+static int picoquic_output_level_lowest_bit(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int index = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+static size_t picoquic_output_level_count(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (size_t)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+static size_t picoquic_output_level_rank(picoquic_cnx_t* cnx, int priority)
+{
+    size_t rank = 0;
+
+    for (int i = 0; i < (priority >> 6); i++) {
+        rank += picoquic_output_level_count(cnx->output_level_bitmap[i]);
+    }
+    if ((priority & 63) != 0) {
+        rank += picoquic_output_level_count(cnx->output_level_bitmap[priority >> 6] & ((1ull << (priority & 63)) - 1));
+    }
+
+    return rank;
+}
+
+static picoquic_output_level_t* picoquic_find_output_level(picoquic_cnx_t* cnx, int priority)
+{
+    picoquic_output_level_t* level = NULL;
+
+    if (((cnx->output_level_bitmap[priority >> 6] >> (priority & 63)) & 1) != 0) {
+        level = &cnx->output_levels[picoquic_output_level_rank(cnx, priority)];
+    }
+
+    return level;
+}
+
+static picoquic_output_level_t* picoquic_create_output_level(picoquic_cnx_t* cnx, int priority)
+{
+    picoquic_output_level_t* level = NULL;
+    size_t rank = picoquic_output_level_rank(cnx, priority);
+
+    if (cnx->nb_output_levels >= cnx->nb_output_levels_alloc) {
+        size_t new_alloc = (cnx->nb_output_levels_alloc == 0) ? 4 : 2 * cnx->nb_output_levels_alloc;
+        picoquic_output_level_t* new_levels = (picoquic_output_level_t*)realloc(cnx->output_levels,
+            new_alloc * sizeof(picoquic_output_level_t));
+
+        if (new_levels == NULL) {
+            return NULL;
+        }
+        cnx->output_levels = new_levels;
+        cnx->nb_output_levels_alloc = new_alloc;
+    }
+
+    if (rank < cnx->nb_output_levels) {
+        memmove(&cnx->output_levels[rank + 1], &cnx->output_levels[rank],
+            (cnx->nb_output_levels - rank) * sizeof(picoquic_output_level_t));
+    }
+    cnx->nb_output_levels++;
+    cnx->output_level_bitmap[priority >> 6] |= (1ull << (priority & 63));
+    level = &cnx->output_levels[rank];
+    memset(level, 0, sizeof(picoquic_output_level_t));
+    level->priority = (uint8_t)priority;
+
+    return level;
+}
+
+static void picoquic_delete_output_level(picoquic_cnx_t* cnx, picoquic_output_level_t* level)
+{
+    size_t rank = level - cnx->output_levels;
+    int priority = level->priority;
+
+    cnx->output_level_bitmap[priority >> 6] &= ~(1ull << (priority & 63));
+    cnx->ready_level_bitmap[priority >> 6] &= ~(1ull << (priority & 63));
+    cnx->nb_output_levels--;
+    if (rank < cnx->nb_output_levels) {
+        memmove(&cnx->output_levels[rank], &cnx->output_levels[rank + 1],
+            (cnx->nb_output_levels - rank) * sizeof(picoquic_output_level_t));
+    }
+}
+
+void picoquic_clear_output_levels(picoquic_cnx_t* cnx)
+{
+    if (cnx->output_levels != NULL) {
+        free(cnx->output_levels);
+        cnx->output_levels = NULL;
+    }
+    cnx->nb_output_levels = 0;
+    cnx->nb_output_levels_alloc = 0;
+    memset(cnx->output_level_bitmap, 0, sizeof(cnx->output_level_bitmap));
+    memset(cnx->ready_level_bitmap, 0, sizeof(cnx->ready_level_bitmap));
+}
+
+/* Return the first level at or after the specified priority that has ready streams. */
+picoquic_output_level_t* picoquic_next_ready_output_level(picoquic_cnx_t* cnx, int priority)
+{
+    picoquic_output_level_t* level = NULL;
+
+    while (level == NULL && priority < 256) {
+        uint64_t bits = cnx->ready_level_bitmap[priority >> 6] & (UINT64_MAX << (priority & 63));
+
+        if (bits != 0) {
+            level = picoquic_find_output_level(cnx, (priority & ~63) + picoquic_output_level_lowest_bit(bits));
+        }
+        else {
+            priority = (priority & ~63) + 64;
+        }
+    }
+
+    return level;
+}
+
+/* Ready lists of the priority levels */
+static void picoquic_insert_ready_stream(picoquic_output_level_t* level, picoquic_stream_head_t* previous,
+    picoquic_stream_head_t* stream)
+{
+    stream->previous_ready_stream = previous;
+    if (previous == NULL) {
+        stream->next_ready_stream = level->first_ready;
+        level->first_ready = stream;
+    }
+    else {
+        stream->next_ready_stream = previous->next_ready_stream;
+        previous->next_ready_stream = stream;
+    }
+    if (stream->next_ready_stream == NULL) {
+        level->last_ready = stream;
+    }
+    else {
+        stream->next_ready_stream->previous_ready_stream = stream;
+    }
+    stream->is_output_ready = 1;
+}
+
+static void picoquic_unlink_ready_stream(picoquic_output_level_t* level, picoquic_stream_head_t* stream)
+{
+    if (level->last_unserved == stream) {
+        level->last_unserved = stream->previous_ready_stream;
+    }
+    if (stream->previous_ready_stream == NULL) {
+        level->first_ready = stream->next_ready_stream;
+    }
+    else {
+        stream->previous_ready_stream->next_ready_stream = stream->next_ready_stream;
+    }
+    if (stream->next_ready_stream == NULL) {
+        level->last_ready = stream->previous_ready_stream;
+    }
+    else {
+        stream->next_ready_stream->previous_ready_stream = stream->previous_ready_stream;
+    }
+    stream->previous_ready_stream = NULL;
+    stream->next_ready_stream = NULL;
+    stream->is_output_ready = 0;
+}
+
+/* Compare the round robin order of two streams that already sent data */
+static int picoquic_output_stream_served_before(picoquic_stream_head_t* stream, picoquic_stream_head_t* other)
+{
+    return (stream->last_time_data_sent < other->last_time_data_sent ||
+        (stream->last_time_data_sent == other->last_time_data_sent && stream->stream_id < other->stream_id));
+}
+
+/* Add an output stream to the ready list of its level. New streams usually
+ * have the highest stream ID, and are added at the end of their section.
+ * A round robin stream that already sent data was typically idle for a
+ * while, and is searched from the start of the served section.
+ */
+void picoquic_ready_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    picoquic_output_level_t* level;
+
+    if (stream->is_output_stream && !stream->is_output_ready &&
+        (level = picoquic_find_output_level(cnx, stream->output_priority)) != NULL) {
+        picoquic_stream_head_t* previous;
+
+        if ((stream->output_priority & 1) != 0) {
+            previous = level->last_ready;
+            while (previous != NULL && previous->stream_id > stream->stream_id) {
+                previous = previous->previous_ready_stream;
+            }
+            picoquic_insert_ready_stream(level, previous, stream);
+        }
+        else if (stream->last_time_data_sent == 0) {
+            previous = level->last_unserved;
+            while (previous != NULL && previous->stream_id > stream->stream_id) {
+                previous = previous->previous_ready_stream;
+            }
+            picoquic_insert_ready_stream(level, previous, stream);
+            if (previous == level->last_unserved) {
+                level->last_unserved = stream;
+            }
+        }
+        else {
+            picoquic_stream_head_t* next = (level->last_unserved == NULL) ? level->first_ready : level->last_unserved->next_ready_stream;
+
+            previous = level->last_unserved;
+            while (next != NULL && picoquic_output_stream_served_before(next, stream)) {
+                previous = next;
+                next = next->next_ready_stream;
+            }
+            picoquic_insert_ready_stream(level, previous, stream);
+        }
+        cnx->ready_level_bitmap[stream->output_priority >> 6] |= (1ull << (stream->output_priority & 63));
+    }
+}
+
+/* Remove an idle stream from the ready list */
+void picoquic_park_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    picoquic_output_level_t* level;
+
+    /* A parked stream starts a new turn when it is ready again */
+    stream->bytes_in_turn = 0;
+
+    if (stream->is_output_ready &&
+        (level = picoquic_find_output_level(cnx, stream->output_priority)) != NULL) {
+        picoquic_unlink_ready_stream(level, stream);
+        if (level->first_ready == NULL) {
+            cnx->ready_level_bitmap[stream->output_priority >> 6] &= ~(1ull << (stream->output_priority & 63));
+        }
+    }
+}
+
+/* After a round robin stream sent data, move it to the end of the ready list.
+ * Streams served at the same time are kept in stream ID order. Streams
+ * with a weight are only moved after sending their quota of bytes, which
+ * shares the bandwidth in proportion of the weights.
+ */
+void picoquic_served_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, size_t length)
+{
+    picoquic_output_level_t* level;
+
+    if (stream->stream_weight != 0) {
+        stream->bytes_in_turn += (uint32_t)length;
+        if (stream->bytes_in_turn < (uint32_t)stream->stream_weight * PICOQUIC_STREAM_WEIGHT_QUANTUM) {
+            return;
+        }
+        stream->bytes_in_turn = 0;
+    }
+
+    if (stream->is_output_ready && (stream->output_priority & 1) == 0 && stream->last_time_data_sent != 0 &&
+        (level = picoquic_find_output_level(cnx, stream->output_priority)) != NULL) {
+        picoquic_stream_head_t* previous;
+
+        picoquic_unlink_ready_stream(level, stream);
+        previous = level->last_ready;
+        while (previous != NULL && previous->last_time_data_sent != 0 &&
+            picoquic_output_stream_served_before(stream, previous)) {
+            previous = previous->previous_ready_stream;
+        }
+        picoquic_insert_ready_stream(level, previous, stream);
+    }
+}
+
 /* This code assumes that the stream is not currently present in the output stream.
+ * The stream is inserted after the last stream of its priority level, or after the
+ * last stream of the previous level if the level is new.
  */
 void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
 {
     if (stream->is_output_stream == 0)  
     {
+        picoquic_output_level_t* level;
+        picoquic_stream_head_t* previous;
+
         if (IS_CLIENT_STREAM_ID(stream->stream_id) == cnx->client_mode) {
             if (stream->stream_id > ((IS_BIDIR_STREAM_ID(stream->stream_id)) ? cnx->max_stream_id_bidir_remote : cnx->max_stream_id_unidir_remote)) {
                 return;
             }
         }
 
-        if (cnx->last_output_stream == NULL) {
-            /* insert first stream */
-            cnx->last_output_stream = stream;
+        if ((level = picoquic_find_output_level(cnx, stream->stream_priority)) == NULL &&
+            (level = picoquic_create_output_level(cnx, stream->stream_priority)) == NULL) {
+            picoquic_log_app_message(cnx, "Cannot create output level %d", stream->stream_priority);
+            (void)picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+            return;
+        }
+
+        if (level->last_output == NULL) {
+            size_t rank = level - cnx->output_levels;
+            previous = (rank > 0) ? cnx->output_levels[rank - 1].last_output : NULL;
+        }
+        else {
+            previous = level->last_output;
+            while (previous != NULL && previous->output_priority == stream->stream_priority &&
+                previous->stream_id > stream->stream_id) {
+                previous = previous->previous_output_stream;
+            }
+        }
+
+        stream->previous_output_stream = previous;
+        if (previous == NULL) {
+            stream->next_output_stream = cnx->first_output_stream;
             cnx->first_output_stream = stream;
         }
-        else if (picoquic_compare_stream_priority(stream, cnx->last_output_stream) >= 0) {
-            /* insert after last stream. Common case for most applications. */
-            stream->previous_output_stream = cnx->last_output_stream;
-            cnx->last_output_stream->next_output_stream = stream;
+        else {
+            stream->next_output_stream = previous->next_output_stream;
+            previous->next_output_stream = stream;
+        }
+        if (stream->next_output_stream == NULL) {
             cnx->last_output_stream = stream;
         }
         else {
-            picoquic_stream_head_t* current = cnx->first_output_stream;
-
-            while (current != NULL) {
-                int cmp = picoquic_compare_stream_priority(stream, current);
-
-                if (cmp < 0) {
-                    /* insert before the current stream, then break */
-                    stream->previous_output_stream = current->previous_output_stream;
-                    if (stream->previous_output_stream == NULL) {
-                        cnx->first_output_stream = stream;
-                    }
-                    else {
-                        stream->previous_output_stream->next_output_stream = stream;
-                    }
-                    current->previous_output_stream = stream;
-                    stream->next_output_stream = current;
-                    break;
-                }
-                else if (cmp == 0) {
-                    /* Stream is already there. This is unexpected */
-                    break;
-                }
-                else {
-                    current = current->next_output_stream;
-                }
-            }
-            if (current == NULL) {
-                /* insert after last stream */
-                stream->previous_output_stream = cnx->last_output_stream;
-                cnx->last_output_stream->next_output_stream = stream;
-                cnx->last_output_stream = stream;
-            }
+            stream->next_output_stream->previous_output_stream = stream;
+        }
+        if (level->last_output == NULL || level->last_output == previous) {
+            level->last_output = stream;
         }
 
+        stream->output_priority = stream->stream_priority;
         stream->is_output_stream = 1;
+        picoquic_ready_output_stream(cnx, stream);
     }
 }
 
 void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream)
 {
     if (stream->is_output_stream) {
+        picoquic_output_level_t* level = picoquic_find_output_level(cnx, stream->output_priority);
+
+        if (level != NULL) {
+            picoquic_park_output_stream(cnx, stream);
+            if (level->last_output == stream) {
+                if (stream->previous_output_stream != NULL &&
+                    stream->previous_output_stream->output_priority == stream->output_priority) {
+                    level->last_output = stream->previous_output_stream;
+                }
+                else {
+                    picoquic_delete_output_level(cnx, level);
+                }
+            }
+        }
+
         stream->is_output_stream = 0;
 
         if (stream->previous_output_stream == NULL) {
@@ -2929,22 +3613,13 @@ void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t *
     }
 }
 
-/* Reorder streams by priorities and rank.
- * A stream is deemed out of order if:
- * - the previous stream in the list has a higher priority, or
- * - the new stream has a lower priority.
+/* Move the stream to its new priority level after a priority change.
  */
 void picoquic_reorder_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
 {
-    if (stream->is_output_stream) {
-        if ((stream->previous_output_stream != NULL &&
-            picoquic_compare_stream_priority(stream, stream->previous_output_stream) < 0) ||
-            (stream->next_output_stream != NULL &&
-                picoquic_compare_stream_priority(stream, stream->next_output_stream) > 0)) {
-            picoquic_remove_output_stream(cnx, stream);
-            stream->is_output_stream = 0;
-            picoquic_insert_output_stream(cnx, stream);
-        }
+    if (stream->is_output_stream && stream->output_priority != stream->stream_priority) {
+        picoquic_remove_output_stream(cnx, stream);
+        picoquic_insert_output_stream(cnx, stream);
     }
 }
 
@@ -2953,12 +3628,138 @@ picoquic_stream_head_t * picoquic_next_stream(picoquic_stream_head_t * stream)
     return (picoquic_stream_head_t *)picosplay_next((picosplay_node_t *)stream);
 }
 
+/* Direct lookup tables of streams, see picoquic_stream_table_t */
+static void picoquic_stream_table_release(picoquic_stream_table_t* table)
+{
+    if (table->slots != NULL) {
+        free(table->slots);
+        table->slots = NULL;
+    }
+    table->nb_slots = 0;
+}
+
+static int picoquic_stream_table_resize(picoquic_stream_table_t* table, uint64_t nb_slots)
+{
+    int ret = 0;
+    picoquic_stream_head_t** slots = (picoquic_stream_head_t**)malloc((size_t)nb_slots * sizeof(picoquic_stream_head_t*));
+
+    if (slots == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(slots, 0, (size_t)nb_slots * sizeof(picoquic_stream_head_t*));
+        for (uint64_t i = 0; i < table->nb_slots; i++) {
+            uint64_t index = table->base_index + i;
+            slots[index & (nb_slots - 1)] = table->slots[index & (table->nb_slots - 1)];
+        }
+        picoquic_stream_table_release(table);
+        table->slots = slots;
+        table->nb_slots = nb_slots;
+    }
+
+    return ret;
+}
+
+static void picoquic_stream_table_insert(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    picoquic_stream_table_t* table = &cnx->stream_table[STREAM_TYPE_FROM_ID(stream->stream_id)];
+    uint64_t index = STREAM_INDEX_FROM_ID(stream->stream_id);
+
+    if (index < table->base_index) {
+        /* Below the window, only found in the stream tree */
+        return;
+    }
+
+    if (index - table->base_index >= table->nb_slots) {
+        uint64_t nb_slots = (table->nb_slots == 0) ? PICOQUIC_STREAM_TABLE_SLOTS_MIN : table->nb_slots;
+
+        while (index - table->base_index >= nb_slots && nb_slots < PICOQUIC_STREAM_TABLE_SLOTS_MAX) {
+            nb_slots *= 2;
+        }
+        if (nb_slots != table->nb_slots && picoquic_stream_table_resize(table, nb_slots) != 0) {
+            /* Stop using the table for this type of streams */
+            picoquic_stream_table_release(table);
+            table->base_index = UINT64_MAX;
+            return;
+        }
+        if (index - table->base_index >= table->nb_slots) {
+            /* Slide the window. The streams left below it are only found in the stream tree */
+            uint64_t new_base = index - table->nb_slots + 1;
+
+            if (new_base - table->base_index >= table->nb_slots) {
+                memset(table->slots, 0, (size_t)table->nb_slots * sizeof(picoquic_stream_head_t*));
+            }
+            else {
+                for (uint64_t i = table->base_index; i < new_base; i++) {
+                    table->slots[i & (table->nb_slots - 1)] = NULL;
+                }
+            }
+            table->base_index = new_base;
+        }
+    }
+
+    table->slots[index & (table->nb_slots - 1)] = stream;
+}
+
+static void picoquic_stream_table_remove(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    int stream_type = (int)STREAM_TYPE_FROM_ID(stream->stream_id);
+    picoquic_stream_table_t* table = &cnx->stream_table[stream_type];
+    uint64_t index = STREAM_INDEX_FROM_ID(stream->stream_id);
+
+    if (index >= table->base_index && index - table->base_index < table->nb_slots &&
+        table->slots[index & (table->nb_slots - 1)] == stream) {
+        uint64_t next_index = STREAM_INDEX_FROM_ID(cnx->next_stream_id[stream_type]);
+
+        table->slots[index & (table->nb_slots - 1)] = NULL;
+        /* Move the bottom of the window past the deleted streams, but not past the
+         * next stream that will be created. */
+        while (table->base_index < next_index && table->slots[table->base_index & (table->nb_slots - 1)] == NULL) {
+            table->base_index++;
+        }
+    }
+}
+
 picoquic_stream_head_t* picoquic_find_stream(picoquic_cnx_t* cnx, uint64_t stream_id)
 {
-    picoquic_stream_head_t target;
-    target.stream_id = stream_id;
+    picoquic_stream_table_t* table = &cnx->stream_table[STREAM_TYPE_FROM_ID(stream_id)];
+    uint64_t index = STREAM_INDEX_FROM_ID(stream_id);
 
-    return (picoquic_stream_head_t *)picosplay_find(&cnx->stream_tree, (void*)&target);
+    if (index >= table->base_index) {
+        return (index - table->base_index < table->nb_slots) ?
+            table->slots[index & (table->nb_slots - 1)] : NULL;
+    }
+    else {
+        picoquic_stream_head_t target;
+        target.stream_id = stream_id;
+
+        return (picoquic_stream_head_t*)picosplay_find(&cnx->stream_tree, (void*)&target);
+    }
+}
+
+/* Next stream of the same type, by order of stream ID */
+picoquic_stream_head_t* picoquic_next_stream_of_type(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    uint64_t stream_type = STREAM_TYPE_FROM_ID(stream->stream_id);
+    picoquic_stream_table_t* table = &cnx->stream_table[stream_type];
+    uint64_t index = STREAM_INDEX_FROM_ID(stream->stream_id);
+    picoquic_stream_head_t* next = NULL;
+
+    if (index >= table->base_index) {
+        uint64_t index_max = table->base_index + table->nb_slots;
+
+        while (next == NULL && ++index < index_max) {
+            next = table->slots[index & (table->nb_slots - 1)];
+        }
+    }
+    else {
+        next = picoquic_next_stream(stream);
+        while (next != NULL && STREAM_TYPE_FROM_ID(next->stream_id) != stream_type) {
+            next = picoquic_next_stream(next);
+        }
+    }
+
+    return next;
 }
 
 void picoquic_add_output_streams(picoquic_cnx_t* cnx, uint64_t old_limit, uint64_t new_limit, unsigned int is_bidir)
@@ -2967,16 +3768,12 @@ void picoquic_add_output_streams(picoquic_cnx_t* cnx, uint64_t old_limit, uint64
     uint64_t first_new_id = STREAM_ID_FROM_RANK(old_rank + 1ull, cnx->client_mode, !is_bidir);
     picoquic_stream_head_t* stream = picoquic_find_stream(cnx, first_new_id );
 
-    while (stream) {
+    /* All the streams of that type are local, with the requested direction */
+    while (stream != NULL && stream->stream_id <= new_limit) {
         if (stream->stream_id > old_limit) {
-            if (stream->stream_id > new_limit) {
-                break;
-            }
-            if (IS_LOCAL_STREAM_ID(stream->stream_id, cnx->client_mode) && IS_BIDIR_STREAM_ID(stream->stream_id) == is_bidir) {
-                picoquic_insert_output_stream(cnx, stream);
-            }
+            picoquic_insert_output_stream(cnx, stream);
         }
-        stream = picoquic_next_stream(stream);
+        stream = picoquic_next_stream_of_type(cnx, stream);
     }
 }
 
@@ -3024,6 +3821,7 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
         picosplay_init_tree(&stream->stream_data_tree, picoquic_stream_data_node_compare, picoquic_stream_data_node_create, picoquic_stream_data_node_delete, picoquic_stream_data_node_value);
 
         picosplay_insert(&cnx->stream_tree, stream);
+        picoquic_stream_table_insert(cnx, stream);
         if (is_output_stream) {
             picoquic_insert_output_stream(cnx, stream);
         }
@@ -3042,6 +3840,7 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
 
 void picoquic_delete_stream(picoquic_cnx_t * cnx, picoquic_stream_head_t* stream)
 {
+    picoquic_stream_table_remove(cnx, stream);
     picosplay_delete(&cnx->stream_tree, stream);
 }
 
@@ -3180,6 +3979,11 @@ void picoquic_delete_local_cnxid(picoquic_cnx_t* cnx, picoquic_local_cnxid_t* l_
     picoquic_local_cnxid_t* previous = NULL;
     picoquic_local_cnxid_t* next = cnx->local_cnxid_first;
 
+    /* The CID may be retired while a batch of incoming packets is processed */
+    if (cnx->quic->unprotect_batch != NULL && cnx->quic->unprotect_batch->l_cid == l_cid) {
+        cnx->quic->unprotect_batch->cnx = NULL;
+        cnx->quic->unprotect_batch->l_cid = NULL;
+    }
 
     /* Set l_cid references to NULL in path contexts */
     for (int i = 0; i < cnx->nb_paths; i++) {
@@ -3216,7 +4020,7 @@ void picoquic_delete_local_cnxid(picoquic_cnx_t* cnx, picoquic_local_cnxid_t* l_
         /* Remove the registration in hash tables */
         if (l_cid->registered_cnx != NULL) {
             picohash_item* item = &l_cid->hash_item;
-            picohash_delete_item(cnx->quic->table_cnx_by_id, item, 0);
+            picohash_oa_delete_item(cnx->quic->table_cnx_by_id, item, 0);
         }
         l_cid->registered_cnx = NULL;
     }
@@ -3467,6 +4271,8 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         cnx->callback_ctx = quic->default_callback_ctx;
         cnx->congestion_alg = quic->default_congestion_alg;
         cnx->is_preemptive_repeat_enabled = quic->is_preemptive_repeat_enabled;
+        cnx->is_retransmit_by_reference_enabled = quic->is_retransmit_by_reference_enabled;
+        cnx->is_stream_data_borrowing_enabled = quic->is_stream_data_borrowing_enabled;
 
         /* Initialize key rotation interval to default value */
         cnx->crypto_epoch_length_max = quic->crypto_epoch_length_max;
@@ -4230,6 +5036,12 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 
         picoquic_log_close_connection(cnx);
 
+        if (cnx->quic->unprotect_batch != NULL && cnx->quic->unprotect_batch->cnx == cnx) {
+            cnx->quic->unprotect_batch->cnx = NULL;
+            cnx->quic->unprotect_batch->l_cid = NULL;
+            cnx->quic->unprotect_batch->pn_dec = NULL;
+        }
+
         if (cnx->is_half_open && cnx->quic->current_number_half_open > 0) {
             cnx->quic->current_number_half_open--;
             cnx->is_half_open = 0;
@@ -4280,13 +5092,19 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             picoquic_delete_misc_or_dg(&cnx->first_datagram, &cnx->last_datagram, cnx->first_datagram);
         }
 
+        picoquic_datagram_ring_release(cnx);
+
         picosplay_empty_tree(&cnx->queue_data_repeat_tree);
 
         for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
             picoquic_clear_stream(&cnx->tls_stream[epoch]);
         }
 
+        for (int i = 0; i < 4; i++) {
+            picoquic_stream_table_release(&cnx->stream_table[i]);
+        }
         picosplay_empty_tree(&cnx->stream_tree);
+        picoquic_clear_output_levels(cnx);
 
         if (cnx->tls_ctx != NULL) {
             picoquic_tlscontext_free(cnx->tls_ctx);
@@ -4357,7 +5175,7 @@ picoquic_cnx_t* picoquic_cnx_by_id(picoquic_quic_t* quic, picoquic_connection_id
     memset(&key, 0, sizeof(key));
     key.cnx_id = cnx_id;
 
-    item = picohash_retrieve(quic->table_cnx_by_id, &key);
+    item = picohash_oa_retrieve(quic->table_cnx_by_id, &key);
 
     if (item != NULL) {
         ret = ((picoquic_local_cnxid_t*)item->key)->registered_cnx;
@@ -4380,7 +5198,7 @@ picoquic_cnx_t* picoquic_cnx_by_net(picoquic_quic_t* quic, const struct sockaddr
 
     picoquic_store_addr(&dummy_path_x.registered_peer_addr, addr);
 
-    item = picohash_retrieve(quic->table_cnx_by_net, &dummy_path_x);
+    item = picohash_oa_retrieve(quic->table_cnx_by_net, &dummy_path_x);
 
     if (item != NULL) {
         ret = ((picoquic_path_t*)item->key)->cnx;
@@ -4398,7 +5216,7 @@ picoquic_cnx_t* picoquic_cnx_by_icid(picoquic_quic_t* quic, picoquic_connection_
     picoquic_store_addr(&dummy_cnx.registered_icid_addr, addr);
     dummy_cnx.initial_cnxid = *icid;
 
-    item = picohash_retrieve(quic->table_cnx_by_icid, &dummy_cnx);
+    item = picohash_oa_retrieve(quic->table_cnx_by_icid, &dummy_cnx);
 
     if (item != NULL) {
         ret = (picoquic_cnx_t*)item->key;
@@ -4489,6 +5307,40 @@ void picoquic_set_preemptive_repeat_per_cnx(picoquic_cnx_t* cnx, int do_repeat)
     cnx->is_preemptive_repeat_enabled = (do_repeat) ? 1 : 0;
 }
 
+void picoquic_set_retransmit_by_reference_policy(picoquic_quic_t* quic, int by_reference)
+{
+    quic->is_retransmit_by_reference_enabled = (by_reference) ? 1 : 0;
+}
+
+void picoquic_set_retransmit_by_reference_per_cnx(picoquic_cnx_t* cnx, int by_reference)
+{
+    cnx->is_retransmit_by_reference_enabled = (by_reference) ? 1 : 0;
+}
+
+int picoquic_set_protect_batch_policy(picoquic_quic_t* quic, int do_batch)
+{
+    int ret = 0;
+
+    if (do_batch) {
+        if (quic->protect_batch == NULL) {
+            quic->protect_batch = (picoquic_protect_batch_t*)malloc(sizeof(picoquic_protect_batch_t));
+            if (quic->protect_batch == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else {
+                memset(quic->protect_batch, 0, sizeof(picoquic_protect_batch_t));
+            }
+        }
+    }
+    else if (quic->protect_batch != NULL) {
+        picoquic_protect_batch_flush(quic);
+        free(quic->protect_batch);
+        quic->protect_batch = NULL;
+    }
+
+    return ret;
+}
+
 void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* alg)
 {
     if (cnx->congestion_alg != NULL) {
@@ -147,6 +147,7 @@ int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
                 stream->app_stream_ctx = app_stream_ctx;
                 if (!stream->is_active) {
                     stream->is_active = 1;
+                    picoquic_ready_output_stream(cnx, stream);
                     picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
                 }
             }
@@ -208,8 +209,39 @@ int picoquic_mark_high_priority_stream(picoquic_cnx_t * cnx, uint64_t stream_id,
     return ret;
 }
 
-int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
-    const uint8_t* data, size_t length, int set_fin, void * app_stream_ctx)
+int picoquic_set_stream_urgency(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t urgency, int is_incremental)
+{
+    int ret = 0;
+
+    if (urgency > PICOQUIC_URGENCY_MAX) {
+        ret = PICOQUIC_ERROR_INVALID_PRIORITY;
+    }
+    else {
+        ret = picoquic_set_stream_priority(cnx, stream_id, PICOQUIC_STREAM_PRIORITY_FROM_URGENCY(urgency, is_incremental));
+    }
+
+    return ret;
+}
+
+int picoquic_set_stream_weight(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t weight)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        stream->stream_weight = weight;
+        stream->bytes_in_turn = 0;
+    }
+
+    return ret;
+}
+
+/* Queue data on a stream. If "is_zero_copy" is set, the queue node references
+ * the application buffer, which will be released by "release_fn".
+ */
+static int picoquic_add_to_stream_ex(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const uint8_t* data, size_t length, int set_fin, void* app_stream_ctx,
+    int is_zero_copy, picoquic_stream_data_release_fn release_fn, void* release_ctx)
 {
     int ret = 0;
     picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
@@ -236,7 +268,16 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         if (stream_data == 0) {
             ret = -1;
         } else {
-            stream_data->bytes = (uint8_t*)malloc(length);
+            if (is_zero_copy) {
+                stream_data->bytes = (uint8_t*)data;
+                stream_data->release_fn = release_fn;
+                stream_data->release_ctx = release_ctx;
+            }
+            else {
+                stream_data->bytes = (uint8_t*)malloc(length);
+                stream_data->release_fn = NULL;
+                stream_data->release_ctx = NULL;
+            }
 
             if (stream_data->bytes == NULL) {
                 free(stream_data);
@@ -246,10 +287,15 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
                 picoquic_stream_queue_node_t** pprevious = &stream->send_queue;
                 picoquic_stream_queue_node_t* next = stream->send_queue;
 
-                memcpy(stream_data->bytes, data, length);
+                if (!is_zero_copy) {
+                    memcpy(stream_data->bytes, data, length);
+                }
                 stream_data->length = length;
                 stream_data->offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->accounted_cnx = cnx;
+                stream_data->accounted_bytes = sizeof(picoquic_stream_queue_node_t) + length;
+                picoquic_memory_account(cnx, picoquic_memory_send_queue, stream_data->accounted_bytes);
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -267,6 +313,31 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         cnx->nb_bytes_queued += length;
         stream->is_active = 0;
         stream->app_stream_ctx = app_stream_ctx;
+        picoquic_ready_output_stream(cnx, stream);
+    }
+
+    return ret;
+}
+
+int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const uint8_t* data, size_t length, int set_fin, void * app_stream_ctx)
+{
+    return picoquic_add_to_stream_ex(cnx, stream_id, data, length, set_fin, app_stream_ctx, 0, NULL, NULL);
+}
+
+int picoquic_add_to_stream_zero_copy(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* data, size_t length,
+    int set_fin, void* app_stream_ctx, picoquic_stream_data_release_fn release_fn, void* release_ctx)
+{
+    int ret = picoquic_add_to_stream_ex(cnx, stream_id, data, length, set_fin, app_stream_ctx, 1, release_fn, release_ctx);
+
+    if (ret == 0 && length == 0 && data != NULL) {
+        /* Nothing was queued, release the buffer now */
+        if (release_fn != NULL) {
+            release_fn(release_ctx, data);
+        }
+        else {
+            free(data);
+        }
     }
 
     return ret;
@@ -340,6 +411,7 @@ int picoquic_reset_stream(picoquic_cnx_t* cnx,
         else if (!stream->reset_requested) {
             stream->local_error = local_stream_error;
             stream->reset_requested = 1;
+            picoquic_ready_output_stream(cnx, stream);
         }
     }
 
@@ -383,6 +455,7 @@ int picoquic_stop_sending(picoquic_cnx_t* cnx,
             stream->local_stop_error = local_stream_error;
             stream->stop_sending_requested = 1;
             picoquic_insert_output_stream(cnx, stream);
+            picoquic_ready_output_stream(cnx, stream);
         }
     }
 
@@ -463,29 +536,89 @@ size_t picoquic_pad_to_policy(picoquic_cnx_t * cnx, uint8_t * bytes, size_t leng
  * Packet management
  */
 
-picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
+static const size_t picoquic_packet_bytes_class_size[PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES] = {
+    128, 512, PICOQUIC_MAX_PACKET_SIZE };
+
+void picoquic_packet_pool_init(picoquic_quic_t* quic)
 {
-    picoquic_packet_t* packet = quic->p_first_packet;
-    
-    if (packet == NULL) {
-        packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
-        if (packet != NULL) {
-            quic->nb_packets_allocated++;
-            if (quic->nb_packets_allocated > quic->nb_packets_allocated_max) {
-                quic->nb_packets_allocated_max = quic->nb_packets_allocated;
-            }
-        }
+    picoquic_slab_class_init(&quic->packet_pool, sizeof(picoquic_packet_t), PICOQUIC_MAX_PACKETS_IN_POOL);
+    for (int i = 0; i < PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES; i++) {
+        picoquic_slab_class_init(&quic->packet_bytes_pool[i], picoquic_packet_bytes_class_size[i],
+            PICOQUIC_MAX_PACKETS_IN_POOL);
     }
-    else {
-        quic->p_first_packet = packet->packet_previous;
-        quic->nb_packets_in_pool--;
+}
+
+void picoquic_packet_pool_clear(picoquic_quic_t* quic)
+{
+    picoquic_slab_class_clear(&quic->packet_pool);
+    for (int i = 0; i < PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES; i++) {
+        picoquic_slab_class_clear(&quic->packet_bytes_pool[i]);
+    }
+}
+
+void picoquic_set_max_packets_in_pool(picoquic_quic_t* quic, size_t max_packets_in_pool)
+{
+    quic->packet_pool.nb_free_max = max_packets_in_pool;
+    for (int i = 0; i < PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES; i++) {
+        quic->packet_bytes_pool[i].nb_free_max = max_packets_in_pool;
     }
+}
+
+static void picoquic_get_pool_class_stats(picoquic_slab_class_t* sc, picoquic_pool_class_stats_t* stats)
+{
+    stats->object_size = sc->object_size;
+    stats->nb_slabs = sc->nb_slabs;
+    stats->nb_slabs_max = sc->nb_slabs_max;
+    stats->nb_in_use = sc->nb_in_use;
+    stats->nb_in_use_max = sc->nb_in_use_max;
+    stats->nb_free = sc->nb_free;
+    stats->bytes_allocated = picoquic_slab_class_bytes(sc);
+}
+
+void picoquic_get_packet_pool_stats(picoquic_quic_t* quic, picoquic_packet_pool_stats_t* stats)
+{
+    picoquic_get_pool_class_stats(&quic->packet_pool, &stats->packets);
+    stats->bytes_allocated = stats->packets.bytes_allocated;
+    for (int i = 0; i < PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES; i++) {
+        picoquic_get_pool_class_stats(&quic->packet_bytes_pool[i], &stats->bytes[i]);
+        stats->bytes_allocated += stats->bytes[i].bytes_allocated;
+    }
+    stats->nb_packet_bytes_shrunk = quic->nb_packet_bytes_shrunk;
+    stats->nb_stream_bytes_by_reference = quic->nb_stream_bytes_by_reference;
+}
+
+static int picoquic_packet_bytes_class(size_t length)
+{
+    int bytes_class = 0;
+
+    while (bytes_class < PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES - 1 &&
+        picoquic_packet_bytes_class_size[bytes_class] < length) {
+        bytes_class++;
+    }
+    return bytes_class;
+}
+
+picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
+{
+    picoquic_packet_t* packet = (picoquic_packet_t*)picoquic_slab_alloc(&quic->packet_pool);
 
     if (packet != NULL) {
-        /* It might be sufficient to zero the metadata, but zeroing everything
-         * appears safer, and does not confuse checkers like valgrind.
-         */
-        memset(packet, 0, sizeof(picoquic_packet_t));
+        uint8_t* bytes = (uint8_t*)picoquic_slab_alloc(&quic->packet_bytes_pool[PICOQUIC_PACKET_POOL_NB_BYTES_CLASSES - 1]);
+
+        if (bytes == NULL) {
+            picoquic_slab_free(&quic->packet_pool, packet);
+            packet = NULL;
+        }
+        else {
+            /* It might be sufficient to zero the metadata, but zeroing everything
+             * appears safer, and does not confuse checkers like valgrind.
+             */
+            memset(packet, 0, sizeof(picoquic_packet_t));
+            memset(bytes, 0, PICOQUIC_MAX_PACKET_SIZE);
+            packet->bytes = bytes;
+            packet->bytes_max = PICOQUIC_MAX_PACKET_SIZE;
+            packet->is_from_pool = 1;
+        }
     }
 
     return packet;
@@ -494,17 +627,89 @@ picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
 void picoquic_recycle_packet(picoquic_quic_t * quic, picoquic_packet_t* packet)
 {
     if (packet != NULL) {
-        if (quic->nb_packets_in_pool >= PICOQUIC_MAX_PACKETS_IN_POOL) {
-            free(packet);
-            quic->nb_packets_allocated--;
+        picoquic_memory_release(packet->accounted_cnx, picoquic_memory_retransmit, packet->accounted_bytes);
+        if (packet->bytes_max > 0) {
+            picoquic_slab_free(&quic->packet_bytes_pool[picoquic_packet_bytes_class(packet->bytes_max)], packet->bytes);
+        }
+        if (packet->is_from_pool) {
+            picoquic_slab_free(&quic->packet_pool, packet);
         }
         else {
-            memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes));
-            packet->packet_previous = quic->p_first_packet;
-            quic->p_first_packet = packet;
-            quic->nb_packets_in_pool++;
+            /* Packet allocated outside of the pool, e.g., in unit tests */
+            free(packet);
+        }
+    }
+}
+
+/* Move the content of the packet to the smallest buffer that can hold it.
+ * This is done when the packet is queued for retransmission, after which
+ * the content does not change anymore. */
+void picoquic_packet_shrink_bytes(picoquic_quic_t* quic, picoquic_packet_t* packet)
+{
+    if (packet->bytes_max > 0) {
+        int bytes_class = picoquic_packet_bytes_class(packet->length);
+
+        if (picoquic_packet_bytes_class_size[bytes_class] < packet->bytes_max) {
+            uint8_t* bytes = (uint8_t*)picoquic_slab_alloc(&quic->packet_bytes_pool[bytes_class]);
+
+            if (bytes != NULL) {
+                memcpy(bytes, packet->bytes, packet->length);
+                picoquic_slab_free(&quic->packet_bytes_pool[picoquic_packet_bytes_class(packet->bytes_max)], packet->bytes);
+                packet->bytes = bytes;
+                packet->bytes_max = picoquic_packet_bytes_class_size[bytes_class];
+                quic->nb_packet_bytes_shrunk++;
+            }
+        }
+    }
+}
+
+/* Replace the stream frames of a sent packet by stream reference frames,
+ * if the stream keeps the data until it is acknowledged. This is done when
+ * the packet is queued for retransmission, before shrinking the buffer.
+ * The frames are rebuilt from the stream data if they need to be repeated.
+ */
+void picoquic_compact_sent_packet(picoquic_cnx_t* cnx, picoquic_packet_t* packet)
+{
+    size_t byte_index = packet->offset;
+    size_t write_index = packet->offset;
+
+    while (byte_index < packet->length) {
+        size_t frame_length = 0;
+        int frame_is_pure_ack = 0;
+        uint8_t* frame = &packet->bytes[byte_index];
+
+        if (picoquic_skip_sent_frame(frame, packet->length - byte_index, &frame_length, &frame_is_pure_ack) != 0) {
+            /* Malformed packet, keep the remaining bytes as they are */
+            frame_length = packet->length - byte_index;
+        }
+        else if (PICOQUIC_IN_RANGE(frame[0], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+            uint64_t stream_id;
+            uint64_t offset;
+            size_t data_length;
+            size_t consumed;
+            int fin;
+            picoquic_stream_head_t* stream;
+
+            if (picoquic_parse_stream_header(frame, frame_length, &stream_id, &offset, &data_length, &fin, &consumed) == 0 &&
+                data_length > PICOQUIC_STREAM_REF_FRAME_SIZE &&
+                (stream = picoquic_find_stream(cnx, stream_id)) != NULL &&
+                picoquic_stream_sent_data(stream, offset, data_length) != NULL) {
+                (void)picoquic_format_stream_ref_frame(&packet->bytes[write_index], frame + frame_length,
+                    stream_id, offset, data_length, fin);
+                write_index += PICOQUIC_STREAM_REF_FRAME_SIZE;
+                byte_index += frame_length;
+                packet->compacted_length += frame_length - PICOQUIC_STREAM_REF_FRAME_SIZE;
+                cnx->quic->nb_stream_bytes_by_reference += data_length;
+                continue;
+            }
         }
+        if (write_index < byte_index) {
+            memmove(&packet->bytes[write_index], frame, frame_length);
+        }
+        write_index += frame_length;
+        byte_index += frame_length;
     }
+    packet->length = write_index;
 }
 
 void picoquic_update_payload_length(
@@ -834,6 +1039,34 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
         }
     }
 
+    /* In a train, defer the encryption and the header protection to the end of the train */
+    if (ptype == picoquic_packet_1rtt_protected && cnx->quic->protect_batch != NULL &&
+        cnx->quic->protect_batch->is_open) {
+        picoquic_protect_batch_t* batch = cnx->quic->protect_batch;
+
+        if (batch->nb_packets > 0 && (batch->aead_context != aead_context || batch->nb_packets >= PICOQUIC_PROTECT_BATCH_MAX)) {
+            picoquic_protect_batch_apply(batch);
+        }
+        if (batch->nb_packets == 0) {
+            picoquic_protect_batch_init(batch, aead_context, pn_enc);
+        }
+        memcpy(send_buffer + h_length, bytes + header_length, length - header_length);
+        if (picoquic_protect_batch_add(batch, send_buffer, h_length, pn_offset, length - header_length,
+            sequence_number, first_mask, cnx->is_multipath_enabled, path_x->p_remote_cnxid->sequence) == 0 &&
+            (cnx->quic->F_log != NULL || cnx->f_binlog != NULL) && picoquic_cnx_is_still_logging(cnx)) {
+            /* The packet is logged when the batch is encrypted */
+            picoquic_protect_batch_packet_t* p = &batch->packets[batch->nb_packets - 1];
+
+            p->log_cnx = cnx;
+            p->log_path = path_x;
+            p->log_pn_length = pn_length;
+            p->log_time = current_time;
+        }
+        send_length = h_length + length - header_length + aead_checksum_length;
+
+        return send_length;
+    }
+
     /* Encrypt the packet */
     if (cnx->is_multipath_enabled && ptype == picoquic_packet_1rtt_protected) {
         send_length = picoquic_aead_encrypt_mp(send_buffer + /* header_length */ h_length,
@@ -877,6 +1110,101 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     return send_length;
 }
 
+void picoquic_protect_batch_init(picoquic_protect_batch_t* batch, void* aead_context, void* pn_enc)
+{
+    batch->aead_context = aead_context;
+    batch->pn_enc = pn_enc;
+    batch->nb_packets = 0;
+}
+
+/* Add a packet to the batch. The header and the clear text payload are already
+ * in place, with space for the checksum after the payload. */
+int picoquic_protect_batch_add(picoquic_protect_batch_t* batch, uint8_t* bytes, size_t header_length,
+    size_t pn_offset, size_t payload_length, uint64_t sequence_number, uint8_t first_mask,
+    int is_multipath, uint64_t path_id)
+{
+    int ret = 0;
+
+    if (batch->nb_packets >= PICOQUIC_PROTECT_BATCH_MAX) {
+        ret = -1;
+    }
+    else {
+        picoquic_protect_batch_packet_t* p = &batch->packets[batch->nb_packets++];
+
+        p->bytes = bytes;
+        p->header_length = header_length;
+        p->pn_offset = pn_offset;
+        p->payload_length = payload_length;
+        p->sequence_number = sequence_number;
+        p->first_mask = first_mask;
+        p->is_multipath = (is_multipath) ? 1 : 0;
+        p->path_id = path_id;
+        p->log_cnx = NULL;
+        p->log_path = NULL;
+        p->log_pn_length = 0;
+        p->log_time = 0;
+    }
+
+    return ret;
+}
+
+/* Encrypt all the packets of the batch in place, then compute all the header
+ * protection masks and apply them. As in picoquic_protect_packet,
+ * logged packets are logged after encryption and before header protection. */
+void picoquic_protect_batch_apply(picoquic_protect_batch_t* batch)
+{
+    for (size_t i = 0; i < batch->nb_packets; i++) {
+        picoquic_protect_batch_packet_t* p = &batch->packets[i];
+        uint8_t* payload = p->bytes + p->header_length;
+        size_t clear_length = p->header_length + p->payload_length;
+
+        if (p->log_cnx != NULL) {
+            memcpy(batch->log_clear, p->bytes, clear_length);
+        }
+
+        if (p->is_multipath) {
+            (void)picoquic_aead_encrypt_mp(payload, payload, p->payload_length, p->path_id,
+                p->sequence_number, p->bytes, p->header_length, batch->aead_context);
+        }
+        else {
+            (void)picoquic_aead_encrypt_generic(payload, payload, p->payload_length,
+                p->sequence_number, p->bytes, p->header_length, batch->aead_context);
+        }
+        memcpy(batch->samples + i * PICOQUIC_HP_SAMPLE_SIZE, p->bytes + p->pn_offset + 4, PICOQUIC_HP_SAMPLE_SIZE);
+
+        if (p->log_cnx != NULL) {
+            picoquic_log_outgoing_packet(p->log_cnx, p->log_path,
+                batch->log_clear, p->sequence_number, p->log_pn_length, clear_length,
+                p->bytes, clear_length + picoquic_aead_get_checksum_length(batch->aead_context), p->log_time);
+        }
+    }
+
+    if (batch->nb_packets > 0) {
+        picoquic_hp_mask_batch(batch->pn_enc, batch->masks, batch->samples, batch->nb_packets);
+
+        for (size_t i = 0; i < batch->nb_packets; i++) {
+            picoquic_protect_batch_packet_t* p = &batch->packets[i];
+            uint8_t* mask_bytes = batch->masks + i * PICOQUIC_HP_SAMPLE_SIZE;
+            uint8_t pn_l = (p->bytes[0] & 3) + 1;
+
+            p->bytes[0] ^= (mask_bytes[0] & p->first_mask);
+            for (uint8_t j = 0; j < pn_l; j++) {
+                p->bytes[p->pn_offset + j] ^= mask_bytes[j + 1];
+            }
+        }
+        batch->nb_batches++;
+        batch->nb_packets_batched += batch->nb_packets;
+        batch->nb_packets = 0;
+    }
+}
+
+/* Protect the pending packets, e.g., at the end of a train or before the keys change */
+void picoquic_protect_batch_flush(picoquic_quic_t* quic)
+{
+    if (quic->protect_batch != NULL) {
+        picoquic_protect_batch_apply(quic->protect_batch);
+    }
+}
 
 /* Compute nanosec per packet */
 uint64_t picoquic_packet_time_nanosec(picoquic_path_t* path_x, size_t length)
@@ -1111,6 +1439,15 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
         pkt_ctx = &cnx->pkt_ctx[packet->pc];
     }
 
+    /* Keep stream data by reference, then release the part of the packet buffer that is not used */
+    if (cnx->is_retransmit_by_reference_enabled && packet->ptype == picoquic_packet_1rtt_protected) {
+        picoquic_compact_sent_packet(cnx, packet);
+    }
+    picoquic_packet_shrink_bytes(cnx->quic, packet);
+    packet->accounted_cnx = cnx;
+    packet->accounted_bytes = sizeof(picoquic_packet_t) + packet->bytes_max;
+    picoquic_memory_account(cnx, picoquic_memory_retransmit, packet->accounted_bytes);
+
     /* Manage the double linked packet list for retransmissions */
     packet->packet_next = NULL;
     if (pkt_ctx->pending_last == NULL) {
@@ -1140,7 +1477,7 @@ picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx,
     picoquic_packet_context_t * pkt_ctx, picoquic_packet_t* p, int should_free,
     int add_to_data_repeat_queue)
 {
-    size_t dequeued_length = p->length + p->checksum_overhead;
+    size_t dequeued_length = PICOQUIC_PACKET_SENT_LENGTH(p) + p->checksum_overhead;
 
     if (p->is_queued_for_retransmit) {
         /* Remove from list */
@@ -1383,7 +1720,7 @@ int picoquic_is_pkt_ctx_backlog_empty(picoquic_packet_context_t* pkt_ctx)
 
         if (!p->is_ack_trap && !p->is_multipath_probe && !p->is_mtu_probe) {
             while (ret == 0 && byte_index < p->length) {
-                ret = picoquic_skip_frame(&p->bytes[byte_index],
+                ret = picoquic_skip_sent_frame(&p->bytes[byte_index],
                     p->length - p->offset, &frame_length, &frame_is_pure_ack);
 
                 if (!frame_is_pure_ack) {
@@ -1462,7 +1799,7 @@ static int picoquic_preemptive_retransmit_packet(picoquic_packet_t* old_p,
         byte_index = old_p->offset;
 
         while (ret == 0 && byte_index < old_p->length) {
-            ret = picoquic_skip_frame(&old_p->bytes[byte_index],
+            ret = picoquic_skip_sent_frame(&old_p->bytes[byte_index],
                 old_p->length - byte_index, &frame_length, &frame_is_pure_ack);
 
             /* Check whether the data was already acked, which may happen in
@@ -1484,8 +1821,21 @@ static int picoquic_preemptive_retransmit_packet(picoquic_packet_t* old_p,
                         write_index += pad_needed;
                     }
                 }
-                /* copy the frame */
-                if (write_index + frame_length <= send_buffer_max_minus_checksum) {
+                /* copy the frame, or rebuild it if the data is kept by reference */
+                if (old_p->bytes[byte_index] == picoquic_frame_type_stream_ref) {
+                    uint8_t* bytes_next = picoquic_format_stream_frame_from_ref(cnx, &old_p->bytes[byte_index], frame_length,
+                        &new_bytes[write_index], &new_bytes[send_buffer_max_minus_checksum]);
+                    if (bytes_next != NULL) {
+                        size_t copied = bytes_next - &new_bytes[write_index];
+                        write_index += copied;
+                        *length += copied;
+                        *has_data = 1;
+                    }
+                    else {
+                        is_repeated = 0;
+                    }
+                }
+                else if (write_index + frame_length <= send_buffer_max_minus_checksum) {
                     memcpy(&new_bytes[write_index], &old_p->bytes[byte_index], frame_length);
                     write_index += frame_length;
                     *length += frame_length;
@@ -1945,7 +2295,7 @@ void picoquic_implicit_handshake_ack(picoquic_cnx_t* cnx, picoquic_packet_contex
         if (old_path != NULL && cnx->congestion_alg != NULL && p->send_time < cnx->start_time + PICOQUIC_INITIAL_RTT) {
             cnx->congestion_alg->alg_notify(cnx, old_path,
                 picoquic_congestion_notification_acknowledgement,
-                0, 0, p->length, 0, current_time);
+                0, 0, PICOQUIC_PACKET_SENT_LENGTH(p), 0, current_time);
         }
         /* Update the number of bytes in transit and remove old packet from queue */
         /* The packet will not be placed in the "retransmitted" queue */
@@ -2061,7 +2411,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
     switch (cnx->cnx_state) {
     case picoquic_state_client_init:
         if (cnx->retry_token_length == 0 && cnx->sni != NULL) {
-            (void)picoquic_get_token(cnx->quic->p_first_token, current_time, cnx->sni, (uint16_t)strlen(cnx->sni),
+            (void)picoquic_get_retry_token(cnx->quic, current_time, cnx->sni, (uint16_t)strlen(cnx->sni),
                 NULL, 0, &cnx->retry_token, &cnx->retry_token_length, 1);
         }
         break;
@@ -2977,6 +3327,10 @@ static uint8_t* picoquic_prepare_datagram_ready(picoquic_cnx_t* cnx, picoquic_pa
         bytes_next = picoquic_format_first_datagram_frame(cnx, bytes_next, bytes_max, more_data, is_pure_ack);
         *more_data |= (cnx->first_datagram != NULL);
     }
+    else if (cnx->datagram_ring.nb_queued > 0) {
+        bytes_next = picoquic_format_ring_datagram_frames(cnx, bytes_next, bytes_max, more_data, is_pure_ack);
+        *more_data |= (cnx->datagram_ring.nb_queued > 0);
+    }
     else {
         while (cnx->is_datagram_ready || path_x->is_datagram_ready) {
             uint8_t* dg_start = bytes_next;
@@ -3039,7 +3393,7 @@ static uint8_t* picoquic_prepare_datagram_ready(picoquic_cnx_t* cnx, picoquic_pa
 */
 
 static uint8_t* picoquic_prepare_stream_and_datagrams(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint8_t* bytes_next, uint8_t* bytes_max,
-    int* more_data, int* is_pure_ack, int* no_data_to_send, int* ret)
+    int* more_data, int* is_pure_ack, int* no_data_to_send, uint64_t current_time, int* ret)
 {
     int datagram_sent = 0;
     int datagram_tried_and_failed = 0;
@@ -3052,6 +3406,7 @@ static uint8_t* picoquic_prepare_stream_and_datagrams(picoquic_cnx_t* cnx, picoq
         * format the frames to send at that level. Repeat in a loop until the
         * packet is full or there is nothing more to send. */
         uint64_t datagram_present = cnx->first_datagram != NULL || cnx->is_datagram_ready || path_x->is_datagram_ready;
+        uint64_t datagram_priority = cnx->datagram_priority;
         picoquic_stream_head_t* first_stream = picoquic_find_ready_stream_path(cnx,
             (cnx->is_multipath_enabled || cnx->is_simple_multipath_enabled) ? path_x : NULL);
         picoquic_packet_t* first_repeat = picoquic_first_data_repeat_packet(cnx);
@@ -3063,8 +3418,16 @@ static uint8_t* picoquic_prepare_stream_and_datagrams(picoquic_cnx_t* cnx, picoq
         more_data_this_round = 0;
 
         int datagram_first = (cnx->datagram_conflicts_max >= cnx->datagram_conflicts_count);
+        if (cnx->datagram_ring.nb_queued > 0) {
+            /* Drop the expired datagrams, and schedule the others at their own priority */
+            uint64_t ring_priority = picoquic_datagram_ring_expire(cnx, current_time);
+            if (ring_priority != UINT64_MAX && cnx->first_datagram == NULL) {
+                datagram_present = 1;
+                datagram_priority = ring_priority;
+            }
+        }
         if (datagram_present) {
-            current_priority = cnx->datagram_priority;
+            current_priority = datagram_priority;
         }
         if (first_stream != NULL) {
             stream_priority = first_stream->stream_priority;
@@ -3085,8 +3448,8 @@ static uint8_t* picoquic_prepare_stream_and_datagrams(picoquic_cnx_t* cnx, picoq
         }
 
         if (datagram_present &&
-            cnx->datagram_priority == current_priority &&
-            (cnx->datagram_priority < stream_priority || datagram_first)) {
+            datagram_priority == current_priority &&
+            (datagram_priority < stream_priority || datagram_first)) {
             bytes_next = picoquic_prepare_datagram_ready(cnx, path_x, bytes_next, bytes_max,
                 &more_data_this_round, is_pure_ack, &datagram_tried_and_failed, &datagram_sent, ret);
             something_sent = datagram_sent;
@@ -3130,8 +3493,8 @@ static uint8_t* picoquic_prepare_stream_and_datagrams(picoquic_cnx_t* cnx, picoq
         }
 
         if (datagram_present &&
-            cnx->datagram_priority == current_priority &&
-            cnx->datagram_priority <= stream_priority &&
+            datagram_priority == current_priority &&
+            datagram_priority <= stream_priority &&
             !datagram_first) {
             bytes_next = picoquic_prepare_datagram_ready(cnx, path_x, bytes_next, bytes_max,
                 more_data, is_pure_ack, &datagram_tried_and_failed, &datagram_sent, ret);
@@ -3322,7 +3685,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                         }
                         if (ret == 0) {
                             bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
-                                &more_data, &is_pure_ack, &no_data_to_send, &ret);
+                                &more_data, &is_pure_ack, &no_data_to_send, current_time, &ret);
                         }
                         /* TODO: replace this by posting of frame when CWIN estimated */
                         /* Send bdp frames if there are no stream frames to send 
@@ -3582,22 +3945,31 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
                 /* If necessary, encode the max data frame */
                 if (ret == 0){
-                    if (cnx->quic->max_data_limit != 0) {
-                        if (cnx->data_received + ((3 * cnx->quic->max_data_limit) / 4) > cnx->maxdata_local) {
-                            uint64_t max_data_increase = cnx->data_received + cnx->quic->max_data_limit - cnx->maxdata_local;
+                    if (cnx->quic->fc_autotune_window_max != 0) {
+                        uint64_t window = picoquic_fc_autotune_window(cnx, &cnx->fc_autotune, cnx->data_consumed,
+                            cnx->local_parameters.initial_max_data, current_time);
+                        if (cnx->data_received + ((3 * window) / 4) > cnx->maxdata_local) {
+                            bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
+                                cnx->data_received + window - cnx->maxdata_local);
+                        }
+                    }
+                    else if (cnx->quic->max_data_limit != 0) {
+                        uint64_t max_data_limit = picoquic_memory_pressure_window(cnx->quic, cnx->quic->max_data_limit);
+                        if (cnx->data_received + ((3 * max_data_limit) / 4) > cnx->maxdata_local) {
+                            uint64_t max_data_increase = cnx->data_received + max_data_limit - cnx->maxdata_local;
                             bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
                                 max_data_increase);
                         }
                     }
                     else if (2 * cnx->data_received > cnx->maxdata_local) {
                         bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
-                            picoquic_cc_increased_window(cnx, cnx->maxdata_local));
+                            picoquic_memory_pressure_window(cnx->quic, picoquic_cc_increased_window(cnx, cnx->maxdata_local)));
                     }
                 }
 
                 /* If necessary, encode the max stream data frames */
                 if (ret == 0 && cnx->max_stream_data_needed) {
-                    bytes_next = picoquic_format_required_max_stream_data_frames(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
+                    bytes_next = picoquic_format_required_max_stream_data_frames(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack, current_time);
                 }
 
                 /* If present, send misc frame */
@@ -3658,7 +4030,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
                         }
                         if (ret == 0) {
                             bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
-                                &more_data, &is_pure_ack, &no_data_to_send, &ret);
+                                &more_data, &is_pure_ack, &no_data_to_send, current_time, &ret);
                         }
 
                         /* TODO: replace this by scheduling of BDP frame when window has been estimated */
@@ -4345,6 +4717,10 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
             cnx->is_sending_large_buffer = 1;
         }
 
+        if (send_msg_size != NULL && cnx->quic->protect_batch != NULL) {
+            cnx->quic->protect_batch->is_open = 1;
+        }
+
         while (ret == 0)
         {
             /* Create a new packet, which may include several segments */
@@ -4482,6 +4858,11 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
         }
     }
 
+    if (cnx->quic->protect_batch != NULL) {
+        picoquic_protect_batch_flush(cnx->quic);
+        cnx->quic->protect_batch->is_open = 0;
+    }
+
     picoquic_reinsert_by_wake_time(cnx->quic, cnx, next_wake_time);
 
     return ret;
@@ -4589,7 +4970,7 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
                     fflush(quic->F_log);
                 }
 
-                if (cnx->f_binlog != NULL) {
+                if (cnx->f_binlog != NULL && quic->binlog_ring == NULL) {
                     fflush(cnx->f_binlog);
                 }
 
@@ -0,0 +1,184 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Slab allocator.
+ * Each slab holds PICOQUIC_SLAB_NB_OBJECTS objects of the same size class.
+ * Each object is preceded by a header pointing to its slab, so that the
+ * object can be released in constant time. The free objects of a slab are
+ * chained in a free list. The slabs that have at least one free object are
+ * kept in the "available" list of the class, the others in the "full" list.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "picoquic_internal.h"
+
+#define PICOQUIC_SLAB_ALIGN 16
+#define PICOQUIC_SLAB_ROUND(x) (((x) + PICOQUIC_SLAB_ALIGN - 1) & ~((size_t)PICOQUIC_SLAB_ALIGN - 1))
+#define PICOQUIC_SLAB_HEADER_SIZE PICOQUIC_SLAB_ROUND(sizeof(picoquic_slab_t*))
+
+struct st_picoquic_slab_t {
+    struct st_picoquic_slab_t* next;
+    struct st_picoquic_slab_t* previous;
+    size_t nb_free;
+    uint8_t* first_free;
+};
+
+static size_t picoquic_slab_stride(picoquic_slab_class_t* sc)
+{
+    return PICOQUIC_SLAB_HEADER_SIZE + PICOQUIC_SLAB_ROUND(sc->object_size);
+}
+
+size_t picoquic_slab_class_bytes(picoquic_slab_class_t* sc)
+{
+    return sc->nb_slabs * (PICOQUIC_SLAB_ROUND(sizeof(picoquic_slab_t)) +
+        PICOQUIC_SLAB_NB_OBJECTS * picoquic_slab_stride(sc));
+}
+
+static void picoquic_slab_list_remove(picoquic_slab_t** first, picoquic_slab_t* slab)
+{
+    if (slab->previous == NULL) {
+        *first = slab->next;
+    }
+    else {
+        slab->previous->next = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->previous = slab->previous;
+    }
+    slab->next = NULL;
+    slab->previous = NULL;
+}
+
+static void picoquic_slab_list_insert(picoquic_slab_t** first, picoquic_slab_t* slab)
+{
+    slab->previous = NULL;
+    slab->next = *first;
+    if (slab->next != NULL) {
+        slab->next->previous = slab;
+    }
+    *first = slab;
+}
+
+void picoquic_slab_class_init(picoquic_slab_class_t* sc, size_t object_size, size_t nb_free_max)
+{
+    memset(sc, 0, sizeof(picoquic_slab_class_t));
+    sc->object_size = (object_size < sizeof(uint8_t*)) ? sizeof(uint8_t*) : object_size;
+    sc->nb_free_max = nb_free_max;
+}
+
+static picoquic_slab_t* picoquic_slab_create(picoquic_slab_class_t* sc)
+{
+    size_t stride = picoquic_slab_stride(sc);
+    picoquic_slab_t* slab = (picoquic_slab_t*)malloc(PICOQUIC_SLAB_ROUND(sizeof(picoquic_slab_t)) +
+        PICOQUIC_SLAB_NB_OBJECTS * stride);
+
+    if (slab != NULL) {
+        uint8_t* x = ((uint8_t*)slab) + PICOQUIC_SLAB_ROUND(sizeof(picoquic_slab_t));
+
+        memset(slab, 0, sizeof(picoquic_slab_t));
+        /* Chain the objects in the free list, in memory order */
+        for (int i = PICOQUIC_SLAB_NB_OBJECTS - 1; i >= 0; i--) {
+            uint8_t* object = x + i * stride + PICOQUIC_SLAB_HEADER_SIZE;
+            *((picoquic_slab_t**)(object - PICOQUIC_SLAB_HEADER_SIZE)) = slab;
+            *((uint8_t**)object) = slab->first_free;
+            slab->first_free = object;
+        }
+        slab->nb_free = PICOQUIC_SLAB_NB_OBJECTS;
+        sc->nb_slabs++;
+        sc->nb_free += PICOQUIC_SLAB_NB_OBJECTS;
+        if (sc->nb_slabs > sc->nb_slabs_max) {
+            sc->nb_slabs_max = sc->nb_slabs;
+        }
+        picoquic_slab_list_insert(&sc->first_available, slab);
+    }
+
+    return slab;
+}
+
+void* picoquic_slab_alloc(picoquic_slab_class_t* sc)
+{
+    picoquic_slab_t* slab = sc->first_available;
+    uint8_t* object = NULL;
+
+    if (slab == NULL) {
+        slab = picoquic_slab_create(sc);
+    }
+
+    if (slab != NULL) {
+        object = slab->first_free;
+        slab->first_free = *((uint8_t**)object);
+        slab->nb_free--;
+        sc->nb_free--;
+        sc->nb_in_use++;
+        if (sc->nb_in_use > sc->nb_in_use_max) {
+            sc->nb_in_use_max = sc->nb_in_use;
+        }
+        if (slab->nb_free == 0) {
+            picoquic_slab_list_remove(&sc->first_available, slab);
+            picoquic_slab_list_insert(&sc->first_full, slab);
+        }
+    }
+
+    return object;
+}
+
+void picoquic_slab_free(picoquic_slab_class_t* sc, void* v_object)
+{
+    uint8_t* object = (uint8_t*)v_object;
+    picoquic_slab_t* slab = *((picoquic_slab_t**)(object - PICOQUIC_SLAB_HEADER_SIZE));
+
+    *((uint8_t**)object) = slab->first_free;
+    slab->first_free = object;
+    slab->nb_free++;
+    sc->nb_free++;
+    sc->nb_in_use--;
+
+    if (slab->nb_free == 1) {
+        picoquic_slab_list_remove(&sc->first_full, slab);
+        picoquic_slab_list_insert(&sc->first_available, slab);
+    }
+
+    if (slab->nb_free == PICOQUIC_SLAB_NB_OBJECTS && sc->nb_free > sc->nb_free_max) {
+        /* The pool holds too many free objects, release this slab */
+        picoquic_slab_list_remove(&sc->first_available, slab);
+        sc->nb_free -= PICOQUIC_SLAB_NB_OBJECTS;
+        sc->nb_slabs--;
+        free(slab);
+    }
+}
+
+void picoquic_slab_class_clear(picoquic_slab_class_t* sc)
+{
+    picoquic_slab_t** lists[2] = { &sc->first_available, &sc->first_full };
+
+    for (int i = 0; i < 2; i++) {
+        while (*lists[i] != NULL) {
+            picoquic_slab_t* slab = *lists[i];
+            *lists[i] = slab->next;
+            free(slab);
+        }
+    }
+    sc->nb_slabs = 0;
+    sc->nb_free = 0;
+    sc->nb_in_use = 0;
+}
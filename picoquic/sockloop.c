@@ -28,9 +28,22 @@
  * loop will terminate if the callback return code is not zero -- except for special processing
  * of the migration testing code.
  * TODO: in Windows, use WSA asynchronous calls instead of sendmsg, allowing for multiple parallel sends.
- * TODO: in Linux, use multiple send per call API
  * TDOO: trim the #define list.
  * TODO: support the QuicDoq scenario, manage extra socket.
+ *
+ * If the application sets the "do_batch_receive" option, the loop receives
+ * batches of packets with a single system call (recvmmsg on Linux), with
+ * UDP GRO enabled when the kernel supports it, and submits the whole batch
+ * to the stack before sending. Similarly, if the application sets the
+ * "do_batch_send" option, the loop prepares packets for several connections
+ * in a pool of send buffers and sends them with a single system call
+ * per socket (sendmmsg on Linux).
+ * By default the loop waits for packets with select(). If the application
+ * sets the "do_epoll" or "do_io_uring" options, the loop uses the
+ * corresponding event backend (see picosocks.h), falling back to epoll
+ * or select if the backend is not available. The io_uring backend only
+ * handles the receive path, the packets are still sent with sendmsg or
+ * sendmmsg.
  */
 
 #ifdef _WINDOWS
@@ -59,6 +72,9 @@
 
 #else /* Linux */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -98,6 +114,12 @@
 #include "picoquic_internal.h"
 #include "picoquic_packet_loop.h"
 #include "picoquic_unified_log.h"
+#include "picoquic_utils.h"
+#include "picoquic_lb.h"
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #if defined(_WINDOWS)
 static int udp_gso_available = 0;
@@ -109,8 +131,34 @@ static int udp_gso_available = 0;
 #endif
 #endif
 
+static int picoquic_packet_loop_set_reuse_port(SOCKET_TYPE s, int reuse_port)
+{
+    int ret = 0;
+#if defined(SO_REUSEPORT)
+    if (reuse_port) {
+        int val = 1;
+        ret = setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&val, sizeof(val));
+    }
+#else
+    if (reuse_port) {
+        ret = -1;
+    }
+#endif
+    return ret;
+}
+
+static int picoquic_packet_loop_open_sockets_ex(int local_port, int local_af, SOCKET_TYPE* s_socket, int* sock_af,
+    uint16_t* sock_ports, int socket_buffer_size, int nb_sockets_max, int reuse_port);
+
 int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE * s_socket, int * sock_af, 
     uint16_t * sock_ports, int socket_buffer_size, int nb_sockets_max)
+{
+    return picoquic_packet_loop_open_sockets_ex(local_port, local_af, s_socket, sock_af, sock_ports,
+        socket_buffer_size, nb_sockets_max, 0);
+}
+
+static int picoquic_packet_loop_open_sockets_ex(int local_port, int local_af, SOCKET_TYPE* s_socket, int* sock_af,
+    uint16_t* sock_ports, int socket_buffer_size, int nb_sockets_max, int reuse_port)
 {
     int nb_sockets = (local_af == AF_UNSPEC) ? 2 : 1;
 
@@ -138,6 +186,7 @@ int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE
         if ((s_socket[i] = socket(sock_af[i], SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET ||
             picoquic_socket_set_ecn_options(s_socket[i], sock_af[i], &recv_set, &send_set) != 0 ||
             picoquic_socket_set_pkt_info(s_socket[i], sock_af[i]) != 0 ||
+            picoquic_packet_loop_set_reuse_port(s_socket[i], reuse_port) != 0 ||
             picoquic_bind_to_port(s_socket[i], sock_af[i], local_port) != 0 ||
             picoquic_get_local_address(s_socket[i], &local_address) != 0 ||
             picoquic_socket_set_pmtud_options(s_socket[i], sock_af[i]) != 0)
@@ -199,14 +248,410 @@ int picoquic_packet_loop_open_sockets(int local_port, int local_af, SOCKET_TYPE
     return nb_sockets;
 }
 
-int picoquic_packet_loop(picoquic_quic_t* quic,
+/* Sharded server support.
+ * In the sharded server mode, each worker thread runs its own packet loop, with
+ * its own QUIC context and its own sockets, all bound to the same port with
+ * SO_REUSEPORT. The kernel distributes incoming packets between the sockets based
+ * on the 4-tuple, which means that packets from a migrated or NAT-rebound client
+ * may arrive at the wrong worker. The connection IDs issued by each worker encode
+ * the shard index using the load balancer compatible CID format (see picoquic_lb.h).
+ * When a worker receives a short header packet for a connection ID encoding a
+ * different shard index, it forwards that packet to the "inbox" of the target
+ * shard, which is a local datagram socket included in the target's select set.
+ * Each forwarded packet is preceded by a header carrying the addresses, interface
+ * index and ECN marks.
+ */
+typedef struct st_picoquic_shard_forward_header_t {
+    struct sockaddr_in6 addr_from;
+    struct sockaddr_in6 addr_to;
+    int if_index;
+    unsigned char received_ecn;
+} picoquic_shard_forward_header_t;
+
+#define PICOQUIC_SHARD_FORWARD_HEADER_SIZE sizeof(picoquic_shard_forward_header_t)
+
+typedef struct st_picoquic_packet_loop_shard_t {
+    struct st_picoquic_sharded_loop_t* sharded_loop;
+    int shard_index;
+    int lb_configured_by_loop;
+    picoquic_quic_t* quic;
+    void* loop_callback_ctx;
+    SOCKET_TYPE inbox[2]; /* inbox[0] read by the shard, inbox[1] written by other shards */
+    picoquic_thread_t thread;
+    int thread_started;
+    int ret;
+} picoquic_packet_loop_shard_t;
+
+typedef struct st_picoquic_sharded_loop_t {
+    picoquic_sharded_loop_param_t* param;
+    picoquic_packet_loop_cb_fn loop_callback;
+    volatile int should_stop;
+    picoquic_packet_loop_shard_t shard[PICOQUIC_SHARDED_LOOP_MAX];
+} picoquic_sharded_loop_t;
+
+/* Find the shard that issued the destination connection ID of a short header packet.
+ * Long header packets are not steered: Initial and 0-RTT packets use a connection ID
+ * chosen by the client, and the other long header packets are only sent before
+ * migration is allowed.
+ */
+static int picoquic_packet_loop_shard_of(picoquic_packet_loop_shard_t* shard, const uint8_t* bytes, size_t length)
+{
+    int target = shard->shard_index;
+    picoquic_quic_t* quic = shard->quic;
+
+    if (length > quic->local_cnxid_length && (bytes[0] & 0x80) == 0 && quic->local_cnxid_length > 0) {
+        picoquic_connection_id_t cnx_id;
+        uint64_t server_id64;
+
+        (void)picoquic_parse_connection_id(bytes + 1, quic->local_cnxid_length, &cnx_id);
+        server_id64 = picoquic_lb_compat_cid_verify(quic, quic->cnx_id_callback_ctx, &cnx_id);
+        if (server_id64 < (uint64_t)shard->sharded_loop->param->nb_shards) {
+            target = (int)server_id64;
+        }
+    }
+
+    return target;
+}
+
+static void picoquic_packet_loop_forward(picoquic_packet_loop_shard_t* shard, int target,
+    const uint8_t* bytes, size_t length, struct sockaddr* addr_from, struct sockaddr* addr_to,
+    int if_index, unsigned char received_ecn)
+{
+    uint8_t buffer[PICOQUIC_SHARD_FORWARD_HEADER_SIZE + PICOQUIC_MAX_PACKET_SIZE];
+    picoquic_shard_forward_header_t header;
+    picoquic_shard_stats_t* stats = &shard->sharded_loop->param->stats[shard->shard_index];
+
+    if (length > PICOQUIC_MAX_PACKET_SIZE) {
+        stats->nb_forward_dropped++;
+    }
+    else {
+        memset(&header, 0, sizeof(header));
+        memcpy(&header.addr_from, addr_from, picoquic_addr_length(addr_from));
+        memcpy(&header.addr_to, addr_to, picoquic_addr_length(addr_to));
+        header.if_index = if_index;
+        header.received_ecn = received_ecn;
+        memcpy(buffer, &header, sizeof(header));
+        memcpy(buffer + sizeof(header), bytes, length);
+#if defined(_WINDOWS)
+        stats->nb_forward_dropped++;
+#else
+        if (send(shard->sharded_loop->shard[target].inbox[1], buffer, sizeof(header) + length, MSG_DONTWAIT) < 0) {
+            /* Inbox is full. Drop the packet, as the network would. */
+            stats->nb_forward_dropped++;
+        }
+        else {
+            stats->nb_packets_forwarded++;
+        }
+#endif
+    }
+}
+
+/* Submit an incoming packet to the stack, or if it belongs to another shard
+ * forward it to that shard.
+ */
+static void picoquic_packet_loop_incoming(picoquic_quic_t* quic, picoquic_packet_loop_shard_t* shard,
+    uint8_t* bytes, size_t length, struct sockaddr* addr_from, struct sockaddr* addr_to,
+    int if_index, unsigned char received_ecn, picoquic_cnx_t** last_cnx, uint64_t current_time)
+{
+    int target;
+
+    if (shard != NULL && (target = picoquic_packet_loop_shard_of(shard, bytes, length)) != shard->shard_index) {
+        picoquic_packet_loop_forward(shard, target, bytes, length, addr_from, addr_to, if_index, received_ecn);
+    }
+    else {
+        (void)picoquic_incoming_packet_ex(quic, bytes, length, addr_from, addr_to, if_index, received_ecn,
+            last_cnx, current_time);
+    }
+}
+
+/* Submit the packet contained in a message received through the shard inbox.
+ * Messages of length zero are used to wake up the shard.
+ */
+static void picoquic_packet_loop_incoming_forwarded(picoquic_quic_t* quic, picoquic_packet_loop_shard_t* shard,
+    uint8_t* bytes, size_t length, picoquic_cnx_t** last_cnx, uint64_t current_time)
+{
+    if (length > PICOQUIC_SHARD_FORWARD_HEADER_SIZE) {
+        picoquic_shard_forward_header_t header;
+
+        memcpy(&header, bytes, sizeof(header));
+        (void)picoquic_incoming_packet_ex(quic, bytes + sizeof(header), length - sizeof(header),
+            (struct sockaddr*)&header.addr_from, (struct sockaddr*)&header.addr_to, header.if_index,
+            header.received_ecn, last_cnx, current_time);
+        shard->sharded_loop->param->stats[shard->shard_index].nb_packets_received_forwarded++;
+    }
+}
+
+/* Set up the batch receive option: try enabling UDP GRO on all sockets, and
+ * size the receive buffers accordingly. If GRO is not available on one of
+ * the sockets, fall back to MTU sized buffers.
+ */
+static picoquic_recv_batch_t* picoquic_packet_loop_create_recv_batch(SOCKET_TYPE* s_socket, int* sock_af, int nb_sockets,
+    size_t recv_buffer_min)
+{
+    size_t recv_buffer_size = PICOQUIC_RECV_GRO_BUFFER_SIZE;
+
+    for (int i = 0; i < nb_sockets; i++) {
+        if (picoquic_socket_set_gro_options(s_socket[i], sock_af[i]) != 0) {
+            recv_buffer_size = recv_buffer_min;
+        }
+    }
+
+    return picoquic_create_recv_batch(PICOQUIC_RECV_BATCH_MAX, recv_buffer_size);
+}
+
+/* Submit the pending datagrams to the stack in a single call */
+static void picoquic_packet_loop_flush_datagrams(picoquic_quic_t* quic, picoquic_incoming_datagram_t* datagrams,
+    size_t* nb_datagrams, uint64_t current_time)
+{
+    if (*nb_datagrams > 0) {
+        (void)picoquic_incoming_packet_batch(quic, datagrams, *nb_datagrams, current_time);
+        *nb_datagrams = 0;
+    }
+}
+
+/* Submit all the packets received in a batch to the stack, splitting
+ * the GRO trains into individual packets. The packets that belong to this
+ * shard are passed to picoquic_incoming_packet_batch, so that successive
+ * packets of the same connection are unprotected together.
+ */
+static void picoquic_packet_loop_submit_batch(picoquic_quic_t* quic, picoquic_packet_loop_shard_t* shard,
+    int is_inbox, picoquic_recv_batch_t* recv_batch, uint16_t current_recv_port, picoquic_cnx_t** last_cnx,
+    uint64_t current_time, picoquic_packet_loop_batch_stats_t* batch_stats)
+{
+    picoquic_incoming_datagram_t datagrams[PICOQUIC_RECV_BATCH_MAX];
+    size_t nb_datagrams = 0;
+
+    batch_stats->batch_time = current_time;
+    batch_stats->nb_datagrams = recv_batch->nb_msg;
+    batch_stats->nb_packets = 0;
+    batch_stats->bytes_received = 0;
+
+    for (size_t i = 0; i < recv_batch->nb_msg; i++) {
+        picoquic_recv_msg_t* r_msg = &recv_batch->msg[i];
+        size_t recv_bytes = 0;
+        int target;
+
+        if (is_inbox) {
+            picoquic_packet_loop_incoming_forwarded(quic, shard, r_msg->buffer, r_msg->bytes_recv,
+                last_cnx, current_time);
+            batch_stats->nb_packets++;
+            batch_stats->bytes_received += r_msg->bytes_recv;
+            continue;
+        }
+
+        /* Document incoming port */
+        if (r_msg->addr_dest.ss_family == AF_INET6) {
+            ((struct sockaddr_in6*)&r_msg->addr_dest)->sin6_port = current_recv_port;
+        }
+        else if (r_msg->addr_dest.ss_family == AF_INET) {
+            ((struct sockaddr_in*)&r_msg->addr_dest)->sin_port = current_recv_port;
+        }
+
+        while (recv_bytes < r_msg->bytes_recv) {
+            size_t recv_length = r_msg->bytes_recv - recv_bytes;
+
+            if (r_msg->udp_coalesced_size > 0 && recv_length > r_msg->udp_coalesced_size) {
+                recv_length = r_msg->udp_coalesced_size;
+            }
+            if (shard != NULL && (target = picoquic_packet_loop_shard_of(shard, r_msg->buffer + recv_bytes, recv_length)) != shard->shard_index) {
+                picoquic_packet_loop_forward(shard, target, r_msg->buffer + recv_bytes, recv_length,
+                    (struct sockaddr*)&r_msg->addr_from, (struct sockaddr*)&r_msg->addr_dest, r_msg->dest_if, r_msg->received_ecn);
+            }
+            else {
+                if (nb_datagrams >= PICOQUIC_RECV_BATCH_MAX) {
+                    picoquic_packet_loop_flush_datagrams(quic, datagrams, &nb_datagrams, current_time);
+                }
+                datagrams[nb_datagrams].bytes = r_msg->buffer + recv_bytes;
+                datagrams[nb_datagrams].length = recv_length;
+                datagrams[nb_datagrams].addr_from = (struct sockaddr*)&r_msg->addr_from;
+                datagrams[nb_datagrams].addr_to = (struct sockaddr*)&r_msg->addr_dest;
+                datagrams[nb_datagrams].if_index_to = r_msg->dest_if;
+                datagrams[nb_datagrams].received_ecn = r_msg->received_ecn;
+                nb_datagrams++;
+            }
+            recv_bytes += recv_length;
+            batch_stats->nb_packets++;
+        }
+        batch_stats->bytes_received += r_msg->bytes_recv;
+    }
+    picoquic_packet_loop_flush_datagrams(quic, datagrams, &nb_datagrams, current_time);
+
+    batch_stats->nb_recv_calls++;
+    batch_stats->nb_packets_total += batch_stats->nb_packets;
+    batch_stats->batch_duration = picoquic_current_time() - current_time;
+}
+
+/* Handle the error after a failed send: log the error, and if the packet was sent
+ * on behalf of a connection, either notify the connection that the destination is
+ * unreachable, or if the error is caused by GSO, retry by chunks and disable GSO.
+ */
+static void picoquic_packet_loop_send_error(picoquic_quic_t* quic, picoquic_cnx_t* last_cnx,
+    picoquic_connection_id_t* log_cid, SOCKET_TYPE send_socket,
+    struct sockaddr_storage* peer_addr, struct sockaddr_storage* local_addr, int if_index,
+    uint8_t* send_buffer, size_t send_length, size_t send_msg_size, int sock_ret, int sock_err,
+    uint64_t current_time, size_t** p_send_msg_ptr)
+{
+    if (last_cnx == NULL) {
+        picoquic_log_context_free_app_message(quic, log_cid, "Could not send message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
+            peer_addr->ss_family, local_addr->ss_family, if_index, sock_ret, sock_err);
+    }
+    else {
+        picoquic_log_app_message(last_cnx, "Could not send message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
+            peer_addr->ss_family, local_addr->ss_family, if_index, sock_ret, sock_err);
+
+        if (picoquic_socket_error_implies_unreachable(sock_err)) {
+            picoquic_notify_destination_unreachable(last_cnx, current_time,
+                (struct sockaddr*)peer_addr, (struct sockaddr*)local_addr, if_index,
+                sock_err);
+        }
+        else if (sock_err == EIO) {
+            size_t packet_index = 0;
+            size_t packet_size = send_msg_size;
+
+            while (packet_index < send_length) {
+                if (packet_index + packet_size > send_length) {
+                    packet_size = send_length - packet_index;
+                }
+                sock_ret = picoquic_sendmsg(send_socket,
+                    (struct sockaddr*)peer_addr, (struct sockaddr*)local_addr, if_index,
+                    (const char*)(send_buffer + packet_index), (int)packet_size, 0, &sock_err);
+                if (sock_ret > 0) {
+                    packet_index += packet_size;
+                }
+                else {
+                    picoquic_log_app_message(last_cnx, "Retry with packet size=%zu fails at index %zu, ret=%d, err=%d.",
+                        packet_size, packet_index, sock_ret, sock_err);
+                    break;
+                }
+            }
+            if (sock_ret > 0) {
+                picoquic_log_app_message(last_cnx, "Retry of %zu bytes by chunks of %zu bytes succeeds.",
+                    send_length, send_msg_size);
+            }
+            if (*p_send_msg_ptr != NULL) {
+                /* Make sure that we do not use GSO anymore in this run */
+                *p_send_msg_ptr = NULL;
+                picoquic_log_app_message(last_cnx, "%s", "UDP GSO was disabled");
+            }
+        }
+    }
+}
+
+/* Connections referenced in a send batch may have been deleted while
+ * preparing the next packets of the batch. Before handling a send error,
+ * check that the connection is still present in the context.
+ */
+static picoquic_cnx_t* picoquic_packet_loop_check_cnx(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
+    picoquic_connection_id_t* log_cid)
+{
+    picoquic_cnx_t* next_cnx = NULL;
+
+    if (cnx != NULL) {
+        next_cnx = picoquic_get_first_cnx(quic);
+        while (next_cnx != NULL &&
+            (next_cnx != cnx || picoquic_compare_connection_id(&next_cnx->initial_cnxid, log_cid) != 0)) {
+            next_cnx = picoquic_get_next_cnx(next_cnx);
+        }
+    }
+
+    return next_cnx;
+}
+
+/* Batch send: prepare packets or GSO trains for as many connections as
+ * possible in the buffers of the send batch, then flush the batch with
+ * a minimal number of system calls, i.e., one sendmmsg call per socket
+ * on Linux. Repeat until there is nothing left to send.
+ */
+static int picoquic_packet_loop_send_batch(picoquic_quic_t* quic, picoquic_send_batch_t* send_batch,
+    uint64_t loop_time, uint64_t current_time, SOCKET_TYPE* s_socket, int* sock_af, int nb_sockets,
+    int dest_if, int testing_migration, uint16_t next_port, size_t** p_send_msg_ptr,
+    picoquic_cnx_t** last_cnx, size_t* bytes_sent)
+{
+    int ret = 0;
+    int is_done = 0;
+    picoquic_cnx_t* msg_cnx[PICOQUIC_SEND_BATCH_MAX];
+    picoquic_connection_id_t msg_cid[PICOQUIC_SEND_BATCH_MAX];
+
+    while (ret == 0 && !is_done) {
+        send_batch->nb_msg = 0;
+
+        while (ret == 0 && send_batch->nb_msg < send_batch->nb_msg_max) {
+            size_t rank = send_batch->nb_msg;
+            picoquic_send_msg_t* s_msg = &send_batch->msg[rank];
+            size_t send_length = 0;
+
+            s_msg->dest_if = dest_if;
+            s_msg->send_msg_size = 0;
+            ret = picoquic_prepare_next_packet_ex(quic, loop_time,
+                s_msg->buffer, send_batch->send_buffer_size, &send_length,
+                &s_msg->addr_dest, &s_msg->addr_from, &s_msg->dest_if, &msg_cid[rank], last_cnx,
+                (*p_send_msg_ptr == NULL) ? NULL : &s_msg->send_msg_size);
+
+            if (ret == 0 && send_length > 0) {
+                s_msg->fd = INVALID_SOCKET;
+                s_msg->length = send_length;
+                msg_cnx[rank] = *last_cnx;
+
+                for (int i = 0; i < nb_sockets; i++) {
+                    if (sock_af[i] == s_msg->addr_dest.ss_family) {
+                        s_msg->fd = s_socket[i];
+                        break;
+                    }
+                }
+
+                if (s_msg->fd == INVALID_SOCKET) {
+                    picoquic_packet_loop_send_error(quic, *last_cnx, &msg_cid[rank], INVALID_SOCKET,
+                        &s_msg->addr_dest, &s_msg->addr_from, s_msg->dest_if, s_msg->buffer, send_length,
+                        s_msg->send_msg_size, -1, -1, current_time, p_send_msg_ptr);
+                }
+                else {
+                    if (testing_migration) {
+                        /* This code path is only used in the migration tests */
+                        uint16_t send_port = (s_msg->addr_from.ss_family == AF_INET) ?
+                            ((struct sockaddr_in*)&s_msg->addr_from)->sin_port :
+                            ((struct sockaddr_in6*)&s_msg->addr_from)->sin6_port;
+
+                        if (send_port == next_port) {
+                            s_msg->fd = s_socket[nb_sockets - 1];
+                        }
+                    }
+                    *bytes_sent += send_length;
+                    send_batch->nb_msg++;
+                }
+            }
+            else {
+                is_done = 1;
+                break;
+            }
+        }
+
+        if (send_batch->nb_msg > 0 &&
+            picoquic_sendmmsg(send_batch) < send_batch->nb_msg) {
+            for (size_t i = 0; i < send_batch->nb_msg; i++) {
+                picoquic_send_msg_t* s_msg = &send_batch->msg[i];
+
+                if (s_msg->bytes_sent <= 0) {
+                    picoquic_packet_loop_send_error(quic, picoquic_packet_loop_check_cnx(quic, msg_cnx[i], &msg_cid[i]),
+                        &msg_cid[i], s_msg->fd, &s_msg->addr_dest, &s_msg->addr_from, s_msg->dest_if,
+                        s_msg->buffer, s_msg->length, s_msg->send_msg_size, s_msg->bytes_sent, s_msg->sock_err,
+                        current_time, p_send_msg_ptr);
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+static int picoquic_packet_loop_ex(picoquic_quic_t* quic,
     int local_port,
     int local_af,
     int dest_if,
     int socket_buffer_size,
     int do_not_use_gso,
     picoquic_packet_loop_cb_fn loop_callback,
-    void* loop_callback_ctx)
+    void* loop_callback_ctx,
+    picoquic_packet_loop_shard_t* shard)
 {
     int ret = 0;
     uint64_t current_time = picoquic_get_quic_time(quic);
@@ -214,7 +659,8 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     struct sockaddr_storage addr_from;
     struct sockaddr_storage addr_to;
     int if_index_to;
-    uint8_t buffer[1536];
+    uint8_t buffer[1536 + PICOQUIC_SHARD_FORWARD_HEADER_SIZE];
+    int buffer_max = (shard == NULL) ? 1536 : (int)sizeof(buffer);
     uint8_t* send_buffer = NULL;
     size_t send_length = 0;
     size_t send_msg_size = 0;
@@ -223,6 +669,8 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     int bytes_recv;
     picoquic_connection_id_t log_cid;
     SOCKET_TYPE s_socket[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    SOCKET_TYPE select_socket[PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1];
+    int nb_select_sockets = 0;
     int sock_af[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
     uint16_t sock_ports[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
     int nb_sockets = 0;
@@ -231,6 +679,10 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     picoquic_cnx_t* last_cnx = NULL;
     int loop_immediate = 0;
     picoquic_packet_loop_options_t options = { 0 };
+    picoquic_recv_batch_t* recv_batch = NULL;
+    picoquic_send_batch_t* send_batch = NULL;
+    picoquic_event_ctx_t* event_ctx = NULL;
+    picoquic_packet_loop_batch_stats_t batch_stats = { 0 };
     uint64_t next_send_time = current_time + PICOQUIC_PACKET_LOOP_SEND_DELAY_MAX;
 #ifdef _WINDOWS
     WSADATA wsaData = { 0 };
@@ -239,8 +691,8 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     memset(sock_af, 0, sizeof(sock_af));
     memset(sock_ports, 0, sizeof(sock_ports));
 
-    if ((nb_sockets = picoquic_packet_loop_open_sockets(local_port, local_af, s_socket, sock_af, 
-        sock_ports, socket_buffer_size, PICOQUIC_PACKET_LOOP_SOCKETS_MAX)) == 0) {
+    if ((nb_sockets = picoquic_packet_loop_open_sockets_ex(local_port, local_af, s_socket, sock_af,
+        sock_ports, socket_buffer_size, PICOQUIC_PACKET_LOOP_SOCKETS_MAX, shard != NULL)) == 0) {
         ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
     }
     else if (loop_callback != NULL) {
@@ -261,6 +713,25 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
         if (send_buffer == NULL) {
             ret = -1;
         }
+        else if (options.do_batch_receive) {
+            recv_batch = picoquic_packet_loop_create_recv_batch(s_socket, sock_af, nb_sockets, (size_t)buffer_max);
+            if (recv_batch == NULL) {
+                ret = -1;
+            }
+        }
+        if (ret == 0 && options.do_batch_send) {
+            send_batch = picoquic_create_send_batch(PICOQUIC_PACKET_LOOP_SEND_BATCH_MAX, send_buffer_size);
+            if (send_batch == NULL) {
+                ret = -1;
+            }
+        }
+        if (ret == 0 && (options.do_io_uring || options.do_epoll)) {
+            event_ctx = picoquic_create_event_ctx((options.do_io_uring) ? picoquic_event_backend_io_uring :
+                picoquic_event_backend_epoll, (recv_batch != NULL) ? recv_batch->recv_buffer_size : (size_t)buffer_max);
+            if (event_ctx == NULL) {
+                ret = -1;
+            }
+        }
     }
 
     /* Wait for packets */
@@ -271,6 +742,17 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
         unsigned char received_ecn;
 
         if_index_to = 0;
+        if (shard != NULL && shard->sharded_loop->should_stop) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+            break;
+        }
+        /* The sockets may change during migration tests, and the shard inbox is
+         * polled after the network sockets */
+        memcpy(select_socket, s_socket, nb_sockets * sizeof(SOCKET_TYPE));
+        nb_select_sockets = nb_sockets;
+        if (shard != NULL) {
+            select_socket[nb_select_sockets++] = shard->inbox[0];
+        }
         /* TODO: rewrite the code and avoid using the "loop_immediate" state variable */
         if (!loop_immediate) {
             delta_t = picoquic_get_next_wake_delay(quic, current_time, delay_max);
@@ -286,11 +768,17 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
         }
         loop_immediate = 0;
 
-        bytes_recv = picoquic_select_ex(s_socket, nb_sockets,
-            &addr_from,
-            &addr_to, &if_index_to, &received_ecn,
-            buffer, sizeof(buffer),
-            delta_t, &socket_rank, &current_time);
+        if (recv_batch != NULL) {
+            bytes_recv = picoquic_event_select_batch(event_ctx, select_socket, nb_select_sockets, recv_batch,
+                delta_t, &socket_rank, &current_time);
+        }
+        else {
+            bytes_recv = picoquic_event_select_ex(event_ctx, select_socket, nb_select_sockets,
+                &addr_from,
+                &addr_to, &if_index_to, &received_ecn,
+                buffer, buffer_max,
+                delta_t, &socket_rank, &current_time);
+        }
         if (bytes_recv < 0) {
             ret = -1;
         }
@@ -299,28 +787,46 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
 
             if (bytes_recv > 0) {
                 uint16_t current_recv_port = 0;
+                int is_inbox = (shard != NULL && socket_rank == nb_sockets);
 
-                if (testing_migration && socket_rank == 0) {
+                if (is_inbox) {
+                    current_recv_port = 0;
+                }
+                else if (testing_migration && socket_rank == 0) {
                     current_recv_port = next_port;
                 } else {
                     current_recv_port = sock_ports[socket_rank];
                 }
-                /* Document incoming port */
-                if (addr_to.ss_family == AF_INET6) {
-                    ((struct sockaddr_in6*) & addr_to)->sin6_port = current_recv_port;
+                if (recv_batch != NULL) {
+                    /* Submit the whole batch to the server */
+                    picoquic_packet_loop_submit_batch(quic, shard, is_inbox, recv_batch, current_recv_port,
+                        &last_cnx, current_time, &batch_stats);
+                }
+                else if (is_inbox) {
+                    picoquic_packet_loop_incoming_forwarded(quic, shard, buffer, (size_t)bytes_recv,
+                        &last_cnx, current_time);
                 }
-                else if (addr_to.ss_family == AF_INET) {
-                    ((struct sockaddr_in*) & addr_to)->sin_port = current_recv_port;
+                else {
+                    /* Document incoming port */
+                    if (addr_to.ss_family == AF_INET6) {
+                        ((struct sockaddr_in6*) & addr_to)->sin6_port = current_recv_port;
+                    }
+                    else if (addr_to.ss_family == AF_INET) {
+                        ((struct sockaddr_in*) & addr_to)->sin_port = current_recv_port;
+                    }
+                    /* Submit the packet to the server */
+                    picoquic_packet_loop_incoming(quic, shard, buffer,
+                        (size_t)bytes_recv, (struct sockaddr*) & addr_from,
+                        (struct sockaddr*) & addr_to, if_index_to, received_ecn,
+                        &last_cnx, current_time);
                 }
-                /* Submit the packet to the server */
-                (void)picoquic_incoming_packet_ex(quic, buffer,
-                    (size_t)bytes_recv, (struct sockaddr*) & addr_from,
-                    (struct sockaddr*) & addr_to, if_index_to, received_ecn,
-                    &last_cnx, current_time);
 
                 if (loop_callback != NULL) {
                     size_t b_recvd = (size_t)bytes_recv;
                     ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &b_recvd);
+                    if (ret == 0 && recv_batch != NULL) {
+                        ret = loop_callback(quic, picoquic_packet_loop_after_receive_batch, loop_callback_ctx, &batch_stats);
+                    }
                 }
                 if (ret == 0 && current_time < next_send_time) {
                     /* Try to receive more packets if possible */
@@ -334,7 +840,13 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
             if (ret != PICOQUIC_NO_ERROR_SIMULATE_NAT && ret != PICOQUIC_NO_ERROR_SIMULATE_MIGRATION) {
                 size_t bytes_sent = 0;
 
-                while (ret == 0) {
+                if (send_batch != NULL) {
+                    ret = picoquic_packet_loop_send_batch(quic, send_batch, loop_time, current_time,
+                        s_socket, sock_af, nb_sockets, dest_if, testing_migration, next_port,
+                        &send_msg_ptr, &last_cnx, &bytes_sent);
+                }
+
+                while (ret == 0 && send_batch == NULL) {
                     struct sockaddr_storage peer_addr;
                     struct sockaddr_storage local_addr;
                     int if_index = dest_if;
@@ -379,50 +891,9 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
                         }
 
                         if (sock_ret <= 0) {
-                            if (last_cnx == NULL) {
-                                picoquic_log_context_free_app_message(quic, &log_cid, "Could not send message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
-                                    peer_addr.ss_family, local_addr.ss_family, if_index, sock_ret, sock_err);
-                            }
-                            else {
-                                picoquic_log_app_message(last_cnx, "Could not send message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
-                                    peer_addr.ss_family, local_addr.ss_family, if_index, sock_ret, sock_err);
-
-                                if (picoquic_socket_error_implies_unreachable(sock_err)) {
-                                    picoquic_notify_destination_unreachable(last_cnx, current_time,
-                                        (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
-                                        sock_err);
-                                }
-                                else if (sock_err == EIO) {
-                                    size_t packet_index = 0;
-                                    size_t packet_size = send_msg_size;
-
-                                    while (packet_index < send_length) {
-                                        if (packet_index + packet_size > send_length) {
-                                            packet_size = send_length - packet_index;
-                                        }
-                                        sock_ret = picoquic_sendmsg(send_socket,
-                                            (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
-                                            (const char*)(send_buffer + packet_index), (int)packet_size, 0, &sock_err);
-                                        if (sock_ret > 0) {
-                                            packet_index += packet_size;
-                                        }
-                                        else {
-                                            picoquic_log_app_message(last_cnx, "Retry with packet size=%zu fails at index %zu, ret=%d, err=%d.",
-                                                packet_size, packet_index, sock_ret, sock_err);
-                                            break;
-                                        }
-                                    }
-                                    if (sock_ret > 0) {
-                                        picoquic_log_app_message(last_cnx, "Retry of %zu bytes by chunks of %zu bytes succeeds.",
-                                            send_length, send_msg_size);
-                                    }
-                                    if (send_msg_ptr != NULL) {
-                                        /* Make sure that we do not use GSO anymore in this run */
-                                        send_msg_ptr = NULL;
-                                        picoquic_log_app_message(last_cnx, "%s", "UDP GSO was disabled");
-                                    }
-                                }
-                            }
+                            picoquic_packet_loop_send_error(quic, last_cnx, &log_cid, send_socket,
+                                &peer_addr, &local_addr, if_index, send_buffer, send_length, send_msg_size,
+                                sock_ret, sock_err, current_time, &send_msg_ptr);
                         }
                     }
                     else {
@@ -510,5 +981,210 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
         free(send_buffer);
     }
 
+    if (recv_batch != NULL) {
+        picoquic_delete_recv_batch(recv_batch);
+    }
+
+    if (send_batch != NULL) {
+        picoquic_delete_send_batch(send_batch);
+    }
+
+    if (event_ctx != NULL) {
+        picoquic_delete_event_ctx(event_ctx);
+    }
+
+    return ret;
+}
+
+int picoquic_packet_loop(picoquic_quic_t* quic,
+    int local_port,
+    int local_af,
+    int dest_if,
+    int socket_buffer_size,
+    int do_not_use_gso,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void* loop_callback_ctx)
+{
+    return picoquic_packet_loop_ex(quic, local_port, local_af, dest_if, socket_buffer_size,
+        do_not_use_gso, loop_callback, loop_callback_ctx, NULL);
+}
+
+#if !defined(_WINDOWS) && defined(SO_REUSEPORT)
+/* Make sure that the CID issued by the shard encode the shard index. If the
+ * application did not set a CID callback, configure the load balancer compatible
+ * "clear" encoding. If the application did configure the load balancer
+ * encoding, check that it matches the shard index.
+ */
+static int picoquic_sharded_loop_set_cid(picoquic_packet_loop_shard_t* shard)
+{
+    int ret = 0;
+    picoquic_quic_t* quic = shard->quic;
+
+    if (quic->cnx_id_callback_fn == NULL) {
+        picoquic_load_balancer_config_t lb_config;
+
+        memset(&lb_config, 0, sizeof(lb_config));
+        lb_config.method = picoquic_load_balancer_cid_clear;
+        lb_config.server_id_length = 1;
+        lb_config.server_id64 = (uint64_t)shard->shard_index;
+        lb_config.connection_id_length = (quic->local_cnxid_length < 8) ? 8 : quic->local_cnxid_length;
+        if ((ret = picoquic_lb_compat_cid_config(quic, &lb_config)) == 0) {
+            shard->lb_configured_by_loop = 1;
+        }
+    }
+    else if (quic->cnx_id_callback_fn != picoquic_lb_compat_cid_generate ||
+        ((picoquic_load_balancer_cid_context_t*)quic->cnx_id_callback_ctx)->server_id64 != (uint64_t)shard->shard_index) {
+        DBG_PRINTF("Shard %d: CID encoding does not match the shard index", shard->shard_index);
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+
+    return ret;
+}
+
+static void picoquic_sharded_loop_pin_cpu(picoquic_packet_loop_shard_t* shard)
+{
+#if defined(__linux__)
+    long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (nb_cpu > 0) {
+        cpu_set_t cpu_set;
+        int cpu = (int)((shard->sharded_loop->param->first_cpu + shard->shard_index) % nb_cpu);
+
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            DBG_PRINTF("Shard %d: cannot pin thread to CPU %d", shard->shard_index, cpu);
+        }
+    }
+#else
+    DBG_PRINTF("Shard %d: CPU pinning not supported on this platform", shard->shard_index);
+#endif
+}
+
+static picoquic_thread_return_t picoquic_sharded_loop_thread(void* v_shard)
+{
+    picoquic_packet_loop_shard_t* shard = (picoquic_packet_loop_shard_t*)v_shard;
+    picoquic_sharded_loop_t* sharded_loop = shard->sharded_loop;
+    picoquic_sharded_loop_param_t* param = sharded_loop->param;
+
+    if (param->do_cpu_pinning) {
+        picoquic_sharded_loop_pin_cpu(shard);
+    }
+
+    shard->ret = picoquic_packet_loop_ex(shard->quic, param->local_port, param->local_af, param->dest_if,
+        param->socket_buffer_size, param->do_not_use_gso, sharded_loop->loop_callback,
+        shard->loop_callback_ctx, shard);
+
+    /* When one shard stops, all shards stop. Wake up the others with an empty message. */
+    sharded_loop->should_stop = 1;
+    for (int i = 0; i < param->nb_shards; i++) {
+        if (i != shard->shard_index && sharded_loop->shard[i].inbox[1] != INVALID_SOCKET) {
+            (void)send(sharded_loop->shard[i].inbox[1], "", 0, MSG_DONTWAIT);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+int picoquic_sharded_packet_loop(picoquic_quic_t** quic,
+    picoquic_sharded_loop_param_t* param,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void** loop_callback_ctx)
+{
+    int ret = 0;
+    picoquic_sharded_loop_t* sharded_loop;
+
+    if (param->nb_shards <= 0 || param->nb_shards > PICOQUIC_SHARDED_LOOP_MAX || param->local_port == 0) {
+        DBG_PRINTF("Invalid sharded loop parameters, nb_shards=%d, port=%d", param->nb_shards, param->local_port);
+        return PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+
+    if ((sharded_loop = (picoquic_sharded_loop_t*)malloc(sizeof(picoquic_sharded_loop_t))) == NULL) {
+        return PICOQUIC_ERROR_MEMORY;
+    }
+    memset(sharded_loop, 0, sizeof(picoquic_sharded_loop_t));
+    sharded_loop->param = param;
+    sharded_loop->loop_callback = loop_callback;
+    memset(param->stats, 0, sizeof(param->stats));
+
+    for (int i = 0; i < param->nb_shards; i++) {
+        picoquic_packet_loop_shard_t* shard = &sharded_loop->shard[i];
+        shard->sharded_loop = sharded_loop;
+        shard->shard_index = i;
+        shard->quic = quic[i];
+        shard->loop_callback_ctx = (loop_callback_ctx == NULL) ? NULL : loop_callback_ctx[i];
+        shard->inbox[0] = INVALID_SOCKET;
+        shard->inbox[1] = INVALID_SOCKET;
+    }
+
+    for (int i = 0; ret == 0 && i < param->nb_shards; i++) {
+        picoquic_packet_loop_shard_t* shard = &sharded_loop->shard[i];
+        int sv[2];
+
+        if (shard->quic == NULL) {
+            ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+        }
+        else if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) != 0) {
+            DBG_PRINTF("Shard %d: cannot create inbox, errno: %d", i, errno);
+            ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+        }
+        else {
+            shard->inbox[0] = sv[0];
+            shard->inbox[1] = sv[1];
+            ret = picoquic_sharded_loop_set_cid(shard);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < param->nb_shards; i++) {
+        picoquic_packet_loop_shard_t* shard = &sharded_loop->shard[i];
+        if ((ret = picoquic_create_thread(&shard->thread, picoquic_sharded_loop_thread, shard)) == 0) {
+            shard->thread_started = 1;
+        }
+        else {
+            DBG_PRINTF("Shard %d: cannot create thread, ret: %d", i, ret);
+            sharded_loop->should_stop = 1;
+        }
+    }
+
+    for (int i = 0; i < param->nb_shards; i++) {
+        picoquic_packet_loop_shard_t* shard = &sharded_loop->shard[i];
+        if (shard->thread_started) {
+            picoquic_wait_thread(shard->thread);
+            if (ret == 0) {
+                ret = shard->ret;
+            }
+        }
+    }
+
+    for (int i = 0; i < param->nb_shards; i++) {
+        picoquic_packet_loop_shard_t* shard = &sharded_loop->shard[i];
+        for (int j = 0; j < 2; j++) {
+            if (shard->inbox[j] != INVALID_SOCKET) {
+                SOCKET_CLOSE(shard->inbox[j]);
+            }
+        }
+        if (shard->lb_configured_by_loop) {
+            picoquic_lb_compat_cid_config_free(shard->quic);
+        }
+    }
+
+    free(sharded_loop);
+
     return ret;
 }
+#else
+int picoquic_sharded_packet_loop(picoquic_quic_t** quic,
+    picoquic_sharded_loop_param_t* param,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void** loop_callback_ctx)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(param);
+    UNREFERENCED_PARAMETER(loop_callback);
+    UNREFERENCED_PARAMETER(loop_callback_ctx);
+#endif
+    DBG_PRINTF("%s", "Sharded packet loop requires SO_REUSEPORT, not supported on this platform");
+    return PICOQUIC_ERROR_UNEXPECTED_ERROR;
+}
+#endif
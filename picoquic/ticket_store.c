@@ -431,6 +431,40 @@ int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
     return ret;
 }
 
+/* Remove from the loaded list the tickets superseded by a record of the file.
+ * A "used" mark, written by the indexed store, removes the ticket with the same ID.
+ * Other records replace the older tickets for the same SNI, ALPN and version, as
+ * in picoquic_store_ticket. Returns the last ticket remaining in the list.
+ */
+static picoquic_stored_ticket_t* picoquic_load_tickets_supersede(picoquic_stored_ticket_t** pp_first_ticket,
+    const picoquic_stored_ticket_t* record)
+{
+    picoquic_stored_ticket_t** pprevious = pp_first_ticket;
+    picoquic_stored_ticket_t* last = NULL;
+    picoquic_stored_ticket_t* next;
+    int is_used_mark = (record->ticket_length < 17);
+
+    while ((next = *pprevious) != NULL) {
+        if (next->sni_length == record->sni_length &&
+            next->alpn_length == record->alpn_length &&
+            memcmp(next->sni, record->sni, record->sni_length) == 0 &&
+            memcmp(next->alpn, record->alpn, record->alpn_length) == 0 &&
+            next->version == record->version &&
+            ((is_used_mark) ?
+                (record->ticket_length >= 8 && memcmp(next->ticket, record->ticket, 8) == 0) :
+                (next->time_valid_until <= record->time_valid_until))) {
+            *pprevious = next->next_ticket;
+            free(next);
+        }
+        else {
+            last = next;
+            pprevious = &next->next_ticket;
+        }
+    }
+
+    return last;
+}
+
 int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
     uint64_t current_time, char const* ticket_file_name)
 {
@@ -473,19 +507,29 @@ int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
 
                 if (ret == 0 && next != NULL) {
                     if (next->time_valid_until < current_time) {
+                        /* Expired ticket */
                         free(next);
                         next = NULL;
                     }
                     else {
-                        next->next_ticket = NULL;
-                        if (previous == NULL) {
-                            *pp_first_ticket = next;
+                        previous = picoquic_load_tickets_supersede(pp_first_ticket, next);
+
+                        if (next->ticket_length < 17) {
+                            /* "Used" mark written by the indexed store */
+                            free(next);
+                            next = NULL;
                         }
                         else {
-                            previous->next_ticket = next;
+                            next->next_ticket = NULL;
+                            if (previous == NULL) {
+                                *pp_first_ticket = next;
+                            }
+                            else {
+                                previous->next_ticket = next;
+                            }
+
+                            previous = next;
                         }
-
-                        previous = next;
                     }
                 }
             }
@@ -508,19 +552,547 @@ void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket)
     }
 }
 
-int picoquic_save_session_tickets(picoquic_quic_t* quic, char const* ticket_store_filename)
+/* Journal of the indexed stores.
+ * Each record is preceded by its 32 bit length, as in the files written
+ * by picoquic_save_tickets and picoquic_save_tokens. The buffer holds at
+ * most one record per entry of the store, plus a margin; past that, the
+ * records are dropped and the file will be rewritten from the index.
+ */
+int picoquic_store_journal_add(picoquic_store_journal_t* journal, const uint8_t* record, size_t record_size,
+    size_t nb_entries_max)
 {
-    return picoquic_save_tickets(quic->p_first_ticket, picoquic_get_quic_time(quic), ticket_store_filename);
+    int ret = 0;
+    uint32_t storage_size = (uint32_t)record_size;
+    size_t required = journal->length + 4 + record_size;
+
+    if (!journal->is_rewrite_required &&
+        journal->nb_pending >= nb_entries_max + PICOQUIC_STORE_INDEX_NB_BINS_MIN) {
+        picoquic_store_journal_drop(journal);
+    }
+
+    if (journal->is_rewrite_required) {
+        /* The file will be rewritten from the index, nothing to journal */
+    }
+    else {
+        if (required > journal->size) {
+            size_t new_size = (journal->size == 0) ? 4096 : 2 * journal->size;
+            uint8_t* new_bytes;
+
+            while (new_size < required) {
+                new_size *= 2;
+            }
+            new_bytes = (uint8_t*)realloc(journal->bytes, new_size);
+            if (new_bytes == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else {
+                journal->bytes = new_bytes;
+                journal->size = new_size;
+            }
+        }
+
+        if (ret == 0) {
+            memcpy(journal->bytes + journal->length, &storage_size, 4);
+            memcpy(journal->bytes + journal->length + 4, record, record_size);
+            journal->length = required;
+            journal->nb_pending++;
+        }
+    }
+
+    return ret;
 }
 
-int picoquic_load_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename)
+int picoquic_store_journal_append(picoquic_store_journal_t* journal, char const* file_name)
+{
+    int ret = 0;
+    FILE* F = NULL;
+
+    if ((F = picoquic_file_open(file_name, "ab")) == NULL) {
+        ret = -1;
+    }
+    else {
+        if (journal->length > 0 && fwrite(journal->bytes, 1, journal->length, F) != journal->length) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+        else {
+            journal->nb_records += journal->nb_pending;
+            journal->nb_pending = 0;
+            journal->length = 0;
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+int picoquic_store_journal_replay(picoquic_store_journal_t* journal, char const* file_name,
+    int (*replay_fn)(void* ctx, uint8_t* bytes, size_t length), void* ctx)
+{
+    int ret = 0;
+    int file_err = 0;
+    FILE* F = NULL;
+    uint32_t storage_size;
+
+    if ((F = picoquic_file_open_ex(file_name, "rb", &file_err)) == NULL) {
+        ret = (file_err == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    }
+
+    while (ret == 0) {
+        uint8_t buffer[2048];
+
+        if (fread(&storage_size, 4, 1, F) != 1) {
+            /* end of file */
+            break;
+        }
+        else if (storage_size > sizeof(buffer) || fread(buffer, 1, storage_size, F) != storage_size) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+        else {
+            journal->nb_records++;
+            ret = replay_fn(ctx, buffer, storage_size);
+        }
+    }
+
+    (void)picoquic_file_close(F);
+
+    return ret;
+}
+
+/* Drop the pending records, for example those of an evicted entry. The older
+ * records in the file could come back at replay, so the next save rewrites
+ * the file from the index instead of appending. */
+void picoquic_store_journal_drop(picoquic_store_journal_t* journal)
+{
+    if (journal->bytes != NULL) {
+        free(journal->bytes);
+        journal->bytes = NULL;
+    }
+    journal->length = 0;
+    journal->size = 0;
+    journal->nb_pending = 0;
+    journal->is_rewrite_required = 1;
+}
+
+void picoquic_store_journal_clear(picoquic_store_journal_t* journal)
+{
+    if (journal->bytes != NULL) {
+        free(journal->bytes);
+    }
+    memset(journal, 0, sizeof(picoquic_store_journal_t));
+}
+
+/* The file is rewritten when more than half of its records are obsolete */
+int picoquic_store_journal_is_compact(picoquic_store_journal_t* journal, size_t nb_entries)
+{
+    return (!journal->is_rewrite_required && journal->nb_records + journal->nb_pending <= 2 * nb_entries + PICOQUIC_STORE_INDEX_NB_BINS_MIN);
+}
+
+/* Indexed store of session tickets.
+ * The tickets are hashed by SNI and ALPN. The version, the expiry time and
+ * the ticket ID are checked when walking the bin.
+ */
+static uint64_t picoquic_ticket_index_hash(char const* sni, uint16_t sni_length,
+    char const* alpn, uint16_t alpn_length)
+{
+    return picohash_hash_mix(picohash_bytes((const uint8_t*)sni, sni_length),
+        picohash_bytes((const uint8_t*)alpn, alpn_length));
+}
+
+static int picoquic_ticket_index_resize(picoquic_ticket_index_t* index, size_t nb_bins)
+{
+    int ret = 0;
+    picoquic_stored_ticket_t** bins = (picoquic_stored_ticket_t**)malloc(nb_bins * sizeof(picoquic_stored_ticket_t*));
+
+    if (bins == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(bins, 0, nb_bins * sizeof(picoquic_stored_ticket_t*));
+        /* Rehash from the tail, so that the most recent tickets end up first in their bin */
+        for (picoquic_stored_ticket_t* next = index->last_ticket; next != NULL; next = next->previous_ticket) {
+            size_t bin = (size_t)(next->key_hash % nb_bins);
+            next->next_in_bin = bins[bin];
+            bins[bin] = next;
+        }
+        if (index->bins != NULL) {
+            free(index->bins);
+        }
+        index->bins = bins;
+        index->nb_bins = nb_bins;
+    }
+
+    return ret;
+}
+
+static void picoquic_ticket_index_unlink(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored)
+{
+    if (stored->previous_ticket == NULL) {
+        quic->p_first_ticket = stored->next_ticket;
+    }
+    else {
+        stored->previous_ticket->next_ticket = stored->next_ticket;
+    }
+    if (stored->next_ticket == NULL) {
+        quic->ticket_index.last_ticket = stored->previous_ticket;
+    }
+    else {
+        stored->next_ticket->previous_ticket = stored->previous_ticket;
+    }
+    stored->next_ticket = NULL;
+    stored->previous_ticket = NULL;
+}
+
+static void picoquic_ticket_index_push(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored)
+{
+    stored->previous_ticket = NULL;
+    stored->next_ticket = quic->p_first_ticket;
+    if (stored->next_ticket == NULL) {
+        quic->ticket_index.last_ticket = stored;
+    }
+    else {
+        stored->next_ticket->previous_ticket = stored;
+    }
+    quic->p_first_ticket = stored;
+}
+
+static void picoquic_ticket_index_delete(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored)
+{
+    picoquic_ticket_index_t* index = &quic->ticket_index;
+    picoquic_stored_ticket_t** pprevious = &index->bins[stored->key_hash % index->nb_bins];
+
+    while (*pprevious != NULL) {
+        if (*pprevious == stored) {
+            *pprevious = stored->next_in_bin;
+            break;
+        }
+        pprevious = &(*pprevious)->next_in_bin;
+    }
+    picoquic_ticket_index_unlink(quic, stored);
+    index->nb_tickets--;
+    memset(stored->ticket, 0, stored->ticket_length);
+    free(stored);
+}
+
+/* Evict the least recently used ticket, and the pending journal records */
+static void picoquic_ticket_index_evict(picoquic_quic_t* quic)
+{
+    if (quic->ticket_index.journal.nb_pending > 0) {
+        picoquic_store_journal_drop(&quic->ticket_index.journal);
+    }
+    picoquic_ticket_index_delete(quic, quic->ticket_index.last_ticket);
+}
+
+static int picoquic_ticket_index_match(picoquic_stored_ticket_t* next, uint64_t key_hash,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length)
+{
+    return (next->key_hash == key_hash &&
+        next->sni_length == sni_length &&
+        next->alpn_length == alpn_length &&
+        memcmp(next->sni, sni, sni_length) == 0 &&
+        memcmp(next->alpn, alpn, alpn_length) == 0);
+}
+
+/* Insert a new ticket, replacing the older tickets for the same SNI, ALPN and version,
+ * and evicting the least recently used tickets if the store is full. */
+static int picoquic_ticket_index_insert(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored)
+{
+    int ret = 0;
+    picoquic_ticket_index_t* index = &quic->ticket_index;
+
+    if (index->nb_tickets + 1 > 2 * index->nb_bins) {
+        ret = picoquic_ticket_index_resize(index,
+            (index->nb_bins == 0) ? PICOQUIC_STORE_INDEX_NB_BINS_MIN : 2 * index->nb_bins);
+    }
+
+    if (ret != 0) {
+        free(stored);
+    }
+    else {
+        picoquic_stored_ticket_t** pprevious;
+        picoquic_stored_ticket_t* next;
+        size_t bin;
+
+        stored->key_hash = picoquic_ticket_index_hash(stored->sni, stored->sni_length,
+            stored->alpn, stored->alpn_length);
+        bin = (size_t)(stored->key_hash % index->nb_bins);
+        pprevious = &index->bins[bin];
+        while ((next = *pprevious) != NULL) {
+            if (next->time_valid_until <= stored->time_valid_until &&
+                next->version == stored->version &&
+                picoquic_ticket_index_match(next, stored->key_hash, stored->sni, stored->sni_length,
+                    stored->alpn, stored->alpn_length)) {
+                *pprevious = next->next_in_bin;
+                picoquic_ticket_index_unlink(quic, next);
+                index->nb_tickets--;
+                memset(next->ticket, 0, next->ticket_length);
+                free(next);
+            }
+            else {
+                pprevious = &next->next_in_bin;
+            }
+        }
+        stored->next_in_bin = index->bins[bin];
+        index->bins[bin] = stored;
+        picoquic_ticket_index_push(quic, stored);
+        index->nb_tickets++;
+
+        while (index->nb_tickets > index->nb_tickets_max && index->last_ticket != stored) {
+            picoquic_ticket_index_evict(quic);
+        }
+    }
+
+    return ret;
+}
+
+static picoquic_stored_ticket_t* picoquic_ticket_index_find(picoquic_ticket_index_t* index,
+    uint64_t current_time, char const* sni, uint16_t sni_length,
+    char const* alpn, uint16_t alpn_length, uint32_t version, int need_unused, uint64_t ticket_id)
+{
+    picoquic_stored_ticket_t* next = NULL;
+
+    if (index->nb_bins > 0) {
+        uint64_t key_hash = picoquic_ticket_index_hash(sni, sni_length, alpn, alpn_length);
+
+        next = index->bins[key_hash % index->nb_bins];
+        while (next != NULL) {
+            if (next->time_valid_until > current_time &&
+                (version == 0 || next->version == version) &&
+                (!need_unused || !next->was_used) &&
+                picoquic_ticket_index_match(next, key_hash, sni, sni_length, alpn, alpn_length)) {
+                uint64_t stored_id = (next->ticket_length < 8) ? 0 : PICOPARSE_64(next->ticket);
+                if (ticket_id == 0 || stored_id == ticket_id) {
+                    break;
+                }
+            }
+            next = next->next_in_bin;
+        }
+    }
+
+    return next;
+}
+
+/* Records of less than 17 bytes, holding only the ticket ID, mark the ticket as used */
+static int picoquic_ticket_index_replay(void* ctx, uint8_t* bytes, size_t length)
+{
+    picoquic_quic_t* quic = (picoquic_quic_t*)ctx;
+    picoquic_stored_ticket_t* stored = NULL;
+    size_t consumed = 0;
+    int ret = picoquic_deserialize_ticket(&stored, bytes, length, &consumed);
+
+    if (ret == 0 && consumed != length) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    }
+
+    if (ret == 0) {
+        uint64_t current_time = picoquic_get_quic_time(quic);
+
+        if (stored->ticket_length < 17) {
+            picoquic_stored_ticket_t* used = (stored->ticket_length < 8) ? NULL :
+                picoquic_ticket_index_find(&quic->ticket_index, current_time, stored->sni, stored->sni_length,
+                stored->alpn, stored->alpn_length, stored->version, 0, PICOPARSE_64(stored->ticket));
+            if (used != NULL) {
+                picoquic_ticket_index_delete(quic, used);
+            }
+            free(stored);
+        }
+        else if (stored->time_valid_until < current_time) {
+            free(stored);
+        }
+        else {
+            ret = picoquic_ticket_index_insert(quic, stored);
+        }
+    }
+    else if (stored != NULL) {
+        free(stored);
+    }
+
+    return ret;
+}
+
+/* Replay the ticket file on first use. Must be called before walking quic->p_first_ticket */
+void picoquic_ticket_index_load(picoquic_quic_t* quic)
+{
+    picoquic_ticket_index_t* index = &quic->ticket_index;
+
+    if (!index->journal.is_loaded) {
+        index->journal.is_loaded = 1;
+        if (index->nb_tickets_max == 0) {
+            index->nb_tickets_max = PICOQUIC_STORED_TICKETS_MAX_DEFAULT;
+        }
+        if (quic->ticket_file_name != NULL) {
+            int ret = picoquic_store_journal_replay(&index->journal, quic->ticket_file_name,
+                picoquic_ticket_index_replay, quic);
+
+            if (ret == PICOQUIC_ERROR_NO_SUCH_FILE) {
+                DBG_PRINTF("Ticket file <%s> not created yet.\n", quic->ticket_file_name);
+            }
+            else if (ret != 0) {
+                DBG_PRINTF("Cannot load tickets from <%s>\n", quic->ticket_file_name);
+                /* Do not append to a damaged file */
+                index->journal.nb_records = SIZE_MAX / 4;
+            }
+        }
+    }
+}
+
+void picoquic_ticket_index_journal(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored)
+{
+    if (quic->ticket_file_name != NULL) {
+        uint8_t buffer[2048];
+        size_t record_size = 0;
+
+        if (picoquic_serialize_ticket(stored, buffer, sizeof(buffer), &record_size) == 0) {
+            (void)picoquic_store_journal_add(&quic->ticket_index.journal, buffer, record_size,
+                quic->ticket_index.nb_tickets_max);
+        }
+    }
+}
+
+int picoquic_store_session_ticket(picoquic_quic_t* quic, uint64_t current_time,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
+    uint32_t version, const uint8_t* ip_addr, uint8_t ip_addr_length,
+    const uint8_t* ip_addr_client, uint8_t ip_addr_client_length,
+    uint8_t* ticket, uint16_t ticket_length, picoquic_tp_t const* tp)
+{
+    int ret = 0;
+    picoquic_stored_ticket_t* stored = NULL;
+
+    picoquic_ticket_index_load(quic);
+    /* Reuse the validation and formatting of the list store */
+    ret = picoquic_store_ticket(&stored, current_time, sni, sni_length, alpn, alpn_length,
+        version, ip_addr, ip_addr_length, ip_addr_client, ip_addr_client_length,
+        ticket, ticket_length, tp);
+    if (ret == 0 && (ret = picoquic_ticket_index_insert(quic, stored)) == 0) {
+        picoquic_ticket_index_journal(quic, stored);
+    }
+
+    return ret;
+}
+
+picoquic_stored_ticket_t* picoquic_get_session_ticket(picoquic_quic_t* quic,
+    uint64_t current_time, char const* sni, uint16_t sni_length,
+    char const* alpn, uint16_t alpn_length, uint32_t version, int need_unused, uint64_t ticket_id)
+{
+    picoquic_stored_ticket_t* next;
+
+    picoquic_ticket_index_load(quic);
+    next = picoquic_ticket_index_find(&quic->ticket_index, current_time, sni, sni_length,
+        alpn, alpn_length, version, need_unused, ticket_id);
+    if (next != NULL && next != quic->p_first_ticket) {
+        picoquic_ticket_index_unlink(quic, next);
+        picoquic_ticket_index_push(quic, next);
+    }
+
+    return next;
+}
+
+void picoquic_mark_session_ticket_used(picoquic_quic_t* quic, picoquic_stored_ticket_t* stored)
+{
+    if (!stored->was_used) {
+        stored->was_used = 1;
+        if (quic->ticket_file_name != NULL && stored->ticket_length >= 8) {
+            picoquic_stored_ticket_t* mark = picoquic_format_ticket(stored->time_valid_until,
+                stored->sni, stored->sni_length, stored->alpn, stored->alpn_length, stored->version,
+                NULL, 0, NULL, 0, stored->ticket, 8, NULL);
+            if (mark != NULL) {
+                picoquic_ticket_index_journal(quic, mark);
+                free(mark);
+            }
+        }
+    }
+}
+
+void picoquic_free_session_tickets(picoquic_quic_t* quic)
+{
+    picoquic_free_tickets(&quic->p_first_ticket);
+    if (quic->ticket_index.bins != NULL) {
+        free(quic->ticket_index.bins);
+    }
+    picoquic_store_journal_clear(&quic->ticket_index.journal);
+    quic->ticket_index.bins = NULL;
+    quic->ticket_index.nb_bins = 0;
+    quic->ticket_index.last_ticket = NULL;
+    quic->ticket_index.nb_tickets = 0;
+}
+
+void picoquic_set_ticket_store_max(picoquic_quic_t* quic, size_t max_tickets, size_t max_tokens)
+{
+    quic->ticket_index.nb_tickets_max = (max_tickets == 0) ? PICOQUIC_STORED_TICKETS_MAX_DEFAULT : max_tickets;
+    quic->token_index.nb_tokens_max = (max_tokens == 0) ? PICOQUIC_STORED_TOKENS_MAX_DEFAULT : max_tokens;
+    while (quic->ticket_index.nb_tickets > quic->ticket_index.nb_tickets_max) {
+        picoquic_ticket_index_evict(quic);
+    }
+    picoquic_token_index_trim(quic);
+}
+
+/* Write the valid tickets from the least to the most recently used,
+ * so that replaying the file restores the LRU order. */
+static int picoquic_ticket_index_rewrite(picoquic_quic_t* quic, uint64_t current_time,
+    char const* ticket_file_name, size_t* nb_written)
+{
+    int ret = 0;
+    FILE* F = NULL;
+
+    *nb_written = 0;
+    if ((F = picoquic_file_open(ticket_file_name, "wb")) == NULL) {
+        ret = -1;
+    }
+    else {
+        for (picoquic_stored_ticket_t* next = quic->ticket_index.last_ticket; ret == 0 && next != NULL;
+            next = next->previous_ticket) {
+            if (next->time_valid_until > current_time && next->was_used == 0) {
+                uint8_t buffer[2048];
+                size_t record_size;
+                uint32_t storage_size;
+
+                ret = picoquic_serialize_ticket(next, buffer, sizeof(buffer), &record_size);
+                storage_size = (uint32_t)record_size;
+                if (ret == 0) {
+                    if (fwrite(&storage_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
+                        ret = PICOQUIC_ERROR_INVALID_FILE;
+                    }
+                    else {
+                        *nb_written += 1;
+                    }
+                }
+            }
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+int picoquic_save_session_tickets(picoquic_quic_t* quic, char const* ticket_store_filename)
 {
-    return picoquic_load_tokens(&quic->p_first_token, picoquic_get_quic_time(quic), token_store_filename);
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    picoquic_ticket_index_t* index = &quic->ticket_index;
+    int is_journal_file = (quic->ticket_file_name != NULL &&
+        strcmp(quic->ticket_file_name, ticket_store_filename) == 0);
+
+    picoquic_ticket_index_load(quic);
+    if (is_journal_file && picoquic_store_journal_is_compact(&index->journal, index->nb_tickets)) {
+        ret = picoquic_store_journal_append(&index->journal, ticket_store_filename);
+    }
+    else {
+        size_t nb_written = 0;
+
+        ret = picoquic_ticket_index_rewrite(quic, current_time, ticket_store_filename, &nb_written);
+        if (ret == 0 && is_journal_file) {
+            index->journal.length = 0;
+            index->journal.nb_pending = 0;
+            index->journal.nb_records = nb_written;
+            index->journal.is_rewrite_required = 0;
+        }
+    }
+
+    return ret;
 }
 
-int picoquic_save_retry_tokens(picoquic_quic_t* quic, char const* ticket_store_filename)
+int picoquic_load_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename)
 {
-    return picoquic_save_tokens(quic->p_first_token, picoquic_get_quic_time(quic), ticket_store_filename);
+    return picoquic_load_token_file(quic, token_store_filename);
 }
 
 void picoquic_update_stored_ticket(picoquic_cnx_t* cnx, picoquic_path_t * path_x, uint64_t current_time)
@@ -536,25 +1108,10 @@ void picoquic_update_stored_ticket(picoquic_cnx_t* cnx, picoquic_path_t * path_x
     picoquic_get_ip_addr((struct sockaddr *)&path_x->peer_addr, &ip_addr, &ip_addr_length);
 
     if (ip_addr != NULL && ip_addr_length <= PICOQUIC_STORED_IP_MAX) {
-        picoquic_stored_ticket_t* next = picoquic_get_stored_ticket(
-            cnx->quic->p_first_ticket, current_time, sni, (uint16_t)sni_length,
-            alpn, (uint16_t)alpn_length, version, 0, cnx->issued_ticket_id);
-        while (next != NULL) {
-            if (next->sni_length == sni_length &&
-                next->alpn_length == alpn_length &&
-                memcmp(next->sni, sni, sni_length) == 0 &&
-                memcmp(next->alpn, alpn, alpn_length) == 0 &&
-                next->version == version) {
-                uint64_t ticket_id = (next->ticket_length < 8) ? 0 : PICOPARSE_64(next->ticket);
-                if (cnx->issued_ticket_id == 0 || cnx->issued_ticket_id == ticket_id) {
-                    break;
-                }
-            }
-            else {
-                next = next->next_ticket;
-            }
-        }
-        if (next != NULL) {
+        picoquic_stored_ticket_t* next = picoquic_get_session_ticket(cnx->quic, current_time,
+            sni, (uint16_t)sni_length, alpn, (uint16_t)alpn_length, version, 0, cnx->issued_ticket_id);
+
+        if (next != NULL && next->version == version) {
             next->ip_addr_length = ip_addr_length;
             memcpy(next->ip_addr, ip_addr, ip_addr_length);
             next->tp_0rtt[picoquic_tp_0rtt_rtt_local] = path_x->rtt_min;
@@ -563,6 +1120,8 @@ void picoquic_update_stored_ticket(picoquic_cnx_t* cnx, picoquic_path_t * path_x
             next->tp_0rtt[picoquic_tp_0rtt_cwin_remote] = path_x->cwin_remote;
             next->ip_addr_client_length = path_x->ip_client_remote_length;
             memcpy(next->ip_addr_client, path_x->ip_client_remote, path_x->ip_client_remote_length);
+            /* The updated record replaces the previous one when the journal is replayed */
+            picoquic_ticket_index_journal(cnx->quic, next);
         }
     }
 }
@@ -581,7 +1140,7 @@ void picoquic_seed_ticket(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t
             target_cwin = (path_x->bandwidth_estimate_max * path_x->rtt_min) / 1000000ull;
         }
         picoquic_get_ip_addr((struct sockaddr*) & path_x->peer_addr, &ip_addr, &ip_addr_length);
-        (void) picoquic_remember_issued_ticket(cnx->quic, cnx->issued_ticket_id,
+        (void) picoquic_remember_issued_ticket(cnx->quic, current_time, cnx->issued_ticket_id,
             path_x->rtt_min, target_cwin, ip_addr, ip_addr_length);
     }
     path_x->is_ticket_seeded = 1;
@@ -1127,7 +1127,7 @@ int picoquic_client_save_ticket_call_back(ptls_save_ticket_t* save_ticket_ctx,
 
     if (sni != NULL && alpn != NULL) {
         /* TODO: SHOULD STORE IP ADDRESSES? */
-        ret = picoquic_store_ticket(&quic->p_first_ticket, 0, sni, (uint16_t)strlen(sni),
+        ret = picoquic_store_session_ticket(quic, 0, sni, (uint16_t)strlen(sni),
             alpn, (uint16_t)strlen(alpn), version, NULL, 0, NULL, 0,
             input.base, (uint16_t)input.len, &cnx->remote_parameters);
         /* Set first 8 bytes of ticket as identifier */
@@ -1526,6 +1526,8 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
 void picoquic_apply_rotated_keys(picoquic_cnx_t * cnx, int is_enc)
 {
     if (is_enc) {
+        /* Packets pending in a protection batch use the current key */
+        picoquic_protect_batch_flush(cnx->quic);
         if (cnx->crypto_context[3].aead_encrypt != NULL) {
             ptls_aead_free((ptls_aead_context_t *)cnx->crypto_context[3].aead_encrypt);
         }
@@ -2097,6 +2099,11 @@ static int picoquic_add_to_tls_stream(picoquic_cnx_t* cnx, const uint8_t* data,
                 stream_data->length = length;
                 stream_data->offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->release_fn = NULL;
+                stream_data->release_ctx = NULL;
+                stream_data->accounted_cnx = cnx;
+                stream_data->accounted_bytes = sizeof(picoquic_stream_queue_node_t) + length;
+                picoquic_memory_account(cnx, picoquic_memory_send_queue, stream_data->accounted_bytes);
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -2176,7 +2183,7 @@ int picoquic_initialize_tls_stream(picoquic_cnx_t* cnx, uint64_t current_time)
     /* No resumption if no alpn specified upfront, because it would make the negotiation and
      * the handling of 0-RTT way too messy */
     if (cnx->sni != NULL && cnx->alpn != NULL && !cnx->quic->client_zero_share) {
-        picoquic_stored_ticket_t* stored_ticket = picoquic_get_stored_ticket(cnx->quic->p_first_ticket, 
+        picoquic_stored_ticket_t* stored_ticket = picoquic_get_session_ticket(cnx->quic,
             current_time, cnx->sni, (uint16_t)strlen(cnx->sni), cnx->alpn, (uint16_t)strlen(cnx->alpn),
             picoquic_supported_versions[cnx->version_index].version, 1, 0);
         if (stored_ticket != NULL) {
@@ -2267,6 +2274,22 @@ void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void
     ptls_cipher_encrypt((ptls_cipher_context_t *) pn_enc, output, input, len);
 }
 
+/* Compute the header protection masks of a batch of packets. The samples and
+ * the masks are arrays of PICOQUIC_HP_SAMPLE_SIZE bytes per packet. Each mask
+ * is computed with the PN encryption context, as in picoquic_pn_encrypt, since
+ * the ECB backends of picotls only process one block per call and a separate
+ * ECB context would only duplicate the key schedule.
+ */
+void picoquic_hp_mask_batch(void* pn_enc, uint8_t* masks, const uint8_t* samples, size_t nb_samples)
+{
+    static const uint8_t zeros[PICOQUIC_HP_SAMPLE_SIZE] = { 0 };
+
+    for (size_t i = 0; i < nb_samples; i++) {
+        picoquic_pn_encrypt(pn_enc, samples + i * PICOQUIC_HP_SAMPLE_SIZE, masks + i * PICOQUIC_HP_SAMPLE_SIZE,
+            zeros, PICOQUIC_HP_SAMPLE_SIZE);
+    }
+}
+
 /* Utility functions, so applications do not have to load picotls.h */
 
 void picoquic_aead_free(void* aead_context)
@@ -2977,20 +3000,20 @@ void * picoquic_create_retry_protection_context(int is_enc, uint8_t * key, const
     return (void *)picoquic_setup_test_aead_context(is_enc, key, prefix_label);
 }
 
-void * picoquic_find_retry_protection_context(picoquic_cnx_t * cnx, int sending)
+void * picoquic_find_retry_protection_context_by_version(picoquic_quic_t * quic, int version_index, int sending)
 {
     void * aead_ctx = NULL;
-    void ** aead_vector = (sending) ? cnx->quic->retry_integrity_sign_ctx : cnx->quic->retry_integrity_verify_ctx;
+    void ** aead_vector = (sending) ? quic->retry_integrity_sign_ctx : quic->retry_integrity_verify_ctx;
 
-    if (picoquic_supported_versions[cnx->version_index].version_retry_key != NULL) {
+    if (picoquic_supported_versions[version_index].version_retry_key != NULL) {
         if (aead_vector == NULL) {
             if (sending) {
-                cnx->quic->retry_integrity_sign_ctx = (void**)malloc(sizeof(void*)*picoquic_nb_supported_versions);
-                aead_vector = cnx->quic->retry_integrity_sign_ctx;
+                quic->retry_integrity_sign_ctx = (void**)malloc(sizeof(void*)*picoquic_nb_supported_versions);
+                aead_vector = quic->retry_integrity_sign_ctx;
             }
             else {
-                cnx->quic->retry_integrity_verify_ctx = (void**)malloc(sizeof(void*)*picoquic_nb_supported_versions);
-                aead_vector = cnx->quic->retry_integrity_verify_ctx;
+                quic->retry_integrity_verify_ctx = (void**)malloc(sizeof(void*)*picoquic_nb_supported_versions);
+                aead_vector = quic->retry_integrity_verify_ctx;
             }
             if (aead_vector != NULL) {
                 memset(aead_vector, 0, sizeof(void*)*picoquic_nb_supported_versions);
@@ -2998,11 +3021,11 @@ void * picoquic_find_retry_protection_context(picoquic_cnx_t * cnx, int sending)
         }
 
         if (aead_vector != NULL) {
-            aead_ctx = aead_vector[cnx->version_index];
+            aead_ctx = aead_vector[version_index];
             if (aead_ctx == NULL) {
-                aead_ctx = picoquic_create_retry_protection_context(sending, picoquic_supported_versions[cnx->version_index].version_retry_key,
-                                                                    picoquic_supported_versions[cnx->version_index].tls_prefix_label);
-                aead_vector[cnx->version_index] = aead_ctx;
+                aead_ctx = picoquic_create_retry_protection_context(sending, picoquic_supported_versions[version_index].version_retry_key,
+                                                                    picoquic_supported_versions[version_index].tls_prefix_label);
+                aead_vector[version_index] = aead_ctx;
             }
         }
     }
@@ -3010,6 +3033,11 @@ void * picoquic_find_retry_protection_context(picoquic_cnx_t * cnx, int sending)
     return aead_ctx;
 }
 
+void * picoquic_find_retry_protection_context(picoquic_cnx_t * cnx, int sending)
+{
+    return picoquic_find_retry_protection_context_by_version(cnx->quic, cnx->version_index, sending);
+}
+
 static void ** picoquic_delete_one_retry_protection_context(void ** ctx)
 {
     if (ctx != NULL) {
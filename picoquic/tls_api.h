@@ -94,6 +94,8 @@ size_t picoquic_pn_iv_size(void *pn_enc);
 
 void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void *input, size_t len);
 
+void picoquic_hp_mask_batch(void* pn_enc, uint8_t* masks, const uint8_t* samples, size_t nb_samples);
+
 typedef const struct st_ptls_cipher_suite_t ptls_cipher_suite_t;
 
 int picoquic_setup_initial_master_secret(
@@ -173,6 +175,7 @@ ptls_iovec_t* picoquic_get_certs_from_file(char const* file_name, size_t * count
 
 /* Special AEAD context definition functions used for stateless retry integrity protection */
 void * picoquic_create_retry_protection_context(int is_enc, uint8_t * key, const char *prefix_label);
+void * picoquic_find_retry_protection_context_by_version(picoquic_quic_t * quic, int version_index, int sending);
 void * picoquic_find_retry_protection_context(picoquic_cnx_t * cnx, int sending);
 void picoquic_delete_retry_protection_contexts(picoquic_quic_t * quic);
 size_t picoquic_encode_retry_protection(void * integrity_aead, uint8_t * bytes, size_t bytes_max, size_t byte_index, const picoquic_connection_id_t * odcid);
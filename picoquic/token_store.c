@@ -313,7 +313,8 @@ int picoquic_load_tokens(picoquic_stored_token_t** pp_first_token,
                 }
 
                 if (ret == 0 && next != NULL) {
-                    if (next->time_valid_until < current_time) {
+                    if (next->time_valid_until < current_time || next->token_length == 0) {
+                        /* Expired token, or "used" mark written by the indexed store */
                         free(next);
                         next = NULL;
                     }
@@ -351,3 +352,389 @@ void picoquic_free_tokens(picoquic_stored_token_t** pp_first_token)
         free(next);
     }
 }
+
+/* Indexed store of retry tokens.
+ * The tokens are hashed by SNI only, because the lookup before the first
+ * connection to a server does not specify the IP address. The address is
+ * checked when walking the bin. A record with an empty token marks the
+ * tokens for that SNI and address as used.
+ */
+static uint64_t picoquic_token_index_hash(char const* sni, uint16_t sni_length)
+{
+    return picohash_bytes((const uint8_t*)sni, sni_length);
+}
+
+static int picoquic_token_index_resize(picoquic_token_index_t* index, size_t nb_bins)
+{
+    int ret = 0;
+    picoquic_stored_token_t** bins = (picoquic_stored_token_t**)malloc(nb_bins * sizeof(picoquic_stored_token_t*));
+
+    if (bins == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(bins, 0, nb_bins * sizeof(picoquic_stored_token_t*));
+        for (picoquic_stored_token_t* next = index->last_token; next != NULL; next = next->previous_token) {
+            size_t bin = (size_t)(next->key_hash % nb_bins);
+            next->next_in_bin = bins[bin];
+            bins[bin] = next;
+        }
+        if (index->bins != NULL) {
+            free(index->bins);
+        }
+        index->bins = bins;
+        index->nb_bins = nb_bins;
+    }
+
+    return ret;
+}
+
+static void picoquic_token_index_unlink(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    if (stored->previous_token == NULL) {
+        quic->p_first_token = stored->next_token;
+    }
+    else {
+        stored->previous_token->next_token = stored->next_token;
+    }
+    if (stored->next_token == NULL) {
+        quic->token_index.last_token = stored->previous_token;
+    }
+    else {
+        stored->next_token->previous_token = stored->previous_token;
+    }
+    stored->next_token = NULL;
+    stored->previous_token = NULL;
+}
+
+static void picoquic_token_index_push(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    stored->previous_token = NULL;
+    stored->next_token = quic->p_first_token;
+    if (stored->next_token == NULL) {
+        quic->token_index.last_token = stored;
+    }
+    else {
+        stored->next_token->previous_token = stored;
+    }
+    quic->p_first_token = stored;
+}
+
+static void picoquic_token_index_delete(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    picoquic_token_index_t* index = &quic->token_index;
+    picoquic_stored_token_t** pprevious = &index->bins[stored->key_hash % index->nb_bins];
+
+    while (*pprevious != NULL) {
+        if (*pprevious == stored) {
+            *pprevious = stored->next_in_bin;
+            break;
+        }
+        pprevious = &(*pprevious)->next_in_bin;
+    }
+    picoquic_token_index_unlink(quic, stored);
+    index->nb_tokens--;
+    free(stored);
+}
+
+static int picoquic_token_index_match(picoquic_stored_token_t* next, uint64_t key_hash,
+    char const* sni, uint16_t sni_length, uint8_t const* ip_addr, uint8_t ip_addr_length)
+{
+    return (next->key_hash == key_hash &&
+        next->sni_length == sni_length &&
+        next->ip_addr_length == ip_addr_length &&
+        memcmp(next->sni, sni, sni_length) == 0 &&
+        memcmp(next->ip_addr, ip_addr, ip_addr_length) == 0);
+}
+
+/* Remove the tokens for the same SNI and address that are not more recent than
+ * the reference time, then insert the new token if there is one. */
+static int picoquic_token_index_insert(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    int ret = 0;
+    picoquic_token_index_t* index = &quic->token_index;
+
+    if (index->nb_tokens + 1 > 2 * index->nb_bins) {
+        ret = picoquic_token_index_resize(index,
+            (index->nb_bins == 0) ? PICOQUIC_STORE_INDEX_NB_BINS_MIN : 2 * index->nb_bins);
+    }
+
+    if (ret != 0) {
+        free(stored);
+    }
+    else {
+        picoquic_stored_token_t** pprevious;
+        picoquic_stored_token_t* next;
+        size_t bin;
+
+        stored->key_hash = picoquic_token_index_hash(stored->sni, stored->sni_length);
+        bin = (size_t)(stored->key_hash % index->nb_bins);
+        pprevious = &index->bins[bin];
+        while ((next = *pprevious) != NULL) {
+            if (next->time_valid_until <= stored->time_valid_until &&
+                picoquic_token_index_match(next, stored->key_hash, stored->sni, stored->sni_length,
+                    stored->ip_addr, stored->ip_addr_length)) {
+                *pprevious = next->next_in_bin;
+                picoquic_token_index_unlink(quic, next);
+                index->nb_tokens--;
+                free(next);
+            }
+            else {
+                pprevious = &next->next_in_bin;
+            }
+        }
+
+        if (stored->token_length == 0) {
+            free(stored);
+        }
+        else {
+            stored->next_in_bin = index->bins[bin];
+            index->bins[bin] = stored;
+            picoquic_token_index_push(quic, stored);
+            index->nb_tokens++;
+            picoquic_token_index_trim(quic);
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_token_index_trim(picoquic_quic_t* quic)
+{
+    while (quic->token_index.nb_tokens > quic->token_index.nb_tokens_max &&
+        quic->token_index.last_token != NULL) {
+        if (quic->token_index.journal.nb_pending > 0) {
+            picoquic_store_journal_drop(&quic->token_index.journal);
+        }
+        picoquic_token_index_delete(quic, quic->token_index.last_token);
+    }
+}
+
+static int picoquic_token_index_replay(void* ctx, uint8_t* bytes, size_t length)
+{
+    picoquic_quic_t* quic = (picoquic_quic_t*)ctx;
+    picoquic_stored_token_t* stored = NULL;
+    size_t consumed = 0;
+    int ret = picoquic_deserialize_token(&stored, bytes, length, &consumed);
+
+    if (ret == 0 && consumed != length) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    }
+
+    if (ret == 0) {
+        if (stored->token_length > 0 && stored->time_valid_until < picoquic_get_quic_time(quic)) {
+            free(stored);
+        }
+        else {
+            ret = picoquic_token_index_insert(quic, stored);
+        }
+    }
+    else if (stored != NULL) {
+        free(stored);
+    }
+
+    return ret;
+}
+
+static void picoquic_token_index_load(picoquic_quic_t* quic)
+{
+    picoquic_token_index_t* index = &quic->token_index;
+
+    if (!index->journal.is_loaded) {
+        index->journal.is_loaded = 1;
+        if (index->nb_tokens_max == 0) {
+            index->nb_tokens_max = PICOQUIC_STORED_TOKENS_MAX_DEFAULT;
+        }
+        if (quic->token_file_name != NULL) {
+            int ret = picoquic_store_journal_replay(&index->journal, quic->token_file_name,
+                picoquic_token_index_replay, quic);
+
+            if (ret == PICOQUIC_ERROR_NO_SUCH_FILE) {
+                DBG_PRINTF("Token file <%s> not created yet.\n", quic->token_file_name);
+            }
+            else if (ret != 0) {
+                DBG_PRINTF("Cannot load tokens from <%s>\n", quic->token_file_name);
+                index->journal.nb_records = SIZE_MAX / 4;
+            }
+        }
+    }
+}
+
+static void picoquic_token_index_journal(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    if (quic->token_file_name != NULL) {
+        uint8_t buffer[2048];
+        size_t record_size = 0;
+
+        if (picoquic_serialize_token(stored, buffer, sizeof(buffer), &record_size) == 0) {
+            (void)picoquic_store_journal_add(&quic->token_index.journal, buffer, record_size,
+                quic->token_index.nb_tokens_max);
+        }
+    }
+}
+
+/* Set the token file. The file is read at the first access to the tokens,
+ * or immediately if tokens were already accessed. */
+int picoquic_load_token_file(picoquic_quic_t* quic, char const * token_file_name)
+{
+    quic->token_file_name = token_file_name;
+    if (quic->token_index.journal.is_loaded) {
+        quic->token_index.journal.is_loaded = 0;
+        quic->token_index.journal.nb_records = 0;
+        quic->token_index.journal.nb_pending = 0;
+        quic->token_index.journal.length = 0;
+        quic->token_index.journal.is_rewrite_required = 0;
+        picoquic_token_index_load(quic);
+    }
+
+    return 0;
+}
+
+int picoquic_store_retry_token(picoquic_quic_t* quic, uint64_t current_time,
+    char const* sni, uint16_t sni_length, uint8_t const* ip_addr, uint8_t ip_addr_length,
+    uint8_t const* token, uint16_t token_length)
+{
+    int ret = 0;
+    picoquic_stored_token_t* stored = NULL;
+
+    picoquic_token_index_load(quic);
+    ret = picoquic_store_token(&stored, current_time, sni, sni_length, ip_addr, ip_addr_length,
+        token, token_length);
+    if (ret == 0 && (ret = picoquic_token_index_insert(quic, stored)) == 0) {
+        picoquic_token_index_journal(quic, stored);
+    }
+
+    return ret;
+}
+
+int picoquic_get_retry_token(picoquic_quic_t* quic, uint64_t current_time,
+    char const* sni, uint16_t sni_length, uint8_t const* ip_addr, uint8_t ip_addr_length,
+    uint8_t** token, uint16_t* token_length, int mark_used)
+{
+    int ret = 0;
+    picoquic_stored_token_t* best_match = NULL;
+
+    picoquic_token_index_load(quic);
+    if (quic->token_index.nb_bins > 0) {
+        uint64_t key_hash = picoquic_token_index_hash(sni, sni_length);
+        picoquic_stored_token_t* next = quic->token_index.bins[key_hash % quic->token_index.nb_bins];
+
+        while (next != NULL) {
+            if (next->time_valid_until > current_time && next->was_used == 0 &&
+                next->key_hash == key_hash && next->sni_length == sni_length &&
+                memcmp(next->sni, sni, sni_length) == 0) {
+                if (ip_addr_length > 0) {
+                    if (next->ip_addr_length == ip_addr_length && memcmp(next->ip_addr, ip_addr, ip_addr_length) == 0) {
+                        best_match = next;
+                        break;
+                    }
+                }
+                else if (best_match == NULL || next->time_valid_until > best_match->time_valid_until) {
+                    best_match = next;
+                }
+            }
+            next = next->next_in_bin;
+        }
+    }
+
+    if (best_match == NULL || (*token = (uint8_t*)malloc(best_match->token_length)) == NULL) {
+        *token = NULL;
+        *token_length = 0;
+        ret = -1;
+    }
+    else {
+        *token_length = best_match->token_length;
+        memcpy(*token, (uint8_t*)best_match->token, best_match->token_length);
+        if (best_match != quic->p_first_token) {
+            picoquic_token_index_unlink(quic, best_match);
+            picoquic_token_index_push(quic, best_match);
+        }
+        if (mark_used && !best_match->was_used) {
+            picoquic_stored_token_t* mark = picoquic_format_token(best_match->time_valid_until,
+                best_match->sni, best_match->sni_length, best_match->ip_addr, best_match->ip_addr_length, NULL, 0);
+            best_match->was_used = 1;
+            if (mark != NULL) {
+                picoquic_token_index_journal(quic, mark);
+                free(mark);
+            }
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_free_retry_tokens(picoquic_quic_t* quic)
+{
+    picoquic_free_tokens(&quic->p_first_token);
+    if (quic->token_index.bins != NULL) {
+        free(quic->token_index.bins);
+    }
+    picoquic_store_journal_clear(&quic->token_index.journal);
+    quic->token_index.bins = NULL;
+    quic->token_index.nb_bins = 0;
+    quic->token_index.last_token = NULL;
+    quic->token_index.nb_tokens = 0;
+}
+
+static int picoquic_token_index_rewrite(picoquic_quic_t* quic, uint64_t current_time,
+    char const* token_file_name, size_t* nb_written)
+{
+    int ret = 0;
+    FILE* F = NULL;
+
+    *nb_written = 0;
+    if ((F = picoquic_file_open(token_file_name, "wb")) == NULL) {
+        ret = -1;
+    }
+    else {
+        for (picoquic_stored_token_t* next = quic->token_index.last_token; ret == 0 && next != NULL;
+            next = next->previous_token) {
+            if (next->time_valid_until > current_time && next->was_used == 0) {
+                uint8_t buffer[2048];
+                size_t record_size;
+                uint32_t storage_size;
+
+                ret = picoquic_serialize_token(next, buffer, sizeof(buffer), &record_size);
+                storage_size = (uint32_t)record_size;
+                if (ret == 0) {
+                    if (fwrite(&storage_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
+                        ret = PICOQUIC_ERROR_INVALID_FILE;
+                    }
+                    else {
+                        *nb_written += 1;
+                    }
+                }
+            }
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+int picoquic_save_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename)
+{
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    picoquic_token_index_t* index = &quic->token_index;
+    int is_journal_file = (quic->token_file_name != NULL &&
+        strcmp(quic->token_file_name, token_store_filename) == 0);
+
+    picoquic_token_index_load(quic);
+    if (is_journal_file && picoquic_store_journal_is_compact(&index->journal, index->nb_tokens)) {
+        ret = picoquic_store_journal_append(&index->journal, token_store_filename);
+    }
+    else {
+        size_t nb_written = 0;
+
+        ret = picoquic_token_index_rewrite(quic, current_time, token_store_filename, &nb_written);
+        if (ret == 0 && is_journal_file) {
+            index->journal.length = 0;
+            index->journal.nb_pending = 0;
+            index->journal.nb_records = nb_written;
+            index->journal.is_rewrite_required = 0;
+        }
+    }
+
+    return ret;
+}
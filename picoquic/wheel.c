@@ -0,0 +1,315 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Hierarchical timing wheel.
+ * The wheel has PICOQUIC_WHEEL_NB_LEVELS levels of 64 slots, with a one
+ * microsecond tick. A node of wake time T is placed relative to the current
+ * time W of the wheel:
+ * - if T <= W, the node is due, and is appended to the "due" list;
+ * - else, if T and W differ in bits 6*L to 6*L+5 and agree on all higher
+ *   bits, the node is placed in the level L slot matching bits 6*L to 6*L+5
+ *   of T;
+ * - if T and W differ above the highest level, the node goes to the
+ *   "overflow" list, or to the "never" list if T is UINT64_MAX.
+ * With that placement, the nodes in lower levels are always earlier than
+ * the nodes in higher levels, and the slots within a level are sorted.
+ * Advancing the wheel processes the occupied slots in time order: level 0
+ * slots are moved to the due list, higher level slots are cascaded to
+ * lower levels. Each node is moved at most once per level.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "picoquic_internal.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define PICOQUIC_WHEEL_RANGE_BITS (PICOQUIC_WHEEL_LEVEL_BITS*PICOQUIC_WHEEL_NB_LEVELS)
+#define PICOQUIC_WHEEL_SLOT_ID(level, index) (1 + (level)*PICOQUIC_WHEEL_LEVEL_SLOTS + (index))
+
+static int picoquic_wheel_lowest_bit(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int index = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+static int picoquic_wheel_highest_bit(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(x);
+#else
+    int index = 0;
+    while ((x >>= 1) != 0) {
+        index++;
+    }
+    return index;
+#endif
+}
+
+void picoquic_wheel_init(picoquic_wheel_t* wheel, uint64_t current_time)
+{
+    memset(wheel, 0, sizeof(picoquic_wheel_t));
+    wheel->current_time = current_time;
+    wheel->overflow_min = UINT64_MAX;
+}
+
+static void picoquic_wheel_push(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node, int slot)
+{
+    node->slot = slot;
+    node->previous = NULL;
+    node->next = wheel->first[slot];
+    if (node->next != NULL) {
+        node->next->previous = node;
+    }
+    wheel->first[slot] = node;
+}
+
+static void picoquic_wheel_append_due(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node)
+{
+    node->slot = PICOQUIC_WHEEL_SLOT_DUE;
+    node->next = NULL;
+    node->previous = wheel->last_due;
+    if (wheel->last_due == NULL) {
+        wheel->first[PICOQUIC_WHEEL_SLOT_DUE] = node;
+    }
+    else {
+        wheel->last_due->next = node;
+    }
+    wheel->last_due = node;
+}
+
+static void picoquic_wheel_place(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node)
+{
+    uint64_t t = node->wake_time;
+    uint64_t x = t ^ wheel->current_time;
+
+    if (t <= wheel->current_time) {
+        picoquic_wheel_append_due(wheel, node);
+    }
+    else if (t == UINT64_MAX) {
+        picoquic_wheel_push(wheel, node, PICOQUIC_WHEEL_SLOT_NEVER);
+    }
+    else if ((x >> PICOQUIC_WHEEL_RANGE_BITS) != 0) {
+        picoquic_wheel_push(wheel, node, PICOQUIC_WHEEL_SLOT_OVERFLOW);
+        if (t < wheel->overflow_min) {
+            wheel->overflow_min = t;
+        }
+    }
+    else {
+        int level = picoquic_wheel_highest_bit(x) / PICOQUIC_WHEEL_LEVEL_BITS;
+        int index = (int)((t >> (level * PICOQUIC_WHEEL_LEVEL_BITS)) & (PICOQUIC_WHEEL_LEVEL_SLOTS - 1));
+
+        picoquic_wheel_push(wheel, node, PICOQUIC_WHEEL_SLOT_ID(level, index));
+        wheel->occupied[level] |= ((uint64_t)1) << index;
+    }
+}
+
+void picoquic_wheel_insert(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node, uint64_t wake_time)
+{
+    node->wake_time = wake_time;
+    picoquic_wheel_place(wheel, node);
+    wheel->nb_nodes++;
+}
+
+void picoquic_wheel_remove(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node)
+{
+    int slot = node->slot;
+
+    if (slot == PICOQUIC_WHEEL_SLOT_NONE) {
+        return;
+    }
+    if (node->previous == NULL) {
+        wheel->first[slot] = node->next;
+    }
+    else {
+        node->previous->next = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->previous = node->previous;
+    }
+    else if (slot == PICOQUIC_WHEEL_SLOT_DUE) {
+        wheel->last_due = node->previous;
+    }
+    if (slot < PICOQUIC_WHEEL_SLOT_DUE && wheel->first[slot] == NULL) {
+        int level = (slot - 1) / PICOQUIC_WHEEL_LEVEL_SLOTS;
+        int index = (slot - 1) % PICOQUIC_WHEEL_LEVEL_SLOTS;
+        wheel->occupied[level] &= ~(((uint64_t)1) << index);
+    }
+    node->next = NULL;
+    node->previous = NULL;
+    node->slot = PICOQUIC_WHEEL_SLOT_NONE;
+    wheel->nb_nodes--;
+}
+
+/* Find the earliest occupied slot, and return the time at which it starts.
+ * Returns UINT64_MAX if all the slots are empty.
+ */
+static uint64_t picoquic_wheel_next_slot(picoquic_wheel_t* wheel, int* slot)
+{
+    uint64_t w = wheel->current_time;
+
+    for (int level = 0; level < PICOQUIC_WHEEL_NB_LEVELS; level++) {
+        int shift = level * PICOQUIC_WHEEL_LEVEL_BITS;
+        int current = (int)((w >> shift) & (PICOQUIC_WHEEL_LEVEL_SLOTS - 1));
+
+        if (current < PICOQUIC_WHEEL_LEVEL_SLOTS - 1) {
+            uint64_t mask = wheel->occupied[level] & (UINT64_MAX << (current + 1));
+
+            if (mask != 0) {
+                int index = picoquic_wheel_lowest_bit(mask);
+                uint64_t start = (w >> (shift + PICOQUIC_WHEEL_LEVEL_BITS)) << (shift + PICOQUIC_WHEEL_LEVEL_BITS);
+
+                *slot = PICOQUIC_WHEEL_SLOT_ID(level, index);
+                return start | (((uint64_t)index) << shift);
+            }
+        }
+    }
+    return UINT64_MAX;
+}
+
+/* Time at which the overflow list shall be redistributed: the start of the
+ * range that contains the earliest overflow node, and never the current range.
+ */
+static uint64_t picoquic_wheel_overflow_start(picoquic_wheel_t* wheel)
+{
+    uint64_t start = UINT64_MAX;
+
+    if (wheel->first[PICOQUIC_WHEEL_SLOT_OVERFLOW] != NULL && wheel->overflow_min != UINT64_MAX) {
+        uint64_t next_range = ((wheel->current_time >> PICOQUIC_WHEEL_RANGE_BITS) + 1) << PICOQUIC_WHEEL_RANGE_BITS;
+        start = (wheel->overflow_min >> PICOQUIC_WHEEL_RANGE_BITS) << PICOQUIC_WHEEL_RANGE_BITS;
+        if (start < next_range) {
+            start = next_range;
+        }
+    }
+    return start;
+}
+
+static void picoquic_wheel_redistribute(picoquic_wheel_t* wheel, int slot, uint64_t start)
+{
+    picoquic_wheel_node_t* node = wheel->first[slot];
+
+    wheel->first[slot] = NULL;
+    if (slot == PICOQUIC_WHEEL_SLOT_OVERFLOW) {
+        wheel->overflow_min = UINT64_MAX;
+    }
+    else {
+        int level = (slot - 1) / PICOQUIC_WHEEL_LEVEL_SLOTS;
+        int index = (slot - 1) % PICOQUIC_WHEEL_LEVEL_SLOTS;
+        wheel->occupied[level] &= ~(((uint64_t)1) << index);
+    }
+    wheel->current_time = start;
+
+    while (node != NULL) {
+        picoquic_wheel_node_t* next = node->next;
+        picoquic_wheel_place(wheel, node);
+        node = next;
+    }
+}
+
+void picoquic_wheel_advance(picoquic_wheel_t* wheel, uint64_t current_time)
+{
+    while (current_time > wheel->current_time) {
+        int slot = PICOQUIC_WHEEL_SLOT_NONE;
+        uint64_t start = picoquic_wheel_next_slot(wheel, &slot);
+
+        if (start > current_time) {
+            slot = PICOQUIC_WHEEL_SLOT_OVERFLOW;
+            start = picoquic_wheel_overflow_start(wheel);
+        }
+        if (start > current_time) {
+            wheel->current_time = current_time;
+        }
+        else {
+            picoquic_wheel_redistribute(wheel, slot, start);
+        }
+    }
+}
+
+picoquic_wheel_node_t* picoquic_wheel_first_due(picoquic_wheel_t* wheel)
+{
+    return wheel->first[PICOQUIC_WHEEL_SLOT_DUE];
+}
+
+uint64_t picoquic_wheel_next_time(picoquic_wheel_t* wheel)
+{
+    uint64_t next_time;
+    int slot;
+
+    if (wheel->first[PICOQUIC_WHEEL_SLOT_DUE] != NULL) {
+        next_time = wheel->first[PICOQUIC_WHEEL_SLOT_DUE]->wake_time;
+    }
+    else if ((next_time = picoquic_wheel_next_slot(wheel, &slot)) == UINT64_MAX &&
+        wheel->first[PICOQUIC_WHEEL_SLOT_OVERFLOW] != NULL) {
+        next_time = wheel->overflow_min;
+    }
+    return next_time;
+}
+
+static picoquic_wheel_node_t* picoquic_wheel_list_min(picoquic_wheel_node_t* node)
+{
+    picoquic_wheel_node_t* best = node;
+
+    while (node != NULL) {
+        if (node->wake_time < best->wake_time) {
+            best = node;
+        }
+        node = node->next;
+    }
+    return best;
+}
+
+picoquic_wheel_node_t* picoquic_wheel_earliest(picoquic_wheel_t* wheel)
+{
+    picoquic_wheel_node_t* node = wheel->first[PICOQUIC_WHEEL_SLOT_DUE];
+
+    if (node == NULL) {
+        int slot = PICOQUIC_WHEEL_SLOT_NONE;
+
+        if (picoquic_wheel_next_slot(wheel, &slot) != UINT64_MAX) {
+            node = picoquic_wheel_list_min(wheel->first[slot]);
+        }
+        else if (wheel->first[PICOQUIC_WHEEL_SLOT_OVERFLOW] != NULL) {
+            node = picoquic_wheel_list_min(wheel->first[PICOQUIC_WHEEL_SLOT_OVERFLOW]);
+        }
+        else {
+            node = wheel->first[PICOQUIC_WHEEL_SLOT_NEVER];
+        }
+    }
+    return node;
+}
@@ -50,6 +50,10 @@ static const picoquic_test_def_t test_table[] = {
     { "threading", util_threading_test },
     { "picohash", picohash_test },
     { "picohash_embedded", picohash_embedded_test },
+    { "picohash_oa", picohash_oa_test },
+    { "picohash_oa_embedded", picohash_oa_embedded_test },
+    { "picohash_oa_resize", picohash_oa_resize_test },
+    { "cid_table_bench", cid_table_bench_test },
     { "bytestream", bytestream_test },
     { "splay", splay_test },
     { "cnxcreation", cnxcreation_test },
@@ -65,11 +69,14 @@ static const picoquic_test_def_t test_table[] = {
     { "parse_frames", parse_frame_test },
     { "logger", logger_test },
     { "binlog", binlog_test },
+    { "binlog_index", binlog_index_test },
+    { "binlog_async", binlog_async_test },
     { "app_message_overflow", app_message_overflow_test },
     { "TlsStreamFrame", TlsStreamFrameTest },
     { "StreamZeroFrame", StreamZeroFrameTest },
     { "stream_splay", stream_splay_test },
     { "stream_output", stream_output_test },
+    { "stream_output_sched", stream_output_sched_test },
     { "stream_retransmit_copy", test_copy_for_retransmit },
     { "dataqueue_copy", dataqueue_copy_test },
     { "dataqueue_packet", dataqueue_packet_test },
@@ -127,6 +134,7 @@ static const picoquic_test_def_t test_table[] = {
     { "datagram_small_new", datagram_small_new_test },
     { "datagram_small_packet", datagram_small_packet_test },
     { "datagram_wifi", datagram_wifi_test },
+    { "datagram_ring", datagram_ring_test },
     { "ddos_amplification", ddos_amplification_test },
     { "ddos_amplification_0rtt", ddos_amplification_0rtt_test },
     { "ddos_amplification_8k", ddos_amplification_8k_test },
@@ -137,6 +145,7 @@ static const picoquic_test_def_t test_table[] = {
     { "vn_tp", vn_tp_test },
     { "vn_compat", vn_compat_test },
     { "stream_rank", stream_rank_test },
+    { "stream_table", stream_table_test },
     { "transport_param", transport_param_test },
     { "tls_api_sni", tls_api_sni_test },
     { "tls_api_alpn", tls_api_alpn_test },
@@ -151,6 +160,10 @@ static const picoquic_test_def_t test_table[] = {
     { "stateless_reset_handshake", stateless_reset_handshake_test },
     { "immediate_close", immediate_close_test },
     { "tls_api_very_long_stream", tls_api_very_long_stream_test },
+    { "zero_copy_send", zero_copy_send_test },
+    { "protect_batch", protect_batch_test },
+    { "receive_batch", receive_batch_test },
+    { "stream_data_borrow", stream_data_borrow_test },
     { "tls_api_very_long_max", tls_api_very_long_max_test },
     { "tls_api_very_long_with_err", tls_api_very_long_with_err_test },
     { "tls_api_very_long_congestion", tls_api_very_long_congestion_test },
@@ -169,11 +182,23 @@ static const picoquic_test_def_t test_table[] = {
     { "nat_attack", nat_attack_test },
     { "sockets", socket_test },
     { "socket_ecn", socket_ecn_test },
+    { "socket_batch", socket_batch_test },
+    { "socket_send_batch", socket_send_batch_test },
+    { "socket_event", socket_event_test },
+    { "socket_sharded_loop", socket_sharded_loop_test },
+    { "slab", slab_test },
+    { "stateless_pool", stateless_pool_test },
+    { "wheel", wheel_test },
     { "ticket_store", ticket_store_test },
     { "ticket_seed", ticket_seed_test },
     { "ticket_seed_from_bdp_frame", ticket_seed_from_bdp_frame_test },
     { "token_store", token_store_test },
+    { "ticket_index", ticket_index_test },
+    { "token_index", token_index_test },
     { "token_reuse_api", token_reuse_api_test },
+    { "anti_replay", anti_replay_test },
+    { "memory_budget", memory_budget_test },
+    { "flow_control_autotune", flow_control_autotune_test },
     { "session_resume", session_resume_test },
     { "zero_rtt", zero_rtt_test },
     { "zero_rtt_loss", zero_rtt_loss_test },
@@ -215,6 +240,8 @@ static const picoquic_test_def_t test_table[] = {
     { "client_only", client_only_test },
     { "packet_enc_dec", packet_enc_dec_test},
     { "pn_vector", cleartext_pn_vector_test },
+    { "protect_batch_vector", protect_batch_vector_test },
+    { "protect_batch_bench", protect_batch_bench_test },
     { "zero_rtt_spurious", zero_rtt_spurious_test },
     { "zero_rtt_retry", zero_rtt_retry_test },
     { "zero_rtt_no_coal", zero_rtt_no_coal_test },
@@ -332,7 +359,9 @@ static const picoquic_test_def_t test_table[] = {
     { "limited_safe", limited_safe_test },
     { "send_stream_blocked", send_stream_blocked_test },
     { "stream_ack", stream_ack_test },
+    { "stream_ref", stream_ref_test },
     { "queue_network_input", queue_network_input_test },
+    { "stream_reassembly", stream_reassembly_test },
     { "pacing_update", pacing_update_test },
     { "quality_update", quality_update_test },
     { "direct_receive", direct_receive_test },
@@ -427,6 +456,8 @@ static const picoquic_test_def_t test_table[] = {
     { "grease_quic_bit_one_way", grease_quic_bit_one_way_test },
     { "pn_random", pn_random_test },
     { "port_blocked", port_blocked_test },
+    { "admission", admission_test },
+    { "initial_flood", initial_flood_test },
     { "cplusplus", cplusplustest },
     { "stress", stress_test },
     { "fuzz", fuzz_test },
@@ -488,6 +519,8 @@ int usage(char const * argv0)
     fprintf(stderr, "  -d ppp uuu dir    Run connection ddoss for ppp packets, uuu usec intervals,\n");
     fprintf(stderr, "  -F nnn            Run the corrupt file fuzzer nnn times,\n");
     fprintf(stderr, "                    logs in dir. No logs if dir=\"-\"");
+    fprintf(stderr, "  -b                Run the connection ID table benchmark.\n");
+    fprintf(stderr, "  -e                Run the packet protection benchmark.\n");
     fprintf(stderr, "  -n                Disable debug prints.\n");
     fprintf(stderr, "  -r                Retry failed tests with debug print enabled.\n");
     fprintf(stderr, "  -h                Print this help message\n");
@@ -524,6 +557,8 @@ int main(int argc, char** argv)
     int do_cnx_stress = 0;
     int do_cnx_ddos = 0;
     int do_cf_fuzz = 0;
+    int do_cid_bench = 0;
+    int do_protect_bench = 0;
     int disable_debug = 0;
     int retry_failed_test = 0;
     int cnx_stress_minutes = 0;
@@ -546,7 +581,7 @@ int main(int argc, char** argv)
     {
         memset(test_status, 0, nb_tests * sizeof(test_status_t));
 
-        while (ret == 0 && (opt = getopt(argc, argv, "c:d:f:F:s:S:x:o:nrh")) != -1) {
+        while (ret == 0 && (opt = getopt(argc, argv, "c:d:f:F:s:S:x:o:benrh")) != -1) {
             switch (opt) {
             case 'x': {
                 optind--;
@@ -650,6 +685,12 @@ int main(int argc, char** argv)
             case 'S':
                 picoquic_set_solution_dir(optarg);
                 break;
+            case 'b':
+                do_cid_bench = 1;
+                break;
+            case 'e':
+                do_protect_bench = 1;
+                break;
             case 'n':
                 disable_debug = 1;
                 break;
@@ -666,7 +707,7 @@ int main(int argc, char** argv)
             }
         }
         /* If one of the stressers was specified, do not run any other test by default */
-        if (do_stress || do_fuzz || do_cnx_stress || do_cnx_ddos || do_cf_fuzz) {
+        if (do_stress || do_fuzz || do_cnx_stress || do_cnx_ddos || do_cf_fuzz || do_cid_bench || do_protect_bench) {
             auto_bypass = 1;
             for (size_t i = 0; i < nb_tests; i++) {
                 test_status[i] = test_excluded;
@@ -696,7 +737,7 @@ int main(int argc, char** argv)
         /* If one of the stressers is requested, just execute it,
          */
 
-        if (ret == 0 && (do_stress || do_fuzz || do_cnx_stress || do_cnx_ddos || do_cf_fuzz)) {
+        if (ret == 0 && (do_stress || do_fuzz || do_cnx_stress || do_cnx_ddos || do_cf_fuzz || do_cid_bench || do_protect_bench)) {
             debug_printf_suspend();
             if (do_stress || do_fuzz) {
                 picoquic_stress_test_duration = stress_minutes;
@@ -740,6 +781,28 @@ int main(int argc, char** argv)
                         test_status[i] = test_success;
                     }
                 }
+                else if (do_cid_bench && strcmp(test_table[i].test_name, "cid_table_bench") == 0) {
+                    nb_test_tried++;
+                    if (cid_table_bench_report(stdout) != 0) {
+                        test_status[i] = test_failed;
+                        nb_test_failed++;
+                        ret = -1;
+                    }
+                    else {
+                        test_status[i] = test_success;
+                    }
+                }
+                else if (do_protect_bench && strcmp(test_table[i].test_name, "protect_batch_bench") == 0) {
+                    nb_test_tried++;
+                    if (protect_batch_bench_report(stdout) != 0) {
+                        test_status[i] = test_failed;
+                        nb_test_failed++;
+                        ret = -1;
+                    }
+                    else {
+                        test_status[i] = test_success;
+                    }
+                }
                 else if (do_cf_fuzz && strcmp(test_table[i].test_name, "eccf_corrupted_fuzz") == 0) {
                     uint64_t r_seed = picoquic_current_time();
                     FILE* F = picoquic_file_open("ECCF_Fuzz_report.csv", "w");
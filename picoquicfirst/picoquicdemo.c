@@ -1114,6 +1114,7 @@ int quic_client(const char* ip_address_text, int server_port,
         uint8_t* ticket;
         uint16_t ticket_length;
 
+        picoquic_ticket_index_load(qclient);
         if (sni != NULL && loop_cb.saved_alpn != NULL && 0 == picoquic_get_ticket(qclient->p_first_ticket, current_time, sni, (uint16_t)strlen(sni), loop_cb.saved_alpn,
             (uint16_t)strlen(loop_cb.saved_alpn), 0, &ticket, &ticket_length, NULL, 0)) {
             fprintf(stdout, "Received ticket from %s (%s):\n", sni, loop_cb.saved_alpn);
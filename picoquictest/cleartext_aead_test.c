@@ -27,6 +27,7 @@
 #include "picoquic_utils.h"
 #include "picotls.h"
 #include "picoquic_lb.h"
+#include <stdlib.h>
 #include <string.h>
 #include "picoquictest_internal.h"
 
@@ -1357,4 +1358,240 @@ int retry_protection_v2_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+/* Batch protection of a packet train.
+ * The packets are short header packets with an 8 bytes CID and a 4 bytes
+ * sequence number. The reference is computed packet by packet, as in
+ * picoquic_protect_packet; the batch is computed in place in a train buffer.
+ */
+#define PROTECT_BATCH_TEST_HEADER 13
+#define PROTECT_BATCH_TEST_CHECKSUM 16
+
+static const uint8_t protect_batch_test_secret[32] = {
+    0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40,
+    0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f, 0x50 };
+
+static size_t protect_batch_test_length(size_t i)
+{
+    return (i == 0) ? 21 : 1200 + PROTECT_BATCH_TEST_HEADER - ((i % 3) * 100);
+}
+
+static void protect_batch_test_packet(uint8_t* bytes, size_t length, uint64_t sequence_number)
+{
+    bytes[0] = 0x43;
+    for (size_t i = 1; i < 9; i++) {
+        bytes[i] = (uint8_t)(0xa0 + i);
+    }
+    picoformat_32(bytes + 9, (uint32_t)sequence_number);
+    for (size_t i = PROTECT_BATCH_TEST_HEADER; i < length; i++) {
+        bytes[i] = (uint8_t)(i + sequence_number);
+    }
+}
+
+static size_t protect_batch_test_one(void* aead, void* pn_enc, uint8_t* clear, size_t length,
+    uint64_t sequence_number, int is_multipath, uint8_t* protected_bytes)
+{
+    uint8_t mask_bytes[5] = { 0, 0, 0, 0, 0 };
+    size_t send_length;
+
+    memcpy(protected_bytes, clear, PROTECT_BATCH_TEST_HEADER);
+    if (is_multipath) {
+        send_length = picoquic_aead_encrypt_mp(protected_bytes + PROTECT_BATCH_TEST_HEADER,
+            clear + PROTECT_BATCH_TEST_HEADER, length - PROTECT_BATCH_TEST_HEADER, 1,
+            sequence_number, protected_bytes, PROTECT_BATCH_TEST_HEADER, aead);
+    }
+    else {
+        send_length = picoquic_aead_encrypt_generic(protected_bytes + PROTECT_BATCH_TEST_HEADER,
+            clear + PROTECT_BATCH_TEST_HEADER, length - PROTECT_BATCH_TEST_HEADER,
+            sequence_number, protected_bytes, PROTECT_BATCH_TEST_HEADER, aead);
+    }
+    picoquic_pn_encrypt(pn_enc, protected_bytes + 9 + 4, mask_bytes, mask_bytes, 5);
+    protected_bytes[0] ^= (mask_bytes[0] & 0x1F);
+    for (int i = 0; i < 4; i++) {
+        protected_bytes[9 + i] ^= mask_bytes[i + 1];
+    }
+
+    return send_length + PROTECT_BATCH_TEST_HEADER;
+}
+
+/* Prepare a train of nb_packets in the buffer "train", and add them to the batch */
+static size_t protect_batch_test_train(picoquic_protect_batch_t* batch, uint8_t* train, size_t nb_packets,
+    uint64_t first_sequence, int is_multipath)
+{
+    size_t train_length = 0;
+
+    for (size_t i = 0; i < nb_packets; i++) {
+        size_t length = protect_batch_test_length(i);
+
+        protect_batch_test_packet(train + train_length, length, first_sequence + i);
+        (void)picoquic_protect_batch_add(batch, train + train_length, PROTECT_BATCH_TEST_HEADER, 9,
+            length - PROTECT_BATCH_TEST_HEADER, first_sequence + i, 0x1F, is_multipath, 1);
+        train_length += length + PROTECT_BATCH_TEST_CHECKSUM;
+    }
+
+    return train_length;
+}
+
+int protect_batch_vector_test()
+{
+    int ret = 0;
+    void* aead = picoquic_setup_test_aead_context(1, protect_batch_test_secret, PICOQUIC_LABEL_QUIC_V1_KEY_BASE);
+    void* pn_enc = picoquic_pn_enc_create_for_test(protect_batch_test_secret, PICOQUIC_LABEL_QUIC_V1_KEY_BASE);
+    picoquic_protect_batch_t* batch = (picoquic_protect_batch_t*)malloc(sizeof(picoquic_protect_batch_t));
+    uint8_t* train = (uint8_t*)malloc(PICOQUIC_PROTECT_BATCH_MAX * PICOQUIC_MAX_PACKET_SIZE);
+
+    if (aead == NULL || pn_enc == NULL || batch == NULL || train == NULL) {
+        DBG_PRINTF("%s", "Cannot create the test contexts");
+        ret = -1;
+    }
+
+    /* Test a full batch and a short one, with and without multipath */
+    for (int test_case = 0; ret == 0 && test_case < 3; test_case++) {
+        int is_multipath = (test_case == 2);
+        size_t nb_packets = (test_case == 0) ? PICOQUIC_PROTECT_BATCH_MAX : 5;
+        uint64_t first_sequence = 0x1000 * test_case + 17;
+        size_t train_length;
+        size_t train_index = 0;
+
+        memset(batch, 0, sizeof(picoquic_protect_batch_t));
+        picoquic_protect_batch_init(batch, aead, pn_enc);
+        train_length = protect_batch_test_train(batch, train, nb_packets, first_sequence, is_multipath);
+
+        if (nb_packets == PICOQUIC_PROTECT_BATCH_MAX &&
+            picoquic_protect_batch_add(batch, train, PROTECT_BATCH_TEST_HEADER, 9, 0, 0, 0x1F, 0, 0) == 0) {
+            DBG_PRINTF("%s", "Batch overflow not detected");
+            ret = -1;
+            break;
+        }
+        picoquic_protect_batch_apply(batch);
+
+        if (batch->nb_packets != 0 || batch->nb_packets_batched != nb_packets) {
+            DBG_PRINTF("Batch not applied, case %d", test_case);
+            ret = -1;
+        }
+
+        for (size_t i = 0; ret == 0 && i < nb_packets; i++) {
+            uint8_t clear[PICOQUIC_MAX_PACKET_SIZE];
+            uint8_t expected[PICOQUIC_MAX_PACKET_SIZE];
+            size_t length = protect_batch_test_length(i);
+            size_t expected_length;
+
+            protect_batch_test_packet(clear, length, first_sequence + i);
+            expected_length = protect_batch_test_one(aead, pn_enc, clear, length, first_sequence + i, is_multipath, expected);
+            if (expected_length != length + PROTECT_BATCH_TEST_CHECKSUM ||
+                train_index + expected_length > train_length ||
+                memcmp(train + train_index, expected, expected_length) != 0) {
+                DBG_PRINTF("Packet %zu differs in batch, case %d", i, test_case);
+                ret = -1;
+            }
+            train_index += length + PROTECT_BATCH_TEST_CHECKSUM;
+        }
+    }
+
+    if (aead != NULL) {
+        picoquic_aead_free(aead);
+    }
+    if (pn_enc != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)pn_enc);
+    }
+    free(batch);
+    free(train);
+
+    return ret;
+}
+
+/* Measure the protection rate of 44 packets trains, packet by packet and in batch */
+#define PROTECT_BATCH_BENCH_TRAIN 44
+
+int protect_batch_bench(size_t nb_trains, double* single_rate, double* batch_rate)
+{
+    int ret = 0;
+    void* aead = picoquic_setup_test_aead_context(1, protect_batch_test_secret, PICOQUIC_LABEL_QUIC_V1_KEY_BASE);
+    void* pn_enc = picoquic_pn_enc_create_for_test(protect_batch_test_secret, PICOQUIC_LABEL_QUIC_V1_KEY_BASE);
+    picoquic_protect_batch_t* batch = (picoquic_protect_batch_t*)malloc(sizeof(picoquic_protect_batch_t));
+    uint8_t* clear = (uint8_t*)malloc(PROTECT_BATCH_BENCH_TRAIN * PICOQUIC_MAX_PACKET_SIZE);
+    uint8_t* train = (uint8_t*)malloc(PROTECT_BATCH_BENCH_TRAIN * PICOQUIC_MAX_PACKET_SIZE);
+
+    if (aead == NULL || pn_enc == NULL || batch == NULL || clear == NULL || train == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(batch, 0, sizeof(picoquic_protect_batch_t));
+        for (size_t i = 0; i < PROTECT_BATCH_BENCH_TRAIN; i++) {
+            protect_batch_test_packet(clear + i * PICOQUIC_MAX_PACKET_SIZE, 1200 + PROTECT_BATCH_TEST_HEADER, i);
+        }
+    }
+
+    for (int pass = 0; ret == 0 && pass < 2; pass++) {
+        uint64_t start_time = picoquic_current_time();
+        uint64_t elapsed;
+        uint64_t sequence_number = 0;
+
+        for (size_t t = 0; t < nb_trains; t++) {
+            size_t train_length = 0;
+
+            if (pass == 0) {
+                for (size_t i = 0; i < PROTECT_BATCH_BENCH_TRAIN; i++) {
+                    train_length += protect_batch_test_one(aead, pn_enc, clear + i * PICOQUIC_MAX_PACKET_SIZE,
+                        1200 + PROTECT_BATCH_TEST_HEADER, sequence_number++, 0, train + train_length);
+                }
+            }
+            else {
+                /* Include the copy of the clear text in the send buffer, as done by the sender */
+                picoquic_protect_batch_init(batch, aead, pn_enc);
+                for (size_t i = 0; i < PROTECT_BATCH_BENCH_TRAIN; i++) {
+                    memcpy(train + train_length, clear + i * PICOQUIC_MAX_PACKET_SIZE, 1200 + PROTECT_BATCH_TEST_HEADER);
+                    (void)picoquic_protect_batch_add(batch, train + train_length, PROTECT_BATCH_TEST_HEADER, 9,
+                        1200, sequence_number++, 0x1F, 0, 0);
+                    train_length += 1200 + PROTECT_BATCH_TEST_HEADER + PROTECT_BATCH_TEST_CHECKSUM;
+                }
+                picoquic_protect_batch_apply(batch);
+            }
+        }
+        elapsed = picoquic_current_time() - start_time;
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+        *((pass == 0) ? single_rate : batch_rate) = ((double)(nb_trains * PROTECT_BATCH_BENCH_TRAIN) * 1000000.0) / (double)elapsed;
+    }
+
+    if (aead != NULL) {
+        picoquic_aead_free(aead);
+    }
+    if (pn_enc != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)pn_enc);
+    }
+    free(batch);
+    free(clear);
+    free(train);
+
+    return ret;
+}
+
+int protect_batch_bench_test()
+{
+    double single_rate = 0;
+    double batch_rate = 0;
+    int ret = protect_batch_bench(100, &single_rate, &batch_rate);
+
+    if (ret == 0 && (single_rate <= 0 || batch_rate <= 0)) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Run the protection benchmark on 100k trains, and print the results */
+int protect_batch_bench_report(FILE* F)
+{
+    double single_rate = 0;
+    double batch_rate = 0;
+    int ret = protect_batch_bench(100000, &single_rate, &batch_rate);
+
+    if (ret == 0) {
+        fprintf(F, "Protection of %d packets trains: %.0f packets/s one by one, %.0f packets/s in batch (x%.2f)\n",
+            PROTECT_BATCH_BENCH_TRAIN, single_rate, batch_rate, batch_rate / single_rate);
+    }
+
+    return ret;
+}
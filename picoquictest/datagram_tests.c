@@ -636,4 +636,227 @@ int datagram_small_packet_test()
     dg_ctx.duration_max = 2060000;
 
     return datagram_test_one(9, &dg_ctx, 0);
-}
\ No newline at end of file
+}
+
+/* Unit test of the datagram send ring: queuing without copy, refusal when
+ * the ring is full, expiry at the deadline with callback, sending by priority
+ * and order of queuing, reuse of any freed slot, replacement queued from
+ * the expiry callback, and sending of smaller datagrams when the next one
+ * does not fit.
+ */
+typedef struct st_datagram_ring_test_ctx_t {
+    int nb_expired;
+    uint8_t last_expired;
+    uint8_t replacement_id;
+} datagram_ring_test_ctx_t;
+
+static int datagram_ring_test_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    datagram_ring_test_ctx_t* ctx = (datagram_ring_test_ctx_t*)callback_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+    UNREFERENCED_PARAMETER(stream_id);
+    UNREFERENCED_PARAMETER(v_stream_ctx);
+#endif
+    if (fin_or_event == picoquic_callback_datagram_expired && length > 0) {
+        ctx->nb_expired++;
+        ctx->last_expired = bytes[0];
+        if (ctx->replacement_id != 0) {
+            /* Queue a replacement while the expired slot is still held */
+            uint8_t* buffer = picoquic_get_datagram_ring_buffer(cnx, length, UINT64_MAX, 0);
+            if (buffer != NULL && buffer != bytes) {
+                memset(buffer, ctx->replacement_id, length);
+                ctx->replacement_id = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+static int datagram_ring_queue(picoquic_cnx_t* cnx, uint8_t id, size_t length, uint64_t deadline, uint8_t priority)
+{
+    uint8_t* buffer = picoquic_get_datagram_ring_buffer(cnx, length, deadline, priority);
+
+    if (buffer == NULL) {
+        return -1;
+    }
+    memset(buffer, id, length);
+    return 0;
+}
+
+/* Check that the packet holds datagrams in the expected order */
+static int datagram_ring_check_order(const uint8_t* bytes, const uint8_t* bytes_max, const uint8_t* expected, size_t nb_expected)
+{
+    int ret = 0;
+    size_t nb_found = 0;
+
+    while (ret == 0 && bytes < bytes_max) {
+        uint8_t frame_id;
+        uint64_t length;
+
+        if ((bytes = picoquic_decode_datagram_frame_header((uint8_t*)bytes, bytes_max, &frame_id, &length)) == NULL ||
+            length == 0 || nb_found >= nb_expected || bytes[0] != expected[nb_found]) {
+            ret = -1;
+        }
+        else {
+            bytes += length;
+            nb_found++;
+        }
+    }
+
+    if (ret == 0 && nb_found != nb_expected) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int datagram_ring_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t packet[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t data[100];
+    uint8_t* bytes_next = NULL;
+    int more_data = 0;
+    int is_pure_ack = 1;
+    datagram_ring_test_ctx_t ctx = { 0 };
+    picoquic_datagram_ring_stats_t stats;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in addr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    memset(data, 4, sizeof(data));
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&addr, simulated_time, 0, NULL, NULL, 1)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create connection");
+        ret = -1;
+    }
+    else {
+        picoquic_set_callback(cnx, datagram_ring_test_callback, &ctx);
+        ret = picoquic_set_datagram_ring(cnx, 4);
+    }
+
+    /* Fill the ring, then verify that the next datagrams are refused */
+    if (ret == 0 && (datagram_ring_queue(cnx, 1, 100, 1000, 2) != 0 ||
+        datagram_ring_queue(cnx, 2, 100, 500, 1) != 0 ||
+        datagram_ring_queue(cnx, 3, 100, UINT64_MAX, 2) != 0 ||
+        picoquic_queue_datagram_frame(cnx, sizeof(data), data) != 0)) {
+        DBG_PRINTF("%s", "Cannot queue datagrams");
+        ret = -1;
+    }
+    if (ret == 0 && (datagram_ring_queue(cnx, 5, 100, UINT64_MAX, 0) == 0 ||
+        picoquic_queue_datagram_frame(cnx, sizeof(data), data) != PICOQUIC_ERROR_DATAGRAM_RING_FULL ||
+        picoquic_set_datagram_ring(cnx, 8) == 0)) {
+        DBG_PRINTF("%s", "Full ring not detected");
+        ret = -1;
+    }
+
+    /* Datagram 2 expires, the others are sent by priority */
+    if (ret == 0 && (picoquic_datagram_ring_expire(cnx, 600) != 2 ||
+        ctx.nb_expired != 1 || ctx.last_expired != 2)) {
+        DBG_PRINTF("%s", "Expired datagram not reported");
+        ret = -1;
+    }
+    if (ret == 0) {
+        uint8_t expected[3] = { 1, 3, 4 };
+        bytes_next = picoquic_format_ring_datagram_frames(cnx, packet, packet + sizeof(packet), &more_data, &is_pure_ack);
+        if (more_data || is_pure_ack || datagram_ring_check_order(packet, bytes_next, expected, 3) != 0) {
+            DBG_PRINTF("%s", "Datagrams not sent in priority order");
+            ret = -1;
+        }
+    }
+
+    /* Reuse the slots after the wrap around, with more data than a packet can hold */
+    if (ret == 0) {
+        picoquic_get_datagram_ring_stats(cnx, &stats);
+        if (stats.nb_slots != 4 || stats.nb_queued != 0 || stats.nb_sent != 3 || stats.nb_expired != 1 ||
+            stats.nb_refused != 2 || cnx->datagram_ring.first_queued != PICOQUIC_DATAGRAM_SLOT_NONE) {
+            DBG_PRINTF("%s", "Unexpected ring statistics");
+            ret = -1;
+        }
+        else if (datagram_ring_queue(cnx, 6, 1000, UINT64_MAX, 3) != 0 ||
+            datagram_ring_queue(cnx, 7, 1000, 2000, 3) != 0) {
+            DBG_PRINTF("%s", "Cannot reuse the slots");
+            ret = -1;
+        }
+        else {
+            uint8_t expected[1] = { 6 };
+            more_data = 0;
+            bytes_next = picoquic_format_ring_datagram_frames(cnx, packet, packet + 1200, &more_data, &is_pure_ack);
+            if (!more_data || cnx->datagram_ring.nb_queued != 1 ||
+                datagram_ring_check_order(packet, bytes_next, expected, 1) != 0) {
+                DBG_PRINTF("%s", "Unexpected datagram after wrap around");
+                ret = -1;
+            }
+        }
+    }
+
+    /* A slot freed behind a queued datagram is reused: 9 expires while 7
+     * is still queued, and 10 takes its slot. After 8 is sent, 7 does not
+     * fit in the packet, and the smaller datagrams 10 and 11 are sent. */
+    if (ret == 0) {
+        ctx.nb_expired = 0;
+        if (datagram_ring_queue(cnx, 8, 1000, UINT64_MAX, 1) != 0 ||
+            datagram_ring_queue(cnx, 9, 100, 1000, 0) != 0 ||
+            datagram_ring_queue(cnx, 11, 100, UINT64_MAX, 4) != 0 ||
+            picoquic_datagram_ring_expire(cnx, 1500) != 1 || ctx.nb_expired != 1 ||
+            datagram_ring_queue(cnx, 10, 100, UINT64_MAX, 2) != 0 ||
+            datagram_ring_queue(cnx, 12, 100, UINT64_MAX, 2) == 0) {
+            DBG_PRINTF("%s", "Freed slot not reused");
+            ret = -1;
+        }
+        else {
+            uint8_t expected[3] = { 8, 10, 11 };
+            more_data = 0;
+            bytes_next = picoquic_format_ring_datagram_frames(cnx, packet, packet + 1300, &more_data, &is_pure_ack);
+            if (!more_data || cnx->datagram_ring.nb_queued != 1 ||
+                datagram_ring_check_order(packet, bytes_next, expected, 3) != 0) {
+                DBG_PRINTF("%s", "Smaller datagrams not sent");
+                ret = -1;
+            }
+        }
+    }
+
+    /* The ring memory is accounted and released */
+    if (ret == 0 && cnx->memory_bytes[picoquic_memory_send_queue] < 4 * sizeof(picoquic_datagram_slot_t)) {
+        DBG_PRINTF("%s", "Ring memory not accounted");
+        ret = -1;
+    }
+    /* A replacement queued from the expired callback is sent */
+    if (ret == 0) {
+        uint8_t expected[1] = { 13 };
+        ctx.replacement_id = 13;
+        more_data = 0;
+        (void)picoquic_datagram_ring_expire(cnx, 3000);
+        bytes_next = picoquic_format_ring_datagram_frames(cnx, packet, packet + sizeof(packet), &more_data, &is_pure_ack);
+        if (ctx.replacement_id != 0 || ctx.last_expired != 7 || more_data || cnx->datagram_ring.nb_queued != 0 ||
+            datagram_ring_check_order(packet, bytes_next, expected, 1) != 0) {
+            DBG_PRINTF("%s", "Replacement datagram not sent");
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        if (picoquic_set_datagram_ring(cnx, 0) != 0 || cnx->memory_bytes[picoquic_memory_send_queue] != 0 ||
+            ctx.nb_expired != 2) {
+            DBG_PRINTF("%s", "Ring not released");
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
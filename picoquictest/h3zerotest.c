@@ -3232,6 +3232,108 @@ int h3zero_settings_test()
     return ret;
 }
 
+/* Test the parsing of RFC 9218 priority fields, both in the "priority"
+ * header and in PRIORITY_UPDATE frames.
+ */
+typedef struct st_h3zero_priority_field_case_t {
+    char const* field;
+    int ret;
+    uint8_t urgency;
+    int is_incremental;
+} h3zero_priority_field_case_t;
+
+static const h3zero_priority_field_case_t h3zero_priority_field_case[] = {
+    { "u=1, i", 0, 1, 1 },
+    { "i, u=7", 0, 7, 1 },
+    { "u=0", 0, 0, 0 },
+    { "u=2, i=?0", 0, 2, 0 },
+    { "u=5,i=?1", 0, 5, 1 },
+    { "u=8", 0, H3ZERO_URGENCY_DEFAULT, 0 },
+    { "u=a, i", 0, H3ZERO_URGENCY_DEFAULT, 1 },
+    { "u=1.5", 0, H3ZERO_URGENCY_DEFAULT, 0 },
+    { "x=\"a, b\", u=6", 0, 6, 0 },
+    { "", 0, H3ZERO_URGENCY_DEFAULT, 0 },
+    { "U=1", -1, H3ZERO_URGENCY_DEFAULT, 0 },
+    { ",u=1", -1, H3ZERO_URGENCY_DEFAULT, 0 }
+};
+
+static const size_t nb_h3zero_priority_field_case = sizeof(h3zero_priority_field_case) / sizeof(h3zero_priority_field_case_t);
+
+static uint8_t h3zero_priority_header[] = {
+    0x00, 0x00, 0xd1, 0xc1,
+    0x27, 0x01, 'p', 'r', 'i', 'o', 'r', 'i', 't', 'y',
+    0x06, 'u', '=', '1', ',', ' ', 'i' };
+
+int h3zero_priority_test()
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_h3zero_priority_field_case; i++) {
+        uint8_t urgency = H3ZERO_URGENCY_DEFAULT;
+        int is_incremental = 0;
+        char const* field = h3zero_priority_field_case[i].field;
+
+        if (h3zero_parse_priority_field((uint8_t const*)field, strlen(field), &urgency, &is_incremental) !=
+            h3zero_priority_field_case[i].ret ||
+            (h3zero_priority_field_case[i].ret == 0 &&
+            (urgency != h3zero_priority_field_case[i].urgency ||
+                is_incremental != h3zero_priority_field_case[i].is_incremental))) {
+            DBG_PRINTF("Priority field case %zu (%s) fails", i, field);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        h3zero_header_parts_t parts;
+        uint8_t* bytes = h3zero_parse_qpack_header_frame(h3zero_priority_header,
+            h3zero_priority_header + sizeof(h3zero_priority_header), &parts);
+
+        if (bytes != h3zero_priority_header + sizeof(h3zero_priority_header) ||
+            parts.method != h3zero_method_get || !parts.priority_found ||
+            parts.urgency != 1 || !parts.is_incremental) {
+            DBG_PRINTF("%s", "Priority header not parsed");
+            ret = -1;
+        }
+        h3zero_release_header_parts(&parts);
+    }
+
+    for (int u = 0; ret == 0 && u <= H3ZERO_URGENCY_MAX; u++) {
+        for (int inc = 0; ret == 0 && inc <= 1; inc++) {
+            uint8_t buffer[64];
+            uint8_t* bytes = h3zero_create_priority_update_frame(buffer, buffer + sizeof(buffer),
+                4 * (uint64_t)u + 1024, (uint8_t)u, inc);
+            const uint8_t* payload = buffer;
+            uint64_t frame_type = 0;
+            uint64_t frame_length = 0;
+            uint64_t stream_id = 0;
+            uint8_t urgency = 0;
+            int is_incremental = 0;
+
+            if (bytes == NULL ||
+                (payload = picoquic_frames_varint_decode(payload, bytes, &frame_type)) == NULL ||
+                (payload = picoquic_frames_varint_decode(payload, bytes, &frame_length)) == NULL ||
+                frame_type != h3zero_frame_priority_update_request ||
+                payload + frame_length != bytes ||
+                h3zero_parse_priority_update_frame(payload, bytes, &stream_id, &urgency, &is_incremental) != bytes ||
+                stream_id != 4 * (uint64_t)u + 1024 || urgency != u || is_incremental != inc) {
+                DBG_PRINTF("Priority update round trip fails for u=%d, i=%d", u, inc);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        uint8_t buffer[4];
+        if (h3zero_create_priority_update_frame(buffer, buffer + sizeof(buffer), 0, 1, 1) != NULL ||
+            h3zero_create_priority_update_frame(buffer, buffer + sizeof(buffer), 0, H3ZERO_URGENCY_MAX + 1, 0) != NULL) {
+            DBG_PRINTF("%s", "Invalid priority update not rejected");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 /* Test support for H3 greasing of stream types.
 * This is a test of the handling of unidirectional streams of unknown types. The
 * desired handling is specified in
@@ -200,3 +200,323 @@ int picohash_embedded_test()
 {
     return(picohash_test_one(1));
 }
+
+/* Open addressing table: same checks as picohash, plus enough items and
+ * deletions to exercise the incremental resize and the deleted slots.
+ */
+#define PICOHASH_OA_TEST_NB_ITEMS 2000
+
+int picohash_oa_test_one(int embedded_item)
+{
+    int ret = 0;
+    picohash_oa_table* t = picohash_oa_create(16, hashtest_hash, hashtest_compare,
+        (embedded_item) ? hashtest_key_to_item : NULL);
+    struct hashtestkey hk;
+
+    if (t == NULL) {
+        DBG_PRINTF("%s", "picohash_oa_create() failed\n");
+        ret = -1;
+    }
+
+    /* Enter a bunch of values, all different */
+    for (uint64_t i = 1; ret == 0 && i <= PICOHASH_OA_TEST_NB_ITEMS; i++) {
+        if (picohash_oa_insert(t, hashtest_item(i)) != 0) {
+            DBG_PRINTF("picohash_oa_insert(%" PRIu64 ") failed\n", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && t->count != PICOHASH_OA_TEST_NB_ITEMS) {
+        DBG_PRINTF("picohash_oa table count != %d (count=%" PRIst ")\n", PICOHASH_OA_TEST_NB_ITEMS, t->count);
+        ret = -1;
+    }
+
+    /* Delete the odd values, then check that only the even values are found */
+    for (uint64_t i = 1; ret == 0 && i <= PICOHASH_OA_TEST_NB_ITEMS; i += 2) {
+        hk.x = i;
+        picohash_item* pi = picohash_oa_retrieve(t, &hk);
+
+        if (pi == NULL) {
+            DBG_PRINTF("picohash_oa_retrieve(%" PRIu64 ") failed\n", i);
+            ret = -1;
+        }
+        else {
+            picohash_oa_delete_item(t, pi, 1);
+        }
+    }
+
+    for (uint64_t i = 0; ret == 0 && i <= PICOHASH_OA_TEST_NB_ITEMS + 1; i++) {
+        hk.x = i;
+        picohash_item* pi = picohash_oa_retrieve(t, &hk);
+        int expected = (i > 0 && i <= PICOHASH_OA_TEST_NB_ITEMS && (i & 1) == 0);
+
+        if ((pi != NULL) != expected || (pi != NULL && ((struct hashtestkey*)pi->key)->x != i)) {
+            DBG_PRINTF("picohash_oa_retrieve(%" PRIu64 ") returns %s\n", i, (pi == NULL) ? "NULL" : "item");
+            ret = -1;
+        }
+    }
+
+    /* Reinsert the odd values, reusing the deleted slots */
+    for (uint64_t i = 1; ret == 0 && i <= PICOHASH_OA_TEST_NB_ITEMS; i += 2) {
+        if (picohash_oa_insert(t, hashtest_item(i)) != 0) {
+            DBG_PRINTF("picohash_oa_insert(%" PRIu64 ") failed\n", i);
+            ret = -1;
+        }
+    }
+
+    for (uint64_t i = 1; ret == 0 && i <= PICOHASH_OA_TEST_NB_ITEMS; i++) {
+        hk.x = i;
+        if (picohash_oa_retrieve(t, &hk) == NULL) {
+            DBG_PRINTF("picohash_oa_retrieve(%" PRIu64 ") failed after reinsert\n", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && t->count != PICOHASH_OA_TEST_NB_ITEMS) {
+        DBG_PRINTF("picohash_oa table count != %d (count=%" PRIst ")\n", PICOHASH_OA_TEST_NB_ITEMS, t->count);
+        ret = -1;
+    }
+
+    /* Delete by key */
+    if (ret == 0) {
+        picohash_item* pi;
+
+        hk.x = 7;
+        pi = picohash_oa_retrieve(t, &hk);
+        picohash_oa_delete_key(t, (void*)pi->key, 1);
+        if (picohash_oa_retrieve(t, &hk) != NULL || t->count != PICOHASH_OA_TEST_NB_ITEMS - 1) {
+            DBG_PRINTF("%s", "picohash_oa_delete_key failed\n");
+            ret = -1;
+        }
+    }
+
+    if (t != NULL) {
+        picohash_oa_delete(t, 1);
+    }
+
+    return ret;
+}
+
+int picohash_oa_test()
+{
+    return(picohash_oa_test_one(0));
+}
+
+int picohash_oa_embedded_test()
+{
+    return(picohash_oa_test_one(1));
+}
+
+/* Lookups and deletions while a resize is in progress. In the middle of
+ * each migration, all the items inserted so far must be found. Then, the
+ * odd items are deleted while the last migration proceeds, and each
+ * deletion must find its item.
+ */
+#define PICOHASH_OA_RESIZE_TEST_NB_ITEMS 50000
+
+static int picohash_oa_resize_check(picohash_oa_table* t, uint64_t nb_items)
+{
+    int ret = 0;
+    struct hashtestkey hk;
+
+    for (uint64_t i = 1; ret == 0 && i <= nb_items; i++) {
+        hk.x = i;
+        if (picohash_oa_retrieve(t, &hk) == NULL) {
+            DBG_PRINTF("picohash_oa_retrieve(%" PRIu64 ") failed during resize\n", i);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int picohash_oa_resize_test()
+{
+    int ret = 0;
+    uint64_t nb_items = 0;
+    int nb_checks = 0;
+    struct hashtestkey hk;
+    picohash_oa_table* t = picohash_oa_create(16, hashtest_hash, hashtest_compare, hashtest_key_to_item);
+
+    if (t == NULL) {
+        DBG_PRINTF("%s", "picohash_oa_create() failed\n");
+        ret = -1;
+    }
+
+    while (ret == 0 && nb_items < PICOHASH_OA_RESIZE_TEST_NB_ITEMS) {
+        nb_items++;
+        if (picohash_oa_insert(t, hashtest_item(nb_items)) != 0) {
+            DBG_PRINTF("picohash_oa_insert(%" PRIu64 ") failed\n", nb_items);
+            ret = -1;
+        }
+        else if (t->previous.nb_groups > 1 && t->migrate_index == t->previous.nb_groups / 2) {
+            ret = picohash_oa_resize_check(t, nb_items);
+            nb_checks++;
+        }
+    }
+
+    if (ret == 0 && nb_checks == 0) {
+        DBG_PRINTF("%s", "No check during a resize\n");
+        ret = -1;
+    }
+
+    /* Keep inserting until a new migration starts, then delete while it proceeds */
+    while (ret == 0 && t->previous.nb_groups == 0) {
+        nb_items++;
+        ret = picohash_oa_insert(t, hashtest_item(nb_items));
+    }
+
+    for (uint64_t i = 1; ret == 0 && i <= nb_items; i += 2) {
+        size_t count = t->count;
+        picohash_item* pi;
+
+        hk.x = i;
+        if ((pi = picohash_oa_retrieve(t, &hk)) == NULL) {
+            DBG_PRINTF("picohash_oa_retrieve(%" PRIu64 ") failed before delete\n", i);
+            ret = -1;
+        }
+        else {
+            picohash_oa_delete_item(t, pi, 1);
+            if (t->count != count - 1) {
+                DBG_PRINTF("picohash_oa_delete_item(%" PRIu64 ") did not find the item\n", i);
+                ret = -1;
+            }
+        }
+    }
+
+    for (uint64_t i = 1; ret == 0 && i <= nb_items; i++) {
+        hk.x = i;
+        if ((picohash_oa_retrieve(t, &hk) != NULL) != ((i & 1) == 0)) {
+            DBG_PRINTF("picohash_oa_retrieve(%" PRIu64 ") unexpected after deletes\n", i);
+            ret = -1;
+        }
+    }
+
+    if (t != NULL) {
+        picohash_oa_delete(t, 1);
+    }
+
+    return ret;
+}
+
+/* Connection ID table benchmark.
+ * Compare the lookup rate of picohash and of the open addressing table,
+ * for tables holding nb_items 8 bytes connection IDs.
+ */
+typedef struct st_cid_bench_key_t {
+    picoquic_connection_id_t cid;
+    picohash_item item;
+} cid_bench_key_t;
+
+static uint64_t cid_bench_hash(const void* key)
+{
+    return picoquic_connection_id_hash(&((const cid_bench_key_t*)key)->cid);
+}
+
+static int cid_bench_compare(const void* key1, const void* key2)
+{
+    return picoquic_compare_connection_id(&((const cid_bench_key_t*)key1)->cid, &((const cid_bench_key_t*)key2)->cid);
+}
+
+static picohash_item* cid_bench_key_to_item(const void* key)
+{
+    return &((cid_bench_key_t*)key)->item;
+}
+
+int cid_table_bench(size_t nb_items, size_t nb_lookups, double* picohash_rate, double* oa_rate)
+{
+    int ret = 0;
+    uint64_t random_context = 0xC1DB3AC4;
+    cid_bench_key_t* keys = (cid_bench_key_t*)malloc(nb_items * sizeof(cid_bench_key_t));
+    cid_bench_key_t* keys_oa = (cid_bench_key_t*)malloc(nb_items * sizeof(cid_bench_key_t));
+    picoquic_connection_id_t* cids = (picoquic_connection_id_t*)malloc(nb_items * sizeof(picoquic_connection_id_t));
+    picohash_table* t = picohash_create_ex(nb_items, cid_bench_hash, cid_bench_compare, cid_bench_key_to_item);
+    picohash_oa_table* t_oa = picohash_oa_create(16, cid_bench_hash, cid_bench_compare, cid_bench_key_to_item);
+
+    if (keys == NULL || keys_oa == NULL || cids == NULL || t == NULL || t_oa == NULL) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_items; i++) {
+        memset(&keys[i], 0, sizeof(cid_bench_key_t));
+        picoquic_test_random_bytes(&random_context, keys[i].cid.id, 8);
+        keys[i].cid.id_len = 8;
+        keys_oa[i] = keys[i];
+        cids[i] = keys[i].cid;
+        if (picohash_insert(t, &keys[i]) != 0 || picohash_oa_insert(t_oa, &keys_oa[i]) != 0) {
+            ret = -1;
+        }
+    }
+
+    for (int pass = 0; ret == 0 && pass < 2; pass++) {
+        uint64_t start_time = picoquic_current_time();
+        uint64_t elapsed;
+        uint64_t x = 0x12345;
+
+        for (size_t i = 0; i < nb_lookups; i++) {
+            cid_bench_key_t key;
+            picohash_item* item;
+
+            /* Pseudo random access order, to defeat the caches. The searched
+             * CID is copied from a separate array, so the table entry is not
+             * brought in the cache before the lookup. */
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+            key.cid = cids[(x >> 33) % nb_items];
+            item = (pass == 0) ? picohash_retrieve(t, &key) : picohash_oa_retrieve(t_oa, &key);
+            if (item == NULL) {
+                DBG_PRINTF("Lookup %zu fails in %s", i, (pass == 0) ? "picohash" : "picohash_oa");
+                ret = -1;
+                break;
+            }
+        }
+        elapsed = picoquic_current_time() - start_time;
+        if (elapsed == 0) {
+            elapsed = 1;
+        }
+        *((pass == 0) ? picohash_rate : oa_rate) = ((double)nb_lookups * 1000000.0) / (double)elapsed;
+    }
+
+    if (t != NULL) {
+        picohash_delete(t, 0);
+    }
+    if (t_oa != NULL) {
+        picohash_oa_delete(t_oa, 0);
+    }
+    free(keys);
+    free(keys_oa);
+    free(cids);
+
+    return ret;
+}
+
+int cid_table_bench_test()
+{
+    double picohash_rate = 0;
+    double oa_rate = 0;
+    int ret = cid_table_bench(10000, 100000, &picohash_rate, &oa_rate);
+
+    if (ret == 0) {
+        DBG_PRINTF("10k CIDs: picohash %.0f lookups/s, picohash_oa %.0f lookups/s", picohash_rate, oa_rate);
+    }
+
+    return ret;
+}
+
+/* Run the benchmark for 10k, 100k and 1M connection IDs, and print the results */
+int cid_table_bench_report(FILE* F)
+{
+    int ret = 0;
+    const size_t nb_items[3] = { 10000, 100000, 1000000 };
+
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        double picohash_rate = 0;
+        double oa_rate = 0;
+
+        if ((ret = cid_table_bench(nb_items[i], 10000000, &picohash_rate, &oa_rate)) == 0) {
+            fprintf(F, "%zu CIDs: picohash %.0f lookups/s, picohash_oa %.0f lookups/s (x%.2f)\n",
+                nb_items[i], picohash_rate, oa_rate, oa_rate / picohash_rate);
+        }
+    }
+
+    return ret;
+}
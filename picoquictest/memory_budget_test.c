@@ -0,0 +1,394 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+int picoquic_queue_network_input(picoquic_quic_t* quic, picoquic_cnx_t* cnx, picosplay_tree_t* tree, uint64_t consumed_offset,
+    uint64_t frame_data_offset, const uint8_t* bytes, size_t length, picoquic_stream_data_node_t* received_data, int* new_data_available);
+const uint8_t* picoquic_decode_blocked_frame(picoquic_cnx_t* cnx, const uint8_t* bytes, const uint8_t* bytes_max);
+const uint8_t* picoquic_decode_stream_blocked_frame(picoquic_cnx_t* cnx, const uint8_t* bytes, const uint8_t* bytes_max);
+
+/* Verify that the context statistics are the sum of the connection statistics */
+static int memory_budget_check_sum(picoquic_quic_t* quic, picoquic_cnx_t** cnx, int nb_cnx)
+{
+    int ret = 0;
+    picoquic_memory_stats_t quic_stats;
+    picoquic_memory_stats_t cnx_stats;
+    uint64_t sum[picoquic_memory_nb_categories] = { 0, 0, 0 };
+
+    picoquic_get_memory_stats(quic, &quic_stats);
+    for (int i = 0; i < nb_cnx; i++) {
+        picoquic_get_cnx_memory_stats(cnx[i], &cnx_stats);
+        sum[picoquic_memory_send_queue] += cnx_stats.send_queue_bytes;
+        sum[picoquic_memory_reassembly] += cnx_stats.reassembly_bytes;
+        sum[picoquic_memory_retransmit] += cnx_stats.retransmit_bytes;
+    }
+    if (quic_stats.send_queue_bytes != sum[picoquic_memory_send_queue] ||
+        quic_stats.reassembly_bytes != sum[picoquic_memory_reassembly] ||
+        quic_stats.retransmit_bytes != sum[picoquic_memory_retransmit] ||
+        quic_stats.total_bytes != picoquic_memory_total(sum)) {
+        DBG_PRINTF("%s", "Context memory is not the sum of connection memory");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Charge the send queue, the reassembly tree and the retransmit queue of
+ * connections, verify the accounting, then verify that everything is
+ * released when the connections are deleted. */
+static int memory_accounting_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t data[2048];
+    picoquic_cnx_t* cnx[2] = { NULL, NULL };
+    picoquic_memory_stats_t stats;
+    struct sockaddr_in addr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    memset(data, 0x5a, sizeof(data));
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        ret = -1;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        addr.sin_port = (uint16_t)(1000 + i);
+        cnx[i] = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, NULL, NULL, 1);
+        if (cnx[i] == NULL) {
+            DBG_PRINTF("Cannot create connection %d", i);
+            ret = -1;
+        }
+    }
+
+    /* Send queue: two nodes on the first connection */
+    if (ret == 0 && (picoquic_add_to_stream(cnx[0], 0, data, 1000, 0) != 0 ||
+        picoquic_add_to_stream(cnx[0], 4, data, 100, 1) != 0)) {
+        DBG_PRINTF("%s", "Cannot queue stream data");
+        ret = -1;
+    }
+    if (ret == 0) {
+        picoquic_get_cnx_memory_stats(cnx[0], &stats);
+        if (stats.send_queue_bytes != 2 * sizeof(picoquic_stream_queue_node_t) + 1100) {
+            DBG_PRINTF("Send queue holds %" PRIu64 " bytes", stats.send_queue_bytes);
+            ret = -1;
+        }
+    }
+
+    /* Reassembly: out of order fragments on the second connection */
+    if (ret == 0) {
+        picoquic_stream_head_t* stream = picoquic_create_missing_streams(cnx[1], 1, 1);
+        int new_data_available = 0;
+
+        if (stream == NULL) {
+            DBG_PRINTF("%s", "Cannot create remote stream");
+            ret = -1;
+        }
+        else if (picoquic_queue_network_input(quic, cnx[1], &stream->stream_data_tree, 0, 100, data, 200, NULL, &new_data_available) != 0 ||
+            picoquic_queue_network_input(quic, cnx[1], &stream->stream_data_tree, 0, 1000, data, 300, NULL, &new_data_available) != 0) {
+            DBG_PRINTF("%s", "Cannot queue received data");
+            ret = -1;
+        }
+        else {
+            picoquic_get_cnx_memory_stats(cnx[1], &stats);
+            if (stats.reassembly_bytes < 500 || stats.send_queue_bytes != 0) {
+                DBG_PRINTF("Reassembly holds %" PRIu64 " bytes", stats.reassembly_bytes);
+                ret = -1;
+            }
+            else {
+                /* Filling the gap merges the nodes and does not leak the charge */
+                uint64_t before = stats.reassembly_bytes;
+                if (picoquic_queue_network_input(quic, cnx[1], &stream->stream_data_tree, 0, 300, data, 700, NULL, &new_data_available) != 0) {
+                    ret = -1;
+                }
+                else {
+                    picoquic_get_cnx_memory_stats(cnx[1], &stats);
+                    if (stats.reassembly_bytes < 1200 || stats.reassembly_bytes > before + 1200) {
+                        DBG_PRINTF("Reassembly holds %" PRIu64 " bytes after merge", stats.reassembly_bytes);
+                        ret = -1;
+                    }
+                }
+            }
+        }
+    }
+
+    /* Retransmit queue: a small packet on each connection */
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        picoquic_packet_t* packet = picoquic_create_packet(quic);
+
+        if (packet == NULL) {
+            ret = -1;
+        }
+        else {
+            packet->length = 100;
+            packet->ptype = picoquic_packet_initial;
+            packet->pc = picoquic_packet_context_initial;
+            packet->send_path = cnx[i]->path[0];
+            picoquic_queue_for_retransmit(cnx[i], cnx[i]->path[0], packet, packet->length, simulated_time);
+            picoquic_get_cnx_memory_stats(cnx[i], &stats);
+            if (stats.retransmit_bytes != sizeof(picoquic_packet_t) + packet->bytes_max) {
+                DBG_PRINTF("Retransmit queue holds %" PRIu64 " bytes", stats.retransmit_bytes);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = memory_budget_check_sum(quic, cnx, 2);
+    }
+
+    if (ret == 0) {
+        picoquic_get_memory_stats(quic, &stats);
+        if (stats.packet_pool_bytes == 0 || stats.memory_budget != 0 || picoquic_is_memory_budget_exceeded(quic)) {
+            DBG_PRINTF("%s", "Unexpected context memory stats");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (cnx[i] != NULL) {
+            picoquic_delete_cnx(cnx[i]);
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_memory_stats(quic, &stats);
+        if (stats.total_bytes != 0 || stats.send_queue_bytes != 0 || stats.reassembly_bytes != 0 ||
+            stats.retransmit_bytes != 0) {
+            DBG_PRINTF("%" PRIu64 " bytes still charged after deleting connections", stats.total_bytes);
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Verify the shrinking of the flow control windows as memory use grows,
+ * and the refusal of new connections when the budget is exceeded. */
+static int memory_pressure_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t budget = 1000000;
+    uint64_t window = 0x100000;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        return -1;
+    }
+
+    if (picoquic_memory_pressure_window(quic, window) != window) {
+        DBG_PRINTF("%s", "Window reduced without budget");
+        ret = -1;
+    }
+
+    picoquic_set_memory_budget(quic, budget);
+    quic->memory_bytes[picoquic_memory_reassembly] = budget / 4;
+    if (ret == 0 && picoquic_memory_pressure_window(quic, window) != window) {
+        DBG_PRINTF("%s", "Window reduced below half budget");
+        ret = -1;
+    }
+
+    quic->memory_bytes[picoquic_memory_send_queue] = budget / 2;
+    if (ret == 0) {
+        uint64_t reduced = picoquic_memory_pressure_window(quic, window);
+        if (reduced >= window || reduced < window / 2 - 1 || reduced > window / 2 + 1 ||
+            picoquic_is_memory_budget_exceeded(quic)) {
+            DBG_PRINTF("Window %" PRIu64 " at 3/4 of budget", reduced);
+            ret = -1;
+        }
+    }
+
+    quic->memory_bytes[picoquic_memory_retransmit] = budget / 2;
+    if (ret == 0 && (picoquic_memory_pressure_window(quic, window) != PICOQUIC_MEMORY_PRESSURE_WINDOW_MIN ||
+        picoquic_memory_pressure_window(quic, 1000) != 1000 || !picoquic_is_memory_budget_exceeded(quic))) {
+        DBG_PRINTF("%s", "Window not at minimum over budget");
+        ret = -1;
+    }
+
+    memset(quic->memory_bytes, 0, sizeof(quic->memory_bytes));
+    picoquic_free(quic);
+
+    return ret;
+}
+
+int memory_budget_test()
+{
+    int ret = memory_accounting_test();
+
+    if (ret == 0) {
+        ret = memory_pressure_test();
+    }
+
+    return ret;
+}
+
+/* Verify the auto tuning of the receive windows: growth to twice the data
+ * drained per RTT, cap at the configured maximum, reduction under memory
+ * pressure, update of the stream limits, and blocked frame statistics. */
+int flow_control_autotune_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t window_max = 0x4000000;
+    uint64_t initial_window;
+    uint64_t window;
+    uint8_t buffer[256];
+    uint8_t blocked[] = { picoquic_frame_type_data_blocked, 0x10 };
+    uint8_t stream_blocked[] = { picoquic_frame_type_stream_data_blocked, 0x00, 0x10 };
+    picoquic_flow_control_stats_t stats;
+    picoquic_stream_head_t* stream = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in addr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    picoquic_set_flow_control_autotune(quic, window_max);
+    cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&addr, simulated_time, 0, NULL, NULL, 1);
+    if (cnx == NULL) {
+        DBG_PRINTF("%s", "Cannot create connection");
+        ret = -1;
+    }
+    else {
+        cnx->path[0]->smoothed_rtt = 10000;
+        initial_window = cnx->local_parameters.initial_max_data;
+
+        /* The window starts at the initial value, and does not grow within an RTT */
+        window = picoquic_fc_autotune_window(cnx, &cnx->fc_autotune, 0, initial_window, simulated_time);
+        simulated_time += 5000;
+        if (window != initial_window ||
+            picoquic_fc_autotune_window(cnx, &cnx->fc_autotune, initial_window, initial_window, simulated_time) != initial_window) {
+            DBG_PRINTF("%s", "Unexpected initial window");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Twice the initial window drained in 10 ms, i.e., one RTT */
+        simulated_time += 5000;
+        window = picoquic_fc_autotune_window(cnx, &cnx->fc_autotune, 2 * initial_window, initial_window, simulated_time);
+        if (window != 4 * initial_window || cnx->nb_fc_window_increases != 1) {
+            DBG_PRINTF("Window %" PRIu64 " after first RTT", window);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Draining faster than the cap */
+        simulated_time += 10000;
+        window = picoquic_fc_autotune_window(cnx, &cnx->fc_autotune, 2 * window_max, initial_window, simulated_time);
+        if (window != window_max || cnx->nb_fc_window_increases != 2) {
+            DBG_PRINTF("Window %" PRIu64 " not capped", window);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Under memory pressure, the window is reduced but the tuned value is kept */
+        picoquic_set_memory_budget(quic, 1000000);
+        quic->memory_bytes[picoquic_memory_send_queue] = 750000;
+        window = picoquic_fc_autotune_window(cnx, &cnx->fc_autotune, 2 * window_max, initial_window, simulated_time);
+        if (window >= window_max || cnx->fc_autotune.window != window_max) {
+            DBG_PRINTF("Window %" PRIu64 " under memory pressure", window);
+            ret = -1;
+        }
+        quic->memory_bytes[picoquic_memory_send_queue] = 0;
+        picoquic_set_memory_budget(quic, 0);
+    }
+
+    if (ret == 0) {
+        /* The stream limit is raised when less than half the window remains */
+        int more_data = 0;
+        int is_pure_ack = 1;
+        uint64_t maxdata_local;
+
+        if ((stream = picoquic_create_stream(cnx, 0)) == NULL) {
+            DBG_PRINTF("%s", "Cannot create stream");
+            ret = -1;
+        }
+        else if (picoquic_is_max_stream_data_needed(cnx, stream)) {
+            DBG_PRINTF("%s", "Stream update needed before any data");
+            ret = -1;
+        }
+        else {
+            maxdata_local = stream->maxdata_local;
+            stream->consumed_offset = maxdata_local - 1;
+            if (!picoquic_is_max_stream_data_needed(cnx, stream) ||
+                picoquic_format_required_max_stream_data_frames(cnx, buffer, buffer + sizeof(buffer),
+                    &more_data, &is_pure_ack, simulated_time) == buffer ||
+                buffer[0] != picoquic_frame_type_max_stream_data ||
+                stream->maxdata_local < stream->consumed_offset + maxdata_local) {
+                DBG_PRINTF("%s", "Stream limit not raised");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_flow_control_stats(cnx, &stats);
+        if (stats.max_data_window != window_max || stats.nb_window_increases != 2 ||
+            stats.nb_data_blocked_received != 0 || stats.nb_stream_data_blocked_received != 0) {
+            DBG_PRINTF("%s", "Unexpected flow control statistics");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (picoquic_decode_blocked_frame(cnx, blocked, blocked + sizeof(blocked)) == NULL ||
+        picoquic_decode_stream_blocked_frame(cnx, stream_blocked, stream_blocked + sizeof(stream_blocked)) == NULL)) {
+        DBG_PRINTF("%s", "Cannot decode blocked frames");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_get_flow_control_stats(cnx, &stats);
+        if (stats.nb_data_blocked_received != 1 || stats.nb_stream_data_blocked_received != 1) {
+            DBG_PRINTF("%s", "Blocked frames not counted");
+            ret = -1;
+        }
+    }
+
+    picoquic_free(quic);
+
+    return ret;
+}
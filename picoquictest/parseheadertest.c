@@ -653,7 +653,7 @@ int test_packet_encrypt_one(
     picoquic_path_t * path_x = cnx_client->path[0];
     uint64_t current_time = 0;
     picoquic_packet_header expected_header;
-    picoquic_packet_t * packet = (picoquic_packet_t *) malloc(sizeof(picoquic_packet_t));
+    picoquic_packet_t * packet = picoquic_create_packet(cnx_client->quic);
     picoquic_packet_context_enum pc = 0;
     picoquic_packet_context_t* pkt_ctx;
 
@@ -664,7 +664,6 @@ int test_packet_encrypt_one(
     else {
         pkt_ctx = (ptype == picoquic_packet_1rtt_protected && cnx_client->is_multipath_enabled) ?
             &path_x->p_remote_cnxid->pkt_ctx : &cnx_client->pkt_ctx[pc];
-        memset(packet, 0, sizeof(picoquic_packet_t));
         memset(packet->bytes, 0xbb, length);
         header_length = picoquic_predict_packet_header_length(cnx_client, ptype, pkt_ctx);
         packet->ptype = ptype;
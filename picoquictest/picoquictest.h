@@ -41,6 +41,10 @@ int util_memcmp_test();
 int util_threading_test();
 int picohash_test();
 int picohash_embedded_test();
+int picohash_oa_test();
+int picohash_oa_embedded_test();
+int picohash_oa_resize_test();
+int cid_table_bench_test();
 int bytestream_test();
 int cnxcreation_test();
 int parseheadertest();
@@ -85,6 +89,10 @@ int stateless_reset_handshake_test();
 int immediate_close_test();
 int sim_link_test();
 int tls_api_very_long_stream_test();
+int zero_copy_send_test();
+int protect_batch_test();
+int receive_batch_test();
+int stream_data_borrow_test();
 int tls_api_very_long_max_test();
 int tls_api_very_long_with_err_test();
 int tls_api_very_long_congestion_test();
@@ -105,6 +113,8 @@ int skip_frame_test();
 int keep_alive_test();
 int logger_test();
 int binlog_test();
+int binlog_index_test();
+int binlog_async_test();
 int app_message_overflow_test();
 int socket_test();
 int test_stateless_blowback();
@@ -112,6 +122,11 @@ int ticket_store_test();
 int ticket_seed_test();
 int ticket_seed_from_bdp_frame_test();
 int token_store_test();
+int ticket_index_test();
+int token_index_test();
+int anti_replay_test();
+int memory_budget_test();
+int flow_control_autotune_test();
 int session_resume_test();
 int zero_rtt_test();
 int zero_rtt_loss_test();
@@ -152,6 +167,8 @@ int client_error_test();
 int client_only_test();
 int packet_enc_dec_test();
 int cleartext_pn_vector_test();
+int protect_batch_vector_test();
+int protect_batch_bench_test();
 int zero_rtt_spurious_test();
 int zero_rtt_retry_test();
 int zero_rtt_no_coal_test();
@@ -164,6 +181,8 @@ int cnx_stress_unit_test();
 int cnx_stress_do_test(uint64_t duration, int nb_clients, int do_report);
 int cnx_ddos_unit_test();
 int cnx_ddos_test_loop(int nb_connections, uint64_t ddos_interval, const char* qlogdir);
+int cid_table_bench_report(FILE* F);
+int protect_batch_bench_report(FILE* F);
 int splay_test();
 int TlsStreamFrameTest();
 int draft17_vector_test();
@@ -276,6 +295,13 @@ int optimistic_ack_test();
 int optimistic_hole_test();
 int document_addresses_test();
 int socket_ecn_test();
+int socket_batch_test();
+int socket_send_batch_test();
+int socket_event_test();
+int socket_sharded_loop_test();
+int slab_test();
+int stateless_pool_test();
+int wheel_test();
 int null_sni_test();
 int preferred_address_test();
 int preferred_address_dis_mig_test();
@@ -291,11 +317,15 @@ int bad_coalesce_test();
 int bad_cnxid_test();
 int stream_splay_test();
 int stream_output_test();
+int stream_output_sched_test();
 int stream_rank_test();
+int stream_table_test();
 int not_before_cnxid_test();
 int send_stream_blocked_test();
 int stream_ack_test();
+int stream_ref_test();
 int queue_network_input_test();
+int stream_reassembly_test();
 int fastcc_test();
 int fastcc_jitter_test();
 int bbr_test();
@@ -327,6 +357,7 @@ int datagram_small_test();
 int datagram_small_new_test();
 int datagram_small_packet_test();
 int datagram_wifi_test();
+int datagram_ring_test();
 int ddos_amplification_test();
 int ddos_amplification_0rtt_test();
 int ddos_amplification_8k_test();
@@ -426,6 +457,8 @@ int grease_quic_bit_test();
 int grease_quic_bit_one_way_test();
 int pn_random_test();
 int port_blocked_test();
+int admission_test();
+int initial_flood_test();
 int red_cc_test();
 int multi_segment_test();
 int pacing_cc_test();
@@ -462,6 +495,7 @@ int h09_multi_file_test();
 int h09_multi_file_loss_test();
 int h09_multi_file_preemptive_test();
 int h3zero_settings_test();
+int h3zero_priority_test();
 int picowt_baton_basic_test();
 int picowt_baton_error_test();
 int picowt_baton_long_test();
@@ -162,6 +162,7 @@ typedef struct st_picoquic_test_endpoint_t {
     uint64_t prepare_cpu_time;
     uint64_t incoming_cpu_time;
     size_t packet_queue_max;
+    int use_batch_receive; /* Process the queued packets with picoquic_incoming_packet_batch */
     /* next time endpoint ready */
     uint64_t next_time_ready;
     /* last time client sent something */
@@ -180,6 +181,14 @@ typedef struct st_test_api_callback_t {
     uint32_t nb_bytes_received;
 } test_api_callback_t;
 
+/* Stream data retained by the application in borrowing tests */
+typedef struct st_test_api_borrowed_t {
+    picoquic_stream_data_ref_t* ref;
+    uint8_t* bytes;
+    uint8_t* copy;
+    size_t length;
+} test_api_borrowed_t;
+
 typedef struct st_picoquic_test_tls_api_ctx_t {
     picoquic_quic_t* qclient;
     picoquic_quic_t* qserver;
@@ -223,6 +232,15 @@ typedef struct st_picoquic_test_tls_api_ctx_t {
     int streams_finished;
     int reset_received;
     int immediate_exit;
+    /* Queue stream data with the zero copy API, count released buffers */
+    int use_zero_copy;
+    int nb_zero_copy_released;
+    /* Retain received stream data instead of copying it */
+    int use_borrowed_data;
+    int nb_borrow_failed;
+    size_t nb_borrowed;
+    size_t nb_borrowed_alloc;
+    test_api_borrowed_t* borrowed;
 
     /* Blackhole period if needed */
     uint64_t blackhole_start;
@@ -536,6 +536,14 @@ static uint8_t test_frame_type_bad_frame_id[] = {
     0x08, 0x02, 0x04, 0x8F, 0xFF, 0xFF, 0xFF, 1, 2, 3, 4
 };
 
+/* The stream reference frame is internal, it must be rejected on the wire */
+static uint8_t test_frame_type_stream_ref_received[] = {
+    picoquic_frame_type_stream_ref, 0,
+    0, 0, 0, 0, 0, 0, 0, 4,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 16
+};
+
 static uint8_t test_frame_type_bad_ack_first_range[] = {
     0x02, 0x02, 0x00, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00
 };
@@ -572,7 +580,8 @@ test_skip_frames_t test_frame_error_list[] = {
     TEST_SKIP_ITEM("bad_bdp", test_frame_type_bdp_bad, 1, 0, 3, ERR_F, 0),
     TEST_SKIP_ITEM("bad_bdp_addr", test_frame_type_bdp_bad_addr, 1, 0, 3, ERR_F, 0),
     TEST_SKIP_ITEM("bad_bdp_length", test_frame_type_bdp_bad_length, 1, 0, 3, ERR_F, 1),
-    TEST_SKIP_ITEM("bad_frame_id", test_frame_type_bad_frame_id, 1, 0, 3, ERR_F, 1)
+    TEST_SKIP_ITEM("bad_frame_id", test_frame_type_bad_frame_id, 1, 0, 3, ERR_F, 1),
+    TEST_SKIP_ITEM("stream_ref_received", test_frame_type_stream_ref_received, 0, 0, 3, ERR_F, 1)
 };
 
 size_t nb_test_frame_error_list = sizeof(test_frame_error_list) / sizeof(test_skip_frames_t);
@@ -705,6 +714,18 @@ int skip_frame_test()
         }
     }
 
+    /* Stream reference frames are only skipped in the packets that we sent */
+    if (ret == 0) {
+        size_t consumed = 0;
+        int pure_ack = 1;
+
+        if (picoquic_skip_sent_frame(test_frame_type_stream_ref_received, sizeof(test_frame_type_stream_ref_received),
+            &consumed, &pure_ack) != 0 || consumed != PICOQUIC_STREAM_REF_FRAME_SIZE || pure_ack != 0) {
+            DBG_PRINTF("%s", "Cannot skip stream reference frame in sent packet\n");
+            ret = -1;
+        }
+    }
+
     /* Do a minimal fuzz test */
     for (size_t i = 0; ret == 0 && i < 100; i++) {
         size_t bytes_max = format_random_packet(buffer, sizeof(buffer), &random_context, -1);
@@ -1418,6 +1439,546 @@ int binlog_test()
     return ret;
 }
 
+/* Wrap test of the asynchronous binary log. Two connections log to their own
+ * file through a small ring. The log file of the first connection is locked,
+ * which blocks the writer thread in fwrite until it is released, so the ring
+ * is guaranteed to fill up: the producer either waits or drops events.
+ */
+#define BINLOG_ASYNC_WRAP_NB_EVENTS 512
+
+#ifdef _WINDOWS
+#define binlog_async_lock_file(f) _lock_file(f)
+#define binlog_async_unlock_file(f) _unlock_file(f)
+#else
+#define binlog_async_lock_file(f) flockfile(f)
+#define binlog_async_unlock_file(f) funlockfile(f)
+#endif
+
+typedef struct st_binlog_async_lock_t {
+    FILE* f;
+    int is_locked;
+    picoquic_mutex_t mutex;
+    picoquic_event_t timer; /* never signaled, only used to sleep */
+} binlog_async_lock_t;
+
+/* The file lock is owned by the thread that takes it, so a separate thread
+ * takes it and releases it while the producer waits for space in the ring. */
+static picoquic_thread_return_t binlog_async_lock_thread(void* vctx)
+{
+    binlog_async_lock_t* ctx = (binlog_async_lock_t*)vctx;
+
+    binlog_async_lock_file(ctx->f);
+    (void)picoquic_lock_mutex(&ctx->mutex);
+    ctx->is_locked = 1;
+    (void)picoquic_unlock_mutex(&ctx->mutex);
+    /* Hold the lock long enough for the producer to fill the ring */
+    (void)picoquic_wait_for_event(&ctx->timer, 200000);
+    binlog_async_unlock_file(ctx->f);
+
+    picoquic_thread_do_return;
+}
+
+static int binlog_async_wrap_test_one(picoquic_binlog_drop_policy_enum drop_policy, picoquic_binlog_async_stats_t* stats)
+{
+    int ret = 0;
+    char const* file_name[2] = { "binlog_async_wrap_1.log", "binlog_async_wrap_2.log" };
+    FILE* f[2] = { NULL, NULL };
+    uint8_t msg[512];
+    binlog_async_lock_t lock_ctx;
+    picoquic_thread_t thread;
+    int is_thread_created = 0;
+    picoquic_binlog_ring_t* ring = NULL;
+
+    memset(msg, 0x5a, sizeof(msg));
+    memset(&lock_ctx, 0, sizeof(lock_ctx));
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if ((f[i] = picoquic_file_open(file_name[i], "wb")) == NULL) {
+            DBG_PRINTF("Cannot open %s", file_name[i]);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (ring = picoquic_binlog_ring_create(0, drop_policy)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        lock_ctx.f = f[0];
+        if (drop_policy == picoquic_binlog_drop_newest) {
+            binlog_async_lock_file(f[0]);
+        }
+        else if (picoquic_create_mutex(&lock_ctx.mutex) != 0) {
+            ret = -1;
+        }
+        else if (picoquic_create_event(&lock_ctx.timer) != 0) {
+            (void)picoquic_delete_mutex(&lock_ctx.mutex);
+            ret = -1;
+        }
+        else if (picoquic_create_thread(&thread, binlog_async_lock_thread, &lock_ctx) != 0) {
+            picoquic_delete_event(&lock_ctx.timer);
+            (void)picoquic_delete_mutex(&lock_ctx.mutex);
+            ret = -1;
+        }
+        else {
+            int is_locked = 0;
+
+            is_thread_created = 1;
+            while (!is_locked) {
+                (void)picoquic_lock_mutex(&lock_ctx.mutex);
+                is_locked = lock_ctx.is_locked;
+                (void)picoquic_unlock_mutex(&lock_ctx.mutex);
+                if (!is_locked) {
+                    (void)picoquic_wait_for_event(&lock_ctx.timer, 1000);
+                }
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Vary the length of the events so that records wrap at the end of the ring */
+        for (size_t i = 0; i < BINLOG_ASYNC_WRAP_NB_EVENTS; i++) {
+            uint8_t head[4];
+
+            picoformat_32(head, (uint32_t)i);
+            (void)picoquic_binlog_ring_write(ring, f[i % 2], head, sizeof(head), msg, 256 + (i * 37) % 256);
+        }
+        if (drop_policy == picoquic_binlog_drop_newest) {
+            binlog_async_unlock_file(f[0]);
+        }
+        for (int i = 0; i < 2; i++) {
+            picoquic_binlog_ring_close_file(ring, f[i], NULL, NULL);
+            f[i] = NULL;
+        }
+        picoquic_binlog_ring_flush(ring);
+        picoquic_binlog_ring_get_stats(ring, stats);
+    }
+
+    if (is_thread_created) {
+        picoquic_delete_thread(&thread);
+        picoquic_delete_event(&lock_ctx.timer);
+        (void)picoquic_delete_mutex(&lock_ctx.mutex);
+    }
+
+    if (ring != NULL) {
+        picoquic_binlog_ring_delete(ring);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (f[i] != NULL) {
+            (void)picoquic_file_close(f[i]);
+        }
+    }
+
+    if (ret == 0) {
+        /* The files hold all the bytes queued for the two connections */
+        uint64_t file_bytes = 0;
+
+        for (int i = 0; ret == 0 && i < 2; i++) {
+            FILE* F = picoquic_file_open(file_name[i], "rb");
+            if (F == NULL) {
+                ret = -1;
+            }
+            else {
+                (void)fseek(F, 0, SEEK_END);
+                file_bytes += (uint64_t)ftell(F);
+                (void)picoquic_file_close(F);
+            }
+        }
+        if (ret == 0 && (file_bytes != stats->nb_bytes_written || stats->nb_bytes_written != stats->nb_bytes_queued ||
+            stats->nb_files_closed != 2 || stats->nb_events_queued + stats->nb_events_dropped != BINLOG_ASYNC_WRAP_NB_EVENTS ||
+            stats->bytes_queued_max > stats->ring_size)) {
+            DBG_PRINTF("Unexpected wrap stats, files: %" PRIu64 ", written: %" PRIu64 "/%" PRIu64 ", closed: %" PRIu64,
+                file_bytes, stats->nb_bytes_written, stats->nb_bytes_queued, stats->nb_files_closed);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Conversion callback of the asynchronous log test. The writer thread must
+ * call it after closing the file, with a copy of the queued request. */
+static char const* binlog_async_convert_file = "binlog_async_convert.log";
+static int binlog_async_nb_conversions = 0;
+
+static int binlog_async_convert(picoquic_autoqlog_request_t const* request)
+{
+    int ret = -1;
+    FILE* f = picoquic_file_open(request->binlog_file_name, "rb");
+
+    if (f != NULL) {
+        uint8_t buffer[64];
+        size_t nb_read = fread(buffer, 1, sizeof(buffer), f);
+
+        if (nb_read == 48 && strcmp(request->qlog_dir, ".") == 0 && request->log_unique == 0x1234 &&
+            request->client_mode && request->cid.id_len == 4 && request->cid.id[3] == 4) {
+            binlog_async_nb_conversions++;
+            ret = 0;
+        }
+        (void)picoquic_file_close(f);
+    }
+
+    return ret;
+}
+
+static int binlog_async_convert_test()
+{
+    int ret = 0;
+    picoquic_binlog_ring_t* ring = picoquic_binlog_ring_create(0, picoquic_binlog_drop_newest);
+    FILE* f = picoquic_file_open(binlog_async_convert_file, "wb");
+    char file_name[64];
+    picoquic_autoqlog_request_t request;
+    const picoquic_connection_id_t cid = { { 1, 2, 3, 4 }, 4 };
+    uint8_t head[16];
+    uint8_t msg[32];
+
+    binlog_async_nb_conversions = 0;
+    memset(head, 0x11, sizeof(head));
+    memset(msg, 0x22, sizeof(msg));
+    memset(&request, 0, sizeof(picoquic_autoqlog_request_t));
+    /* The request strings are copied in the ring, the caller may free them */
+    (void)picoquic_sprintf(file_name, sizeof(file_name), NULL, "%s", binlog_async_convert_file);
+    request.cid = cid;
+    request.binlog_file_name = file_name;
+    request.qlog_dir = ".";
+    request.log_unique = 0x1234;
+    request.client_mode = 1;
+
+    if (ring == NULL || f == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_binlog_ring_write(ring, f, head, sizeof(head), msg, sizeof(msg)) != 0) {
+        ret = -1;
+    }
+    else {
+        picoquic_binlog_ring_close_file(ring, f, binlog_async_convert, &request);
+        f = NULL;
+        memset(file_name, 0, sizeof(file_name));
+        picoquic_binlog_ring_flush(ring);
+        if (binlog_async_nb_conversions != 1) {
+            DBG_PRINTF("Expected 1 conversion after the close, got %d", binlog_async_nb_conversions);
+            ret = -1;
+        }
+    }
+
+    if (f != NULL) {
+        (void)picoquic_file_close(f);
+    }
+    if (ring != NULL) {
+        picoquic_binlog_ring_delete(ring);
+    }
+
+    return ret;
+}
+
+/* Test of the asynchronous binary log. The events logged through the
+ * connection are written by the background thread, and the resulting
+ * file must match the reference log of the synchronous test. Events that
+ * do not fit in the ring are dropped and counted.
+ */
+int binlog_async_test()
+{
+    int ret = 0;
+    char log_test_ref[512];
+    uint64_t simulated_time = 0;
+    picoquic_binlog_async_stats_t stats;
+    const picoquic_connection_id_t initial_cid = {
+        { 1, 2, 3, 4 }, 4
+    };
+    const picoquic_connection_id_t dest_cid = {
+        { 5, 6, 7, 8 }, 4
+    };
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if (picoquic_get_input_path(log_test_ref, sizeof(log_test_ref), picoquic_solution_dir, BINLOG_TEST_REF) != 0) {
+        DBG_PRINTF("%s", "Cannot set the log ref file name.\n");
+        ret = -1;
+    }
+    else if (picoquic_set_binlog(quic, ".") != 0 ||
+        picoquic_set_binlog_async(quic, PICOQUIC_BINLOG_RING_SIZE_MIN, picoquic_binlog_wait_for_space) != 0) {
+        DBG_PRINTF("%s", "Cannot set the asynchronous binary log.\n");
+        ret = -1;
+    }
+    else {
+        struct sockaddr_in saddr;
+        picoquic_cnx_t* cnx;
+
+        picoquic_set_default_spinbit_policy(quic, picoquic_spinbit_null);
+        memset(&saddr, 0, sizeof(struct sockaddr_in));
+        cnx = picoquic_create_cnx(quic, initial_cid, dest_cid, (struct sockaddr*)&saddr,
+            simulated_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create QUIC CNX context\n");
+            ret = -1;
+        }
+        else {
+            picoquic_log_new_connection(cnx);
+            for (int is_error = 0; is_error < 2; is_error++) {
+                size_t nb_packets = (is_error) ? nb_test_frame_error_list : nb_test_skip_list;
+
+                for (size_t i = 0; i < nb_packets; i++) {
+                    picoquic_packet_header ph;
+                    const uint8_t* bytes = (is_error) ? test_frame_error_list[i].val : test_skip_list[i].val;
+                    size_t length = (is_error) ? test_frame_error_list[i].len : test_skip_list[i].len;
+
+                    memset(&ph, 0, sizeof(ph));
+                    ph.ptype = picoquic_packet_1rtt_protected;
+                    ph.pn64 = i;
+                    ph.dest_cnx_id = initial_cid;
+                    ph.srce_cnx_id = dest_cid;
+                    ph.offset = 0;
+                    ph.payload_length = length;
+
+                    picoquic_log_packet(cnx, cnx->path[0], 0, 0, &ph, bytes, length);
+                }
+            }
+            picoquic_delete_cnx(cnx);
+
+            picoquic_binlog_ring_flush(quic->binlog_ring);
+            if (picoquic_get_binlog_async_stats(quic, &stats) != 0) {
+                DBG_PRINTF("%s", "Cannot get the asynchronous log stats.\n");
+                ret = -1;
+            }
+            else if (stats.nb_events_dropped != 0 || stats.nb_files_closed != 1 ||
+                stats.nb_bytes_written != stats.nb_bytes_queued || stats.bytes_queued_max > stats.ring_size) {
+                DBG_PRINTF("Unexpected stats, dropped: %" PRIu64 ", closed: %" PRIu64 ", written: %" PRIu64 "/%" PRIu64,
+                    stats.nb_events_dropped, stats.nb_files_closed, stats.nb_bytes_written, stats.nb_bytes_queued);
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    if (ret == 0 && picoquic_test_compare_binary_files(binlog_test_file, log_test_ref) != 0) {
+        DBG_PRINTF("%s", "Unexpected content in binary log file.\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* The qlog conversion runs on the writer thread, after the file is closed */
+        ret = binlog_async_convert_test();
+    }
+
+    if (ret == 0) {
+        /* Events larger than half the ring are always dropped */
+        picoquic_binlog_ring_t* ring = picoquic_binlog_ring_create(0, picoquic_binlog_drop_newest);
+        uint8_t head[4] = { 0 };
+        uint8_t* big_msg = (uint8_t*)malloc(PICOQUIC_BINLOG_RING_SIZE_MIN);
+
+        if (ring == NULL || big_msg == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(big_msg, 0, PICOQUIC_BINLOG_RING_SIZE_MIN);
+            if (picoquic_binlog_ring_write(ring, stdout, head, sizeof(head), big_msg, PICOQUIC_BINLOG_RING_SIZE_MIN / 2) == 0) {
+                DBG_PRINTF("%s", "Oversized event was not dropped.\n");
+                ret = -1;
+            }
+            else {
+                picoquic_binlog_ring_get_stats(ring, &stats);
+                if (stats.nb_events_dropped != 1 || stats.nb_events_queued != 0 ||
+                    stats.nb_bytes_dropped != sizeof(head) + PICOQUIC_BINLOG_RING_SIZE_MIN / 2) {
+                    DBG_PRINTF("%s", "Unexpected drop counters.\n");
+                    ret = -1;
+                }
+            }
+        }
+        if (ring != NULL) {
+            picoquic_binlog_ring_delete(ring);
+        }
+        if (big_msg != NULL) {
+            free(big_msg);
+        }
+    }
+
+    if (ret == 0) {
+        /* The producer waits for space, and the ring wraps several times */
+        if ((ret = binlog_async_wrap_test_one(picoquic_binlog_wait_for_space, &stats)) == 0 &&
+            (stats.nb_producer_waits == 0 || stats.nb_events_dropped != 0 ||
+                stats.nb_bytes_queued < 4 * (uint64_t)stats.ring_size)) {
+            DBG_PRINTF("Wait for space, waits: %" PRIu64 ", dropped: %" PRIu64 ", queued: %" PRIu64,
+                stats.nb_producer_waits, stats.nb_events_dropped, stats.nb_bytes_queued);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The events that do not fit in the ring are dropped, without waiting */
+        if ((ret = binlog_async_wrap_test_one(picoquic_binlog_drop_newest, &stats)) == 0 &&
+            (stats.nb_producer_waits != 0 || stats.nb_events_dropped == 0)) {
+            DBG_PRINTF("Drop newest, waits: %" PRIu64 ", dropped: %" PRIu64,
+                stats.nb_producer_waits, stats.nb_events_dropped);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Test of the binary log index. The log holds info messages of several
+ * connections, interleaved. The index must list the connections, and
+ * return for each connection the same events as a scan of the whole file.
+ */
+#define BINLOG_INDEX_TEST_NB_CIDS 3
+#define BINLOG_INDEX_TEST_NB_EVENTS 300
+
+typedef struct st_binlog_index_test_ctx_t {
+    size_t nb_events;
+    uint64_t last_time;
+    int is_out_of_order;
+} binlog_index_test_ctx_t;
+
+static int binlog_index_test_message(uint64_t time, bytestream* s, void* ptr)
+{
+    binlog_index_test_ctx_t* ctx = (binlog_index_test_ctx_t*)ptr;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(s);
+#endif
+    if (ctx->nb_events > 0 && time <= ctx->last_time) {
+        ctx->is_out_of_order = 1;
+    }
+    ctx->last_time = time;
+    ctx->nb_events++;
+    return 0;
+}
+
+static int binlog_index_test_write(char const* file_name, picoquic_connection_id_t* cids, int is_truncated)
+{
+    int ret = 0;
+    FILE* F = picoquic_file_open(file_name, "wb");
+
+    if (F == NULL) {
+        ret = -1;
+    }
+    else {
+        bytestream_buf stream;
+        bytestream* ps = bytestream_buf_init(&stream, BYTESTREAM_MAX_BUFFER_SIZE);
+
+        bytewrite_int32(ps, FOURCC('q', 'l', 'o', 'g'));
+        bytewrite_int16(ps, 0);
+        bytewrite_int16(ps, 0x01);
+        bytewrite_int64(ps, 0);
+        ret = (fwrite(bytestream_data(ps), bytestream_length(ps), 1, F) != 1);
+
+        for (int i = 0; ret == 0 && i < BINLOG_INDEX_TEST_NB_EVENTS; i++) {
+            uint8_t head[4];
+            bytestream* msg = bytestream_buf_init(&stream, BYTESTREAM_MAX_BUFFER_SIZE);
+
+            bytewrite_cid(msg, &cids[(i * 7) % BINLOG_INDEX_TEST_NB_CIDS]);
+            bytewrite_vint(msg, 1000 + i);
+            bytewrite_vint(msg, 0);
+            bytewrite_vint(msg, picoquic_log_event_info_message);
+            bytewrite_cstr(msg, "binlog index test");
+            picoformat_32(head, (uint32_t)bytestream_length(msg));
+            ret = (fwrite(head, sizeof(head), 1, F) != 1 ||
+                fwrite(bytestream_data(msg), bytestream_length(msg), 1, F) != 1);
+        }
+
+        if (ret == 0 && is_truncated) {
+            uint8_t head[4] = { 0, 0, 1, 0 };
+            ret = (fwrite(head, sizeof(head), 1, F) != 1);
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+int binlog_index_test()
+{
+    int ret = 0;
+    char const* index_test_file = "binlog_index_test.log";
+    picoquic_connection_id_t cids[BINLOG_INDEX_TEST_NB_CIDS] = {
+        { { 1, 2, 3, 4, 5, 6, 7, 8 }, 8 },
+        { { 9, 10, 11, 12 }, 4 },
+        { { 0 }, 0 } };
+    binlog_index_t index;
+    uint64_t log_time = 0;
+    uint16_t flags = 0;
+    FILE* f_binlog = NULL;
+
+    memset(&index, 0, sizeof(index));
+    if (binlog_index_test_write(index_test_file, cids, 0) != 0 ||
+        (f_binlog = picoquic_open_cc_log_file_for_read(index_test_file, &flags, &log_time)) == NULL) {
+        DBG_PRINTF("Cannot create %s", index_test_file);
+        ret = -1;
+    }
+    else if (binlog_index_open(&index, f_binlog) != 0 ||
+        index.nb_cids != BINLOG_INDEX_TEST_NB_CIDS || index.nb_events != BINLOG_INDEX_TEST_NB_EVENTS) {
+        DBG_PRINTF("%s", "Unexpected index of the binary log");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < BINLOG_INDEX_TEST_NB_CIDS; i++) {
+        binlog_index_test_ctx_t indexed_ctx = { 0 };
+        binlog_index_test_ctx_t scan_ctx = { 0 };
+        binlog_convert_cb_t callbacks;
+
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.info_message = binlog_index_test_message;
+        callbacks.ptr = &indexed_ctx;
+        if (binlog_convert_indexed(&index, &cids[i], &callbacks) != 0) {
+            ret = -1;
+        }
+        else {
+            callbacks.ptr = &scan_ctx;
+            ret = binlog_convert(f_binlog, &cids[i], &callbacks);
+        }
+        if (ret == 0 && (indexed_ctx.nb_events != BINLOG_INDEX_TEST_NB_EVENTS / BINLOG_INDEX_TEST_NB_CIDS ||
+            indexed_ctx.nb_events != scan_ctx.nb_events || indexed_ctx.last_time != scan_ctx.last_time ||
+            indexed_ctx.is_out_of_order)) {
+            DBG_PRINTF("Indexed events of connection %d do not match the file", i);
+            ret = -1;
+        }
+    }
+
+    binlog_index_close(&index);
+    (void)picoquic_file_close(f_binlog);
+    f_binlog = NULL;
+
+    /* The events before a truncated tail are still indexed */
+    if (ret == 0) {
+        if (binlog_index_test_write(index_test_file, cids, 1) != 0 ||
+            (f_binlog = picoquic_open_cc_log_file_for_read(index_test_file, &flags, &log_time)) == NULL) {
+            DBG_PRINTF("Cannot create %s", index_test_file);
+            ret = -1;
+        }
+        else if (binlog_index_open(&index, f_binlog) != 0 || !index.is_truncated ||
+            index.nb_cids != BINLOG_INDEX_TEST_NB_CIDS || index.nb_events != BINLOG_INDEX_TEST_NB_EVENTS) {
+            DBG_PRINTF("%s", "Truncated log not indexed");
+            ret = -1;
+        }
+
+        for (int i = 0; ret == 0 && i < BINLOG_INDEX_TEST_NB_CIDS; i++) {
+            binlog_index_test_ctx_t indexed_ctx = { 0 };
+            binlog_convert_cb_t callbacks;
+
+            memset(&callbacks, 0, sizeof(callbacks));
+            callbacks.info_message = binlog_index_test_message;
+            callbacks.ptr = &indexed_ctx;
+            if (binlog_convert_indexed(&index, &cids[i], &callbacks) != 0 ||
+                indexed_ctx.nb_events != BINLOG_INDEX_TEST_NB_EVENTS / BINLOG_INDEX_TEST_NB_CIDS) {
+                DBG_PRINTF("Events of connection %d not indexed in truncated log", i);
+                ret = -1;
+            }
+        }
+        binlog_index_close(&index);
+        (void)picoquic_file_close(f_binlog);
+    }
+
+    return ret;
+}
+
 /* Basic test of connection ID stash, part of migration support  */
 static const picoquic_remote_cnxid_t stash_test_case[] = {
     { NULL,  1,{ { 0, 1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }, 4 },
@@ -1901,6 +2462,7 @@ int test_copy_for_retransmit()
     picoquic_cnx_t * cnx = NULL;
     int ret = 0;
     picoquic_packet_t old_p;
+    uint8_t old_bytes[PICOQUIC_MAX_PACKET_SIZE];
     uint8_t new_bytes[PICOQUIC_MAX_PACKET_SIZE];
     size_t length = 0;
     int packet_is_pure_ack = 0;
@@ -1941,6 +2503,7 @@ int test_copy_for_retransmit()
 
         /* Initialize the old packet */
         memset(&old_p, 0, sizeof(picoquic_packet_t));
+        old_p.bytes = old_bytes;
         if (copy_retransmit_case[i].packet_length > 0) {
             memcpy(old_p.bytes, copy_retransmit_case[i].packet, copy_retransmit_case[i].packet_length);
             old_p.length = copy_retransmit_case[i].packet_length;
@@ -2057,10 +2620,15 @@ static size_t dataqueue_prepare_packet(
     uint64_t stream_id, uint64_t offset, size_t frame_data_length)
 {
     uint8_t* bytes = packet->bytes;
-    uint8_t* bytes_max = bytes + sizeof(packet->bytes);
+    uint8_t* bytes_max = bytes + PICOQUIC_MAX_PACKET_SIZE;
+    size_t bytes_size = packet->bytes_max;
+    unsigned int is_from_pool = packet->is_from_pool;
     size_t copied_index;
 
     memset(packet, 0, sizeof(picoquic_packet_t));
+    packet->bytes = bytes;
+    packet->bytes_max = bytes_size;
+    packet->is_from_pool = is_from_pool;
     packet->offset = 12;
     packet->data_repeat_frame = 17;
     packet->data_repeat_index = 17;
@@ -2242,10 +2810,14 @@ int dataqueue_copy_test()
 {
     int ret = 0;
     picoquic_packet_t packet;
+    uint8_t packet_bytes[PICOQUIC_MAX_PACKET_SIZE];
     uint8_t data[1536];
     uint8_t output[1536];
     size_t length_max = 1536;
 
+    memset(&packet, 0, sizeof(picoquic_packet_t));
+    packet.bytes = packet_bytes;
+
     for (int case_opt = 0; ret == 0 && case_opt < 5; case_opt++) {
         int has_length = (case_opt & 1) == 0;
         int has_fin = (case_opt & 2) == 2;
@@ -2563,7 +3135,7 @@ int send_stream_blocked_test()
     return ret;
 }
 
-int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t consumed_offset,
+int picoquic_queue_network_input(picoquic_quic_t * quic, picoquic_cnx_t* cnx, picosplay_tree_t* tree, uint64_t consumed_offset,
     uint64_t stream_ofs, const uint8_t* bytes, size_t length, picoquic_stream_data_node_t* received_data, int* new_data_available);
 
 int64_t picoquic_stream_data_node_compare(void* l, void* r);
@@ -2580,11 +3152,10 @@ int queue_network_input_test()
         NULL, NULL, NULL, NULL, simulated_time,
         &simulated_time, NULL, NULL, 0);
 
-    const size_t expected_length[3] = { 4, 2, 4 };
-    const uint8_t expected[3][4] = {
-        { 0, 1, 2, 3 },
-        { 4, 5 },
-        { 6, 7, 8, 9 }
+    /* Adjacent chunks are merged */
+    const size_t expected_length[1] = { 10 };
+    const uint8_t expected[1][10] = {
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }
     };
 
     const uint8_t data[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
@@ -2603,7 +3174,7 @@ int queue_network_input_test()
     /* Fill 0..3 */
     if (ret == 0) {
         new_data_available = 0;
-        if ((ret = picoquic_queue_network_input(quic, tree, 0, 0, data, 4, NULL,
+        if ((ret = picoquic_queue_network_input(quic, NULL, tree, 0, 0, data, 4, NULL,
             &new_data_available)) != 0) {
             DBG_PRINTF("picoquic_queue_network_input(0, 0, 4) failed (%d)", ret);
         }
@@ -2616,7 +3187,7 @@ int queue_network_input_test()
     /* Fill 6..9 */
     if (ret == 0) {
         new_data_available = 0;
-        if ((ret = picoquic_queue_network_input(quic, tree, 0, 6, data + 6, 4, NULL, &new_data_available)) != 0) {
+        if ((ret = picoquic_queue_network_input(quic, NULL, tree, 0, 6, data + 6, 4, NULL, &new_data_available)) != 0) {
             DBG_PRINTF("picoquic_queue_network_input(0, 6, 4) failed (%d)", ret);
         } else if (new_data_available == 0) {
             DBG_PRINTF("new_data_available doesn't signal new data (%d)", new_data_available);
@@ -2627,7 +3198,7 @@ int queue_network_input_test()
     /* Fill the gap from 4..5 with a chunk from 2..7 */
     if (ret == 0) {
         new_data_available = 0;
-        if ((ret = picoquic_queue_network_input(quic, tree, 0, 2, data + 2, 6, NULL, &new_data_available)) != 0) {
+        if ((ret = picoquic_queue_network_input(quic, NULL, tree, 0, 2, data + 2, 6, NULL, &new_data_available)) != 0) {
             DBG_PRINTF("picoquic_queue_network_input(0, 2, 6) failed (%d)", ret);
         } else if (new_data_available == 0) {
             DBG_PRINTF("new_data_available signals new data (%d)", new_data_available);
@@ -2638,7 +3209,7 @@ int queue_network_input_test()
     /* No new data delivered by chunk 2..7 */
     if (ret == 0) {
         new_data_available = 0;
-        if ((ret = picoquic_queue_network_input(quic, tree, 0, 2, data, 6, NULL, &new_data_available)) != 0) {
+        if ((ret = picoquic_queue_network_input(quic, NULL, tree, 0, 2, data, 6, NULL, &new_data_available)) != 0) {
             DBG_PRINTF("picoquic_queue_network_input(0, 2, 6) failed (%d)", ret);
         }
 
@@ -2650,9 +3221,9 @@ int queue_network_input_test()
 
     if (ret == 0) {
         picoquic_stream_data_node_t* next = (picoquic_stream_data_node_t*)picosplay_first(tree);
-        for (int i = 0; i < 3; ++i) {
+        for (int i = 0; i < 1; ++i) {
             if (next == NULL) {
-                DBG_PRINTF("tree does not contain enough data (%d chunks vs 3 exptected)", i);
+                DBG_PRINTF("tree does not contain enough data (%d chunks vs 1 exptected)", i);
                 ret = 1;
                 break;
             }
@@ -2666,6 +3237,113 @@ int queue_network_input_test()
             }
             next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
         }
+        if (ret == 0 && next != NULL) {
+            DBG_PRINTF("%s", "tree contains more chunks than expected");
+            ret = 1;
+        }
+    }
+
+    if (tree != NULL) {
+        picosplay_empty_tree(tree);
+        free(tree);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test that out of order fragments are stored compactly:
+ * - small fragments received in reverse order are merged in compact chunks,
+ * - large fragments keep the received packet buffer,
+ * - small fragments do not keep the received packet buffer.
+ */
+#define REASSEMBLY_TEST_FRAGMENT 50
+#define REASSEMBLY_TEST_NB_FRAGMENTS 200
+
+int stream_reassembly_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    uint8_t data[REASSEMBLY_TEST_FRAGMENT * REASSEMBLY_TEST_NB_FRAGMENTS];
+    uint64_t data_offset = 1000;
+    uint64_t pinned_offset = data_offset + sizeof(data) + 100;
+    picoquic_stream_data_node_t* received_data[2] = { NULL, NULL };
+    int new_data_available = 0;
+    picosplay_tree_t* tree = picosplay_new_tree(
+        picoquic_stream_data_node_compare,
+        picoquic_stream_data_node_create,
+        picoquic_stream_data_node_delete,
+        picoquic_stream_data_node_value);
+
+    if (quic == NULL || tree == NULL) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7 + 1);
+    }
+
+    /* Queue the fragments in reverse order, so each new fragment precedes the previous one */
+    for (int i = REASSEMBLY_TEST_NB_FRAGMENTS - 1; ret == 0 && i >= 0; i--) {
+        size_t frag_ofs = (size_t)i * REASSEMBLY_TEST_FRAGMENT;
+        if ((ret = picoquic_queue_network_input(quic, NULL, tree, 0, data_offset + frag_ofs, data + frag_ofs,
+            REASSEMBLY_TEST_FRAGMENT, NULL, &new_data_available)) != 0) {
+            DBG_PRINTF("picoquic_queue_network_input(fragment %d) failed (%d)", i, ret);
+        }
+    }
+
+    /* Verify that the data is stored in a small number of compact chunks */
+    if (ret == 0) {
+        picoquic_stream_data_node_t* node = (picoquic_stream_data_node_t*)picosplay_first(tree);
+        uint64_t expected_offset = data_offset;
+        int nb_nodes = 0;
+
+        while (node != NULL && ret == 0) {
+            if (!node->is_compact || node->length > PICOQUIC_STREAM_DATA_CHUNK_MAX || node->offset != expected_offset ||
+                memcmp(node->bytes, data + (node->offset - data_offset), node->length) != 0) {
+                DBG_PRINTF("Unexpected chunk at offset %" PRIu64 ", length %zu", node->offset, node->length);
+                ret = -1;
+            }
+            expected_offset += node->length;
+            nb_nodes++;
+            node = (picoquic_stream_data_node_t*)picosplay_next(&node->stream_data_node);
+        }
+
+        if (ret == 0 && (expected_offset != data_offset + sizeof(data) ||
+            nb_nodes > (int)(sizeof(data) / (PICOQUIC_STREAM_DATA_CHUNK_MAX / 2)) + 1)) {
+            DBG_PRINTF("Found %d chunks, up to offset %" PRIu64, nb_nodes, expected_offset);
+            ret = -1;
+        }
+    }
+
+    /* Large fragment, keep the received packet */
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        size_t length = (i == 0) ? PICOQUIC_STREAM_DATA_PIN_MIN : 100;
+
+        if ((received_data[i] = picoquic_stream_data_node_alloc(quic)) == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(received_data[i]->data, data, length);
+            if ((ret = picoquic_queue_network_input(quic, NULL, tree, 0, pinned_offset, received_data[i]->data, length,
+                received_data[i], &new_data_available)) != 0) {
+                DBG_PRINTF("picoquic_queue_network_input(pinned %d) failed (%d)", i, ret);
+            }
+            else if ((i == 0) != (received_data[i]->bytes != NULL)) {
+                DBG_PRINTF("Packet buffer %s for fragment of %zu bytes", (i == 0) ? "not kept" : "kept", length);
+                ret = -1;
+            }
+            else if (i != 0) {
+                picoquic_stream_data_node_recycle(received_data[i]);
+            }
+            pinned_offset += PICOQUIC_STREAM_DATA_PIN_MIN + 100;
+        }
     }
 
     if (tree != NULL) {
@@ -2944,3 +3622,232 @@ int stream_ack_test()
 
     return ret;
 }
+
+/* Test the retransmission of stream data by reference.
+ * Send the data of two nodes in a series of small packets, compact the
+ * packets as if they were queued for retransmission, and verify that the
+ * stream frames are replaced by references, that they can be rebuilt from
+ * the stream data, in one go or in several parts, and that the data is
+ * released from the stream when acknowledged.
+ */
+#define STREAM_REF_TEST_NODE_LENGTH 600
+#define STREAM_REF_TEST_NB_PACKETS 8
+
+static int stream_ref_check_rebuilt(picoquic_cnx_t* cnx, picoquic_packet_t* packet,
+    const uint8_t* original, size_t original_length)
+{
+    int ret = 0;
+    uint8_t rebuilt[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t* bytes_next = picoquic_format_stream_frame_from_ref(cnx, packet->bytes + 1, PICOQUIC_STREAM_REF_FRAME_SIZE,
+        rebuilt, rebuilt + sizeof(rebuilt));
+    uint64_t stream_id[2];
+    uint64_t offset[2];
+    size_t data_length[2];
+    size_t consumed[2];
+    int fin[2];
+
+    if (bytes_next == NULL) {
+        DBG_PRINTF("%s", "Cannot rebuild the stream frame");
+        ret = -1;
+    }
+    else if (picoquic_parse_stream_header(original + 1, original_length - 1, &stream_id[0], &offset[0],
+        &data_length[0], &fin[0], &consumed[0]) != 0 ||
+        picoquic_parse_stream_header(rebuilt, bytes_next - rebuilt, &stream_id[1], &offset[1],
+        &data_length[1], &fin[1], &consumed[1]) != 0) {
+        DBG_PRINTF("%s", "Cannot parse the stream frames");
+        ret = -1;
+    }
+    else if (stream_id[0] != stream_id[1] || offset[0] != offset[1] || data_length[0] != data_length[1] ||
+        fin[0] != fin[1] || consumed[1] + data_length[1] != (size_t)(bytes_next - rebuilt) ||
+        memcmp(original + 1 + consumed[0], rebuilt + consumed[1], data_length[0]) != 0) {
+        DBG_PRINTF("Rebuilt frame does not match at offset %" PRIu64, offset[0]);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int stream_ref_check_repeat(picoquic_cnx_t* cnx, picoquic_packet_t* sent_packet, const uint8_t* data)
+{
+    int ret = 0;
+    picoquic_packet_t copied_packet;
+    picoquic_packet_t* packet = &copied_packet;
+    uint8_t packet_bytes[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t output[PICOQUIC_MAX_PACKET_SIZE];
+    uint64_t stream_id;
+    uint64_t offset;
+    uint64_t expected_offset;
+    size_t data_length;
+    size_t consumed;
+    int fin;
+    size_t buffer_size[2] = { 128, sizeof(output) };
+
+    /* Work on a copy, so the reference in the sent packet is not modified */
+    copied_packet = *sent_packet;
+    memcpy(packet_bytes, sent_packet->bytes, sent_packet->length);
+    packet->bytes = packet_bytes;
+    expected_offset = PICOPARSE_64(packet->bytes + 11);
+
+    packet->data_repeat_frame = 1;
+    packet->data_repeat_index = 1;
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        uint8_t* bytes_next = picoquic_copy_stream_frame_for_retransmit(cnx, packet, output, output + buffer_size[i]);
+
+        if (bytes_next == NULL || picoquic_parse_stream_header(output, bytes_next - output,
+            &stream_id, &offset, &data_length, &fin, &consumed) != 0) {
+            DBG_PRINTF("Cannot repeat the stream frame, step %d", i);
+            ret = -1;
+        }
+        else if (offset != expected_offset || memcmp(output + consumed, data + offset, data_length) != 0) {
+            DBG_PRINTF("Repeated data does not match at offset %" PRIu64, offset);
+            ret = -1;
+        }
+        else if (i == 0 && (packet->data_repeat_frame != 1 || PICOPARSE_64(packet->bytes + 11) != offset + data_length)) {
+            DBG_PRINTF("%s", "Reference not updated after partial repeat");
+            ret = -1;
+        }
+        else if (i == 1 && packet->data_repeat_frame != 1 + PICOQUIC_STREAM_REF_FRAME_SIZE) {
+            DBG_PRINTF("%s", "Reference not skipped after repeat");
+            ret = -1;
+        }
+        expected_offset = offset + data_length;
+    }
+
+    return ret;
+}
+
+int stream_ref_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t stream_id = 4;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_stream_head_t* stream = NULL;
+    picoquic_packet_t* packets[STREAM_REF_TEST_NB_PACKETS] = { NULL };
+    int nb_packets = 0;
+    uint8_t data[2 * STREAM_REF_TEST_NODE_LENGTH];
+    struct sockaddr_storage addr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if ((ret = picoquic_store_text_addr(&addr, "10.0.0.1", 1234)) == 0 &&
+        (cnx = picoquic_create_cnx(quic, picoquic_null_connection_id,
+            picoquic_null_connection_id, (struct sockaddr*)&addr,
+            simulated_time, 0, "test-sni", "test-alpn", 1)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_set_retransmit_by_reference_per_cnx(cnx, 1);
+        cnx->maxdata_remote = UINT64_MAX;
+        cnx->max_stream_id_bidir_remote = stream_id;
+        if (picoquic_add_to_stream(cnx, stream_id, data, STREAM_REF_TEST_NODE_LENGTH, 0) != 0 ||
+            picoquic_add_to_stream(cnx, stream_id, data + STREAM_REF_TEST_NODE_LENGTH, STREAM_REF_TEST_NODE_LENGTH, 1) != 0 ||
+            (stream = picoquic_find_stream(cnx, stream_id)) == NULL) {
+            DBG_PRINTF("%s", "Cannot queue the stream data");
+            ret = -1;
+        }
+        else {
+            stream->maxdata_remote = UINT64_MAX;
+        }
+    }
+
+    /* Send the data in packets starting with a ping. The first packet only
+     * holds part of the first node, the others end with a ping after the
+     * stream frame. */
+    while (ret == 0 && stream->send_queue != NULL) {
+        picoquic_packet_t* packet;
+        uint8_t original[PICOQUIC_MAX_PACKET_SIZE];
+        size_t original_length;
+        size_t trailer_length = 0;
+        uint8_t* bytes_next;
+        int more_data = 0;
+        int is_pure_ack = 1;
+        int is_still_active = 0;
+
+        if (nb_packets >= STREAM_REF_TEST_NB_PACKETS || (packet = picoquic_create_packet(quic)) == NULL) {
+            DBG_PRINTF("%s", "Cannot create packet");
+            ret = -1;
+            break;
+        }
+        packets[nb_packets++] = packet;
+        packet->ptype = picoquic_packet_1rtt_protected;
+        packet->bytes[0] = picoquic_frame_type_ping;
+        bytes_next = picoquic_format_stream_frame(cnx, stream, packet->bytes + 1, packet->bytes + ((nb_packets == 1) ? 256 : 1024),
+            &more_data, &is_pure_ack, &is_still_active, &ret);
+        if (ret != 0 || bytes_next == NULL || bytes_next == packet->bytes + 1) {
+            DBG_PRINTF("Cannot format stream frame in packet %d", nb_packets);
+            ret = -1;
+            break;
+        }
+        if (nb_packets > 1) {
+            *bytes_next++ = picoquic_frame_type_ping;
+            trailer_length = 1;
+        }
+        packet->length = bytes_next - packet->bytes;
+        original_length = packet->length;
+        memcpy(original, packet->bytes, original_length);
+
+        picoquic_compact_sent_packet(cnx, packet);
+
+        if (packet->bytes[1] != picoquic_frame_type_stream_ref ||
+            packet->length != 1 + PICOQUIC_STREAM_REF_FRAME_SIZE + trailer_length ||
+            PICOQUIC_PACKET_SENT_LENGTH(packet) != original_length ||
+            (trailer_length > 0 && packet->bytes[packet->length - 1] != picoquic_frame_type_ping)) {
+            DBG_PRINTF("Packet %d not compacted as expected", nb_packets);
+            ret = -1;
+        }
+        else {
+            ret = stream_ref_check_rebuilt(cnx, packet, original, original_length - trailer_length);
+        }
+    }
+
+    if (ret == 0 && (stream->sent_queue == NULL || stream->sent_queue->next_stream_data == NULL ||
+        quic->nb_stream_bytes_by_reference != sizeof(data))) {
+        DBG_PRINTF("%s", "Sent data not kept in the stream");
+        ret = -1;
+    }
+
+    /* Repeat the second packet in two steps */
+    if (ret == 0 && nb_packets > 1) {
+        ret = stream_ref_check_repeat(cnx, packets[1], data);
+    }
+
+    /* Acknowledge all packets but the last, then the last one */
+    for (int i = 0; ret == 0 && i < nb_packets; i++) {
+        size_t consumed = 0;
+
+        if (picoquic_process_ack_of_stream_frame(cnx, packets[i]->bytes + 1, PICOQUIC_STREAM_REF_FRAME_SIZE, &consumed) != 0 ||
+            consumed != PICOQUIC_STREAM_REF_FRAME_SIZE) {
+            DBG_PRINTF("Cannot process ack of packet %d", i);
+            ret = -1;
+        }
+        else if (i == nb_packets - 2 && (stream->sent_queue == NULL || stream->sent_queue->next_stream_data != NULL)) {
+            DBG_PRINTF("%s", "First node not released after ack");
+            ret = -1;
+        }
+        else if (i == nb_packets - 1 && stream->sent_queue != NULL) {
+            DBG_PRINTF("%s", "Sent data not released after ack");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < nb_packets; i++) {
+        picoquic_recycle_packet(quic, packets[i]);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
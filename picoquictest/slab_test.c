@@ -0,0 +1,301 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Test the slab allocator: objects are allocated from slabs, and
+ * slabs are released when the number of free objects exceeds the cap.
+ */
+#define SLAB_TEST_NB_OBJECTS (4*PICOQUIC_SLAB_NB_OBJECTS)
+
+static int slab_class_test()
+{
+    int ret = 0;
+    picoquic_slab_class_t sc;
+    uint8_t* objects[SLAB_TEST_NB_OBJECTS];
+
+    picoquic_slab_class_init(&sc, 100, PICOQUIC_SLAB_NB_OBJECTS);
+
+    for (int i = 0; ret == 0 && i < SLAB_TEST_NB_OBJECTS; i++) {
+        objects[i] = (uint8_t*)picoquic_slab_alloc(&sc);
+        if (objects[i] == NULL) {
+            DBG_PRINTF("Cannot allocate object %d", i);
+            ret = -1;
+        }
+        else {
+            memset(objects[i], (int)i, sc.object_size);
+        }
+    }
+
+    if (ret == 0 && (sc.nb_slabs != 4 || sc.nb_in_use != SLAB_TEST_NB_OBJECTS || sc.nb_free != 0)) {
+        DBG_PRINTF("Unexpected slab count after alloc: %zu slabs, %zu in use, %zu free",
+            sc.nb_slabs, sc.nb_in_use, sc.nb_free);
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < SLAB_TEST_NB_OBJECTS; i++) {
+        for (size_t j = 0; j < sc.object_size; j++) {
+            if (objects[i][j] != (uint8_t)i) {
+                DBG_PRINTF("Object %d overwritten at byte %zu", i, j);
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    /* Free every other object, no slab becomes empty */
+    for (int i = 0; ret == 0 && i < SLAB_TEST_NB_OBJECTS; i += 2) {
+        picoquic_slab_free(&sc, objects[i]);
+        objects[i] = NULL;
+    }
+
+    if (ret == 0 && (sc.nb_slabs != 4 || sc.nb_free != SLAB_TEST_NB_OBJECTS / 2)) {
+        DBG_PRINTF("Unexpected slab count after half free: %zu slabs, %zu free", sc.nb_slabs, sc.nb_free);
+        ret = -1;
+    }
+
+    /* Free the remaining objects. Slabs are released once more than
+     * PICOQUIC_SLAB_NB_OBJECTS objects are free */
+    for (int i = 1; ret == 0 && i < SLAB_TEST_NB_OBJECTS; i += 2) {
+        picoquic_slab_free(&sc, objects[i]);
+        objects[i] = NULL;
+    }
+
+    if (ret == 0 && (sc.nb_in_use != 0 || sc.nb_slabs != 1 || sc.nb_free != PICOQUIC_SLAB_NB_OBJECTS ||
+        sc.nb_slabs_max != 4 || sc.nb_in_use_max != SLAB_TEST_NB_OBJECTS)) {
+        DBG_PRINTF("Unexpected slab count after free: %zu slabs, %zu in use, %zu free",
+            sc.nb_slabs, sc.nb_in_use, sc.nb_free);
+        ret = -1;
+    }
+
+    /* Allocation reuses the retained slab */
+    if (ret == 0) {
+        objects[0] = (uint8_t*)picoquic_slab_alloc(&sc);
+        if (objects[0] == NULL || sc.nb_slabs != 1) {
+            DBG_PRINTF("%s", "Retained slab not reused");
+            ret = -1;
+        }
+    }
+
+    picoquic_slab_class_clear(&sc);
+    if (ret == 0 && picoquic_slab_class_bytes(&sc) != 0) {
+        DBG_PRINTF("%s", "Slabs not cleared");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Test the packet pool: packets are created with a full size buffer,
+ * moved to a smaller buffer when queued, and recycled.
+ */
+static int slab_packet_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+    size_t test_length[3] = { 64, 400, 1200 };
+    size_t expected_max[3] = { 128, 512, PICOQUIC_MAX_PACKET_SIZE };
+    picoquic_packet_t* packet[3] = { NULL, NULL, NULL };
+    picoquic_packet_pool_stats_t stats;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        packet[i] = picoquic_create_packet(quic);
+        if (packet[i] == NULL) {
+            DBG_PRINTF("Cannot create packet %d", i);
+            ret = -1;
+        }
+        else if (packet[i]->bytes_max != PICOQUIC_MAX_PACKET_SIZE) {
+            DBG_PRINTF("Packet %d created with %zu bytes", i, packet[i]->bytes_max);
+            ret = -1;
+        }
+        else {
+            memset(packet[i]->bytes, (int)(i + 1), test_length[i]);
+            packet[i]->length = test_length[i];
+            picoquic_packet_shrink_bytes(quic, packet[i]);
+            if (packet[i]->bytes_max != expected_max[i]) {
+                DBG_PRINTF("Packet %d shrunk to %zu bytes instead of %zu", i, packet[i]->bytes_max, expected_max[i]);
+                ret = -1;
+            }
+            else {
+                for (size_t j = 0; j < test_length[i]; j++) {
+                    if (packet[i]->bytes[j] != (uint8_t)(i + 1)) {
+                        DBG_PRINTF("Packet %d content lost at byte %zu", i, j);
+                        ret = -1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_packet_pool_stats(quic, &stats);
+        if (stats.packets.nb_in_use != 3 || stats.bytes[0].nb_in_use != 1 || stats.bytes[1].nb_in_use != 1 ||
+            stats.bytes[2].nb_in_use != 1 || stats.nb_packet_bytes_shrunk != 2 || stats.bytes_allocated == 0) {
+            DBG_PRINTF("%s", "Unexpected packet pool stats");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (packet[i] != NULL) {
+            picoquic_recycle_packet(quic, packet[i]);
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_packet_pool_stats(quic, &stats);
+        if (stats.packets.nb_in_use != 0 || stats.bytes[0].nb_in_use != 0 || stats.bytes[1].nb_in_use != 0 ||
+            stats.bytes[2].nb_in_use != 0 || stats.packets.nb_in_use_max != 3) {
+            DBG_PRINTF("%s", "Packets not returned to the pool");
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+int slab_test()
+{
+    int ret = slab_class_test();
+
+    if (ret == 0) {
+        ret = slab_packet_test();
+    }
+
+    return ret;
+}
+
+/* Test the stateless packet pool: version negotiation packets are prepared
+ * in the pool slots, packets are dropped when the pool is full, and the
+ * slots are reused once the packets are sent.
+ */
+#define STATELESS_POOL_TEST_SIZE 4
+
+static int stateless_pool_incoming(picoquic_quic_t* quic, uint8_t* packet, size_t length, uint16_t port)
+{
+    struct sockaddr_in addr_from;
+    struct sockaddr_in addr_to;
+
+    memset(&addr_from, 0, sizeof(struct sockaddr_in));
+    addr_from.sin_family = AF_INET;
+    addr_from.sin_port = htons(port);
+    memset(&addr_to, 0, sizeof(struct sockaddr_in));
+    addr_to.sin_family = AF_INET;
+    addr_to.sin_port = htons(4443);
+
+    return picoquic_incoming_packet(quic, packet, length, (struct sockaddr*)&addr_from,
+        (struct sockaddr*)&addr_to, 0, 0, 0);
+}
+
+int stateless_pool_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t packet[PICOQUIC_ENFORCED_INITIAL_MTU];
+    picoquic_stateless_packet_stats_t stats;
+    picoquic_stateless_packet_t* sp;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        return -1;
+    }
+
+    /* Long header packet with an unsupported version, padded to the minimum size */
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 0xc0;
+    picoformat_32(packet + 1, 0x1a2a3a4a);
+    packet[5] = 8;
+    memset(packet + 6, 0xd1, 8);
+    packet[14] = 8;
+    memset(packet + 15, 0x51, 8);
+
+    if (picoquic_set_stateless_pool_size(quic, STATELESS_POOL_TEST_SIZE) != 0) {
+        DBG_PRINTF("%s", "Cannot set the pool size");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < STATELESS_POOL_TEST_SIZE + 2; i++) {
+        (void)stateless_pool_incoming(quic, packet, sizeof(packet), (uint16_t)(10000 + i));
+    }
+
+    if (ret == 0) {
+        picoquic_get_stateless_packet_stats(quic, &stats);
+        if (stats.pool_size != STATELESS_POOL_TEST_SIZE || stats.nb_in_use != STATELESS_POOL_TEST_SIZE ||
+            stats.nb_queued != STATELESS_POOL_TEST_SIZE || stats.nb_dropped != 2) {
+            DBG_PRINTF("Pool stats: %zu in use, %" PRIu64 " queued, %" PRIu64 " dropped",
+                stats.nb_in_use, stats.nb_queued, stats.nb_dropped);
+            ret = -1;
+        }
+        else if (picoquic_set_stateless_pool_size(quic, 2 * STATELESS_POOL_TEST_SIZE) == 0) {
+            DBG_PRINTF("%s", "Pool resized while in use");
+            ret = -1;
+        }
+    }
+
+    /* Packets are dequeued in order of arrival */
+    for (int i = 0; ret == 0 && i < STATELESS_POOL_TEST_SIZE; i++) {
+        if ((sp = picoquic_dequeue_stateless_packet(quic)) == NULL) {
+            DBG_PRINTF("Missing stateless packet %d", i);
+            ret = -1;
+        }
+        else {
+            if (sp->ptype != picoquic_packet_version_negotiation ||
+                ((struct sockaddr_in*)&sp->addr_to)->sin_port != htons((uint16_t)(10000 + i))) {
+                DBG_PRINTF("Unexpected stateless packet %d", i);
+                ret = -1;
+            }
+            picoquic_delete_stateless_packet(sp);
+        }
+    }
+
+    if (ret == 0) {
+        /* The slots are reused, and the queue accepts new packets */
+        (void)stateless_pool_incoming(quic, packet, sizeof(packet), 20000);
+        picoquic_get_stateless_packet_stats(quic, &stats);
+        if (stats.nb_in_use != 1 || stats.nb_in_use_max != STATELESS_POOL_TEST_SIZE ||
+            stats.nb_sent != STATELESS_POOL_TEST_SIZE || quic->pending_stateless_packet == NULL ||
+            quic->pending_stateless_packet != quic->pending_stateless_last) {
+            DBG_PRINTF("%s", "Slots not reused after sending");
+            ret = -1;
+        }
+    }
+
+    /* The pending packet is released when the context is freed */
+    picoquic_free(quic);
+
+    return ret;
+}
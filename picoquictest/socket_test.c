@@ -21,6 +21,9 @@
 
 #include "picosocks.h"
 #include "picoquic_utils.h"
+#include "picoquic_internal.h"
+#include "picoquic_packet_loop.h"
+#include "picoquic_lb.h"
 
 static int socket_ping_pong(SOCKET_TYPE fd, struct sockaddr* server_addr,
     picoquic_server_sockets_t* server_sockets)
@@ -240,3 +243,554 @@ int socket_ecn_test()
 
     return ret;
 }
+
+/*
+ * Test the batch receive API. Send a series of datagrams of different
+ * sizes to a local socket, then verify that they are all received by
+ * one or several calls to picoquic_select_batch.
+ */
+#define SOCKET_BATCH_TEST_NB_MSG 8
+
+int socket_batch_test()
+{
+    int ret = 0;
+    int test_port = 12347;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    SOCKET_TYPE s_fd = picoquic_open_client_socket(AF_INET);
+    picoquic_recv_batch_t* batch = NULL;
+    struct sockaddr_storage server_address;
+    int is_name;
+    uint8_t message[256];
+    size_t nb_received = 0;
+    size_t bytes_expected = 0;
+    size_t bytes_received = 0;
+    int nb_calls = 0;
+
+    if (s_fd == INVALID_SOCKET || picoquic_bind_to_port(s_fd, AF_INET, test_port) != 0) {
+        DBG_PRINTF("%s", "Cannot open batch test server socket\n");
+        ret = -1;
+    }
+    else if (picoquic_get_server_address("127.0.0.1", test_port, &server_address, &is_name) != 0) {
+        ret = -1;
+    }
+    else if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+        ret = -1;
+    }
+    else if ((batch = picoquic_create_recv_batch(SOCKET_BATCH_TEST_NB_MSG, PICOQUIC_MAX_PACKET_SIZE)) == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < SOCKET_BATCH_TEST_NB_MSG; i++) {
+        size_t length = 32 + 16 * i;
+        memset(message, i, length);
+        if (sendto(fd, (const char*)message, (int)length, 0, (struct sockaddr*)&server_address,
+            sizeof(struct sockaddr_in)) != (int)length) {
+            DBG_PRINTF("Sendto failed for message %d\n", i);
+            ret = -1;
+        }
+        bytes_expected += length;
+    }
+
+    while (ret == 0 && nb_received < SOCKET_BATCH_TEST_NB_MSG && nb_calls < SOCKET_BATCH_TEST_NB_MSG) {
+        uint64_t current_time;
+        int socket_rank = -1;
+        int bytes_recv = picoquic_select_batch(&s_fd, 1, batch, 1000000, &socket_rank, &current_time);
+
+        nb_calls++;
+        if (bytes_recv <= 0 || batch->nb_msg == 0) {
+            DBG_PRINTF("Select batch returns %d\n", bytes_recv);
+            ret = -1;
+        }
+        else {
+            for (size_t i = 0; ret == 0 && i < batch->nb_msg; i++) {
+                size_t rank = nb_received + i;
+                if (batch->msg[i].bytes_recv != 32 + 16 * rank ||
+                    batch->msg[i].buffer[0] != (uint8_t)rank ||
+                    batch->msg[i].buffer[batch->msg[i].bytes_recv - 1] != (uint8_t)rank) {
+                    DBG_PRINTF("Unexpected message %zu in batch, length %zu\n", rank, batch->msg[i].bytes_recv);
+                    ret = -1;
+                }
+            }
+            nb_received += batch->nb_msg;
+            bytes_received += (size_t)bytes_recv;
+        }
+    }
+
+    if (ret == 0 && (nb_received != SOCKET_BATCH_TEST_NB_MSG || bytes_received != bytes_expected)) {
+        DBG_PRINTF("Received %zu messages, %zu bytes\n", nb_received, bytes_received);
+        ret = -1;
+    }
+
+    if (batch != NULL) {
+        picoquic_delete_recv_batch(batch);
+    }
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    if (s_fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(s_fd);
+    }
+
+    return ret;
+}
+
+/*
+ * Test the batch send API. Prepare a series of messages in a send batch,
+ * send them with a single call to picoquic_sendmmsg, and verify that they
+ * are received in order.
+ */
+int socket_send_batch_test()
+{
+    int ret = 0;
+    int test_port = 12349;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    SOCKET_TYPE s_fd = picoquic_open_client_socket(AF_INET);
+    picoquic_send_batch_t* s_batch = NULL;
+    picoquic_recv_batch_t* r_batch = NULL;
+    struct sockaddr_storage server_address;
+    int is_name;
+    size_t nb_received = 0;
+    int nb_calls = 0;
+
+    if (s_fd == INVALID_SOCKET || picoquic_bind_to_port(s_fd, AF_INET, test_port) != 0) {
+        DBG_PRINTF("%s", "Cannot open batch test server socket\n");
+        ret = -1;
+    }
+    else if (picoquic_get_server_address("127.0.0.1", test_port, &server_address, &is_name) != 0) {
+        ret = -1;
+    }
+    else if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+        ret = -1;
+    }
+    else if ((s_batch = picoquic_create_send_batch(SOCKET_BATCH_TEST_NB_MSG, PICOQUIC_MAX_PACKET_SIZE)) == NULL ||
+        (r_batch = picoquic_create_recv_batch(SOCKET_BATCH_TEST_NB_MSG, PICOQUIC_MAX_PACKET_SIZE)) == NULL) {
+        ret = -1;
+    }
+    else {
+        for (size_t i = 0; i < SOCKET_BATCH_TEST_NB_MSG; i++) {
+            picoquic_send_msg_t* s_msg = &s_batch->msg[i];
+
+            s_msg->fd = fd;
+            picoquic_store_addr(&s_msg->addr_dest, (struct sockaddr*)&server_address);
+            memset(&s_msg->addr_from, 0, sizeof(s_msg->addr_from));
+            s_msg->dest_if = 0;
+            s_msg->length = 64 + 8 * i;
+            s_msg->send_msg_size = 0;
+            memset(s_msg->buffer, (int)i, s_msg->length);
+        }
+        s_batch->nb_msg = SOCKET_BATCH_TEST_NB_MSG;
+
+        if (picoquic_sendmmsg(s_batch) != SOCKET_BATCH_TEST_NB_MSG) {
+            DBG_PRINTF("%s", "Could not send all messages in batch\n");
+            ret = -1;
+        }
+    }
+
+    while (ret == 0 && nb_received < SOCKET_BATCH_TEST_NB_MSG && nb_calls < SOCKET_BATCH_TEST_NB_MSG) {
+        uint64_t current_time;
+        int socket_rank = -1;
+        int bytes_recv = picoquic_select_batch(&s_fd, 1, r_batch, 1000000, &socket_rank, &current_time);
+
+        nb_calls++;
+        if (bytes_recv <= 0) {
+            ret = -1;
+        }
+        else {
+            for (size_t i = 0; ret == 0 && i < r_batch->nb_msg; i++) {
+                size_t rank = nb_received + i;
+                if (r_batch->msg[i].bytes_recv != 64 + 8 * rank ||
+                    r_batch->msg[i].buffer[0] != (uint8_t)rank) {
+                    DBG_PRINTF("Unexpected message %zu in batch, length %zu\n", rank, r_batch->msg[i].bytes_recv);
+                    ret = -1;
+                }
+            }
+            nb_received += r_batch->nb_msg;
+        }
+    }
+
+    if (ret == 0 && nb_received != SOCKET_BATCH_TEST_NB_MSG) {
+        ret = -1;
+    }
+
+    if (s_batch != NULL) {
+        picoquic_delete_send_batch(s_batch);
+    }
+    if (r_batch != NULL) {
+        picoquic_delete_recv_batch(r_batch);
+    }
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    if (s_fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(s_fd);
+    }
+
+    return ret;
+}
+
+/*
+ * Test the event backends. For each backend, receive messages sent to two
+ * sockets one at a time, then as a batch, and verify that a call without
+ * pending data times out. On platforms or kernels that do not support a
+ * backend, the event context falls back to select, and the test still runs.
+ */
+static int socket_event_test_one(picoquic_event_backend_enum backend, int test_port)
+{
+    int ret = 0;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    SOCKET_TYPE s_fd[2] = { INVALID_SOCKET, INVALID_SOCKET };
+    struct sockaddr_storage server_address[2];
+    picoquic_event_ctx_t* ev = NULL;
+    picoquic_recv_batch_t* batch = NULL;
+    uint8_t message[PICOQUIC_MAX_PACKET_SIZE];
+    size_t nb_received = 0;
+    int nb_calls = 0;
+    int is_name;
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        s_fd[i] = picoquic_open_client_socket(AF_INET);
+        if (s_fd[i] == INVALID_SOCKET || picoquic_bind_to_port(s_fd[i], AF_INET, test_port + i) != 0 ||
+            picoquic_get_server_address("127.0.0.1", test_port + i, &server_address[i], &is_name) != 0) {
+            DBG_PRINTF("Cannot open event test server socket %d\n", i);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET ||
+        (ev = picoquic_create_event_ctx(backend, PICOQUIC_MAX_PACKET_SIZE)) == NULL ||
+        (batch = picoquic_create_recv_batch(SOCKET_BATCH_TEST_NB_MSG, PICOQUIC_MAX_PACKET_SIZE)) == NULL)) {
+        ret = -1;
+    }
+
+    /* Single messages, alternating between the two sockets */
+    for (int i = 0; ret == 0 && i < SOCKET_BATCH_TEST_NB_MSG; i++) {
+        size_t length = 32 + 16 * i;
+        memset(message, i, length);
+        if (sendto(fd, (const char*)message, (int)length, 0, (struct sockaddr*)&server_address[i % 2],
+            sizeof(struct sockaddr_in)) != (int)length) {
+            ret = -1;
+        }
+    }
+
+    while (ret == 0 && nb_received < SOCKET_BATCH_TEST_NB_MSG && nb_calls < 4 * SOCKET_BATCH_TEST_NB_MSG) {
+        struct sockaddr_storage addr_from;
+        struct sockaddr_storage addr_dest;
+        int dest_if = 0;
+        unsigned char received_ecn = 0;
+        uint64_t current_time;
+        int socket_rank = -1;
+        int bytes_recv = picoquic_event_select_ex(ev, s_fd, 2, &addr_from, &addr_dest, &dest_if,
+            &received_ecn, message, sizeof(message), 1000000, &socket_rank, &current_time);
+
+        nb_calls++;
+        if (bytes_recv < 0) {
+            ret = -1;
+        }
+        else if (bytes_recv > 0) {
+            int rank = message[0];
+            if (rank >= SOCKET_BATCH_TEST_NB_MSG || bytes_recv != 32 + 16 * rank ||
+                socket_rank != rank % 2 || addr_from.ss_family != AF_INET) {
+                DBG_PRINTF("Backend %d, unexpected message %d, length %d, socket %d\n",
+                    (int)picoquic_event_ctx_backend(ev), rank, bytes_recv, socket_rank);
+                ret = -1;
+            }
+            nb_received++;
+        }
+    }
+
+    if (ret == 0 && nb_received != SOCKET_BATCH_TEST_NB_MSG) {
+        DBG_PRINTF("Backend %d, received %zu messages\n", (int)picoquic_event_ctx_backend(ev), nb_received);
+        ret = -1;
+    }
+
+    /* A batch of messages sent to the second socket */
+    for (int i = 0; ret == 0 && i < SOCKET_BATCH_TEST_NB_MSG; i++) {
+        size_t length = 64 + 8 * i;
+        memset(message, i, length);
+        if (sendto(fd, (const char*)message, (int)length, 0, (struct sockaddr*)&server_address[1],
+            sizeof(struct sockaddr_in)) != (int)length) {
+            ret = -1;
+        }
+    }
+
+    nb_received = 0;
+    nb_calls = 0;
+    while (ret == 0 && nb_received < SOCKET_BATCH_TEST_NB_MSG && nb_calls < 4 * SOCKET_BATCH_TEST_NB_MSG) {
+        uint64_t current_time;
+        int socket_rank = -1;
+        int bytes_recv = picoquic_event_select_batch(ev, s_fd, 2, batch, 1000000, &socket_rank, &current_time);
+
+        nb_calls++;
+        if (bytes_recv < 0) {
+            ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < batch->nb_msg; i++) {
+            size_t rank = nb_received + i;
+            if (socket_rank != 1 || batch->msg[i].bytes_recv != 64 + 8 * rank ||
+                batch->msg[i].buffer[0] != (uint8_t)rank) {
+                DBG_PRINTF("Backend %d, unexpected batch message %zu\n", (int)picoquic_event_ctx_backend(ev), rank);
+                ret = -1;
+            }
+            else if (picoquic_event_ctx_backend(ev) == picoquic_event_backend_io_uring &&
+                batch->msg[i].buffer >= batch->buffer_ring &&
+                batch->msg[i].buffer < batch->buffer_ring + batch->nb_msg_max * batch->recv_buffer_size) {
+                DBG_PRINTF("Batch message %zu copied to the batch buffers\n", rank);
+                ret = -1;
+            }
+        }
+        nb_received += batch->nb_msg;
+    }
+
+    if (ret == 0 && nb_received != SOCKET_BATCH_TEST_NB_MSG) {
+        DBG_PRINTF("Backend %d, received %zu messages in batches\n", (int)picoquic_event_ctx_backend(ev), nb_received);
+        ret = -1;
+    }
+
+    /* Nothing more to receive, the call should time out */
+    if (ret == 0) {
+        uint64_t start_time = picoquic_current_time();
+        uint64_t current_time;
+        int socket_rank = -1;
+        int bytes_recv = picoquic_event_select_batch(ev, s_fd, 2, batch, 20000, &socket_rank, &current_time);
+
+        if (bytes_recv != 0 || batch->nb_msg != 0 || current_time < start_time + 10000) {
+            DBG_PRINTF("Backend %d, timeout test returns %d after %" PRIu64 "us\n",
+                (int)picoquic_event_ctx_backend(ev), bytes_recv, current_time - start_time);
+            ret = -1;
+        }
+    }
+
+    if (ev != NULL) {
+        picoquic_delete_event_ctx(ev);
+    }
+    if (batch != NULL) {
+        picoquic_delete_recv_batch(batch);
+    }
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (s_fd[i] != INVALID_SOCKET) {
+            SOCKET_CLOSE(s_fd[i]);
+        }
+    }
+
+    return ret;
+}
+
+int socket_event_test()
+{
+    int ret = 0;
+
+    ret = socket_event_test_one(picoquic_event_backend_select, 12351);
+    if (ret == 0) {
+        ret = socket_event_test_one(picoquic_event_backend_epoll, 12353);
+    }
+    if (ret == 0) {
+        ret = socket_event_test_one(picoquic_event_backend_io_uring, 12355);
+    }
+
+    return ret;
+}
+
+/*
+ * Test the sharded server loop. Each shard checks in its ready callback that the
+ * CID issued by its QUIC context encode the shard index. Once all shards are ready,
+ * shard 0 sends short header packets carrying the CID of each shard from a single
+ * client socket. All these packets are delivered by the kernel to the same shard,
+ * so the packets for the other shard must be forwarded to it. The packets are too
+ * short to trigger a stateless reset, the QUIC contexts silently drop them.
+ */
+#define SOCKET_SHARDED_TEST_PORT 12357
+#define SOCKET_SHARDED_TEST_NB_SHARDS 2
+#define SOCKET_SHARDED_TEST_NB_MSG 32
+#define SOCKET_SHARDED_TEST_PACKET_SIZE 38
+
+typedef struct st_socket_sharded_test_ctx_t {
+    picoquic_mutex_t mutex;
+    picoquic_sharded_loop_param_t* param;
+    struct sockaddr_storage server_addr;
+    uint64_t end_time;
+    int nb_ready;
+    int is_sent;
+    int is_error;
+    picoquic_connection_id_t cid[SOCKET_SHARDED_TEST_NB_SHARDS];
+} socket_sharded_test_ctx_t;
+
+typedef struct st_socket_sharded_test_shard_t {
+    socket_sharded_test_ctx_t* ctx;
+    int shard_index;
+} socket_sharded_test_shard_t;
+
+static int socket_sharded_test_send(socket_sharded_test_ctx_t* ctx)
+{
+    int ret = 0;
+    SOCKET_TYPE fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    uint8_t packet[SOCKET_SHARDED_TEST_PACKET_SIZE];
+
+    if (fd == INVALID_SOCKET) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < SOCKET_SHARDED_TEST_NB_SHARDS * SOCKET_SHARDED_TEST_NB_MSG; i++) {
+        picoquic_connection_id_t* cid = &ctx->cid[i % SOCKET_SHARDED_TEST_NB_SHARDS];
+
+        memset(packet, i, sizeof(packet));
+        packet[0] = 0x40;
+        memcpy(packet + 1, cid->id, cid->id_len);
+        if (sendto(fd, (const char*)packet, (int)sizeof(packet), 0, (struct sockaddr*)&ctx->server_addr,
+            sizeof(struct sockaddr_in)) != (int)sizeof(packet)) {
+            ret = -1;
+        }
+    }
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+
+    return ret;
+}
+
+static int socket_sharded_test_cb(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_arg)
+{
+    int ret = 0;
+    socket_sharded_test_shard_t* shard = (socket_sharded_test_shard_t*)callback_ctx;
+    socket_sharded_test_ctx_t* ctx = shard->ctx;
+
+    if (cb_mode == picoquic_packet_loop_ready) {
+        picoquic_connection_id_t cid_local;
+        picoquic_connection_id_t cid;
+
+        ((picoquic_packet_loop_options_t*)callback_arg)->do_time_check = 1;
+        memset(&cid_local, 0, sizeof(cid_local));
+        memset(cid_local.id, 0x5a + shard->shard_index, quic->local_cnxid_length);
+        cid_local.id_len = quic->local_cnxid_length;
+        cid = cid_local;
+        if (quic->cnx_id_callback_fn != NULL) {
+            quic->cnx_id_callback_fn(quic, cid_local, picoquic_null_connection_id, quic->cnx_id_callback_ctx, &cid);
+        }
+        (void)picoquic_lock_mutex(&ctx->mutex);
+        if (cid.id_len != quic->local_cnxid_length ||
+            picoquic_lb_compat_cid_verify(quic, quic->cnx_id_callback_ctx, &cid) != (uint64_t)shard->shard_index) {
+            DBG_PRINTF("Shard %d, CID does not encode the shard index", shard->shard_index);
+            ctx->is_error = 1;
+        }
+        ctx->cid[shard->shard_index] = cid;
+        ctx->nb_ready++;
+        (void)picoquic_unlock_mutex(&ctx->mutex);
+    }
+    else if (cb_mode == picoquic_packet_loop_time_check) {
+        packet_loop_time_check_arg_t* time_check_arg = (packet_loop_time_check_arg_t*)callback_arg;
+        uint64_t nb_received_forwarded = 0;
+
+        (void)picoquic_lock_mutex(&ctx->mutex);
+        if (ctx->is_error) {
+            ret = -1;
+        }
+        else if (shard->shard_index == 0 && !ctx->is_sent && ctx->nb_ready == SOCKET_SHARDED_TEST_NB_SHARDS) {
+            ctx->is_sent = 1;
+            if (socket_sharded_test_send(ctx) != 0) {
+                DBG_PRINTF("%s", "Cannot send the test packets");
+                ctx->is_error = 1;
+                ret = -1;
+            }
+        }
+        (void)picoquic_unlock_mutex(&ctx->mutex);
+
+        /* The stats of the other shards are read without locking, the test only
+         * waits until their final values are reached. */
+        for (int i = 0; i < SOCKET_SHARDED_TEST_NB_SHARDS; i++) {
+            nb_received_forwarded += ctx->param->stats[i].nb_packets_received_forwarded;
+        }
+        if (ret == 0 && (nb_received_forwarded >= SOCKET_SHARDED_TEST_NB_MSG ||
+            time_check_arg->current_time >= ctx->end_time)) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        }
+        /* The loop waits for delta_t before acting on the return code */
+        if (ret != 0) {
+            time_check_arg->delta_t = 0;
+        }
+        else if (time_check_arg->delta_t > 10000) {
+            time_check_arg->delta_t = 10000;
+        }
+    }
+
+    return ret;
+}
+
+int socket_sharded_loop_test()
+{
+    int ret = 0;
+#if !defined(_WINDOWS) && defined(SO_REUSEPORT)
+    picoquic_quic_t* quic[SOCKET_SHARDED_TEST_NB_SHARDS];
+    socket_sharded_test_shard_t shard[SOCKET_SHARDED_TEST_NB_SHARDS];
+    void* loop_ctx[SOCKET_SHARDED_TEST_NB_SHARDS];
+    socket_sharded_test_ctx_t ctx;
+    picoquic_sharded_loop_param_t* param = (picoquic_sharded_loop_param_t*)malloc(sizeof(picoquic_sharded_loop_param_t));
+    uint64_t current_time = picoquic_current_time();
+    int is_name = 0;
+
+    memset(quic, 0, sizeof(quic));
+    memset(&ctx, 0, sizeof(ctx));
+    if (param == NULL || picoquic_create_mutex(&ctx.mutex) != 0) {
+        if (param != NULL) {
+            free(param);
+        }
+        return -1;
+    }
+    memset(param, 0, sizeof(picoquic_sharded_loop_param_t));
+    param->nb_shards = SOCKET_SHARDED_TEST_NB_SHARDS;
+    param->local_port = SOCKET_SHARDED_TEST_PORT;
+    param->local_af = AF_INET;
+    ctx.param = param;
+    ctx.end_time = current_time + 5000000;
+    ret = picoquic_get_server_address("127.0.0.1", SOCKET_SHARDED_TEST_PORT, &ctx.server_addr, &is_name);
+
+    for (int i = 0; ret == 0 && i < SOCKET_SHARDED_TEST_NB_SHARDS; i++) {
+        shard[i].ctx = &ctx;
+        shard[i].shard_index = i;
+        loop_ctx[i] = &shard[i];
+        if ((quic[i] = picoquic_create(8, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL, NULL,
+            current_time, NULL, NULL, NULL, 0)) == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_sharded_packet_loop(quic, param, socket_sharded_test_cb, loop_ctx);
+        if (ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+            ret = 0;
+        }
+    }
+
+    if (ret == 0) {
+        /* One shard received all the packets, and forwarded those of the other shard */
+        uint64_t nb_forwarded = 0;
+        uint64_t nb_received_forwarded = 0;
+        uint64_t nb_dropped = 0;
+
+        for (int i = 0; i < SOCKET_SHARDED_TEST_NB_SHARDS; i++) {
+            nb_forwarded += param->stats[i].nb_packets_forwarded;
+            nb_received_forwarded += param->stats[i].nb_packets_received_forwarded;
+            nb_dropped += param->stats[i].nb_forward_dropped;
+            if (param->stats[i].nb_packets_forwarded != 0 &&
+                param->stats[i].nb_packets_forwarded != SOCKET_SHARDED_TEST_NB_MSG) {
+                ret = -1;
+            }
+        }
+        if (ret != 0 || !ctx.is_sent || nb_forwarded != SOCKET_SHARDED_TEST_NB_MSG ||
+            nb_received_forwarded != SOCKET_SHARDED_TEST_NB_MSG || nb_dropped != 0) {
+            DBG_PRINTF("Sharded loop, sent: %d, forwarded: %" PRIu64 ", received: %" PRIu64 ", dropped: %" PRIu64,
+                ctx.is_sent, nb_forwarded, nb_received_forwarded, nb_dropped);
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < SOCKET_SHARDED_TEST_NB_SHARDS; i++) {
+        if (quic[i] != NULL) {
+            picoquic_free(quic[i]);
+        }
+    }
+    (void)picoquic_delete_mutex(&ctx.mutex);
+    free(param);
+#endif
+    return ret;
+}
@@ -21,6 +21,7 @@
 
 #include <string.h>
 #include "picoquic_internal.h"
+#include "picoquic_utils.h"
 
 /*
  * Testing Arrival of Frame for Stream Zero
@@ -853,6 +854,349 @@ int stream_output_test()
     return ret;
 }
 
+/* Test the priority levels of the output stream scheduler. The stream
+ * returned by the scheduler is compared to a scan of the whole output list:
+ * the first priority level that has an active stream is served, in stream ID
+ * order for odd priorities, and in round robin order for even priorities.
+ * At each step, the selected stream is served, and streams are randomly
+ * activated, deactivated or moved to another priority.
+ */
+#define STREAM_SCHED_TEST_NB_STREAMS 64
+#define STREAM_SCHED_TEST_NB_STEPS 2000
+
+static picoquic_stream_head_t* stream_output_sched_expected(picoquic_cnx_t* cnx)
+{
+    picoquic_stream_head_t* stream = cnx->first_output_stream;
+    picoquic_stream_head_t* found_stream = NULL;
+
+    while (stream != NULL) {
+        if (found_stream != NULL && stream->stream_priority > found_stream->stream_priority) {
+            break;
+        }
+        if (stream->is_active) {
+            if ((stream->stream_priority & 1) != 0) {
+                found_stream = stream;
+                break;
+            }
+            else if (found_stream == NULL || stream->last_time_data_sent < found_stream->last_time_data_sent) {
+                found_stream = stream;
+            }
+        }
+        stream = stream->next_output_stream;
+    }
+
+    return found_stream;
+}
+
+static int stream_output_sched_check_list(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    size_t nb_levels = 0;
+    picoquic_stream_head_t* stream = cnx->first_output_stream;
+
+    while (ret == 0 && stream != NULL) {
+        picoquic_stream_head_t* next = stream->next_output_stream;
+
+        if (next != NULL && (next->stream_priority < stream->stream_priority ||
+            (next->stream_priority == stream->stream_priority && next->stream_id <= stream->stream_id))) {
+            DBG_PRINTF("Stream %" PRIu64 " listed after stream %" PRIu64, next->stream_id, stream->stream_id);
+            ret = -1;
+        }
+        else if (next == NULL || next->stream_priority != stream->stream_priority) {
+            if (nb_levels >= cnx->nb_output_levels ||
+                cnx->output_levels[nb_levels].priority != stream->stream_priority ||
+                cnx->output_levels[nb_levels].last_output != stream) {
+                DBG_PRINTF("Level %zu does not end with stream %" PRIu64, nb_levels, stream->stream_id);
+                ret = -1;
+            }
+            nb_levels++;
+        }
+        stream = next;
+    }
+
+    if (ret == 0 && nb_levels != cnx->nb_output_levels) {
+        DBG_PRINTF("Found %zu levels instead of %zu", nb_levels, cnx->nb_output_levels);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Verify the RFC 9218 mapping and the weighted round robin: two incremental
+ * streams of the same urgency with weights 2 and 1 share the link in a 2:1
+ * ratio, and a non incremental stream of the same urgency preempts them.
+ */
+static int stream_output_weight_test(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    uint64_t stream_id[3];
+    uint64_t nb_bytes[2] = { 0, 0 };
+    uint64_t current_time = 1000000;
+
+    for (int i = 1; ret == 0 && i <= STREAM_SCHED_TEST_NB_STREAMS; i++) {
+        if (picoquic_find_stream(cnx, STREAM_ID_FROM_RANK(i, 1, 0)) != NULL) {
+            ret = picoquic_mark_active_stream(cnx, STREAM_ID_FROM_RANK(i, 1, 0), 0, NULL);
+        }
+    }
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        picoquic_stream_head_t* stream;
+
+        stream_id[i] = STREAM_ID_FROM_RANK(i + 1, 1, 0);
+        if ((stream = picoquic_find_stream(cnx, stream_id[i])) == NULL &&
+            (stream = picoquic_create_stream(cnx, stream_id[i])) == NULL) {
+            ret = -1;
+        }
+        else {
+            stream->maxdata_remote = UINT64_MAX;
+        }
+    }
+
+    if (ret == 0 && picoquic_set_stream_urgency(cnx, stream_id[0], PICOQUIC_URGENCY_MAX + 1, 0) !=
+        PICOQUIC_ERROR_INVALID_PRIORITY) {
+        DBG_PRINTF("%s", "Invalid urgency accepted");
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if ((ret = picoquic_set_stream_urgency(cnx, stream_id[i], 0, 1)) == 0 &&
+            (ret = picoquic_set_stream_weight(cnx, stream_id[i], (uint8_t)(2 - i))) == 0) {
+            ret = picoquic_mark_active_stream(cnx, stream_id[i], 1, NULL);
+        }
+    }
+
+    for (int turn = 0; ret == 0 && turn < 30; turn++) {
+        picoquic_stream_head_t* found = picoquic_find_ready_stream(cnx);
+
+        if (found == NULL || (found->stream_id != stream_id[0] && found->stream_id != stream_id[1])) {
+            DBG_PRINTF("Turn %d, unexpected stream %" PRId64, turn, (found == NULL) ? -1 : (int64_t)found->stream_id);
+            ret = -1;
+        }
+        else {
+            nb_bytes[(found->stream_id == stream_id[0]) ? 0 : 1] += PICOQUIC_STREAM_WEIGHT_QUANTUM / 2;
+            found->last_time_data_sent = current_time++;
+            picoquic_served_output_stream(cnx, found, PICOQUIC_STREAM_WEIGHT_QUANTUM / 2);
+        }
+    }
+
+    if (ret == 0 && (nb_bytes[0] != 20 * (PICOQUIC_STREAM_WEIGHT_QUANTUM / 2) ||
+        nb_bytes[1] != 10 * (PICOQUIC_STREAM_WEIGHT_QUANTUM / 2))) {
+        DBG_PRINTF("Weighted shares: %" PRIu64 ", %" PRIu64, nb_bytes[0], nb_bytes[1]);
+        ret = -1;
+    }
+
+    if (ret == 0 && ((ret = picoquic_set_stream_urgency(cnx, stream_id[2], 0, 0)) != 0 ||
+        (ret = picoquic_mark_active_stream(cnx, stream_id[2], 1, NULL)) != 0 ||
+        picoquic_find_ready_stream(cnx) != picoquic_find_stream(cnx, stream_id[2]))) {
+        DBG_PRINTF("%s", "Non incremental stream does not preempt incremental streams");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Weighted round robin with unequal weights 3, 1 and 2: over full cycles,
+ * the streams get shares of 3:1:2. A stream that is parked in the middle of
+ * its turn starts a new turn when it is ready again.
+ */
+static int stream_output_unequal_weight_test(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    uint8_t weights[3] = { 3, 1, 2 };
+    uint64_t stream_id[3];
+    uint64_t nb_bytes[3] = { 0, 0, 0 };
+    uint64_t current_time = 2000000;
+    size_t chunk = PICOQUIC_STREAM_WEIGHT_QUANTUM / 2;
+    picoquic_stream_head_t* stream;
+
+    if (PICOQUIC_STREAM_PRIORITY_FROM_URGENCY(PICOQUIC_URGENCY_DEFAULT, 0) != PICOQUIC_DEFAULT_STREAM_PRIORITY) {
+        DBG_PRINTF("%s", "Default urgency does not map to the default priority");
+        ret = -1;
+    }
+
+    for (int i = 1; ret == 0 && i <= STREAM_SCHED_TEST_NB_STREAMS; i++) {
+        if (picoquic_find_stream(cnx, STREAM_ID_FROM_RANK(i, 1, 0)) != NULL) {
+            ret = picoquic_mark_active_stream(cnx, STREAM_ID_FROM_RANK(i, 1, 0), 0, NULL);
+        }
+    }
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        stream_id[i] = STREAM_ID_FROM_RANK(i + 4, 1, 0);
+        if ((stream = picoquic_find_stream(cnx, stream_id[i])) == NULL &&
+            (stream = picoquic_create_stream(cnx, stream_id[i])) == NULL) {
+            ret = -1;
+        }
+        else {
+            stream->maxdata_remote = UINT64_MAX;
+            if ((ret = picoquic_set_stream_urgency(cnx, stream_id[i], 5, 1)) == 0 &&
+                (ret = picoquic_set_stream_weight(cnx, stream_id[i], weights[i])) == 0) {
+                ret = picoquic_mark_active_stream(cnx, stream_id[i], 1, NULL);
+            }
+        }
+    }
+
+    /* Each cycle is 2 * (3 + 1 + 2) chunks */
+    for (int turn = 0; ret == 0 && turn < 5 * 12; turn++) {
+        picoquic_stream_head_t* found = picoquic_find_ready_stream(cnx);
+        int rank = -1;
+
+        for (int i = 0; found != NULL && i < 3; i++) {
+            if (found->stream_id == stream_id[i]) {
+                rank = i;
+            }
+        }
+        if (rank < 0) {
+            DBG_PRINTF("Turn %d, unexpected stream %" PRId64, turn, (found == NULL) ? -1 : (int64_t)found->stream_id);
+            ret = -1;
+        }
+        else {
+            nb_bytes[rank] += chunk;
+            found->last_time_data_sent = current_time++;
+            picoquic_served_output_stream(cnx, found, chunk);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        if (nb_bytes[i] != 5 * 2 * weights[i] * chunk) {
+            DBG_PRINTF("Stream %d, weight %d, sent %" PRIu64 " bytes", i, weights[i], nb_bytes[i]);
+            ret = -1;
+        }
+    }
+
+    /* Park the first stream in the middle of its turn */
+    if (ret == 0) {
+        stream = picoquic_find_ready_stream(cnx);
+        if (stream == NULL || stream->stream_id != stream_id[0]) {
+            DBG_PRINTF("%s", "Unexpected stream after full cycles");
+            ret = -1;
+        }
+        else {
+            stream->last_time_data_sent = current_time++;
+            picoquic_served_output_stream(cnx, stream, chunk);
+            picoquic_park_output_stream(cnx, stream);
+            if (stream->bytes_in_turn != 0 || picoquic_find_ready_stream(cnx) == stream) {
+                DBG_PRINTF("%s", "Parked stream keeps its turn");
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int stream_output_sched_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    uint64_t simulated_time = 0;
+    uint64_t random_ctx = 0xdeadbeef0badcafeull;
+    uint8_t priorities[] = { 2, 3, 4, 5, 200 };
+    struct sockaddr_in saddr;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(quic,
+        picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*)&saddr,
+        simulated_time, 0, "test-sni", "test-alpn", 1)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create connection\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_callback(cnx, stream_output_test_callback, NULL);
+        cnx->max_stream_id_bidir_remote = STREAM_ID_FROM_RANK(STREAM_SCHED_TEST_NB_STREAMS, 1, 0);
+        cnx->maxdata_remote = UINT64_MAX;
+
+        /* Create the streams in random order, with random priorities */
+        for (int i = 0; ret == 0 && i < STREAM_SCHED_TEST_NB_STREAMS; i++) {
+            uint64_t rank = 1 + picoquic_test_uniform_random(&random_ctx, STREAM_SCHED_TEST_NB_STREAMS);
+            uint64_t stream_id = STREAM_ID_FROM_RANK(rank, 1, 0);
+            picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+            if (stream == NULL) {
+                stream = picoquic_create_stream(cnx, stream_id);
+            }
+            if (stream == NULL) {
+                ret = -1;
+            }
+            else {
+                stream->maxdata_remote = UINT64_MAX;
+                ret = picoquic_set_stream_priority(cnx, stream_id,
+                    priorities[picoquic_test_uniform_random(&random_ctx, sizeof(priorities))]);
+            }
+        }
+
+        if (ret == 0) {
+            ret = stream_output_sched_check_list(cnx);
+        }
+
+        for (int step = 0; ret == 0 && step < STREAM_SCHED_TEST_NB_STEPS; step++) {
+            picoquic_stream_head_t* expected = stream_output_sched_expected(cnx);
+            picoquic_stream_head_t* found = picoquic_find_ready_stream(cnx);
+            uint64_t stream_id = STREAM_ID_FROM_RANK(1 + picoquic_test_uniform_random(&random_ctx, STREAM_SCHED_TEST_NB_STREAMS), 1, 0);
+
+            if (found != expected) {
+                DBG_PRINTF("Step %d, found stream %" PRId64 " instead of %" PRId64, step,
+                    (found == NULL) ? -1 : (int64_t)found->stream_id,
+                    (expected == NULL) ? -1 : (int64_t)expected->stream_id);
+                ret = -1;
+                break;
+            }
+            /* Serve the selected stream, sometimes at the same time as the previous one */
+            if (found != NULL) {
+                found->last_time_data_sent = simulated_time;
+                picoquic_served_output_stream(cnx, found, 0);
+            }
+            if (picoquic_test_uniform_random(&random_ctx, 4) != 0) {
+                simulated_time++;
+            }
+            /* Change the state of a random stream */
+            if (picoquic_find_stream(cnx, stream_id) != NULL) {
+                switch (picoquic_test_uniform_random(&random_ctx, 4)) {
+                case 0:
+                    ret = picoquic_set_stream_priority(cnx, stream_id,
+                        priorities[picoquic_test_uniform_random(&random_ctx, sizeof(priorities))]);
+                    break;
+                case 1:
+                    ret = picoquic_mark_active_stream(cnx, stream_id, 0, NULL);
+                    break;
+                default:
+                    ret = picoquic_mark_active_stream(cnx, stream_id, 1, NULL);
+                    break;
+                }
+            }
+            if (ret == 0) {
+                ret = stream_output_sched_check_list(cnx);
+            }
+        }
+
+        if (ret == 0) {
+            ret = stream_output_weight_test(cnx);
+        }
+
+        if (ret == 0) {
+            ret = stream_output_unequal_weight_test(cnx);
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 /* Test the STREAM ID and STREAM RANK macros
  */
 
@@ -898,3 +1242,129 @@ int stream_rank_test()
 
     return ret;
 }
+
+/* Test the direct lookup of streams against the stream tree.
+ * Streams of all types are created in random order, including streams far
+ * above the window, and deleted at random. After each step, the lookup of
+ * every stream ID in the range and the ordered iteration by type must match
+ * the content of the tree.
+ */
+#define STREAM_TABLE_TEST_NB_STEPS 4000
+#define STREAM_TABLE_TEST_INDEX_RANGE 200
+
+static picoquic_stream_head_t* stream_table_test_tree_find(picoquic_cnx_t* cnx, uint64_t stream_id)
+{
+    picoquic_stream_head_t target;
+    target.stream_id = stream_id;
+
+    return (picoquic_stream_head_t*)picosplay_find(&cnx->stream_tree, (void*)&target);
+}
+
+static int stream_table_test_check(picoquic_cnx_t* cnx, uint64_t index_top)
+{
+    int ret = 0;
+
+    for (uint64_t stream_id = 0; ret == 0 && stream_id < 4 * (index_top + 1); stream_id++) {
+        if (picoquic_find_stream(cnx, stream_id) != stream_table_test_tree_find(cnx, stream_id)) {
+            DBG_PRINTF("Lookup of stream %" PRIu64 " does not match the tree", stream_id);
+            ret = -1;
+        }
+    }
+
+    for (uint64_t stream_type = 0; ret == 0 && stream_type < 4; stream_type++) {
+        picoquic_stream_head_t* expected = picoquic_first_stream(cnx);
+        picoquic_stream_head_t* stream = NULL;
+
+        while (expected != NULL && STREAM_TYPE_FROM_ID(expected->stream_id) != stream_type) {
+            expected = picoquic_next_stream(expected);
+        }
+        stream = expected;
+        while (ret == 0 && expected != NULL) {
+            do {
+                expected = picoquic_next_stream(expected);
+            } while (expected != NULL && STREAM_TYPE_FROM_ID(expected->stream_id) != stream_type);
+            stream = picoquic_next_stream_of_type(cnx, stream);
+            if (stream != expected) {
+                DBG_PRINTF("Iteration of type %" PRIu64 " does not match the tree", stream_type);
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int stream_table_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    uint64_t simulated_time = 0;
+    uint64_t random_ctx = 0x5747ab1e5eed0001ull;
+    uint64_t index_top = STREAM_TABLE_TEST_INDEX_RANGE;
+    struct sockaddr_in saddr;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*)&saddr,
+            simulated_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    for (int step = 0; ret == 0 && step < STREAM_TABLE_TEST_NB_STEPS; step++) {
+        uint64_t stream_type = picoquic_test_uniform_random(&random_ctx, 4);
+        uint64_t index = picoquic_test_uniform_random(&random_ctx, STREAM_TABLE_TEST_INDEX_RANGE);
+        uint64_t stream_id;
+        picoquic_stream_head_t* stream;
+
+        if (step % 1000 == 999) {
+            /* Jump far above the window, forcing it to slide */
+            index = PICOQUIC_STREAM_TABLE_SLOTS_MAX + (uint64_t)step;
+            if (index > index_top) {
+                index_top = index;
+            }
+        }
+        stream_id = 4 * index + stream_type;
+        stream = stream_table_test_tree_find(cnx, stream_id);
+
+        if (stream == NULL) {
+            if (picoquic_create_stream(cnx, stream_id) == NULL) {
+                DBG_PRINTF("Cannot create stream %" PRIu64, stream_id);
+                ret = -1;
+            }
+        }
+        else if (picoquic_test_uniform_random(&random_ctx, 2) == 0) {
+            picoquic_delete_stream(cnx, stream);
+        }
+
+        if (ret == 0 && (step % 97 == 0 || step % 1000 == 999)) {
+            ret = stream_table_test_check(cnx, (step % 1000 == 999) ? index_top : STREAM_TABLE_TEST_INDEX_RANGE);
+        }
+    }
+
+    if (ret == 0) {
+        ret = stream_table_test_check(cnx, index_top);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
@@ -1420,3 +1420,358 @@ int fuzz_initial_test()
 
     return ret;
 }
+
+/* Admission control of Initial packets.
+ * The unit test exercises the rate limit of each source prefix and the
+ * forced stateless retry directly on the admission filter.
+ */
+static void admission_test_set_addr(struct sockaddr_storage* addr_s, int is_ipv6, uint32_t prefix, uint32_t host)
+{
+    memset(addr_s, 0, sizeof(struct sockaddr_storage));
+    if (is_ipv6) {
+        struct sockaddr_in6* a6 = (struct sockaddr_in6*)addr_s;
+        uint8_t* a = (uint8_t*)&a6->sin6_addr;
+        a6->sin6_family = AF_INET6;
+        a[0] = 0x20;
+        a[1] = 0x01;
+        a[4] = (uint8_t)(prefix >> 8);
+        a[5] = (uint8_t)prefix;
+        a[14] = (uint8_t)(host >> 8);
+        a[15] = (uint8_t)host;
+        a6->sin6_port = htons((uint16_t)(1000 + host));
+    }
+    else {
+        struct sockaddr_in* a4 = (struct sockaddr_in*)addr_s;
+        uint8_t* a = (uint8_t*)&a4->sin_addr;
+        a4->sin_family = AF_INET;
+        a[0] = 10;
+        a[1] = (uint8_t)(prefix >> 8);
+        a[2] = (uint8_t)prefix;
+        a[3] = (uint8_t)host;
+        a4->sin_port = htons((uint16_t)(1000 + host));
+    }
+}
+
+int admission_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 1000000;
+    struct sockaddr_storage addr_s;
+    picoquic_admission_stats_t stats;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        return -1;
+    }
+
+    /* By default, everything is admitted */
+    admission_test_set_addr(&addr_s, 0, 1, 1);
+    for (int i = 0; ret == 0 && i < 100; i++) {
+        if (picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time) != 0) {
+            DBG_PRINTF("%s", "Initial refused without admission control");
+            ret = -1;
+        }
+    }
+
+    /* 10 Initials per second per prefix, bursts of 8 */
+    if (ret == 0 && picoquic_set_admission_parameters(quic, 10, 8, 0) != 0) {
+        DBG_PRINTF("%s", "Cannot set the admission parameters");
+        ret = -1;
+    }
+
+    for (int is_ipv6 = 0; ret == 0 && is_ipv6 < 2; is_ipv6++) {
+        int nb_admitted = 0;
+        int nb_other_admitted = 0;
+
+        /* Hosts in the same prefix share the same bucket */
+        for (uint32_t host = 0; host < 64; host++) {
+            admission_test_set_addr(&addr_s, is_ipv6, 2, host);
+            if (picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time) == 0) {
+                nb_admitted++;
+            }
+            /* Other prefixes are not affected */
+            admission_test_set_addr(&addr_s, is_ipv6, 3 + host, 1);
+            if (picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time) == 0) {
+                nb_other_admitted++;
+            }
+        }
+        if (nb_admitted != 8 || nb_other_admitted != 64) {
+            DBG_PRINTF("IPv%d: admitted %d in the prefix, %d in others", is_ipv6 ? 6 : 4, nb_admitted, nb_other_admitted);
+            ret = -1;
+        }
+        else {
+            /* After 100 ms, one more Initial is admitted from the prefix */
+            admission_test_set_addr(&addr_s, is_ipv6, 2, 100);
+            if (picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time + 100000) != 0 ||
+                picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time + 100000) == 0) {
+                DBG_PRINTF("IPv%d: unexpected admission after 100 ms", is_ipv6 ? 6 : 4);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Under load, Initials without token are answered with a retry */
+    if (ret == 0) {
+        simulated_time += 10000000;
+        picoquic_set_admission_load(quic, 800);
+        if (picoquic_set_admission_parameters(quic, 0, 0, 500) != 0) {
+            ret = -1;
+        }
+        admission_test_set_addr(&addr_s, 0, 2, 1);
+        if (ret != 0 ||
+            picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time) != PICOQUIC_ERROR_STATELESS_RETRY ||
+            picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 1, simulated_time) != 0) {
+            DBG_PRINTF("%s", "Unexpected admission under load");
+            ret = -1;
+        }
+        picoquic_set_admission_load(quic, 100);
+        if (ret == 0 && picoquic_admission_check(quic, (struct sockaddr*)&addr_s, 0, simulated_time) != 0) {
+            DBG_PRINTF("%s", "Unexpected retry without load");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_admission_stats(quic, &stats);
+        if (stats.nb_initials_checked != stats.nb_admitted + stats.nb_rate_limited + stats.nb_stateless_retry ||
+            stats.nb_rate_limited != 2 * (56 + 1) || stats.nb_stateless_retry != 1 || stats.load_permille != 100) {
+            DBG_PRINTF("Unexpected stats: %" PRIu64 " checked, %" PRIu64 " admitted, %" PRIu64 " limited, %" PRIu64 " retry",
+                stats.nb_initials_checked, stats.nb_admitted, stats.nb_rate_limited, stats.nb_stateless_retry);
+            ret = -1;
+        }
+    }
+
+    picoquic_free(quic);
+
+    return ret;
+}
+
+/* Flood of Initial packets.
+ * A real client Initial is replayed from many source addresses. The test
+ * verifies that rate limited and retried Initials do not create connection
+ * contexts, and reports the processing cost of an admitted Initial, a rate
+ * limited Initial and a retried Initial.
+ */
+#define INITIAL_FLOOD_NB_PACKETS 128
+
+static int initial_flood_submit(picoquic_test_tls_api_ctx_t* test_ctx, uint8_t* bytes, size_t length,
+    uint32_t prefix_base, int same_prefix, uint64_t simulated_time, double* ns_per_packet)
+{
+    int ret = 0;
+    struct sockaddr_storage addr_s;
+    uint64_t start_time = picoquic_current_time();
+
+    for (uint32_t i = 0; ret == 0 && i < INITIAL_FLOOD_NB_PACKETS; i++) {
+        if (same_prefix) {
+            admission_test_set_addr(&addr_s, 0, prefix_base, i);
+        }
+        else {
+            admission_test_set_addr(&addr_s, 0, prefix_base + i, 1);
+        }
+        ret = picoquic_incoming_packet(test_ctx->qserver, bytes, length, (struct sockaddr*)&addr_s,
+            (struct sockaddr*)&test_ctx->server_addr, 0, 0, simulated_time);
+    }
+    *ns_per_packet = ((double)(picoquic_current_time() - start_time)) * 1000.0 / INITIAL_FLOOD_NB_PACKETS;
+
+    return ret;
+}
+
+static int initial_flood_nb_cnx(picoquic_quic_t* quic)
+{
+    int nb_cnx = 0;
+    picoquic_cnx_t* cnx = quic->cnx_list;
+
+    while (cnx != NULL) {
+        nb_cnx++;
+        cnx = cnx->next_in_table;
+    }
+    return nb_cnx;
+}
+
+static void initial_flood_reset(picoquic_quic_t* quic)
+{
+    picoquic_stateless_packet_t* sp;
+
+    while (quic->cnx_list != NULL) {
+        picoquic_delete_cnx(quic->cnx_list);
+    }
+    while ((sp = picoquic_dequeue_stateless_packet(quic)) != NULL) {
+        picoquic_delete_stateless_packet(sp);
+    }
+}
+
+/* An Initial whose token does not verify must be treated as carrying no
+ * token, i.e., answered by a stateless retry while the server is overloaded.
+ */
+static int initial_flood_forged_token(picoquic_test_tls_api_ctx_t* test_ctx, const uint8_t* initial,
+    size_t initial_length, uint64_t simulated_time)
+{
+    int ret = 0;
+    uint8_t forged[PICOQUIC_MAX_PACKET_SIZE];
+    size_t byte_index = 5;
+    size_t token_length = 0;
+    picoquic_admission_stats_t stats;
+    uint64_t nb_stateless_retry;
+    picoquic_stateless_packet_t* sp;
+
+    picoquic_get_admission_stats(test_ctx->qserver, &stats);
+    nb_stateless_retry = stats.nb_stateless_retry;
+
+    /* Skip the DCID and the SCID, then flip a byte of the token */
+    memcpy(forged, initial, initial_length);
+    byte_index += 1 + (size_t)forged[byte_index];
+    byte_index += 1 + (size_t)forged[byte_index];
+    byte_index += picoquic_decode_varint_length(forged[byte_index]);
+    token_length = test_ctx->cnx_client->retry_token_length;
+    if (token_length == 0 || byte_index + token_length > initial_length) {
+        DBG_PRINTF("%s", "No token in the client Initial");
+        ret = -1;
+    }
+    else {
+        forged[byte_index + token_length - 1] ^= 0xFF;
+        ret = picoquic_incoming_packet(test_ctx->qserver, forged, initial_length,
+            (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0, 0, simulated_time);
+        picoquic_get_admission_stats(test_ctx->qserver, &stats);
+        if (ret == 0 && (initial_flood_nb_cnx(test_ctx->qserver) != 0 || stats.nb_stateless_retry != nb_stateless_retry + 1)) {
+            DBG_PRINTF("%s", "Initial with forged token was not retried");
+            ret = -1;
+        }
+    }
+    while ((sp = picoquic_dequeue_stateless_packet(test_ctx->qserver)) != NULL) {
+        picoquic_delete_stateless_packet(sp);
+    }
+
+    return ret;
+}
+
+int initial_flood_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t initial[PICOQUIC_MAX_PACKET_SIZE];
+    size_t initial_length = 0;
+    struct sockaddr_storage addr_to;
+    struct sockaddr_storage addr_from;
+    double ns_admitted = 0;
+    double ns_rate_limited = 0;
+    double ns_retry = 0;
+    picoquic_admission_stats_t stats;
+
+    ret = tls_api_init_ctx_ex2(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time,
+        NULL, NULL, 0, 0, 0, NULL, 2 * INITIAL_FLOOD_NB_PACKETS, 0, 0, 0);
+
+    /* The defaults would trigger token checks after 64 half open connections,
+     * and would only hold 64 stateless packets. */
+    if (ret == 0) {
+        test_ctx->qserver->max_half_open_before_retry = 2 * INITIAL_FLOOD_NB_PACKETS;
+        ret = picoquic_set_stateless_pool_size(test_ctx->qserver, 2 * INITIAL_FLOOD_NB_PACKETS);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time, initial, sizeof(initial),
+            &initial_length, &addr_to, &addr_from, NULL);
+        if (ret == 0 && initial_length == 0) {
+            DBG_PRINTF("%s", "Could not prepare the client Initial");
+            ret = -1;
+        }
+    }
+
+    /* Baseline: every Initial creates a connection context */
+    if (ret == 0) {
+        ret = initial_flood_submit(test_ctx, initial, initial_length, 0x100, 0, simulated_time, &ns_admitted);
+        if (ret == 0 && initial_flood_nb_cnx(test_ctx->qserver) != INITIAL_FLOOD_NB_PACKETS) {
+            DBG_PRINTF("Baseline created %d contexts", initial_flood_nb_cnx(test_ctx->qserver));
+            ret = -1;
+        }
+        initial_flood_reset(test_ctx->qserver);
+    }
+
+    /* Rate limit: once the burst is consumed, nothing is admitted from the prefix */
+    if (ret == 0) {
+        ret = picoquic_set_admission_parameters(test_ctx->qserver, 10, 8, 0);
+        if (ret == 0) {
+            struct sockaddr_storage addr_s;
+
+            admission_test_set_addr(&addr_s, 0, 0x200, 0);
+            for (int i = 0; i < 8; i++) {
+                (void)picoquic_admission_check(test_ctx->qserver, (struct sockaddr*)&addr_s, 0, simulated_time);
+            }
+            ret = initial_flood_submit(test_ctx, initial, initial_length, 0x200, 1, simulated_time, &ns_rate_limited);
+        }
+        picoquic_get_admission_stats(test_ctx->qserver, &stats);
+        if (ret == 0 && (initial_flood_nb_cnx(test_ctx->qserver) != 0 ||
+            stats.nb_rate_limited != INITIAL_FLOOD_NB_PACKETS)) {
+            DBG_PRINTF("Rate limit created %d contexts, %" PRIu64 " limited",
+                initial_flood_nb_cnx(test_ctx->qserver), stats.nb_rate_limited);
+            ret = -1;
+        }
+        initial_flood_reset(test_ctx->qserver);
+    }
+
+    /* Overload: every Initial is answered by a stateless retry */
+    if (ret == 0) {
+        ret = picoquic_set_admission_parameters(test_ctx->qserver, 0, 0, 500);
+        picoquic_set_admission_load(test_ctx->qserver, 900);
+        if (ret == 0) {
+            ret = initial_flood_submit(test_ctx, initial, initial_length, 0x300, 0, simulated_time, &ns_retry);
+        }
+        picoquic_get_admission_stats(test_ctx->qserver, &stats);
+        if (ret == 0 && (initial_flood_nb_cnx(test_ctx->qserver) != 0 ||
+            stats.nb_stateless_retry != INITIAL_FLOOD_NB_PACKETS ||
+            test_ctx->qserver->nb_stateless_queued < INITIAL_FLOOD_NB_PACKETS)) {
+            DBG_PRINTF("Retry mode created %d contexts, %" PRIu64 " retries",
+                initial_flood_nb_cnx(test_ctx->qserver), stats.nb_stateless_retry);
+            ret = -1;
+        }
+        initial_flood_reset(test_ctx->qserver);
+    }
+
+    /* The client that receives the retry is admitted with the token */
+    if (ret == 0) {
+        picoquic_stateless_packet_t* sp;
+        uint64_t nb_admitted = stats.nb_admitted;
+
+        ret = picoquic_incoming_packet(test_ctx->qserver, initial, initial_length,
+            (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0, 0, simulated_time);
+        if (ret == 0 && (sp = picoquic_dequeue_stateless_packet(test_ctx->qserver)) != NULL) {
+            ret = picoquic_incoming_packet(test_ctx->qclient, sp->bytes, sp->length,
+                (struct sockaddr*)&test_ctx->server_addr, (struct sockaddr*)&test_ctx->client_addr, 0, 0, simulated_time);
+            picoquic_delete_stateless_packet(sp);
+            if (ret == 0) {
+                ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time, initial, sizeof(initial),
+                    &initial_length, &addr_to, &addr_from, NULL);
+            }
+            if (ret == 0) {
+                ret = initial_flood_forged_token(test_ctx, initial, initial_length, simulated_time);
+            }
+            if (ret == 0) {
+                ret = picoquic_incoming_packet(test_ctx->qserver, initial, initial_length,
+                    (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0, 0, simulated_time);
+            }
+            picoquic_get_admission_stats(test_ctx->qserver, &stats);
+            if (ret == 0 && (test_ctx->cnx_client->retry_token_length == 0 ||
+                initial_flood_nb_cnx(test_ctx->qserver) != 1 || stats.nb_admitted != nb_admitted + 1)) {
+                DBG_PRINTF("%s", "Initial with retry token not admitted");
+                ret = -1;
+            }
+        }
+        else if (ret == 0) {
+            DBG_PRINTF("%s", "No retry sent to the client");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("Cost per Initial: admitted %.0f ns, rate limited %.0f ns, retry %.0f ns",
+            ns_admitted, ns_rate_limited, ns_retry);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+    }
+
+    return ret;
+}
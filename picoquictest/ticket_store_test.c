@@ -422,6 +422,301 @@ int token_store_test()
     return ret;
 }
 
+/* Check the indexed stores of the QUIC context: lookup among many SNI,
+ * LRU eviction, journal of the used marks, compaction of the file, and
+ * bound of the journal kept in memory.
+ */
+#define TICKET_INDEX_TEST_MAX 512
+#define TICKET_INDEX_TEST_NB 1023
+
+static char const* test_ticket_index_file_name = "ticket_index_test.bin";
+static char const* test_token_index_file_name = "token_index_test.bin";
+
+static picoquic_quic_t* ticket_index_test_create(uint64_t* p_simulated_time)
+{
+    picoquic_quic_t* quic = picoquic_create(4, NULL, NULL, NULL, test_alpn[0], NULL, NULL, NULL, NULL,
+        NULL, *p_simulated_time, p_simulated_time, test_ticket_index_file_name, NULL, 0);
+
+    if (quic != NULL) {
+        picoquic_set_ticket_store_max(quic, TICKET_INDEX_TEST_MAX, 64);
+    }
+    return quic;
+}
+
+static int ticket_index_test_store(picoquic_quic_t* quic, uint64_t current_time, size_t i)
+{
+    char sni[32];
+    uint8_t ticket[64];
+    int ret = create_test_ticket(current_time / 1000 + i, 100000, ticket, sizeof(ticket));
+
+    if (ret == 0) {
+        (void)picoquic_sprintf(sni, sizeof(sni), NULL, "s%zu.example.com", i);
+        ret = picoquic_store_session_ticket(quic, current_time, sni, (uint16_t)strlen(sni),
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]), test_version[0], NULL, 0, NULL, 0,
+            ticket, (uint16_t)sizeof(ticket), &test_tp);
+    }
+    return ret;
+}
+
+static picoquic_stored_ticket_t* ticket_index_test_get(picoquic_quic_t* quic, uint64_t current_time, size_t i)
+{
+    char sni[32];
+
+    (void)picoquic_sprintf(sni, sizeof(sni), NULL, "s%zu.example.com", i);
+    return picoquic_get_session_ticket(quic, current_time, sni, (uint16_t)strlen(sni),
+        test_alpn[0], (uint16_t)strlen(test_alpn[0]), test_version[0], 1, 0);
+}
+
+int ticket_index_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 1000000000;
+    picoquic_quic_t* quic = NULL;
+    picoquic_stored_ticket_t* p_first_ticket = NULL;
+    picoquic_stored_ticket_t* used_ticket = NULL;
+
+    /* Start from an empty file */
+    ret = picoquic_save_tickets(NULL, simulated_time, test_ticket_index_file_name);
+    if (ret == 0 && (quic = ticket_index_test_create(&simulated_time)) == NULL) {
+        ret = -1;
+    }
+
+    /* Fill the store, refresh the first ticket, then overflow it */
+    for (size_t i = 0; ret == 0 && i < TICKET_INDEX_TEST_NB; i++) {
+        if (i == TICKET_INDEX_TEST_MAX && ticket_index_test_get(quic, simulated_time, 0) == NULL) {
+            DBG_PRINTF("%s", "Cannot find the first ticket");
+            ret = -1;
+        }
+        else {
+            ret = ticket_index_test_store(quic, simulated_time, i);
+        }
+    }
+
+    if (ret == 0 && quic->ticket_index.nb_tickets != TICKET_INDEX_TEST_MAX) {
+        DBG_PRINTF("Store has %zu tickets", quic->ticket_index.nb_tickets);
+        ret = -1;
+    }
+
+    /* The records of the evicted tickets are not kept in memory */
+    if (ret == 0 && (quic->ticket_index.journal.nb_pending != 0 || !quic->ticket_index.journal.is_rewrite_required)) {
+        DBG_PRINTF("Journal has %zu pending records", quic->ticket_index.journal.nb_pending);
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < TICKET_INDEX_TEST_NB; i++) {
+        int is_expected = (i == 0 || i >= TICKET_INDEX_TEST_MAX);
+        if ((ticket_index_test_get(quic, simulated_time, i) != NULL) != is_expected) {
+            DBG_PRINTF("Ticket %zu found: %d", i, !is_expected);
+            ret = -1;
+        }
+    }
+
+    /* Update the last ticket, mark one ticket as used and save the store */
+    if (ret == 0) {
+        ret = ticket_index_test_store(quic, simulated_time, TICKET_INDEX_TEST_NB - 1);
+    }
+
+    if (ret == 0) {
+        if ((used_ticket = ticket_index_test_get(quic, simulated_time, TICKET_INDEX_TEST_MAX)) == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_mark_session_ticket_used(quic, used_ticket);
+            ret = picoquic_save_session_tickets(quic, test_ticket_index_file_name);
+            if (ret == 0 && quic->ticket_index.journal.nb_records != TICKET_INDEX_TEST_MAX - 1) {
+                DBG_PRINTF("File has %zu records", quic->ticket_index.journal.nb_records);
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+        quic = NULL;
+    }
+
+    /* The file was rewritten from the index, without the used ticket */
+    if (ret == 0) {
+        size_t nb_loaded = 0;
+        size_t nb_last = 0;
+
+        ret = picoquic_load_tickets(&p_first_ticket, simulated_time, test_ticket_index_file_name);
+        for (picoquic_stored_ticket_t* next = p_first_ticket; next != NULL; next = next->next_ticket) {
+            nb_loaded++;
+            if (next->sni_length == 16 && memcmp(next->sni, "s512.example.com", 16) == 0) {
+                DBG_PRINTF("%s", "Used ticket loaded");
+                ret = -1;
+            }
+            else if (next->sni_length == 17 && memcmp(next->sni, "s1022.example.com", 17) == 0) {
+                nb_last++;
+            }
+        }
+        if (ret == 0 && (nb_loaded != TICKET_INDEX_TEST_MAX - 1 || nb_last != 1)) {
+            DBG_PRINTF("Loaded %zu tickets, %zu copies of the last one", nb_loaded, nb_last);
+            ret = -1;
+        }
+        picoquic_free_tickets(&p_first_ticket);
+    }
+
+    /* Reload, verify that the used ticket is not resurrected */
+    if (ret == 0 && (quic = ticket_index_test_create(&simulated_time)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        if (ticket_index_test_get(quic, simulated_time, TICKET_INDEX_TEST_NB - 1) == NULL) {
+            DBG_PRINTF("%s", "Last ticket not reloaded");
+            ret = -1;
+        }
+        else if (picoquic_get_session_ticket(quic, simulated_time, "s512.example.com", 16,
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]), test_version[0], 0, 0) != NULL) {
+            DBG_PRINTF("%s", "Used ticket reloaded");
+            ret = -1;
+        }
+    }
+
+    /* Add enough tickets to make most of the file obsolete, and check the compaction */
+    for (size_t i = TICKET_INDEX_TEST_NB; ret == 0 && i < TICKET_INDEX_TEST_NB + TICKET_INDEX_TEST_MAX / 4; i++) {
+        ret = ticket_index_test_store(quic, simulated_time, i);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_save_session_tickets(quic, test_ticket_index_file_name);
+        if (ret == 0 && quic->ticket_index.journal.nb_records != TICKET_INDEX_TEST_MAX) {
+            DBG_PRINTF("File not compacted, %zu records", quic->ticket_index.journal.nb_records);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        size_t nb_loaded = 0;
+
+        ret = picoquic_load_tickets(&p_first_ticket, simulated_time, test_ticket_index_file_name);
+        for (picoquic_stored_ticket_t* next = p_first_ticket; next != NULL; next = next->next_ticket) {
+            nb_loaded++;
+        }
+        if (ret == 0 && nb_loaded != TICKET_INDEX_TEST_MAX) {
+            DBG_PRINTF("Compacted file has %zu tickets", nb_loaded);
+            ret = -1;
+        }
+        picoquic_free_tickets(&p_first_ticket);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+        quic = NULL;
+    }
+
+    /* The replay of the compacted file restores the LRU order */
+    if (ret == 0 && (quic = ticket_index_test_create(&simulated_time)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_stored_ticket_t* last_stored = ticket_index_test_get(quic, simulated_time,
+            TICKET_INDEX_TEST_NB + TICKET_INDEX_TEST_MAX / 4 - 1);
+        if (last_stored == NULL || quic->p_first_ticket != last_stored ||
+            quic->ticket_index.nb_tickets != TICKET_INDEX_TEST_MAX ||
+            quic->ticket_index.last_ticket == NULL || quic->ticket_index.last_ticket->previous_ticket == NULL) {
+            DBG_PRINTF("%s", "Unexpected store after compaction");
+            ret = -1;
+        }
+    }
+
+    /* Repeated updates of the same ticket do not grow the journal past the store capacity */
+    for (size_t i = 0; ret == 0 && i < 2 * TICKET_INDEX_TEST_MAX; i++) {
+        ret = ticket_index_test_store(quic, simulated_time, TICKET_INDEX_TEST_NB + TICKET_INDEX_TEST_MAX / 4 - 1);
+        if (ret == 0 && quic->ticket_index.journal.nb_pending > TICKET_INDEX_TEST_MAX + PICOQUIC_STORE_INDEX_NB_BINS_MIN) {
+            DBG_PRINTF("Journal has %zu pending records", quic->ticket_index.journal.nb_pending);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_save_session_tickets(quic, test_ticket_index_file_name);
+        if (ret == 0 && (quic->ticket_index.journal.nb_records != TICKET_INDEX_TEST_MAX ||
+            quic->ticket_index.journal.is_rewrite_required)) {
+            DBG_PRINTF("File not rewritten, %zu records", quic->ticket_index.journal.nb_records);
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+#define TOKEN_INDEX_TEST_NB 100
+
+int token_index_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 1000000000;
+    uint8_t ip_addr[4] = { 10, 0, 0, 1 };
+    picoquic_quic_t* quic = NULL;
+
+    ret = picoquic_save_tokens(NULL, simulated_time, test_token_index_file_name);
+
+    for (int pass = 0; ret == 0 && pass < 2; pass++) {
+        if ((quic = ticket_index_test_create(&simulated_time)) == NULL) {
+            ret = -1;
+        }
+        else {
+            (void)picoquic_load_token_file(quic, test_token_index_file_name);
+        }
+
+        for (size_t i = 0; ret == 0 && pass == 0 && i < TOKEN_INDEX_TEST_NB; i++) {
+            char sni[32];
+            uint8_t token[16];
+
+            (void)picoquic_sprintf(sni, sizeof(sni), NULL, "s%zu.example.com", i);
+            memset(token, (int)i, sizeof(token));
+            ret = picoquic_store_retry_token(quic, simulated_time, sni, (uint16_t)strlen(sni),
+                ip_addr, sizeof(ip_addr), token, sizeof(token));
+        }
+
+        /* The most recent token is used in the first pass, and must not come back */
+        for (size_t i = 0; ret == 0 && i < TOKEN_INDEX_TEST_NB; i++) {
+            char sni[32];
+            uint8_t* token = NULL;
+            uint16_t token_length = 0;
+            int is_expected = (i >= TOKEN_INDEX_TEST_NB - 64 && (pass == 0 || i < TOKEN_INDEX_TEST_NB - 1));
+            int is_found;
+
+            (void)picoquic_sprintf(sni, sizeof(sni), NULL, "s%zu.example.com", i);
+            is_found = (picoquic_get_retry_token(quic, simulated_time, sni, (uint16_t)strlen(sni),
+                (i % 2 == 0) ? ip_addr : NULL, (i % 2 == 0) ? sizeof(ip_addr) : 0,
+                &token, &token_length, i == TOKEN_INDEX_TEST_NB - 1) == 0);
+            if (is_found != is_expected || (is_found && (token_length != 16 || token[0] != (uint8_t)i))) {
+                DBG_PRINTF("Pass %d, token %zu found: %d", pass, i, is_found);
+                ret = -1;
+            }
+            if (token != NULL) {
+                free(token);
+            }
+        }
+
+        /* The used token is kept in memory, but not reloaded */
+        if (ret == 0 && quic->token_index.nb_tokens != ((pass == 0) ? 64 : 63)) {
+            DBG_PRINTF("Pass %d, store has %zu tokens", pass, quic->token_index.nb_tokens);
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            ret = picoquic_save_retry_tokens(quic, test_token_index_file_name);
+        }
+
+        if (quic != NULL) {
+            picoquic_free(quic);
+            quic = NULL;
+        }
+    }
+
+    return ret;
+}
+
 /* Check the protection against token reuse */
 typedef struct st_token_reuse_api_case_t {
     uint64_t expiry_date;
@@ -446,6 +741,7 @@ int token_reuse_api_test()
     int ret = 0;
     uint64_t test_time = 4;
     uint64_t simulated_time = 0;
+    uint64_t unit = 1;
     picoquic_quic_t * quic = picoquic_create(4, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL,
         NULL, 0, &simulated_time, NULL, NULL, 0);
 
@@ -454,12 +750,15 @@ int token_reuse_api_test()
         ret = -1;
     }
     else {
+        /* Tokens are expired per time bucket, so each test date is in a separate bucket */
+        unit = quic->token_anti_replay.bucket_duration;
+        test_time *= unit;
         /* Test that all tokens can be created */
         for (size_t i = 0; ret == 0 && i < nb_token_reuse_api_cases; i++) {
             if (picoquic_registered_token_check_reuse(quic,
                 token_reuse_api_cases[i].token,
                 token_reuse_api_cases[i].token_length,
-                token_reuse_api_cases[i].expiry_date) != 0) {
+                token_reuse_api_cases[i].expiry_date * unit) != 0) {
                 DBG_PRINTF("Token[%z] already used?", i);
                 ret = -1;
             }
@@ -469,7 +768,7 @@ int token_reuse_api_test()
             if (picoquic_registered_token_check_reuse(quic,
                 token_reuse_api_cases[i].token,
                 token_reuse_api_cases[i].token_length,
-                token_reuse_api_cases[i].expiry_date) == 0) {
+                token_reuse_api_cases[i].expiry_date * unit) == 0) {
                 DBG_PRINTF("Token[%z] not already used?", i);
                 ret = -1;
             }
@@ -481,12 +780,12 @@ int token_reuse_api_test()
             int x = picoquic_registered_token_check_reuse(quic,
                 token_reuse_api_cases[i].token,
                 token_reuse_api_cases[i].token_length,
-                token_reuse_api_cases[i].expiry_date);
-            if (x == 0 && token_reuse_api_cases[i].expiry_date >= test_time){
+                token_reuse_api_cases[i].expiry_date * unit);
+            if (x == 0 && token_reuse_api_cases[i].expiry_date * unit >= test_time){
                 DBG_PRINTF("Token[%z], time %" PRIu64 " not already used?", i, token_reuse_api_cases[i].expiry_date);
                 ret = -1;
             }
-            if (x != 0 && token_reuse_api_cases[i].expiry_date < test_time) {
+            if (x != 0 && token_reuse_api_cases[i].expiry_date * unit < test_time) {
                 DBG_PRINTF("Token[%z], time %" PRIu64 " already used?", i, token_reuse_api_cases[i].expiry_date);
                 ret = -1;
             }
@@ -507,6 +806,118 @@ int token_reuse_api_test()
     return ret;
 }
 
+/* Check the false positive budget and the memory cap of the anti-replay
+ * filters, the expiry of whole buckets, and the expiry of the issued tickets.
+ */
+#define ANTI_REPLAY_TEST_NB_TOKENS 2000
+#define ANTI_REPLAY_TEST_NB_EXTRA 1000
+
+static void anti_replay_test_token(uint8_t* token, uint64_t seed)
+{
+    picoformat_64(token, seed);
+    picoformat_64(token + 8, seed * 0x9E3779B97F4A7C15ull + 0x12345);
+}
+
+int anti_replay_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t expiry_time = 0;
+    uint64_t nb_false_positives = 0;
+    uint8_t token[16];
+    picoquic_anti_replay_stats_t stats;
+    picoquic_quic_t* quic = picoquic_create(4, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL,
+        NULL, 0, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        return -1;
+    }
+
+    /* 1 in 256 false positives, capacity of a bit more than 2000 tokens per bucket.
+     * The false positive rate grows to the budget as the bucket fills up. */
+    picoquic_set_anti_replay_parameters(quic, PICOQUIC_ANTI_REPLAY_NB_BUCKETS * 8 * 2100 * 8 * 100 / (69 * 64), 8);
+    expiry_time = simulated_time + PICOQUIC_TOKEN_DELAY_SHORT;
+    for (uint64_t i = 0; ret == 0 && i < ANTI_REPLAY_TEST_NB_TOKENS; i++) {
+        anti_replay_test_token(token, i);
+        if (picoquic_registered_token_check_reuse(quic, token, sizeof(token), expiry_time) != 0) {
+            nb_false_positives++;
+        }
+    }
+    picoquic_get_anti_replay_stats(quic, &stats);
+    if (stats.bucket_capacity < ANTI_REPLAY_TEST_NB_TOKENS ||
+        stats.bytes_allocated > quic->token_anti_replay.memory_max) {
+        DBG_PRINTF("Capacity %" PRIu64 ", %zu bytes", stats.bucket_capacity, stats.bytes_allocated);
+        ret = -1;
+    }
+    else if (nb_false_positives > ANTI_REPLAY_TEST_NB_TOKENS / 256 || stats.nb_tokens_over_capacity != 0) {
+        DBG_PRINTF("%" PRIu64 " false positives", nb_false_positives);
+        ret = -1;
+    }
+    /* Registering more tokens than planned is possible, but counted */
+    for (uint64_t i = 0; ret == 0 && i < ANTI_REPLAY_TEST_NB_EXTRA; i++) {
+        anti_replay_test_token(token, ANTI_REPLAY_TEST_NB_TOKENS + i);
+        (void)picoquic_registered_token_check_reuse(quic, token, sizeof(token), expiry_time);
+    }
+    picoquic_get_anti_replay_stats(quic, &stats);
+    if (ret == 0 && (stats.nb_tokens_over_capacity == 0 ||
+        stats.nb_tokens_registered + stats.nb_replays_detected != ANTI_REPLAY_TEST_NB_TOKENS + ANTI_REPLAY_TEST_NB_EXTRA)) {
+        DBG_PRINTF("Over capacity: %" PRIu64 ", registered: %" PRIu64, stats.nb_tokens_over_capacity, stats.nb_tokens_registered);
+        ret = -1;
+    }
+
+    /* All the tokens are in one bucket, which expires in one step */
+    if (ret == 0) {
+        anti_replay_test_token(token, 0);
+        picoquic_registered_token_clear(quic, expiry_time + quic->token_anti_replay.bucket_duration);
+        picoquic_get_anti_replay_stats(quic, &stats);
+        if (stats.nb_buckets_expired != 1 || stats.nb_tokens_in_filters != 0) {
+            DBG_PRINTF("Expired %" PRIu64 " buckets", stats.nb_buckets_expired);
+            ret = -1;
+        }
+        else if (picoquic_registered_token_check_reuse(quic, token, sizeof(token), expiry_time) != 0) {
+            DBG_PRINTF("%s", "Token still registered after expiry");
+            ret = -1;
+        }
+    }
+
+    /* A token that expired a full ring ago cannot be checked */
+    if (ret == 0) {
+        uint64_t ring_time = quic->token_anti_replay.bucket_duration * PICOQUIC_ANTI_REPLAY_NB_BUCKETS;
+
+        anti_replay_test_token(token, 1);
+        if (picoquic_registered_token_check_reuse(quic, token, sizeof(token), expiry_time + ring_time) != 0 ||
+            picoquic_registered_token_check_reuse(quic, token, sizeof(token), expiry_time) == 0) {
+            DBG_PRINTF("%s", "Out of window token accepted");
+            ret = -1;
+        }
+        else {
+            picoquic_get_anti_replay_stats(quic, &stats);
+            if (stats.nb_tokens_out_of_window != 1) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* The issued tickets expire after their lifetime, oldest first */
+    for (uint64_t i = 0; ret == 0 && i < 3; i++) {
+        ret = picoquic_remember_issued_ticket(quic, i * 1000000, 1000 + i, 10000, 100000, NULL, 0);
+    }
+    if (ret == 0) {
+        ret = picoquic_remember_issued_ticket(quic, PICOQUIC_ISSUED_TICKET_LIFETIME + 1000000, 2000, 10000, 100000, NULL, 0);
+        picoquic_get_anti_replay_stats(quic, &stats);
+        if (ret == 0 && (stats.nb_issued_tickets != 2 || stats.nb_issued_tickets_expired != 2 ||
+            picoquic_retrieve_issued_ticket(quic, 1001) != NULL || picoquic_retrieve_issued_ticket(quic, 1002) == NULL)) {
+            DBG_PRINTF("%zu issued tickets, %" PRIu64 " expired", stats.nb_issued_tickets, stats.nb_issued_tickets_expired);
+            ret = -1;
+        }
+    }
+
+    picoquic_free(quic);
+
+    return ret;
+}
+
 /* Ticket seed. Do a connection, and verify that server and client have properly
  * documented the congestion parameters in the outgoing or incoming tickets
  */
@@ -557,6 +968,7 @@ int ticket_seed_test_one(int bdp_option)
         /* Check the ticket store at the client. */
         picoquic_stored_ticket_t* client_ticket;
 
+        picoquic_ticket_index_load(test_ctx->qclient);
         client_ticket = picoquic_get_stored_ticket(test_ctx->qclient->p_first_ticket, simulated_time,
             PICOQUIC_TEST_SNI, (uint16_t)strlen(PICOQUIC_TEST_SNI),
             PICOQUIC_TEST_ALPN, (uint16_t)strlen(PICOQUIC_TEST_ALPN),
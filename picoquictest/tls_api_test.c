@@ -403,6 +403,78 @@ static int tls_api_inject_packet(picoquic_test_tls_api_ctx_t* test_ctx, int from
     return ret;
 }
 
+static void test_api_zero_copy_release(void* release_ctx, uint8_t* data)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(data);
+#endif
+    ((picoquic_test_tls_api_ctx_t*)release_ctx)->nb_zero_copy_released++;
+}
+
+static int test_api_add_to_stream(picoquic_test_tls_api_ctx_t* test_ctx, picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* data, size_t length)
+{
+    int ret;
+
+    if (test_ctx->use_zero_copy) {
+        ret = picoquic_add_to_stream_zero_copy(cnx, stream_id, data, length, 1, NULL,
+            test_api_zero_copy_release, test_ctx);
+    }
+    else {
+        ret = picoquic_add_to_stream(cnx, stream_id, data, length, 1);
+    }
+    return ret;
+}
+
+static void test_api_borrow_data(picoquic_test_tls_api_ctx_t* test_ctx, picoquic_cnx_t* cnx,
+    uint8_t* bytes, size_t length)
+{
+    test_api_borrowed_t* borrowed;
+
+    if (test_ctx->nb_borrowed >= test_ctx->nb_borrowed_alloc) {
+        size_t new_alloc = (test_ctx->nb_borrowed_alloc == 0) ? 64 : 2 * test_ctx->nb_borrowed_alloc;
+        test_api_borrowed_t* new_borrowed = (test_api_borrowed_t*)realloc(test_ctx->borrowed,
+            new_alloc * sizeof(test_api_borrowed_t));
+        if (new_borrowed == NULL) {
+            test_ctx->nb_borrow_failed++;
+            return;
+        }
+        test_ctx->borrowed = new_borrowed;
+        test_ctx->nb_borrowed_alloc = new_alloc;
+    }
+    borrowed = &test_ctx->borrowed[test_ctx->nb_borrowed];
+    if ((borrowed->copy = (uint8_t*)malloc(length)) == NULL) {
+        test_ctx->nb_borrow_failed++;
+    }
+    else if ((borrowed->ref = picoquic_retain_stream_data(cnx, bytes)) == NULL) {
+        free(borrowed->copy);
+        test_ctx->nb_borrow_failed++;
+    }
+    else {
+        memcpy(borrowed->copy, bytes, length);
+        borrowed->bytes = bytes;
+        borrowed->length = length;
+        test_ctx->nb_borrowed++;
+    }
+}
+
+/* Verify that the retained data was not modified, then release it */
+static int test_api_release_borrowed_data(picoquic_test_tls_api_ctx_t* test_ctx)
+{
+    int ret = 0;
+
+    for (size_t i = 0; i < test_ctx->nb_borrowed; i++) {
+        if (memcmp(test_ctx->borrowed[i].bytes, test_ctx->borrowed[i].copy, test_ctx->borrowed[i].length) != 0) {
+            ret = -1;
+        }
+        picoquic_release_stream_data(test_ctx->borrowed[i].ref);
+        free(test_ctx->borrowed[i].copy);
+    }
+    test_ctx->nb_borrowed = 0;
+
+    return ret;
+}
+
 int test_api_queue_initial_queries(picoquic_test_tls_api_ctx_t* test_ctx, uint64_t stream_id)
 {
     int ret = 0;
@@ -414,9 +486,9 @@ int test_api_queue_initial_queries(picoquic_test_tls_api_ctx_t* test_ctx, uint64
 
             cnx = IS_CLIENT_STREAM_ID(test_ctx->test_stream[i].stream_id) ? test_ctx->cnx_client : test_ctx->cnx_server;
 
-            ret = picoquic_add_to_stream(cnx, test_ctx->test_stream[i].stream_id,
+            ret = test_api_add_to_stream(test_ctx, cnx, test_ctx->test_stream[i].stream_id,
                 test_ctx->test_stream[i].q_src,
-                test_ctx->test_stream[i].q_len, 1);
+                test_ctx->test_stream[i].q_len);
 
             if (ret == 0) {
                 test_ctx->test_stream[i].q_sent = 1;
@@ -745,6 +817,10 @@ int test_api_callback(picoquic_cnx_t* cnx,
         } else {
             ctx->sum_data_received_at_server += (int) length;
         }
+        if (ctx->use_borrowed_data && length > 0 &&
+            (fin_or_event == picoquic_callback_stream_data || fin_or_event == picoquic_callback_stream_fin)) {
+            test_api_borrow_data(ctx, cnx, bytes, length);
+        }
     }
 
     if (stream_id == 0 && cb_ctx->client_mode == 0 &&
@@ -811,9 +887,9 @@ int test_api_callback(picoquic_cnx_t* cnx,
                         }
                         else if (cb_ctx->error_detected == 0) {
                             /* send a response */
-                            if (picoquic_add_to_stream(cnx, stream_id,
+                            if (test_api_add_to_stream(ctx, cnx, stream_id,
                                 ctx->test_stream[stream_index].r_src,
-                                ctx->test_stream[stream_index].r_len, 1)
+                                ctx->test_stream[stream_index].r_len)
                                 != 0) {
                                 cb_ctx->error_detected |= test_api_fail_cannot_send_response;
                             }
@@ -839,9 +915,9 @@ int test_api_callback(picoquic_cnx_t* cnx,
                         }
                         else if (cb_ctx->error_detected == 0) {
                             /* send a response */
-                            if (picoquic_add_to_stream(cnx, stream_id,
+                            if (test_api_add_to_stream(ctx, cnx, stream_id,
                                 ctx->test_stream[stream_index].r_src,
-                                ctx->test_stream[stream_index].r_len, 1)
+                                ctx->test_stream[stream_index].r_len)
                                 != 0) {
                                 cb_ctx->error_detected |= test_api_fail_cannot_send_response;
                             }
@@ -1034,6 +1110,13 @@ static void tls_api_endpoint_release(
 
 void tls_api_delete_ctx(picoquic_test_tls_api_ctx_t* test_ctx)
 {
+    /* Borrowed data must be released before deleting the QUIC contexts */
+    (void)test_api_release_borrowed_data(test_ctx);
+    if (test_ctx->borrowed != NULL) {
+        free(test_ctx->borrowed);
+        test_ctx->borrowed = NULL;
+    }
+
     if (test_ctx->qclient != NULL) {
         picoquic_free(test_ctx->qclient);
     }
@@ -1267,11 +1350,57 @@ static picoquictest_sim_packet_t* tls_api_one_endpoint_packet_dequeue(
     return packet;
 }
 
+#define TLS_API_BATCH_RECEIVE_MAX 32
+
+static int tls_api_one_endpoint_batch_dequeue(picoquic_test_endpoint_t* endpoint,
+    picoquic_quic_t* quic, uint64_t simulated_time, int* was_active, uint8_t recv_ecn)
+{
+    int ret = 0;
+    picoquictest_sim_packet_t* packets[TLS_API_BATCH_RECEIVE_MAX];
+    picoquic_incoming_datagram_t datagrams[TLS_API_BATCH_RECEIVE_MAX];
+    size_t nb_packets = 0;
+    size_t nb_datagrams = 0;
+
+    while (nb_packets < TLS_API_BATCH_RECEIVE_MAX &&
+        (packets[nb_packets] = tls_api_one_endpoint_packet_dequeue(endpoint)) != NULL) {
+        picoquictest_sim_packet_t* packet = packets[nb_packets++];
+
+        if (packet->length > 16) {
+            picoquic_incoming_datagram_t* datagram = &datagrams[nb_datagrams++];
+
+            datagram->bytes = packet->bytes;
+            datagram->length = packet->length;
+            datagram->addr_from = (struct sockaddr*)&packet->addr_from;
+            datagram->addr_to = (struct sockaddr*)&packet->addr_to;
+            datagram->if_index_to = 0;
+            datagram->received_ecn = (recv_ecn == 0) ? packet->ecn_mark : recv_ecn;
+        }
+    }
+
+    if (nb_datagrams > 0) {
+        ret = picoquic_incoming_packet_batch(quic, datagrams, nb_datagrams, simulated_time);
+        *was_active |= 1;
+
+        endpoint->next_time_ready = simulated_time +
+            nb_datagrams * endpoint->incoming_cpu_time;
+    }
+
+    for (size_t i = 0; i < nb_packets; i++) {
+        free(packets[i]);
+    }
+
+    return (ret == 0) ? 0 : -1;
+}
+
 static int tls_api_one_endpoint_dequeue(picoquic_test_endpoint_t *endpoint,
     picoquic_quic_t * quic, uint64_t simulated_time, int * was_active, uint8_t recv_ecn)
 {
     int ret = 0;
 
+    if (endpoint->use_batch_receive) {
+        return tls_api_one_endpoint_batch_dequeue(endpoint, quic, simulated_time, was_active, recv_ecn);
+    }
+
     /* If there is something to receive, do it now */
     picoquictest_sim_packet_t* packet = tls_api_one_endpoint_packet_dequeue(endpoint);
 
@@ -3051,6 +3180,221 @@ int tls_api_q2_and_r2_stream_test()
     return tls_api_one_scenario_test(test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2), 0, 0, 0, 0, 0, 86000, NULL, NULL);
 }
 
+/* Send queries and responses with the zero copy API, verify that the
+ * data arrives intact and that each buffer is released exactly once.
+ */
+int zero_copy_send_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, 0, NULL, NULL);
+
+    if (ret == 0) {
+        test_ctx->use_zero_copy = 1;
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2), 0, 0, 0, 0, 86000);
+    }
+
+    if (ret == 0 && test_ctx->nb_zero_copy_released != 4) {
+        DBG_PRINTF("Released %d zero copy buffers instead of 4", test_ctx->nb_zero_copy_released);
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Send data in packet trains with batch protection, with short key epochs
+ * so that the keys are rotated while trains are prepared. Verify that the
+ * data arrives intact and that the packets were protected in batches.
+ */
+int protect_batch_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0xba, 0x7c, 0x4e, 0xd0, 0, 0, 0, 0}, 8 };
+    const uint64_t latency_target = 10000;
+    const uint64_t picosec_per_byte = (1000000ull * 8) / 100;
+    int ret = tls_api_init_ctx_ex2(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid, 8, 0, 0xFFFF, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        test_ctx->c_to_s_link->microsec_latency = latency_target;
+        test_ctx->c_to_s_link->picosec_per_byte = picosec_per_byte;
+        test_ctx->s_to_c_link->microsec_latency = latency_target;
+        test_ctx->s_to_c_link->picosec_per_byte = picosec_per_byte;
+        if (picoquic_set_protect_batch_policy(test_ctx->qserver, 1) != 0 ||
+            picoquic_set_protect_batch_policy(test_ctx->qclient, 1) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, latency_target, &simulated_time);
+    }
+
+    if (ret == 0) {
+        test_ctx->cnx_server->crypto_epoch_length_max = 1000;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained2, sizeof(test_scenario_sustained2));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 2000000);
+    }
+
+    if (ret == 0) {
+        picoquic_protect_batch_t* batch = test_ctx->qserver->protect_batch;
+
+        if (batch->nb_batches == 0 || batch->nb_packets_batched < 2 * batch->nb_batches) {
+            DBG_PRINTF("%" PRIu64 " packets protected in %" PRIu64 " batches", batch->nb_packets_batched, batch->nb_batches);
+            ret = -1;
+        }
+        else if (test_ctx->cnx_server->crypto_epoch_sequence == 0) {
+            DBG_PRINTF("%s", "Keys were not rotated");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Receive the packets in batches. The client is CPU limited, so the packets
+ * queue up and are passed to picoquic_incoming_packet_batch in bursts. The
+ * key rotation verifies that the precomputed masks survive a key update.
+ */
+int receive_batch_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0xba, 0x7c, 0x4e, 0xc0, 0, 0, 0, 0}, 8 };
+    const uint64_t latency_target = 10000;
+    const uint64_t picosec_per_byte = (1000000ull * 8) / 1000;
+    int ret = tls_api_init_ctx_ex2(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid, 8, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        test_ctx->c_to_s_link->microsec_latency = latency_target;
+        test_ctx->c_to_s_link->picosec_per_byte = picosec_per_byte;
+        test_ctx->s_to_c_link->microsec_latency = latency_target;
+        test_ctx->s_to_c_link->picosec_per_byte = picosec_per_byte;
+        test_ctx->client_endpoint.incoming_cpu_time = 20;
+        test_ctx->server_endpoint.use_batch_receive = 1;
+        test_ctx->client_endpoint.use_batch_receive = 1;
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, latency_target, &simulated_time);
+    }
+
+    if (ret == 0) {
+        test_ctx->cnx_server->crypto_epoch_length_max = 1000;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 2000000);
+    }
+
+    if (ret == 0) {
+        picoquic_unprotect_batch_t* batch = test_ctx->qclient->unprotect_batch;
+
+        if (batch == NULL || batch->nb_batches == 0 || batch->nb_packets_batched < 2 * batch->nb_batches) {
+            DBG_PRINTF("%" PRIu64 " packets received in %" PRIu64 " batches",
+                (batch == NULL) ? 0 : batch->nb_packets_batched, (batch == NULL) ? 0 : batch->nb_batches);
+            ret = -1;
+        }
+        else if (test_ctx->cnx_client->nb_crypto_key_rotations == 0) {
+            DBG_PRINTF("%s", "Keys were not rotated");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Retain the stream data delivered to client and server instead of copying
+ * it. Verify that the retained buffers are not modified by the stack while
+ * the transfer proceeds, and that the data nodes return to the pool once
+ * released.
+ */
+int stream_data_borrow_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_one_scenario_init(&test_ctx, &simulated_time, 0, NULL, NULL);
+
+    if (ret == 0) {
+        picoquic_set_default_stream_data_borrowing(test_ctx->qserver, 1);
+        picoquic_set_stream_data_borrowing(test_ctx->cnx_client, 1);
+        test_ctx->use_borrowed_data = 1;
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0 && (test_ctx->nb_borrow_failed != 0 || test_ctx->nb_borrowed == 0 ||
+        test_ctx->qserver->nb_data_nodes_borrowed == 0)) {
+        DBG_PRINTF("Borrowed %zu chunks, %d failures", test_ctx->nb_borrowed, test_ctx->nb_borrow_failed);
+        ret = -1;
+    }
+
+    if (ret == 0 && (ret = test_api_release_borrowed_data(test_ctx)) != 0) {
+        DBG_PRINTF("%s", "Borrowed data was modified");
+    }
+
+    if (ret == 0 && (test_ctx->qserver->nb_data_nodes_borrowed != 0 || test_ctx->qclient->nb_data_nodes_borrowed != 0)) {
+        DBG_PRINTF("%s", "Borrowed data nodes not released");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 int tls_api_very_long_stream_test()
 {
     return tls_api_one_scenario_test(test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 0, 0, 1000000, NULL, NULL);
@@ -0,0 +1,287 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2024, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Test the timing wheel against a linear scan of the nodes. The wake times
+ * are drawn from ranges covering all levels of the wheel, the overflow list
+ * and the "never" list. At each step, the wheel is advanced, the due nodes
+ * are verified and rescheduled, and some other nodes are moved.
+ */
+#define WHEEL_TEST_NB_NODES 512
+#define WHEEL_TEST_NB_STEPS 2000
+
+static uint64_t wheel_test_delay(uint64_t* random_ctx)
+{
+    uint64_t delay;
+
+    switch (picoquic_test_uniform_random(random_ctx, 8)) {
+    case 0:
+        delay = picoquic_test_uniform_random(random_ctx, 64);
+        break;
+    case 1:
+    case 2:
+        delay = picoquic_test_uniform_random(random_ctx, 5000);
+        break;
+    case 3:
+    case 4:
+        delay = picoquic_test_uniform_random(random_ctx, 300000);
+        break;
+    case 5:
+        delay = picoquic_test_uniform_random(random_ctx, 30000000);
+        break;
+    case 6:
+        delay = picoquic_test_uniform_random(random_ctx, 4000000000ull);
+        break;
+    default:
+        delay = UINT64_MAX;
+        break;
+    }
+    return delay;
+}
+
+static void wheel_test_reschedule(picoquic_wheel_t* wheel, picoquic_wheel_node_t* node,
+    uint64_t current_time, uint64_t* random_ctx)
+{
+    uint64_t delay = wheel_test_delay(random_ctx);
+
+    picoquic_wheel_remove(wheel, node);
+    picoquic_wheel_insert(wheel, node, (delay == UINT64_MAX) ? UINT64_MAX : current_time + delay);
+}
+
+static int wheel_test_step(picoquic_wheel_t* wheel, picoquic_wheel_node_t* nodes, uint64_t current_time,
+    uint64_t* random_ctx)
+{
+    int ret = 0;
+    size_t nb_expected = 0;
+    size_t nb_due = 0;
+    uint64_t next_expected = UINT64_MAX;
+    picoquic_wheel_node_t* node;
+
+    picoquic_wheel_advance(wheel, current_time);
+
+    for (int i = 0; i < WHEEL_TEST_NB_NODES; i++) {
+        if (nodes[i].wake_time <= current_time) {
+            nb_expected++;
+        }
+        else if (nodes[i].wake_time < next_expected) {
+            next_expected = nodes[i].wake_time;
+        }
+    }
+
+    node = picoquic_wheel_first_due(wheel);
+    while (node != NULL && ret == 0) {
+        if (node->wake_time > current_time) {
+            DBG_PRINTF("Node due at %" PRIu64 " expired at %" PRIu64, node->wake_time, current_time);
+            ret = -1;
+        }
+        nb_due++;
+        node = node->next;
+    }
+
+    if (ret == 0 && nb_due != nb_expected) {
+        DBG_PRINTF("Found %zu due nodes instead of %zu at %" PRIu64, nb_due, nb_expected, current_time);
+        ret = -1;
+    }
+
+    if (ret == 0 && nb_due == 0) {
+        uint64_t next_time = picoquic_wheel_next_time(wheel);
+        picoquic_wheel_node_t* earliest = picoquic_wheel_earliest(wheel);
+
+        if (next_time > next_expected || (next_expected < UINT64_MAX && next_time <= current_time)) {
+            DBG_PRINTF("Next time %" PRIu64 " instead of %" PRIu64, next_time, next_expected);
+            ret = -1;
+        }
+        else if (earliest == NULL || earliest->wake_time != next_expected) {
+            DBG_PRINTF("Earliest node does not wake at %" PRIu64, next_expected);
+            ret = -1;
+        }
+    }
+
+    /* Process the due nodes, then move a few other nodes */
+    while (ret == 0 && (node = picoquic_wheel_first_due(wheel)) != NULL) {
+        wheel_test_reschedule(wheel, node, current_time, random_ctx);
+    }
+
+    for (int i = 0; ret == 0 && i < 8; i++) {
+        node = &nodes[picoquic_test_uniform_random(random_ctx, WHEEL_TEST_NB_NODES)];
+        wheel_test_reschedule(wheel, node, current_time, random_ctx);
+    }
+
+    if (ret == 0 && wheel->nb_nodes != WHEEL_TEST_NB_NODES) {
+        DBG_PRINTF("Wheel holds %zu nodes", wheel->nb_nodes);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int wheel_random_test()
+{
+    int ret = 0;
+    uint64_t random_ctx = 0x7755aa0011223344ull;
+    uint64_t current_time = 1000000;
+    picoquic_wheel_t wheel;
+    picoquic_wheel_node_t* nodes = (picoquic_wheel_node_t*)malloc(sizeof(picoquic_wheel_node_t) * WHEEL_TEST_NB_NODES);
+
+    if (nodes == NULL) {
+        return -1;
+    }
+    memset(nodes, 0, sizeof(picoquic_wheel_node_t) * WHEEL_TEST_NB_NODES);
+    picoquic_wheel_init(&wheel, current_time);
+
+    for (int i = 0; i < WHEEL_TEST_NB_NODES; i++) {
+        wheel_test_reschedule(&wheel, &nodes[i], current_time, &random_ctx);
+    }
+
+    for (int step = 0; ret == 0 && step < WHEEL_TEST_NB_STEPS; step++) {
+        /* Mostly small steps, sometimes jump to the next wake time */
+        if ((step % 16) == 15) {
+            uint64_t next_time = picoquic_wheel_next_time(&wheel);
+            if (next_time != UINT64_MAX && next_time > current_time) {
+                current_time = next_time;
+            }
+        }
+        else {
+            current_time += picoquic_test_uniform_random(&random_ctx, ((step % 64) == 63) ? 100000000 : 2000);
+        }
+        ret = wheel_test_step(&wheel, nodes, current_time, &random_ctx);
+    }
+
+    for (int i = 0; i < WHEEL_TEST_NB_NODES; i++) {
+        picoquic_wheel_remove(&wheel, &nodes[i]);
+    }
+    if (ret == 0 && wheel.nb_nodes != 0) {
+        DBG_PRINTF("%s", "Wheel not empty after removing all nodes");
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < PICOQUIC_WHEEL_NB_SLOTS; i++) {
+        if (wheel.first[i] != NULL) {
+            DBG_PRINTF("Slot %d not empty", i);
+            ret = -1;
+        }
+    }
+    for (int i = 0; ret == 0 && i < PICOQUIC_WHEEL_NB_LEVELS; i++) {
+        if (wheel.occupied[i] != 0) {
+            DBG_PRINTF("Level %d still marked occupied", i);
+            ret = -1;
+        }
+    }
+
+    free(nodes);
+    return ret;
+}
+
+/* Test the wake scheduler of the QUIC context: switch connections from the
+ * splay to the wheel and back, and verify the order and the batch expiry.
+ */
+#define WHEEL_TEST_NB_CNX 5
+
+static int wheel_scheduler_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t wake_time[WHEEL_TEST_NB_CNX] = { 5000, 100, UINT64_MAX, 3000000, 100 };
+    picoquic_cnx_t* cnx[WHEEL_TEST_NB_CNX] = { NULL };
+    picoquic_cnx_t* batch[WHEEL_TEST_NB_CNX];
+    struct sockaddr_in addr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        ret = -1;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    for (int i = 0; ret == 0 && i < WHEEL_TEST_NB_CNX; i++) {
+        addr.sin_port = (uint16_t)(1000 + i);
+        cnx[i] = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, NULL, NULL, 1);
+        if (cnx[i] == NULL) {
+            DBG_PRINTF("Cannot create connection %d", i);
+            ret = -1;
+        }
+        else {
+            picoquic_reinsert_by_wake_time(quic, cnx[i], wake_time[i]);
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_set_wake_scheduler(quic, picoquic_wake_scheduler_wheel, simulated_time);
+        if (picoquic_get_wake_scheduler(quic) != picoquic_wake_scheduler_wheel ||
+            quic->cnx_wake_wheel.nb_nodes != WHEEL_TEST_NB_CNX) {
+            DBG_PRINTF("%s", "Connections not moved to the wheel");
+            ret = -1;
+        }
+        else if (picoquic_get_earliest_cnx_to_wake(quic, 99) != NULL ||
+            picoquic_get_next_wake_time(quic, 99) != 100) {
+            DBG_PRINTF("%s", "Unexpected wake up before 100us");
+            ret = -1;
+        }
+        else if (picoquic_get_cnx_to_wake_batch(quic, 4999, batch, WHEEL_TEST_NB_CNX) != 2 ||
+            batch[0]->next_wake_time != 100 || batch[1]->next_wake_time != 100) {
+            DBG_PRINTF("%s", "Unexpected batch at 4999us");
+            ret = -1;
+        }
+        else {
+            picoquic_reinsert_by_wake_time(quic, batch[0], 20000);
+            picoquic_reinsert_by_wake_time(quic, batch[1], 10000);
+            if (picoquic_get_earliest_cnx_to_wake(quic, 10000) != cnx[0] ||
+                picoquic_get_cnx_to_wake_batch(quic, 20000, batch, WHEEL_TEST_NB_CNX) != 3) {
+                DBG_PRINTF("%s", "Unexpected wake up after reschedule");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_set_wake_scheduler(quic, picoquic_wake_scheduler_splay, simulated_time);
+        if (picoquic_get_wake_scheduler(quic) != picoquic_wake_scheduler_splay ||
+            picoquic_get_earliest_cnx_to_wake(quic, 0) != cnx[0] ||
+            picoquic_get_cnx_to_wake_batch(quic, 20000, batch, WHEEL_TEST_NB_CNX) != 3 ||
+            batch[2]->next_wake_time != 20000) {
+            DBG_PRINTF("%s", "Connections not moved back to the splay");
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+int wheel_test()
+{
+    int ret = wheel_random_test();
+
+    if (ret == 0) {
+        ret = wheel_scheduler_test();
+    }
+
+    return ret;
+}
@@ -62,7 +62,7 @@
 #include "picoquic.h"
 #include "picoquic_internal.h"
 #include "picoquic_utils.h"
-/* #include "picoquic_packet_loop.h" */
+#include "picoquic_packet_loop.h"
 /* #include "picoquic_unified_log.h" */
 
 /* Thread context, passed as parameter when starting network thread */
@@ -547,6 +547,188 @@ void* event_loop_thread(void* lpParam)
 #endif
 }
 
+/* Sharded loop benchmark.
+ * Starts a sharded server loop with nb_shards QUIC contexts, and one load thread per
+ * shard sending short header packets as fast as possible to the server port. Each load
+ * thread uses its own source port, and CID encoding a random shard index, so that
+ * most packets arrive at a shard other than the one selected in the CID and have to
+ * be forwarded. The packets are shorter than the minimum size of a stateless reset
+ * trigger, so the server drops them after steering.
+ */
+#define SHARDED_BENCH_PORT 12346
+#define SHARDED_BENCH_PACKET_SIZE 38
+
+typedef struct st_sharded_bench_shard_ctx_t {
+    uint64_t end_time;
+    uint64_t nb_packets;
+} sharded_bench_shard_ctx_t;
+
+typedef struct st_sharded_bench_ctx_t {
+    int nb_shards;
+    struct sockaddr_storage server_addr;
+    volatile int should_stop;
+    uint64_t nb_sent;
+} sharded_bench_ctx_t;
+
+int sharded_bench_loop_cb(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_arg)
+{
+    int ret = 0;
+    sharded_bench_shard_ctx_t* shard_ctx = (sharded_bench_shard_ctx_t*)callback_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+#endif
+
+    switch (cb_mode) {
+    case picoquic_packet_loop_ready:
+        ((picoquic_packet_loop_options_t*)callback_arg)->do_time_check = 1;
+        break;
+    case picoquic_packet_loop_after_receive:
+        /* Under continuous load the loop does not call the time check, so the
+         * end time is also tested after receiving packets. */
+        shard_ctx->nb_packets++;
+        if ((shard_ctx->nb_packets & 0x3ff) == 0 && picoquic_current_time() >= shard_ctx->end_time) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        }
+        break;
+    case picoquic_packet_loop_time_check: {
+        packet_loop_time_check_arg_t* time_check_arg = (packet_loop_time_check_arg_t*)callback_arg;
+        if (time_check_arg->current_time >= shard_ctx->end_time) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        }
+        else if (time_check_arg->delta_t > 10000) {
+            time_check_arg->delta_t = 10000;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return ret;
+}
+
+#ifdef _WINDOWS
+DWORD WINAPI sharded_bench_load_thread(LPVOID lpParam)
+#else
+void* sharded_bench_load_thread(void* lpParam)
+#endif
+{
+    sharded_bench_ctx_t* ctx = (sharded_bench_ctx_t*)lpParam;
+    SOCKET_TYPE l_socket;
+    uint8_t buffer[SHARDED_BENCH_PACKET_SIZE];
+    uint64_t random_ctx = picoquic_current_time();
+    uint64_t nb_sent = 0;
+
+    if ((l_socket = socket(ctx->server_addr.ss_family, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+        DBG_PRINTF("Cannot set socket (af=%d)\n", ctx->server_addr.ss_family);
+    }
+    else {
+        while (!ctx->should_stop) {
+            /* Short header packet, 8 bytes CID, first CID byte encodes the CID length,
+             * second byte is the shard index, as set by the "clear" LB encoding. */
+            picoquic_test_random_bytes(&random_ctx, buffer, sizeof(buffer));
+            buffer[0] = 0x40 | (buffer[0] & 0x3f);
+            buffer[1] = 7;
+            buffer[2] = (uint8_t)(picoquic_test_uniform_random(&random_ctx, (uint64_t)ctx->nb_shards));
+            if (sendto(l_socket, (const char*)buffer, sizeof(buffer), 0, (struct sockaddr*)&ctx->server_addr,
+                picoquic_addr_length((struct sockaddr*)&ctx->server_addr)) == (int)sizeof(buffer)) {
+                nb_sent++;
+            }
+        }
+        SOCKET_CLOSE(l_socket);
+    }
+    ctx->nb_sent += nb_sent;
+#ifdef _WINDOWS
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+int sharded_bench(int nb_shards, int duration_sec)
+{
+    int ret = 0;
+    int is_name = 0;
+    uint64_t start_time = picoquic_current_time();
+    picoquic_quic_t* quic[PICOQUIC_SHARDED_LOOP_MAX];
+    sharded_bench_shard_ctx_t shard_ctx[PICOQUIC_SHARDED_LOOP_MAX];
+    void* loop_ctx[PICOQUIC_SHARDED_LOOP_MAX];
+    picoquic_thread_t t_load[PICOQUIC_SHARDED_LOOP_MAX];
+    picoquic_sharded_loop_param_t* param = (picoquic_sharded_loop_param_t*)malloc(sizeof(picoquic_sharded_loop_param_t));
+    sharded_bench_ctx_t ctx;
+    uint64_t nb_received = 0;
+    uint64_t nb_forwarded = 0;
+    uint64_t nb_dropped = 0;
+    double duration;
+
+    if (param == NULL || nb_shards <= 0 || nb_shards > PICOQUIC_SHARDED_LOOP_MAX) {
+        DBG_PRINTF("Cannot run sharded bench with %d shards", nb_shards);
+        if (param != NULL) {
+            free(param);
+        }
+        return -1;
+    }
+    memset(param, 0, sizeof(picoquic_sharded_loop_param_t));
+    memset(&ctx, 0, sizeof(ctx));
+    memset(quic, 0, sizeof(quic));
+    param->nb_shards = nb_shards;
+    param->local_port = SHARDED_BENCH_PORT;
+    param->local_af = AF_INET;
+    param->do_cpu_pinning = 1;
+    ctx.nb_shards = nb_shards;
+    ret = picoquic_get_server_address("127.0.0.1", SHARDED_BENCH_PORT, &ctx.server_addr, &is_name);
+
+    for (int i = 0; ret == 0 && i < nb_shards; i++) {
+        shard_ctx[i].end_time = start_time + ((uint64_t)duration_sec) * 1000000;
+        shard_ctx[i].nb_packets = 0;
+        loop_ctx[i] = &shard_ctx[i];
+        if ((quic[i] = picoquic_create(8, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL, NULL,
+            start_time, NULL, NULL, NULL, 0)) == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Start the load after the server sockets are bound */
+        for (int i = 0; ret == 0 && i < nb_shards; i++) {
+            ret = picoquic_create_thread(&t_load[i], sharded_bench_load_thread, &ctx);
+            if (ret != 0) {
+                nb_shards = i;
+                ctx.should_stop = 1;
+            }
+        }
+        if (ret == 0) {
+            ret = picoquic_sharded_packet_loop(quic, param, sharded_bench_loop_cb, loop_ctx);
+        }
+        ctx.should_stop = 1;
+        for (int i = 0; i < nb_shards; i++) {
+            (void)picoquic_wait_thread(t_load[i]);
+        }
+    }
+
+    duration = ((double)(picoquic_current_time() - start_time)) / 1000000.0;
+    for (int i = 0; i < param->nb_shards; i++) {
+        nb_received += shard_ctx[i].nb_packets;
+        nb_forwarded += param->stats[i].nb_packets_forwarded;
+        nb_dropped += param->stats[i].nb_forward_dropped;
+        printf("Shard %d: %" PRIu64 " packets received, %" PRIu64 " forwarded, %" PRIu64 " received from other shards.\n",
+            i, shard_ctx[i].nb_packets, param->stats[i].nb_packets_forwarded, param->stats[i].nb_packets_received_forwarded);
+    }
+    printf("Sharded loop, %d shards, ret = %d (0x%x)\n", param->nb_shards, ret, ret);
+    printf("Packets sent: %" PRIu64 "\n", ctx.nb_sent);
+    printf("Packets received: %" PRIu64 ", %.0f packets/s\n", nb_received, (duration > 0) ? (double)nb_received / duration : 0.0);
+    printf("Packets forwarded: %" PRIu64 ", dropped: %" PRIu64 "\n", nb_forwarded, nb_dropped);
+
+    for (int i = 0; i < param->nb_shards; i++) {
+        if (quic[i] != NULL) {
+            picoquic_free(quic[i]);
+        }
+    }
+    free(param);
+
+    return ret;
+}
+
 int main(int argc, char** argv)
 {
     int ret = 0;
@@ -560,10 +742,16 @@ int main(int argc, char** argv)
     WSADATA wsaData = { 0 };
     (void)WSA_START(MAKEWORD(2, 2), &wsaData);
 #endif
-    printf("testing the thread execution\n");
-
     debug_set_stream(stdout);
 
+    if (argc >= 3 && strcmp(argv[1], "-s") == 0) {
+        /* Usage: thread_test -s <nb_shards> [duration_seconds] */
+        ret = sharded_bench(atoi(argv[2]), (argc >= 4) ? atoi(argv[3]) : 5);
+        exit(ret);
+    }
+
+    printf("testing the thread execution\n");
+
     memset(&ctx, 0, sizeof(thread_test_context_t));
     ctx.server_port = 12345;
     ret = picoquic_get_server_address("::1", ctx.server_port,